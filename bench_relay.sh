@@ -0,0 +1,199 @@
+#!/bin/bash
+# Fan-in of relay leaves into one gateway, without radios: the relay link layer runs against an
+# in-process stand-in for ESP-NOW, a shared channel with airtime and random frame loss.
+# Prints delivered records, frames and channel use per second for each number of leaves, and the
+# time from the first frame of a record to its complete ack. A record whose ack was lost on every
+# retry is sent again as a new one, so delivered can exceed offered: delivery is at least once.
+#   RECORD_BYTES=400 PERIOD_S=30 LOSS=0.05 ./bench_relay.sh 10 50 100 200
+RECORD_BYTES=${RECORD_BYTES:-400}
+PERIOD_S=${PERIOD_S:-30}
+LOSS=${LOSS:-0.05}
+DURATION_S=${DURATION_S:-600}
+RATE_KBPS=${RATE_KBPS:-1000}
+PEERS=${PEERS:-8}
+ACK_TIMEOUT_MS=${ACK_TIMEOUT_MS:-50}
+RETRIES=${RETRIES:-5}
+LEAVES=${@:-10 50 100 200 400}
+
+WORK=$(mktemp -d)
+trap 'rm -rf $WORK' EXIT
+
+cat > $WORK/fanin.c <<'SRC'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "relay_link.h"
+
+/* Preamble, MAC header and FCS of an ESP-NOW action frame, in bytes at the PHY rate */
+#define FRAME_OVERHEAD 60
+#define QUEUE_MAX 65536
+#define STEP_US 100
+#define SLOT_SIZE 2048
+#define BUNDLE_SIZE 4096
+#define BUNDLE_MAX_AGE_US 10000000LL
+#define BACKOFF_US 2000000LL
+/* Frames waiting for the channel longer than this do not fit the driver's transmit queue */
+#define TX_QUEUE_US 50000
+
+/* The stand-in medium: one channel, frames go out back to back and arrive after their airtime */
+typedef struct {
+    uint8_t to[RELAY_ADDR_LEN];
+    uint8_t from[RELAY_ADDR_LEN];
+    uint8_t len;
+    uint8_t data[RELAY_FRAME_MAX];
+    int64_t arrives_us;
+} frame_t;
+
+static frame_t queue[QUEUE_MAX];
+static size_t head, tail;
+static int64_t now_us, channel_free_us, airtime_us;
+static uint64_t frames_sent, frames_lost, frames_refused;
+
+typedef struct {
+    uint8_t addr[RELAY_ADDR_LEN];
+    relay_transport_t transport;
+    relay_sender_t sender;
+    uint8_t record[RELAY_MESSAGE_MAX];
+    uint32_t pending;
+    int64_t next_record_us;
+    int64_t started_us;
+    int64_t resume_us;
+} leaf_t;
+
+static bool medium_send(void* ctx, const uint8_t addr[RELAY_ADDR_LEN], const uint8_t* data, size_t len) {
+    if ((tail + 1) % QUEUE_MAX == head || channel_free_us - now_us > TX_QUEUE_US) {
+        frames_refused++;
+        return false;
+    }
+    int64_t start = now_us > channel_free_us ? now_us : channel_free_us;
+    int64_t air = (int64_t)(len + FRAME_OVERHEAD) * 8 * 1000 / RATE_KBPS;
+    channel_free_us = start + air;
+    airtime_us += air;
+    frames_sent++;
+
+    if ((double)rand() / RAND_MAX < LOSS) {
+        frames_lost++;
+        return true;
+    }
+
+    frame_t* frame = &queue[tail];
+    memcpy(frame->to, addr, RELAY_ADDR_LEN);
+    memcpy(frame->from, ctx, RELAY_ADDR_LEN);
+    frame->len = (uint8_t)len;
+    memcpy(frame->data, data, len);
+    frame->arrives_us = channel_free_us;
+    tail = (tail + 1) % QUEUE_MAX;
+    return true;
+}
+
+/* Gateway side, records are bundled like app_relay_take_bundle does */
+static const uint8_t gateway_addr[RELAY_ADDR_LEN] = { 0x02, 0, 0, 0, 0, 0 };
+static size_t bundle_bytes;
+static int64_t bundle_first_us;
+static uint64_t delivered, delivered_bytes, bundles, busy;
+
+static bool deliver(void* ctx, const uint8_t addr[RELAY_ADDR_LEN], const uint8_t* data, size_t len) {
+    if (bundle_bytes + len + 32 > BUNDLE_SIZE) {
+        busy++;
+        return false;
+    }
+    if (bundle_bytes == 0) {
+        bundle_first_us = now_us;
+    }
+    bundle_bytes += len + 32;
+    delivered++;
+    delivered_bytes += len;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int count = atoi(argv[1]);
+    leaf_t* leaves = calloc(count, sizeof(leaf_t));
+    srand(1);
+
+    relay_sender_config_t config = { .ack_timeout_ms = ACK_TIMEOUT_MS, .retries = RETRIES };
+    for (int i = 0; i < count; ++i) {
+        leaf_t* leaf = &leaves[i];
+        leaf->addr[0] = 0x06;
+        leaf->addr[4] = (uint8_t)(i >> 8);
+        leaf->addr[5] = (uint8_t)i;
+        leaf->transport = (relay_transport_t){ .send = medium_send, .ctx = leaf->addr };
+        relay_sender_init(&leaf->sender, &config, &leaf->transport, gateway_addr, (uint16_t)rand());
+        memset(leaf->record, 0x5a, sizeof(leaf->record));
+        leaf->next_record_us = (int64_t)rand() % (PERIOD_S * 1000000LL);
+    }
+
+    static relay_peer_t peers[PEERS];
+    static uint8_t arena[PEERS * SLOT_SIZE];
+    relay_transport_t gateway_transport = { .send = medium_send, .ctx = (void*)gateway_addr };
+    relay_receiver_t receiver;
+    relay_receiver_init(&receiver, &gateway_transport, peers, PEERS, arena, SLOT_SIZE, deliver, NULL);
+
+    uint64_t generated = 0, acked = 0, failed = 0;
+    int64_t latency_us = 0, latency_max_us = 0;
+
+    for (now_us = 0; now_us < DURATION_S * 1000000LL; now_us += STEP_US) {
+        uint64_t now_ms = now_us / 1000;
+
+        while (head != tail && queue[head].arrives_us <= now_us) {
+            frame_t* frame = &queue[head];
+            head = (head + 1) % QUEUE_MAX;
+            if (memcmp(frame->to, gateway_addr, RELAY_ADDR_LEN) == 0) {
+                relay_receiver_receive(&receiver, frame->from, frame->data, frame->len, now_ms);
+            } else {
+                relay_sender_receive(&leaves[frame->to[4] << 8 | frame->to[5]].sender, frame->data, frame->len);
+            }
+        }
+
+        for (int i = 0; i < count; ++i) {
+            leaf_t* leaf = &leaves[i];
+            if (now_us >= leaf->next_record_us) {
+                leaf->pending++;
+                generated++;
+                leaf->next_record_us += PERIOD_S * 1000000LL;
+            }
+
+            relay_send_state_t state = relay_sender_poll(&leaf->sender, now_ms);
+            if (state == RELAY_SEND_DELIVERED) {
+                int64_t latency = now_us - leaf->started_us;
+                latency_us += latency;
+                latency_max_us = latency > latency_max_us ? latency : latency_max_us;
+                leaf->pending--;
+                acked++;
+            } else if (state == RELAY_SEND_FAILED) {
+                failed++;
+                leaf->resume_us = now_us + BACKOFF_US;
+            }
+
+            if (leaf->pending > 0 && leaf->sender.state == RELAY_SEND_IDLE && now_us >= leaf->resume_us) {
+                relay_sender_start(&leaf->sender, leaf->record, RECORD_BYTES, now_ms);
+                leaf->started_us = now_us;
+            }
+        }
+
+        if (bundle_bytes > 0 && (bundle_bytes >= BUNDLE_SIZE / 2 || now_us - bundle_first_us >= BUNDLE_MAX_AGE_US)) {
+            bundles++;
+            bundle_bytes = 0;
+        }
+    }
+
+    double seconds = DURATION_S;
+    printf("%5d leaves  %7.2f rec/s offered  %7.2f rec/s delivered  %7.1f frames/s  %5.1f%% air  "
+           "%5.1f%% lost  %5.1f%% refused  %6llu failed  %5llu busy  delivery %6.0f ms avg %6.0f ms max  %5.2f bundles/s\n",
+           count, generated / seconds, delivered / seconds, frames_sent / seconds,
+           100.0 * airtime_us / (DURATION_S * 1000000.0), 100.0 * frames_lost / (frames_sent ? frames_sent : 1),
+           100.0 * frames_refused / (frames_sent + frames_refused ? frames_sent + frames_refused : 1),
+           (unsigned long long)failed, (unsigned long long)busy,
+           acked ? latency_us / 1000.0 / acked : 0, latency_max_us / 1000.0, bundles / seconds);
+    return 0;
+}
+SRC
+
+gcc -O2 -o $WORK/fanin $WORK/fanin.c main/relay/relay_link.c -Imain/relay \
+  -DRECORD_BYTES=$RECORD_BYTES -DPERIOD_S=$PERIOD_S -DLOSS=$LOSS -DDURATION_S=$DURATION_S \
+  -DRATE_KBPS=$RATE_KBPS -DPEERS=$PEERS -DACK_TIMEOUT_MS=$ACK_TIMEOUT_MS -DRETRIES=$RETRIES || exit 1
+
+for n in $LEAVES; do
+  $WORK/fanin $n
+done
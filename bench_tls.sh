@@ -0,0 +1,73 @@
+#!/bin/bash
+# Compare the cost of the device's TLS handshake variants against a local broker:
+# full RSA-2048 and full ECDSA P-256 client credentials, and the ECDSA session resumed
+# from its ticket the way the firmware does after deep sleep.
+# Uses mosquitto when installed, otherwise openssl s_server without a session cache,
+# so only a ticket can resume.
+RUNS=${1:-20}
+PORT=${2:-18883}
+
+WORK=$(mktemp -d)
+trap 'kill $SERVER 2>/dev/null; rm -rf $WORK' EXIT
+
+# throwaway CA, broker and client credentials
+openssl ecparam -name prime256v1 -genkey -noout -out $WORK/ca.key
+openssl req -x509 -new -key $WORK/ca.key -subj "/CN=bench-ca" -days 1 -out $WORK/ca.crt
+
+issue() {
+  openssl req -new -key $WORK/$1.key -subj "/CN=$1" | \
+  openssl x509 -req -CA $WORK/ca.crt -CAkey $WORK/ca.key -days 1 -sha256 \
+    -set_serial 0x$(openssl rand -hex 8) -out $WORK/$1.crt 2>/dev/null
+}
+
+openssl genrsa -out $WORK/server.key 2048 2>/dev/null && issue server
+openssl genrsa -out $WORK/rsa.key 2048 2>/dev/null && issue rsa
+openssl ecparam -name prime256v1 -genkey -noout -out $WORK/ec.key && issue ec
+
+if command -v mosquitto >/dev/null; then
+  cat > $WORK/mosquitto.conf <<CONF
+listener $PORT 127.0.0.1
+cafile $WORK/ca.crt
+certfile $WORK/server.crt
+keyfile $WORK/server.key
+require_certificate true
+tls_version tlsv1.2
+CONF
+  mosquitto -c $WORK/mosquitto.conf >/dev/null 2>&1 &
+else
+  openssl s_server -quiet -accept $PORT -tls1_2 -no_cache -cert $WORK/server.crt -key $WORK/server.key \
+    -CAfile $WORK/ca.crt -Verify 1 >/dev/null 2>&1 </dev/null &
+fi
+SERVER=$!
+sleep 1
+
+# one handshake, prints "<ms> <bytes read> <bytes written> <new|reused>"
+handshake() {
+  local start=$(date +%s%N)
+  local out=$(openssl s_client -connect 127.0.0.1:$PORT -tls1_2 -CAfile $WORK/ca.crt \
+    -cert $WORK/$1.crt -key $WORK/$1.key "${@:2}" </dev/null 2>/dev/null)
+  local end=$(date +%s%N)
+  local bytes=$(echo "$out" | sed -n 's/.*has read \([0-9]*\) bytes and written \([0-9]*\) bytes.*/\1 \2/p')
+  local state=$(echo "$out" | grep -o -m1 '^\(New\|Reused\)' | tr 'A-Z' 'a-z')
+  echo "$(( (end - start) / 1000000 )) $bytes $state"
+}
+
+bench() {
+  local name=$1; shift
+  local total_ms=0 total_read=0 total_written=0 reused=0
+  for i in $(seq $RUNS); do
+    read ms rd wr state <<< "$(handshake "$@")"
+    total_ms=$((total_ms + ms)); total_read=$((total_read + rd)); total_written=$((total_written + wr))
+    [ "$state" = "reused" ] && reused=$((reused + 1))
+  done
+  printf "%-12s %8d ms %8d B read %8d B written %4d/%d reused\n" $name \
+    $((total_ms / RUNS)) $((total_read / RUNS)) $((total_written / RUNS)) $reused $RUNS
+}
+
+# a first handshake stores the session, every resumed run presents the ticket of the previous one
+# and keeps the session it got back, as the firmware keeps it in RTC memory
+handshake ec -sess_out $WORK/ec.session >/dev/null
+
+bench rsa-full rsa
+bench ec-full ec
+bench ec-resumed ec -sess_in $WORK/ec.session -sess_out $WORK/ec.session
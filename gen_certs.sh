@@ -1,11 +1,17 @@
 #!/bin/bash
 CLIENT_NAME=$1
 CA_PRIVATE_KEY=$2
+# ec (P-256, default) or rsa (2048)
+KEY_TYPE=${3:-ec}
 
 CRT_DIR=main/certs
 
 # generate client key (in pem format)
-openssl genrsa -out $CRT_DIR/client.key 2048
+if [ "$KEY_TYPE" = "rsa" ]; then
+  openssl genrsa -out $CRT_DIR/client.key 2048
+else
+  openssl ecparam -name prime256v1 -genkey -noout -out $CRT_DIR/client.key
+fi
 
 # generate a client csr file
 openssl req -new -key $CRT_DIR/client.key -subj "/CN=${CLIENT_NAME}" | \
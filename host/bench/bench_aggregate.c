@@ -0,0 +1,256 @@
+/* Replays 1 s samples through the idle aggregation of app_mqtt_task twice, once publishing every sample
+ * raw and once as aggregate_sample does, and compares what goes out: encoded SampleBatchV2 and
+ * SampleSummaryBatch bytes and publishes per day, and the aggregate_add time per sample.
+ * The synthetic trace has line pressure with a few thousandths of noise, two irrigation runs a day and
+ * extra channels alternating zone pressure and zone flow, one zone watering on its own every evening.
+ * Traces can be given as CSV instead, one "timestamp_ms,flow,pressure[,channel...]" line per sample,
+ * normalized to full scale like on the device. Deadbands, window and batch limits are the Kconfig defaults.
+ *   bench_aggregate [days] [extra channels]
+ *   bench_aggregate trace.csv... */
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pb_encode.h"
+#include "aggregate.h"
+#include "batcher.h"
+#include "sensors.h"
+#include "sdkconfig.h"
+
+#define BENCH_DAYS 7
+#define BENCH_CHANNELS 2
+#define DAY_S 86400
+/* 2024-06-01 00:00:00 UTC */
+#define DAY0_MS 1717200000000ull
+
+/* As in mqtt.c */
+#define SUMMARY_MAX_COUNT (sizeof(((SampleSummaryBatch*)0)->summaries) / sizeof(SampleSummary))
+#define SUMMARY_FIT_COUNT (CONFIG_BATCH_MAX_BYTES / (SampleSummary_size + 3))
+#define SUMMARY_BATCH_MAX (SUMMARY_FIT_COUNT < SUMMARY_MAX_COUNT ? SUMMARY_FIT_COUNT : SUMMARY_MAX_COUNT)
+
+typedef struct {
+    batcher_t batcher;
+    uint8_t arena[CONFIG_BATCH_MAX_BYTES];
+    uint64_t bytes;
+    uint64_t publishes;
+} stream_t;
+
+static stream_t raw, aggregated;
+static aggregate_t aggregator;
+static SampleSummaryBatch summaries;
+static uint8_t buffer[CONFIG_BATCH_MAX_BYTES];
+
+static struct {
+    uint64_t samples;
+    uint64_t summarized;
+    uint64_t summaries;
+    uint64_t summary_bytes;
+    uint64_t summary_publishes;
+    uint64_t aggregate_ns;
+    uint64_t first_ms;
+    uint64_t last_ms;
+} bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void stream_init(stream_t* stream) {
+    batcher_config_t config = {
+        .max_samples = CONFIG_BATCH_MAX_SAMPLES,
+        .max_age_ms = CONFIG_BATCH_MAX_AGE_MS,
+        .pressure_min = PRESSURE_MIN_VALUE,
+    };
+    stream->bytes = 0;
+    stream->publishes = 0;
+    batcher_init(&stream->batcher, &config, stream->arena, sizeof(stream->arena));
+}
+
+static void stream_flush(stream_t* stream) {
+    if (batcher_count(&stream->batcher) == 0) {
+        return;
+    }
+    size_t len = batcher_finish(&stream->batcher, buffer, sizeof(buffer));
+    if (len == 0) {
+        fprintf(stderr, "Failed to encode batch\n");
+        exit(1);
+    }
+    stream->bytes += len;
+    stream->publishes++;
+    batcher_reset(&stream->batcher);
+}
+
+/* As batch_sample in mqtt.c */
+static void stream_add(stream_t* stream, const Sample* sample) {
+    if (!batcher_add(&stream->batcher, sample)) {
+        stream_flush(stream);
+        batcher_add(&stream->batcher, sample);
+    }
+    if (batcher_is_complete(&stream->batcher)) {
+        stream_flush(stream);
+    }
+}
+
+static void summaries_flush(void) {
+    if (summaries.summaries_count == 0) {
+        return;
+    }
+    pb_ostream_t out = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&out, SampleSummaryBatch_fields, &summaries)) {
+        fprintf(stderr, "Failed to encode summaries\n");
+        exit(1);
+    }
+    bench.summary_bytes += out.bytes_written;
+    bench.summary_publishes++;
+    summaries.summaries_count = 0;
+}
+
+static void summaries_append(const aggregate_window_t* window) {
+    if (summaries.summaries_count == SUMMARY_BATCH_MAX) {
+        summaries_flush();
+    }
+    aggregate_summary(window, &summaries.summaries[summaries.summaries_count++]);
+    bench.summaries++;
+}
+
+/* As aggregate_sample in mqtt.c, without the sleep decision */
+static void replay(const Sample* sample) {
+    bench.first_ms = bench.samples++ ? bench.first_ms : sample->timestamp;
+    bench.last_ms = sample->timestamp;
+
+    stream_add(&raw, sample);
+
+    aggregate_window_t window;
+    bool closed;
+    uint64_t started = now_ns();
+    aggregate_result_t result = aggregate_add(&aggregator, sample, &window, &closed);
+    bench.aggregate_ns += now_ns() - started;
+
+    if (closed) {
+        summaries_append(&window);
+    }
+    if (result == AGGREGATE_RAW) {
+        stream_add(&aggregated, sample);
+        return;
+    }
+    bench.summarized++;
+    batcher_t* batcher = &aggregated.batcher;
+    if (batcher_count(batcher) > 0 && (closed || sample->timestamp - batcher->first.timestamp >= batcher->config.max_age_ms)) {
+        stream_flush(&aggregated);
+    }
+}
+
+/* Normalized values are rounded to 3 decimals by the sensors */
+static float round3(float value) {
+    return roundf(value * 1000) / 1000;
+}
+
+static void synthetic(uint64_t days, pb_size_t channels) {
+    uint32_t noise = 1;
+    for (uint64_t t = 0; t < days * DAY_S; ++t) {
+        uint32_t second = t % DAY_S;
+        bool running = (second >= 6 * 3600 && second < 6 * 3600 + 1800) ||
+                       (second >= 19 * 3600 && second < 19 * 3600 + 1200);
+        /* The first zone waters on its own after the main run */
+        bool zone = second >= 20 * 3600 && second < 20 * 3600 + 900;
+
+        noise = noise * 1664525u + 1013904223u;
+        float jitter = ((int)(noise >> 24) - 128) / 128.0f * 0.002f;
+
+        Sample sample = Sample_init_zero;
+        sample.timestamp = DAY0_MS + t * 1000;
+        sample.flow = running ? round3(0.4f + jitter) : 0;
+        sample.pressure = round3((running ? 0.25f : 0.3f) + jitter);
+        sample.channels_count = channels;
+        for (pb_size_t c = 0; c < channels; ++c) {
+            bool watering = running || (zone && c < 2);
+            sample.channels[c] = c % 2 == 0
+                ? round3((watering ? 0.22f : 0.3f) - jitter)
+                : (watering ? round3(0.2f + jitter) : 0);
+        }
+        replay(&sample);
+    }
+}
+
+static bool csv(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char* cursor = line;
+        Sample sample = Sample_init_zero;
+        sample.timestamp = strtoull(cursor, &cursor, 10);
+        if (*cursor != ',') {
+            continue;
+        }
+        sample.flow = strtof(cursor + 1, &cursor);
+        if (*cursor != ',') {
+            continue;
+        }
+        sample.pressure = strtof(cursor + 1, &cursor);
+        while (*cursor == ',' && sample.channels_count < CODEC_CHANNELS_MAX) {
+            sample.channels[sample.channels_count++] = strtof(cursor + 1, &cursor);
+        }
+        replay(&sample);
+    }
+    fclose(f);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    stream_init(&raw);
+    stream_init(&aggregated);
+    aggregate_config_t config = {
+        .flow_deadband = CONFIG_AGGREGATE_FLOW_DEADBAND / 1000.0f,
+        .pressure_deadband = CONFIG_AGGREGATE_PRESSURE_DEADBAND / 1000.0f,
+        .window_ms = CONFIG_AGGREGATE_WINDOW_S * 1000,
+        .hold_ms = CONFIG_BATCH_MAX_AGE_MS,
+    };
+    aggregate_init(&aggregator, &config);
+
+    pb_size_t channels = 0;
+    if (argc > 1 && !isdigit((unsigned char)argv[1][0])) {
+        for (int i = 1; i < argc; ++i) {
+            if (!csv(argv[i])) {
+                return 1;
+            }
+        }
+    } else {
+        uint64_t days = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DAYS;
+        unsigned long requested = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_CHANNELS;
+        channels = requested < CODEC_CHANNELS_MAX ? (pb_size_t)requested : CODEC_CHANNELS_MAX;
+        synthetic(days, channels);
+    }
+
+    aggregate_window_t window;
+    if (aggregate_close(&aggregator, &window)) {
+        summaries_append(&window);
+    }
+    summaries_flush();
+    stream_flush(&raw);
+    stream_flush(&aggregated);
+
+    double days = (bench.last_ms - bench.first_ms) / 86400000.0;
+    if (bench.samples < 2 || days <= 0) {
+        fprintf(stderr, "Trace too short\n");
+        return 1;
+    }
+    uint64_t bytes = aggregated.bytes + bench.summary_bytes;
+    uint64_t publishes = aggregated.publishes + bench.summary_publishes;
+    printf("{\"samples\":%llu,\"channels\":%u,\"summarized_pct\":%.1f,\"summaries\":%llu,"
+        "\"raw_bytes_per_day\":%.0f,\"raw_publishes_per_day\":%.0f,"
+        "\"aggregated_bytes_per_day\":%.0f,\"aggregated_publishes_per_day\":%.0f,"
+        "\"summary_bytes_per_day\":%.0f,\"reduction\":%.1f,\"aggregate_ns_per_sample\":%.1f}\n",
+        (unsigned long long)bench.samples, (unsigned)channels, 100.0 * bench.summarized / bench.samples,
+        (unsigned long long)bench.summaries, raw.bytes / days, raw.publishes / days, bytes / days, publishes / days,
+        bench.summary_bytes / days, bytes ? (double)raw.bytes / bytes : 0, (double)bench.aggregate_ns / bench.samples);
+    return 0;
+}
@@ -0,0 +1,139 @@
+/* Per-sample CPU cost of the sensor registry against its size: for every channel the conversion to a
+ * normalized value (pulse_rate_update and convert_flow_rate for flow, convert_pressure for pressure), then
+ * the sample into the batcher, finished batches included. The driver calls of app_sensors_read (ADC
+ * conversion, PCNT read) are hardware time and left out, the sampler's "read" stats line has them on
+ * the device. Registries of 2 to SENSOR_CHANNELS_MAX channels alternate pressure and flow zones after the
+ * primary pair. Prints one JSON object: ns per sample for each size, the least squares ns per channel,
+ * the largest deviation from that line, and the share of the fast sampling interval at 4 channels.
+ *   bench_channels [samples] */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "batcher.h"
+#include "channels.h"
+#include "convert.h"
+#include "pulse_rate.h"
+#include "adaptive_rate.h"
+
+#define BENCH_SAMPLES 200000
+#define SIZES (SENSOR_CHANNELS_MAX - 1)
+#define BUDGET_CHANNELS 4
+
+static batcher_t batcher;
+static uint8_t arena[CONFIG_BATCH_MAX_BYTES];
+static uint8_t buffer[CONFIG_BATCH_MAX_BYTES];
+static pulse_rate_t rates[SENSOR_CHANNELS_MAX];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static bool is_flow(size_t channel) {
+    return channel % 2 == SENSOR_PRIMARY_FLOW;
+}
+
+static double run(size_t channels, uint64_t samples) {
+    batcher_config_t config = {
+        .max_samples = CONFIG_BATCH_MAX_SAMPLES,
+        .max_age_ms = CONFIG_BATCH_MAX_AGE_MS,
+        .pressure_min = PRESSURE_MIN_VALUE,
+    };
+    batcher_init(&batcher, &config, arena, sizeof(arena));
+    pulse_rate_config_t rate_config = { .count_min = 100, .timeout_ms = CONFIG_FLOW_PULSE_TIMEOUT_S * 1000 };
+    for (size_t c = 0; c < channels; ++c) {
+        pulse_rate_init(&rates[c], &rate_config);
+    }
+
+    uint32_t noise = 1;
+    size_t bytes = 0;
+    uint64_t started = now_ns();
+    for (uint64_t i = 0; i < samples; ++i) {
+        int64_t now_us = (int64_t)(i + 1) * MEASUREMENT_INTERVAL_MS * 1000;
+        float values[SENSOR_CHANNELS_MAX];
+
+        for (size_t c = 0; c < channels; ++c) {
+            noise = noise * 1664525u + 1013904223u;
+            if (is_flow(c)) {
+                uint32_t count = 20 + (noise >> 28);
+                pulse_edges_t edges = { count, now_us - 990000, now_us - 10000 };
+                float pulses_per_second = pulse_rate_update(&rates[c], count, &edges, MEASUREMENT_INTERVAL_MS * 1000, now_us);
+                values[c] = convert_flow_rate(pulses_per_second, FLOW_SENSOR_PULSES_PER_LITER, MAX_FLOW_LPM);
+            } else {
+                values[c] = convert_pressure(1500 + (int)(noise >> 26), PRESSURE_SENSOR_VOLTAGE_MAX);
+            }
+        }
+
+        Sample sample = Sample_init_zero;
+        sample.timestamp = (uint64_t)now_us / 1000;
+        sample.pressure = values[SENSOR_PRIMARY_PRESSURE];
+        sample.flow = values[SENSOR_PRIMARY_FLOW];
+        sample.channels_count = channels - 2;
+        for (size_t c = 2; c < channels; ++c) {
+            sample.channels[c - 2] = values[c];
+        }
+
+        /* As batch_sample in mqtt.c */
+        if (!batcher_add(&batcher, &sample)) {
+            bytes += batcher_finish(&batcher, buffer, sizeof(buffer));
+            batcher_reset(&batcher);
+            batcher_add(&batcher, &sample);
+        }
+        if (batcher_is_complete(&batcher)) {
+            bytes += batcher_finish(&batcher, buffer, sizeof(buffer));
+            batcher_reset(&batcher);
+        }
+    }
+    uint64_t elapsed = now_ns() - started;
+
+    /* Keeps the work from being optimized out */
+    if (bytes == 0) {
+        fprintf(stderr, "No batches\n");
+        exit(1);
+    }
+    return (double)elapsed / samples;
+}
+
+int main(int argc, char** argv) {
+    uint64_t samples = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_SAMPLES;
+    double ns[SIZES];
+
+    /* Warm up, then the sizes in turn */
+    run(SENSOR_CHANNELS_MAX, samples / 10 + 1);
+    for (size_t i = 0; i < SIZES; ++i) {
+        ns[i] = run(i + 2, samples);
+    }
+
+    /* Least squares line over the channel count */
+    double sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (size_t i = 0; i < SIZES; ++i) {
+        double x = i + 2;
+        sx += x;
+        sy += ns[i];
+        sxx += x * x;
+        sxy += x * ns[i];
+    }
+    double slope = (SIZES * sxy - sx * sy) / (SIZES * sxx - sx * sx);
+    double intercept = (sy - slope * sx) / SIZES;
+    double max_error = 0;
+    for (size_t i = 0; i < SIZES; ++i) {
+        double error = fabs(ns[i] - (intercept + slope * (i + 2))) / ns[i];
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+
+    const adaptive_rate_config_t rate = ADAPTIVE_RATE_CONFIG_DEFAULT;
+    printf("{\"samples\":%llu,\"ns_per_sample\":[", (unsigned long long)samples);
+    for (size_t i = 0; i < SIZES; ++i) {
+        printf("%s{\"channels\":%zu,\"ns\":%.0f}", i > 0 ? "," : "", i + 2, ns[i]);
+    }
+    printf("],\"ns_per_channel\":%.1f,\"ns_fixed\":%.1f,\"linear_max_error_pct\":%.1f,"
+        "\"fast_interval_ms\":%lu,\"budget_pct_%dch\":%.5f}\n",
+        slope, intercept, 100 * max_error, (unsigned long)rate.fast_ms, BUDGET_CHANNELS,
+        100 * ns[BUDGET_CHANNELS - 2] / (rate.fast_ms * 1e6));
+    return 0;
+}
@@ -0,0 +1,94 @@
+/* Encodes the same samples as SampleBatch (v1, data topic before SampleBatchV2) and as SampleBatchV2,
+ * in batches of SAMPLE_BATCH_SIZE samples read from the fake sensor HAL every MEASUREMENT_INTERVAL_MS.
+ * The trace alternates idle line pressure and irrigation runs. Prints one JSON object with bytes per
+ * sample and encode ns per batch of each format; v2 counts codec_batch_add of every sample plus finish.
+ *   bench_codec [batches] [extra channels] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pb_encode.h"
+#include "codec.h"
+#include "sensors.h"
+#include "fake_sensors.h"
+
+#define BENCH_BATCHES 10000
+#define BENCH_NOISE_MV 5
+#define TRACE_PERIOD_S 1800
+#define TRACE_RUN_S 1200
+
+static SampleBatch batch;
+static uint8_t buffer[SampleBatch_size];
+static uint8_t arena[SampleBatch_size];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void trace_set(uint64_t t_ms) {
+    bool running = t_ms / 1000 % TRACE_PERIOD_S < TRACE_RUN_S;
+    fake_adc_set_mv(0, running ? 1200 : 1600);
+    fake_pcnt_set_flow_lpm(running ? 12.0f : 0.0f);
+    for (size_t i = 1; i <= FAKE_SENSORS_EXTRA_MAX; ++i) {
+        fake_adc_set_mv(i, 800 + (int)(i * 100));
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t batches = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_BATCHES;
+    size_t extra = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+    uint64_t v1_bytes = 0, v1_ns = 0, v2_bytes = 0, v2_ns = 0;
+
+    fake_sensors_reset();
+    fake_sensors_set_extra(extra);
+    fake_adc_set_noise_mv(BENCH_NOISE_MV);
+    app_sensors_init();
+
+    codec_batch_t encoder;
+    codec_batch_init(&encoder, arena, sizeof(arena));
+
+    for (uint64_t b = 0; b < batches; ++b) {
+        batch.samples_count = SAMPLE_BATCH_SIZE;
+        for (size_t i = 0; i < SAMPLE_BATCH_SIZE; ++i) {
+            fake_clock_advance_ms(MEASUREMENT_INTERVAL_MS);
+            trace_set(fake_clock_ms());
+            batch.samples[i] = (Sample)Sample_init_zero;
+            app_sensors_read(&batch.samples[i]);
+        }
+
+        uint64_t started = now_ns();
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        if (!pb_encode(&stream, SampleBatch_fields, &batch)) {
+            fprintf(stderr, "v1 encode failed: %s\n", PB_GET_ERROR(&stream));
+            return 1;
+        }
+        v1_ns += now_ns() - started;
+        v1_bytes += stream.bytes_written;
+
+        started = now_ns();
+        codec_batch_reset(&encoder);
+        for (size_t i = 0; i < SAMPLE_BATCH_SIZE; ++i) {
+            if (!codec_batch_add(&encoder, &batch.samples[i])) {
+                fprintf(stderr, "v2 batch full\n");
+                return 1;
+            }
+        }
+        size_t len = codec_batch_finish(&encoder, buffer, sizeof(buffer));
+        v2_ns += now_ns() - started;
+        if (len == 0) {
+            fprintf(stderr, "v2 encode failed\n");
+            return 1;
+        }
+        v2_bytes += len;
+    }
+
+    uint64_t samples = batches * SAMPLE_BATCH_SIZE;
+    printf("{\"batches\":%llu,\"samples_per_batch\":%d,\"extra_channels\":%zu,"
+        "\"v1_bytes_per_sample\":%.2f,\"v1_encode_ns\":%llu,\"v2_bytes_per_sample\":%.2f,\"v2_encode_ns\":%llu}\n",
+        (unsigned long long)batches, SAMPLE_BATCH_SIZE, extra,
+        (double)v1_bytes / samples, (unsigned long long)(v1_ns / batches),
+        (double)v2_bytes / samples, (unsigned long long)(v2_ns / batches));
+    return 0;
+}
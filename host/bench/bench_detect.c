@@ -0,0 +1,70 @@
+/* Replays days of 1 s samples through detect_update with the default config and times it. Every day has
+ * two irrigation runs, from the third day on a small leak runs through the night. Prints one JSON object
+ * with the replay rate in samples per second of host CPU time and the events found.
+ *   bench_detect [days] */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "detect.h"
+
+#define BENCH_DAYS 30
+#define DAY_S 86400
+/* 2024-06-01 00:00:00 UTC */
+#define DAY0_MS 1717200000000ull
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void trace(uint64_t t, float* flow, float* pressure) {
+    uint32_t second = t % DAY_S;
+    bool running = (second >= 6 * 3600 && second < 6 * 3600 + 1800) ||
+                   (second >= 19 * 3600 && second < 19 * 3600 + 1200);
+    bool leaking = t >= 2 * DAY_S && second < 5 * 3600;
+
+    *flow = running ? 0.4f : leaking ? 0.01f : 0;
+    *pressure = (running ? 0.25f : 0.3f) + 0.002f * sinf(t * 0.7f);
+}
+
+int main(int argc, char** argv) {
+    uint64_t days = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_DAYS;
+    uint64_t samples = days * DAY_S;
+
+    /* The trace is generated up front so only the detector is timed */
+    float* flow = malloc(samples * sizeof(float));
+    float* pressure = malloc(samples * sizeof(float));
+    if (flow == NULL || pressure == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (uint64_t t = 0; t < samples; ++t) {
+        trace(t, &flow[t], &pressure[t]);
+    }
+
+    detect_config_t config = DETECT_CONFIG_DEFAULT;
+    detect_t detect;
+    detect_init(&detect, &config);
+    uint32_t events[3] = { 0 };
+
+    uint64_t started = now_ns();
+    for (uint64_t t = 0; t < samples; ++t) {
+        detect_event_t event;
+        if (detect_update(&detect, DAY0_MS + t * 1000, flow[t], pressure[t], &event)) {
+            events[event.type]++;
+        }
+    }
+    uint64_t elapsed = now_ns() - started;
+
+    printf("{\"samples\":%llu,\"ns_per_sample\":%.1f,\"samples_per_s\":%.0f,"
+        "\"flow_cusum\":%u,\"night_flow\":%u,\"pressure_decay\":%u}\n",
+        (unsigned long long)samples, (double)elapsed / samples, samples * 1e9 / elapsed,
+        events[DETECT_EVENT_FLOW_CUSUM], events[DETECT_EVENT_NIGHT_FLOW], events[DETECT_EVENT_PRESSURE_DECAY]);
+
+    free(flow);
+    free(pressure);
+    return 0;
+}
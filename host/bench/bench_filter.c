@@ -0,0 +1,68 @@
+/* Times the filter task's work on one DMA frame of PRESSURE_FRAME_RESULTS conversions, split across the
+ * scanned analog channels: per channel boxcar decimation, median and the interval stats update. The ADC
+ * readout and the channel demux are left out, they depend on the driver. Prints one JSON object with
+ * ns per frame and the share of the frame period, 256 conversions at CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ.
+ * The device logs the same cost in cycles per frame in its "filter" stats line.
+ *   bench_filter [frames] [channels] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+#include "filter.h"
+
+#define BENCH_FRAMES 200000
+#define FRAME_RESULTS 256
+#define CHANNELS_MAX 4
+
+static uint16_t codes[CHANNELS_MAX][FRAME_RESULTS];
+static float decimated[FRAME_RESULTS / CONFIG_PRESSURE_SENSOR_DECIMATION];
+static filter_stats_t stats[CHANNELS_MAX];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    uint64_t frames = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_FRAMES;
+    size_t channels = argc > 2 ? strtoul(argv[2], NULL, 10) : 1;
+    if (channels == 0 || channels > CHANNELS_MAX) {
+        fprintf(stderr, "1 to %d channels\n", CHANNELS_MAX);
+        return 1;
+    }
+    size_t per_channel = FRAME_RESULTS / channels;
+
+    uint32_t noise = 1;
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t i = 0; i < per_channel; ++i) {
+            noise = noise * 1664525u + 1013904223u;
+            codes[c][i] = (uint16_t)(2000 + (noise >> 24) % 64);
+        }
+        filter_stats_reset(&stats[c]);
+    }
+
+    uint64_t started = now_ns();
+    for (uint64_t f = 0; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            size_t m = filter_boxcar_decimate(codes[c], per_channel, CONFIG_PRESSURE_SENSOR_DECIMATION, decimated);
+            if (m > 0) {
+                filter_stats_add(&stats[c], filter_median(decimated, m));
+            }
+        }
+    }
+    uint64_t elapsed = now_ns() - started;
+
+    /* Keeps the work from being optimized out */
+    if (stats[0].count != frames) {
+        fprintf(stderr, "Lost frames\n");
+        return 1;
+    }
+
+    double frame_ns = (double)elapsed / frames;
+    double period_ns = 1e9 * FRAME_RESULTS / CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ;
+    printf("{\"frames\":%llu,\"channels\":%zu,\"ns_per_frame\":%.0f,\"frame_period_pct\":%.3f}\n",
+        (unsigned long long)frames, channels, frame_ns, 100.0 * frame_ns / period_ns);
+    return 0;
+}
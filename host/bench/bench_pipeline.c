@@ -0,0 +1,232 @@
+/* Runs the live sample -> encode -> publish path of app_mqtt_task on the host: the fake sensor HAL is
+ * read every MEASUREMENT_INTERVAL_MS of simulated time, samples go through the batcher and finished
+ * batches to esp_mqtt_client_publish, like batch_sample and flush_batch do on the device.
+ * The trace repeats idle line pressure, an irrigation run and the valve closing.
+ * Prints one JSON object:
+ *   encode_ns_*         batcher_add of every sample of a batch plus batcher_finish
+ *   bytes_per_sample    encoded SampleBatchV2 bytes over samples
+ *   allocs_per_batch    heap allocations from reading the samples to the publish call
+ *   latency_ns_*        reading the newest sample of a batch to the publish call, host CPU time
+ *   sample_age_ms_*     oldest sample of a batch to the publish call, simulated time
+ *   bench_pipeline [samples] [extra channels] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batcher.h"
+#include "sensors.h"
+#include "mqtt.h"
+#include "mqtt_client.h"
+#include "fake_sensors.h"
+#include "fake_mqtt.h"
+
+#define BENCH_SAMPLES 100000
+#define BENCH_NOISE_MV 5
+
+/* Trace phases in simulated seconds: idle, irrigation, pressure decay after the valve closed */
+#define TRACE_IDLE_S 600
+#define TRACE_RUN_S 1200
+#define TRACE_DECAY_S 60
+#define TRACE_IDLE_MV 1600
+#define TRACE_RUN_MV 1200
+#define TRACE_RUN_LPM 12.0f
+
+typedef struct {
+    uint64_t count;
+    uint64_t total;
+    uint64_t max;
+} stat_t;
+
+static batcher_t batcher;
+static uint8_t batch_arena[CONFIG_BATCH_MAX_BYTES];
+static uint8_t batch_buffer[CONFIG_BATCH_MAX_BYTES];
+
+static struct {
+    uint64_t batches;
+    uint64_t samples;
+    uint64_t bytes;
+    uint64_t allocs;
+    stat_t encode_ns;
+    stat_t latency_ns;
+    stat_t sample_age_ms;
+} bench;
+
+static uint64_t batch_encode_ns;    // batcher_add time of the open batch
+static uint64_t newest_read_ns;     // read time of the newest sample of the open batch
+static uint64_t publish_ns;
+
+/* Heap allocations are counted through the linker's --wrap, see CMakeLists.txt */
+#if BENCH_WRAP_MALLOC
+static uint64_t allocs;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    allocs++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    allocs++;
+    return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+#define ALLOCS allocs
+#else
+#define ALLOCS 0
+#endif
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void stat_add(stat_t* stat, uint64_t value) {
+    stat->count++;
+    stat->total += value;
+    if (value > stat->max) {
+        stat->max = value;
+    }
+}
+
+static uint64_t stat_avg(const stat_t* stat) {
+    return stat->count > 0 ? stat->total / stat->count : 0;
+}
+
+static void publish_hook(const char* topic, const char* data, int len, int qos) {
+    (void)topic;
+    (void)data;
+    (void)len;
+    (void)qos;
+    publish_ns = now_ns();
+}
+
+static void flush_batch(void) {
+    if (batcher_count(&batcher) == 0) {
+        return;
+    }
+
+    uint64_t started = now_ns();
+    size_t len = batcher_finish(&batcher, batch_buffer, sizeof(batch_buffer));
+    stat_add(&bench.encode_ns, batch_encode_ns + now_ns() - started);
+
+    if (len == 0) {
+        fprintf(stderr, "Failed to encode batch\n");
+        exit(1);
+    }
+    esp_mqtt_client_publish(NULL, MQTT_TOPIC_DATA_V2, (const char*)batch_buffer, len, QOS1, NO_RETAIN);
+
+    stat_add(&bench.latency_ns, publish_ns - newest_read_ns);
+    stat_add(&bench.sample_age_ms, fake_clock_ms() - batcher.first.timestamp);
+    bench.batches++;
+    bench.samples += batcher_count(&batcher);
+    bench.bytes += len;
+
+    batcher_reset(&batcher);
+    batch_encode_ns = 0;
+}
+
+static bool batch_add(const Sample* sample, uint64_t read_ns) {
+    uint64_t started = now_ns();
+    bool added = batcher_add(&batcher, sample);
+    batch_encode_ns += now_ns() - started;
+    if (added) {
+        newest_read_ns = read_ns;
+    }
+    return added;
+}
+
+/* Samples that do not belong into the current batch start the next one */
+static void batch_sample(const Sample* sample, uint64_t read_ns) {
+    if (!batch_add(sample, read_ns)) {
+        flush_batch();
+        if (!batch_add(sample, read_ns)) {
+            fprintf(stderr, "Sample does not fit an empty batch\n");
+            exit(1);
+        }
+    }
+
+    if (batcher_is_complete(&batcher)) {
+        flush_batch();
+    }
+}
+
+static void trace_set(uint64_t t_ms) {
+    uint64_t t_s = t_ms / 1000 % (TRACE_IDLE_S + TRACE_RUN_S + TRACE_DECAY_S);
+
+    if (t_s < TRACE_IDLE_S) {
+        fake_adc_set_mv(0, TRACE_IDLE_MV);
+        fake_pcnt_set_flow_lpm(0);
+    } else if (t_s < TRACE_IDLE_S + TRACE_RUN_S) {
+        fake_adc_set_mv(0, TRACE_RUN_MV);
+        fake_pcnt_set_flow_lpm(TRACE_RUN_LPM);
+    } else {
+        uint64_t decay_s = t_s - TRACE_IDLE_S - TRACE_RUN_S;
+        fake_adc_set_mv(0, TRACE_RUN_MV + (int)((TRACE_IDLE_MV - TRACE_RUN_MV) * decay_s / TRACE_DECAY_S));
+        fake_pcnt_set_flow_lpm(0);
+    }
+    for (size_t i = 1; i <= FAKE_SENSORS_EXTRA_MAX; ++i) {
+        fake_adc_set_mv(i, TRACE_IDLE_MV / 2 + (int)(i * 100));
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t samples = argc > 1 ? strtoull(argv[1], NULL, 10) : BENCH_SAMPLES;
+    size_t extra = argc > 2 ? strtoul(argv[2], NULL, 10) : 0;
+
+    batcher_config_t config = {
+        .max_samples = CONFIG_BATCH_MAX_SAMPLES,
+        .max_age_ms = CONFIG_BATCH_MAX_AGE_MS,
+        .pressure_min = PRESSURE_MIN_VALUE,
+    };
+    batcher_init(&batcher, &config, batch_arena, sizeof(batch_arena));
+
+    fake_sensors_reset();
+    fake_sensors_set_extra(extra);
+    fake_adc_set_noise_mv(BENCH_NOISE_MV);
+    fake_mqtt_set_hook(publish_hook);
+    app_sensors_init();
+
+    uint64_t allocs_before = ALLOCS;
+    for (uint64_t i = 0; i < samples; ++i) {
+        fake_clock_advance_ms(MEASUREMENT_INTERVAL_MS);
+        trace_set(fake_clock_ms());
+
+        Sample sample = Sample_init_zero;
+        uint64_t read_ns = now_ns();
+        app_sensors_read(&sample);
+        batch_sample(&sample, read_ns);
+    }
+    flush_batch();
+    bench.allocs = ALLOCS - allocs_before;
+
+    if (bench.batches == 0) {
+        fprintf(stderr, "No batches\n");
+        return 1;
+    }
+
+    /* null if the linker could not wrap the allocator */
+    char allocs_per_batch[24] = "null";
+#if BENCH_WRAP_MALLOC
+    snprintf(allocs_per_batch, sizeof(allocs_per_batch), "%.2f", (double)bench.allocs / bench.batches);
+#endif
+
+    printf("{\"samples\":%llu,\"extra_channels\":%zu,\"batches\":%llu,\"bytes_per_sample\":%.2f,"
+        "\"encode_ns_avg\":%llu,\"encode_ns_max\":%llu,\"allocs_per_batch\":%s,"
+        "\"latency_ns_avg\":%llu,\"latency_ns_max\":%llu,\"sample_age_ms_avg\":%llu,\"sample_age_ms_max\":%llu}\n",
+        (unsigned long long)bench.samples, extra, (unsigned long long)bench.batches,
+        (double)bench.bytes / bench.samples,
+        (unsigned long long)stat_avg(&bench.encode_ns), (unsigned long long)bench.encode_ns.max,
+        allocs_per_batch,
+        (unsigned long long)stat_avg(&bench.latency_ns), (unsigned long long)bench.latency_ns.max,
+        (unsigned long long)stat_avg(&bench.sample_age_ms), (unsigned long long)bench.sample_age_ms.max);
+    return 0;
+}
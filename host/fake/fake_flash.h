@@ -0,0 +1,33 @@
+#ifndef FAKE_FLASH_H_
+#define FAKE_FLASH_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ring_store.h"
+
+/* NOR flash in RAM for ring_store: a write can only clear bits, an erase sets a whole sector to 0xFF.
+ * Power can be cut after a given number of steps, one per byte programmed and one per sector erase.
+ * The byte being programmed at the cut gets only part of its bits, an erase at the cut only clears
+ * the first half of the sector. Every access fails from then on until the power comes back. */
+
+typedef struct {
+    uint8_t* data;
+    uint32_t size;
+    uint32_t sector_size;
+    uint64_t steps;             // done since power on
+    uint64_t cut_at;            // power fails at this step, UINT64_MAX never
+    bool off;
+} fake_flash_t;
+
+/* data of size bytes is erased */
+void fake_flash_init(fake_flash_t* flash, uint8_t* data, uint32_t size, uint32_t sector_size);
+ring_store_flash_t fake_flash_ops(fake_flash_t* flash);
+
+/* Cuts the power after steps more steps */
+void fake_flash_cut_after(fake_flash_t* flash, uint64_t steps);
+
+/* Power back on, without a cut */
+void fake_flash_power_on(fake_flash_t* flash);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef FAKE_MQTT_H_
+#define FAKE_MQTT_H_
+
+/* Fake esp-mqtt client for the host build: publish and enqueue hand the message to a hook and
+ * return increasing message ids, as a connected client would */
+
+typedef void (*fake_mqtt_hook_t)(const char* topic, const char* data, int len, int qos);
+
+void fake_mqtt_set_hook(fake_mqtt_hook_t hook);
+
+/* Message id the next publish returns */
+int fake_mqtt_next_id(void);
+
+#endif
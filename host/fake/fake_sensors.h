@@ -0,0 +1,32 @@
+#ifndef FAKE_SENSORS_H_
+#define FAKE_SENSORS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fake sensor HAL for the host build: app_sensors_read() over a simulated ADC, pulse counter and
+ * monotonic clock. The caller sets the signals and advances the clock, the conversions to normalized
+ * values are those of the device (convert.h). */
+
+/* Max number of simulated channels past the primary pair, all pressure transducers */
+#define FAKE_SENSORS_EXTRA_MAX 6
+
+/* Back to boot: clock at 0, no pressure, no flow, no extra channels, no noise */
+void fake_sensors_reset(void);
+
+/* Transducer voltage of the primary pressure channel, or of extra channel 1.. */
+void fake_adc_set_mv(size_t channel, int millivolts);
+
+/* Uniform noise of up to ±millivolts on every ADC reading, from a fixed seed */
+void fake_adc_set_noise_mv(int millivolts);
+
+/* Extra channels carried in Sample.channels */
+void fake_sensors_set_extra(size_t count);
+
+/* Flow through the primary meter, pulses are counted with the fraction carried to the next read */
+void fake_pcnt_set_flow_lpm(float lpm);
+
+void fake_clock_advance_ms(uint32_t ms);
+uint64_t fake_clock_ms(void);
+
+#endif
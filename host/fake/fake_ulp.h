@@ -0,0 +1,35 @@
+#ifndef FAKE_ULP_H_
+#define FAKE_ULP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ulp_config.h"
+
+/* C model of the flow bucketing of main/ulp/pulse_count.S, the pressure monitor is left disabled.
+ * Variables are 32 bit words of RTC memory like ulp_main.h exposes them. The ULP works on 16 bit
+ * registers and a store fills the upper half of the word with the program counter, modelled here by a
+ * fixed pattern, so readers have to mask like they do on the device. */
+
+typedef struct {
+    uint32_t next_edge;
+    uint32_t edge_count;
+    uint32_t edge_count_to_wake_up;
+    uint32_t ticks_per_bucket;
+    uint32_t tick_count;
+    uint32_t bucket_index;
+    uint32_t bucket_total;
+    uint32_t bucket_edges[ULP_BUCKET_COUNT];
+    bool woke;                  // the program signalled a wake-up
+} fake_ulp_t;
+
+/* Power-on state, all words zero */
+void fake_ulp_init(fake_ulp_t* ulp);
+
+/* The counter reset of app_sleep_enter, next_edge is left as it is there */
+void fake_ulp_arm(fake_ulp_t* ulp, uint32_t ticks_per_bucket, uint32_t wake_edges);
+
+/* One timer triggered program run with the flow input at level (0 or 1), returns true on a wake-up */
+bool fake_ulp_run(fake_ulp_t* ulp, int level);
+
+#endif
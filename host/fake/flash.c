@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "fake_flash.h"
+
+typedef enum {
+    STEP_DONE,
+    STEP_CUT,       // power fails during this step
+    STEP_OFF,
+} step_t;
+
+static step_t step(fake_flash_t* flash) {
+    if (flash->off) {
+        return STEP_OFF;
+    }
+    if (flash->steps++ == flash->cut_at) {
+        flash->off = true;
+        return STEP_CUT;
+    }
+    return STEP_DONE;
+}
+
+static bool flash_read(void* ctx, uint32_t offset, void* dst, size_t len) {
+    fake_flash_t* flash = ctx;
+    if (flash->off || offset + len > flash->size) {
+        return false;
+    }
+    memcpy(dst, flash->data + offset, len);
+    return true;
+}
+
+static bool flash_write(void* ctx, uint32_t offset, const void* src, size_t len) {
+    fake_flash_t* flash = ctx;
+    const uint8_t* bytes = src;
+    if (offset + len > flash->size) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        step_t result = step(flash);
+        if (result == STEP_CUT) {
+            /* Torn byte, the low bits made it */
+            flash->data[offset + i] &= bytes[i] | 0xF0;
+        }
+        if (result != STEP_DONE) {
+            return false;
+        }
+        flash->data[offset + i] &= bytes[i];
+    }
+    return true;
+}
+
+static bool flash_erase_sector(void* ctx, uint32_t offset) {
+    fake_flash_t* flash = ctx;
+    if (offset % flash->sector_size != 0 || offset + flash->sector_size > flash->size) {
+        return false;
+    }
+    step_t result = step(flash);
+    if (result == STEP_CUT) {
+        memset(flash->data + offset, 0xFF, flash->sector_size / 2);
+    }
+    if (result != STEP_DONE) {
+        return false;
+    }
+    memset(flash->data + offset, 0xFF, flash->sector_size);
+    return true;
+}
+
+void fake_flash_init(fake_flash_t* flash, uint8_t* data, uint32_t size, uint32_t sector_size) {
+    flash->data = data;
+    flash->size = size;
+    flash->sector_size = sector_size;
+    memset(data, 0xFF, size);
+    fake_flash_power_on(flash);
+}
+
+ring_store_flash_t fake_flash_ops(fake_flash_t* flash) {
+    return (ring_store_flash_t) {
+        .read = flash_read,
+        .write = flash_write,
+        .erase_sector = flash_erase_sector,
+        .ctx = flash,
+        .size = flash->size,
+        .sector_size = flash->sector_size,
+    };
+}
+
+void fake_flash_cut_after(fake_flash_t* flash, uint64_t steps) {
+    flash->steps = 0;
+    flash->cut_at = steps;
+}
+
+void fake_flash_power_on(fake_flash_t* flash) {
+    flash->steps = 0;
+    flash->cut_at = UINT64_MAX;
+    flash->off = false;
+}
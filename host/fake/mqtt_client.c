@@ -0,0 +1,30 @@
+#include <stddef.h>
+
+#include "mqtt_client.h"
+#include "fake_mqtt.h"
+
+static fake_mqtt_hook_t publish_hook;
+static int next_id = 1;
+
+void fake_mqtt_set_hook(fake_mqtt_hook_t hook) {
+    publish_hook = hook;
+}
+
+int fake_mqtt_next_id(void) {
+    return next_id;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain) {
+    (void)client;
+    (void)retain;
+    if (publish_hook != NULL) {
+        publish_hook(topic, data, len, qos);
+    }
+    /* QoS 0 messages have no id */
+    return qos > 0 ? next_id++ : 0;
+}
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain, bool store) {
+    (void)store;
+    return esp_mqtt_client_publish(client, topic, data, len, qos, retain);
+}
@@ -0,0 +1,100 @@
+#include <math.h>
+#include <string.h>
+
+#include "sensors.h"
+#include "convert.h"
+#include "fake_sensors.h"
+
+#define ADC_MAX_CODE 4095
+
+static struct {
+    uint64_t now_ms;
+    uint64_t read_ms;           // clock at the previous read, the pulse counter window starts there
+    int millivolts[1 + FAKE_SENSORS_EXTRA_MAX];
+    int noise_mv;
+    uint32_t noise_state;
+    size_t extra;
+    float flow_lpm;
+    double pulses;              // counted but not yet read, the fraction stays for the next window
+} fake;
+
+void fake_sensors_reset(void) {
+    memset(&fake, 0, sizeof(fake));
+    fake.noise_state = 1;
+}
+
+void fake_adc_set_mv(size_t channel, int millivolts) {
+    if (channel <= FAKE_SENSORS_EXTRA_MAX) {
+        fake.millivolts[channel] = millivolts;
+    }
+}
+
+void fake_adc_set_noise_mv(int millivolts) {
+    fake.noise_mv = millivolts;
+}
+
+void fake_sensors_set_extra(size_t count) {
+    fake.extra = count < FAKE_SENSORS_EXTRA_MAX ? count : FAKE_SENSORS_EXTRA_MAX;
+}
+
+void fake_pcnt_set_flow_lpm(float lpm) {
+    fake.flow_lpm = lpm;
+}
+
+void fake_clock_advance_ms(uint32_t ms) {
+    fake.pulses += (double)fake.flow_lpm * FLOW_SENSOR_PULSES_PER_LITER / 60000.0 * ms;
+    fake.now_ms += ms;
+}
+
+uint64_t fake_clock_ms(void) {
+    return fake.now_ms;
+}
+
+/* 12 bit code of the voltage, without a calibration curve like an uncalibrated ADC1 channel */
+static int adc_read_code(size_t channel) {
+    int millivolts = fake.millivolts[channel];
+    if (fake.noise_mv > 0) {
+        fake.noise_state = fake.noise_state * 1664525u + 1013904223u;
+        millivolts += (int)(fake.noise_state >> 8) % (2 * fake.noise_mv + 1) - fake.noise_mv;
+    }
+    int code = millivolts * ADC_MAX_CODE / (int)(PRESSURE_SENSOR_VOLTAGE_MAX * 1000);
+    return code < 0 ? 0 : (code > ADC_MAX_CODE ? ADC_MAX_CODE : code);
+}
+
+static float pressure_read(size_t channel) {
+    int millivolts = adc_read_code(channel) * (int)(PRESSURE_SENSOR_VOLTAGE_MAX * 1000) / ADC_MAX_CODE;
+    return normalize_pressure(millivolts);
+}
+
+void app_sensors_init(void) {
+    fake.read_ms = fake.now_ms;
+    fake.pulses = 0;
+}
+
+void app_sensors_read(Sample* sample) {
+    uint32_t period_ms = (uint32_t)(fake.now_ms - fake.read_ms);
+    uint32_t pulse_count = (uint32_t)fake.pulses;
+
+    fake.pulses -= pulse_count;
+    fake.read_ms = fake.now_ms;
+
+    sample->timestamp = fake.now_ms;
+    sample->pressure = pressure_read(0);
+    sample->flow = period_ms > 0 ? normalize_flow(pulse_count, period_ms) : 0;
+    sample->has_pressure_min = false;
+    sample->has_pressure_max = false;
+    sample->has_pressure_stddev = false;
+    sample->channels_count = fake.extra;
+    for (size_t i = 0; i < fake.extra; ++i) {
+        sample->channels[i] = pressure_read(i + 1);
+    }
+}
+
+float app_sensors_normalize_flow(uint32_t pulse_count, uint32_t period_ms) {
+    return normalize_flow(pulse_count, period_ms);
+}
+
+uint16_t app_sensors_pressure_to_raw(float pressure) {
+    int code = (int)lroundf(pressure * ADC_MAX_CODE);
+    return code < 0 ? 0 : (code > ADC_MAX_CODE ? ADC_MAX_CODE : code);
+}
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "fake_ulp.h"
+
+/* What a ULP st leaves in the upper half of a word */
+#define STORE_UPPER 0x5A5A0000u
+
+static uint16_t ld(const uint32_t* word) {
+    return (uint16_t)*word;
+}
+
+static void st(uint32_t* word, uint16_t value) {
+    *word = STORE_UPPER | value;
+}
+
+void fake_ulp_init(fake_ulp_t* ulp) {
+    memset(ulp, 0, sizeof(*ulp));
+}
+
+void fake_ulp_arm(fake_ulp_t* ulp, uint32_t ticks_per_bucket, uint32_t wake_edges) {
+    ulp->edge_count_to_wake_up = wake_edges;
+    ulp->ticks_per_bucket = ticks_per_bucket;
+    ulp->edge_count = 0;
+    ulp->tick_count = 0;
+    ulp->bucket_index = 0;
+    ulp->bucket_total = 0;
+    memset(ulp->bucket_edges, 0, sizeof(ulp->bucket_edges));
+    ulp->woke = false;
+}
+
+/* entry, next_bucket, read_io and edge_detected in that order, instruction by instruction */
+bool fake_ulp_run(fake_ulp_t* ulp, int level) {
+    uint16_t tick = ld(&ulp->tick_count) + 1;
+    st(&ulp->tick_count, tick);
+    if ((uint16_t)(ld(&ulp->ticks_per_bucket) - tick) == 0) {
+        st(&ulp->tick_count, 0);
+        st(&ulp->bucket_total, ld(&ulp->bucket_total) + 1);
+        uint16_t index = (ld(&ulp->bucket_index) + 1) & (ULP_BUCKET_COUNT - 1);
+        st(&ulp->bucket_index, index);
+        st(&ulp->bucket_edges[index], 0);
+    }
+
+    /* An edge is the input at the level next_edge expects */
+    if (((level & 1) + ld(&ulp->next_edge)) & 1) {
+        return false;
+    }
+    st(&ulp->next_edge, (ld(&ulp->next_edge) + 1) & 1);
+
+    uint32_t* bucket = &ulp->bucket_edges[ld(&ulp->bucket_index)];
+    st(bucket, ld(bucket) + 1);
+
+    uint16_t edges = ld(&ulp->edge_count) + 1;
+    st(&ulp->edge_count, edges);
+    if ((uint16_t)(ld(&ulp->edge_count_to_wake_up) - edges) == 0) {
+        ulp->woke = true;
+        return true;
+    }
+    return false;
+}
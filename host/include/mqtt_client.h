@@ -0,0 +1,9 @@
+/* The part of esp-mqtt's client API the host build publishes through, see fake/mqtt_client.c */
+#pragma once
+
+#include <stdbool.h>
+
+typedef struct esp_mqtt_client* esp_mqtt_client_handle_t;
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain);
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos, int retain, bool store);
@@ -0,0 +1,34 @@
+/* Kconfig defaults of main/Kconfig.projbuild for the host build, bool options that default to n are left undefined */
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32 1
+#define CONFIG_MQTT_BROKER_URL "mqtts://irrigo.xyz:8883"
+#define CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ 20000
+#define CONFIG_PRESSURE_SENSOR_DECIMATION 16
+#define CONFIG_FLOW_PULSE_PERIOD 1
+#define CONFIG_FLOW_PULSE_TIMEOUT_S 900
+#define CONFIG_PRESSURE_TRANSIENT_CAPTURE 1
+#define CONFIG_PRESSURE_TRANSIENT_PRE_MS 200
+#define CONFIG_PRESSURE_TRANSIENT_POST_MS 800
+#define CONFIG_PRESSURE_TRANSIENT_TRIGGER 5
+#define CONFIG_POWER_LIGHT_SLEEP 1
+#define CONFIG_WIFI_LISTEN_INTERVAL 3
+#define CONFIG_RAW_UPLOAD_HOLD_S 300
+#define CONFIG_AGGREGATE_IDLE 1
+#define CONFIG_AGGREGATE_FLOW_DEADBAND 2
+#define CONFIG_AGGREGATE_PRESSURE_DEADBAND 5
+#define CONFIG_AGGREGATE_WINDOW_S 60
+#define CONFIG_BATCH_MAX_SAMPLES 30
+#define CONFIG_BATCH_MAX_BYTES 2048
+#define CONFIG_BATCH_MAX_AGE_MS 30000
+#define CONFIG_RELAY_LEAF 1
+#define CONFIG_RELAY_WIFI_RETRY_H 24
+#define CONFIG_RELAY_ACK_TIMEOUT_MS 50
+#define CONFIG_RELAY_RETRIES 5
+#define CONFIG_RELAY_GATEWAY_PEERS 8
+#define CONFIG_PROV_BUTTON_GPIO 0
+#define CONFIG_PROV_BUTTON_HOLD_MS 3000
+#define CONFIG_TIME_ERROR_BUDGET_MS 1000
+#define CONFIG_TIME_VALID_MAX_ERROR_S 60
+#define CONFIG_SLEEP_QUIET_BATCHES 3
+#define CONFIG_SLEEP_ACK_TIMEOUT_MS 5000
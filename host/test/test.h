@@ -0,0 +1,42 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <math.h>
+#include <stdio.h>
+
+/* Checks keep going after a failure, main returns TEST_RESULT() so ctest sees any of them */
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        long long a_ = (long long)(a), b_ = (long long)(b); \
+        if (a_ != b_) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) do { \
+        double a_ = (double)(a), b_ = (double)(b); \
+        if (!(fabs(a_ - b_) <= (tolerance))) { \
+            fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %g != %g\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+            test_failures++; \
+        } \
+    } while (0)
+
+#define RUN(test) do { \
+        int failures_ = test_failures; \
+        test(); \
+        printf("%s %s\n", test_failures == failures_ ? "ok  " : "FAIL", #test); \
+    } while (0)
+
+#define TEST_RESULT() (test_failures == 0 ? 0 : 1)
+
+#endif
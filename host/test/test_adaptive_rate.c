@@ -0,0 +1,158 @@
+/* Closed loop simulation of the sampler: every sample is taken the interval adaptive_rate_update picked
+ * for it after the previous one, with the default config and flat, step and ramp inputs. */
+#include <math.h>
+
+#include "adaptive_rate.h"
+#include "test.h"
+
+#define T0 1717200000000ull
+#define DECISIONS_MAX 4096
+
+typedef void (*input_t)(uint64_t t_ms, float* flow, float* pressure);
+
+typedef struct {
+    uint64_t t_ms;              // since T0
+    uint32_t interval_ms;       // picked at this sample
+} decision_t;
+
+static const adaptive_rate_config_t config = ADAPTIVE_RATE_CONFIG_DEFAULT;
+static decision_t decisions[DECISIONS_MAX];
+static size_t decision_count;
+
+/* A few thousandths of pressure noise within the deadband, reproducible */
+static float noise(uint64_t t_ms) {
+    return 0.0008f * sinf(t_ms * 0.0007f);
+}
+
+static void simulate(input_t input, uint64_t duration_ms) {
+    adaptive_rate_t rate;
+    adaptive_rate_init(&rate, &config);
+
+    decision_count = 0;
+    for (uint64_t t = 0; t < duration_ms && decision_count < DECISIONS_MAX;) {
+        float flow, pressure;
+        input(t, &flow, &pressure);
+        uint32_t interval = adaptive_rate_update(&rate, T0 + t, flow, pressure);
+        decisions[decision_count++] = (decision_t) { t, interval };
+        t += interval;
+    }
+    CHECK(decision_count < DECISIONS_MAX);
+}
+
+/* Number of decisions in [from_ms, to_ms) that picked interval_ms */
+static size_t count_between(uint64_t from_ms, uint64_t to_ms, uint32_t interval_ms) {
+    size_t count = 0;
+    for (size_t i = 0; i < decision_count; ++i) {
+        if (decisions[i].t_ms >= from_ms && decisions[i].t_ms < to_ms && decisions[i].interval_ms == interval_ms) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static size_t samples_between(uint64_t from_ms, uint64_t to_ms) {
+    size_t count = 0;
+    for (size_t i = 0; i < decision_count; ++i) {
+        count += decisions[i].t_ms >= from_ms && decisions[i].t_ms < to_ms;
+    }
+    return count;
+}
+
+/* First sample at or after t_ms */
+static const decision_t* first_from(uint64_t t_ms) {
+    for (size_t i = 0; i < decision_count; ++i) {
+        if (decisions[i].t_ms >= t_ms) {
+            return &decisions[i];
+        }
+    }
+    return NULL;
+}
+
+static void flat(uint64_t t, float* flow, float* pressure) {
+    *flow = 0;
+    *pressure = 0.3f + noise(t);
+}
+
+/* Normal for stable_ms, slow from then on, never fast */
+static void test_flat(void) {
+    simulate(flat, 300000);
+
+    CHECK_EQ(decisions[0].interval_ms, config.normal_ms);
+    CHECK_EQ(count_between(0, config.stable_ms, config.normal_ms), samples_between(0, config.stable_ms));
+    CHECK_EQ(count_between(config.stable_ms, 300000, config.slow_ms), samples_between(config.stable_ms, 300000));
+    CHECK_EQ(count_between(0, 300000, config.fast_ms), 0);
+    /* 60 samples at 1 s, then 24 at 10 s */
+    CHECK_EQ(decision_count, 60 + 24);
+}
+
+#define STEP_AT_MS 180500
+
+static void flow_step(uint64_t t, float* flow, float* pressure) {
+    flat(t, flow, pressure);
+    if (t >= STEP_AT_MS) {
+        *flow = 0.3f;
+        *pressure -= 0.04f;
+    }
+}
+
+/* Seen by the next slow sample, then fast for fast_hold_ms, normal until the new level was flat for
+ * stable_ms, and slow again */
+static void test_step(void) {
+    simulate(flow_step, 600000);
+
+    CHECK_EQ(count_between(120000, STEP_AT_MS, config.slow_ms), samples_between(120000, STEP_AT_MS));
+
+    const decision_t* seen = first_from(STEP_AT_MS);
+    CHECK(seen != NULL);
+    if (seen == NULL) {
+        return;
+    }
+    uint64_t detected = seen->t_ms;
+    CHECK(detected - STEP_AT_MS < config.slow_ms);
+    CHECK_EQ(seen->interval_ms, config.fast_ms);
+
+    uint64_t hold_end = detected + config.fast_hold_ms;
+    uint64_t stable_end = detected + config.stable_ms;
+    CHECK_EQ(count_between(detected, hold_end, config.fast_ms), samples_between(detected, hold_end));
+    CHECK_EQ(samples_between(detected, hold_end), config.fast_hold_ms / config.fast_ms);
+    CHECK_EQ(count_between(hold_end, stable_end, config.normal_ms), samples_between(hold_end, stable_end));
+    CHECK_EQ(count_between(stable_end, 600000, config.slow_ms), samples_between(stable_end, 600000));
+}
+
+#define RAMP_FROM_MS 180000
+#define RAMP_TO_MS 480000
+#define RAMP_PER_S 0.001f
+
+/* The pressure sags slower than the deadband per normal interval, which is still a moving signal */
+static void pressure_ramp(uint64_t t, float* flow, float* pressure) {
+    flat(t, flow, pressure);
+    uint64_t ramp_ms = t < RAMP_FROM_MS ? 0 : (t < RAMP_TO_MS ? t : RAMP_TO_MS) - RAMP_FROM_MS;
+    *pressure -= RAMP_PER_S * ramp_ms / 1000;
+}
+
+/* Once the ramp has moved past the deadband the sampler stays at normal until it ends, without slowing
+ * down or mistaking the change over a slow interval for a transient, and slows down stable_ms after */
+static void test_ramp(void) {
+    simulate(pressure_ramp, 800000);
+
+    /* Slow when the ramp starts, seen within a slow interval plus the time to cross the deadband */
+    uint64_t seen_by = RAMP_FROM_MS + config.slow_ms + (uint64_t)(config.pressure_deadband / RAMP_PER_S * 1000) + 1000;
+    /* A fast burst is allowed for the first sample, the ramp over a whole slow interval exceeds the step */
+    uint64_t settled = seen_by + config.fast_hold_ms;
+
+    CHECK_EQ(count_between(settled, RAMP_TO_MS, config.normal_ms), samples_between(settled, RAMP_TO_MS));
+    CHECK(samples_between(settled, RAMP_TO_MS) >= (RAMP_TO_MS - settled) / config.normal_ms - 1);
+
+    /* The last change is marked up to one deadband before the ramp ends, noise can move it a few s after */
+    uint64_t deadband_ms = (uint64_t)(config.pressure_deadband / RAMP_PER_S * 1000);
+    uint64_t slow_from = RAMP_TO_MS + config.stable_ms + 10000;
+    CHECK_EQ(count_between(RAMP_TO_MS, RAMP_TO_MS + config.stable_ms - deadband_ms - config.normal_ms, config.slow_ms), 0);
+    CHECK_EQ(count_between(slow_from, 800000, config.slow_ms), samples_between(slow_from, 800000));
+}
+
+int main(void) {
+    RUN(test_flat);
+    RUN(test_step);
+    RUN(test_ramp);
+    return TEST_RESULT();
+}
@@ -0,0 +1,145 @@
+/* Sample streams through aggregate.c: which samples go out raw, and what the closed windows hold */
+#include "pb_encode.h"
+#include "pb_decode.h"
+#include "aggregate.h"
+#include "test.h"
+
+#define T0 1717200000000ull
+#define INTERVAL_MS 1000
+#define HOLD_MS 30000
+#define WINDOW_MS 60000
+
+static const aggregate_config_t config = {
+    .flow_deadband = 0.002f,
+    .pressure_deadband = 0.005f,
+    .window_ms = WINDOW_MS,
+    .hold_ms = HOLD_MS,
+};
+
+typedef struct {
+    uint32_t raw;
+    uint32_t summarized;
+    uint32_t switches;          // raw to summarized and back
+    uint32_t windows;
+    uint32_t windowed;          // samples in the closed windows
+} run_t;
+
+static aggregate_t aggregate;
+
+static void feed(run_t* run, uint64_t t, float flow, float pressure) {
+    Sample sample = Sample_init_zero;
+    sample.timestamp = T0 + t;
+    sample.flow = flow;
+    sample.pressure = pressure;
+
+    static aggregate_result_t previous;
+    aggregate_window_t window;
+    bool closed;
+    aggregate_result_t result = aggregate_add(&aggregate, &sample, &window, &closed);
+    if (run->raw + run->summarized > 0 && result != previous) {
+        run->switches++;
+    }
+    previous = result;
+    *(result == AGGREGATE_RAW ? &run->raw : &run->summarized) += 1;
+    if (closed) {
+        run->windows++;
+        run->windowed += window.count;
+    }
+}
+
+/* The first sample and the hold after it are raw, the rest goes into full windows */
+static void test_flat(void) {
+    aggregate_init(&aggregate, &config);
+    run_t run = { 0 };
+    for (uint64_t t = 0; t < 10 * WINDOW_MS; t += INTERVAL_MS) {
+        feed(&run, t, 0, 0.3f);
+    }
+    CHECK_EQ(run.raw, HOLD_MS / INTERVAL_MS);
+    CHECK_EQ(run.switches, 1);
+    CHECK_EQ(run.windowed, run.windows * (WINDOW_MS / INTERVAL_MS));
+    /* The last window is still open */
+    CHECK(run.summarized - run.windowed <= WINDOW_MS / INTERVAL_MS);
+    CHECK_EQ(run.summarized + run.raw, 10 * WINDOW_MS / INTERVAL_MS);
+}
+
+/* Pressure crossing the deadband every 10 s stays raw instead of flipping every sample */
+static void test_edge_of_deadband(void) {
+    aggregate_init(&aggregate, &config);
+    run_t run = { 0 };
+    for (uint64_t t = 0; t < 10 * WINDOW_MS; t += INTERVAL_MS) {
+        feed(&run, t, 0, 0.3f + ((t / 10000) % 2) * 0.006f);
+    }
+    CHECK_EQ(run.summarized, 0);
+    CHECK_EQ(run.switches, 0);
+}
+
+/* A single excursion, then flat: one raw run of the hold, summarized before and after it */
+static void test_excursion(void) {
+    aggregate_init(&aggregate, &config);
+    run_t run = { 0 };
+    const uint64_t at = 5 * WINDOW_MS;
+    for (uint64_t t = 0; t < 10 * WINDOW_MS; t += INTERVAL_MS) {
+        feed(&run, t, 0, t == at ? 0.35f : 0.3f);
+    }
+    /* The initial hold, the excursion, and the step back to 0.3 which moved again with its hold */
+    CHECK_EQ(run.raw, 2 * HOLD_MS / INTERVAL_MS + 1);
+    CHECK_EQ(run.switches, 3);
+}
+
+/* Additional channels that stay within the deadband are summarized like pressure and flow, and come back
+ * from the encoded SampleSummaryBatch */
+static void test_channels(void) {
+    aggregate_init(&aggregate, &config);
+    const float base[3] = { 0.3f, 0.1f, 0.25f };
+    aggregate_window_t window;
+    bool closed = false;
+    uint64_t t = 0;
+
+    /* Past the hold, then one window of samples with channel 1 going 0.098, 0.100, 0.102 */
+    for (; !closed && t < 10 * WINDOW_MS; t += INTERVAL_MS) {
+        Sample sample = Sample_init_zero;
+        sample.timestamp = T0 + t;
+        sample.pressure = 0.3f;
+        sample.channels_count = 3;
+        for (pb_size_t c = 0; c < 3; ++c) {
+            sample.channels[c] = base[c];
+        }
+        sample.channels[1] += ((int)(t / INTERVAL_MS % 3) - 1) * 0.002f;
+        aggregate_add(&aggregate, &sample, &window, &closed);
+    }
+    CHECK_EQ(window.channels_count, 3);
+
+    SampleSummaryBatch batch = SampleSummaryBatch_init_zero;
+    batch.summaries_count = 1;
+    aggregate_summary(&window, &batch.summaries[0]);
+
+    uint8_t buffer[SampleSummaryBatch_size];
+    pb_ostream_t out = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    CHECK(pb_encode(&out, SampleSummaryBatch_fields, &batch));
+    CHECK(out.bytes_written <= SampleSummary_size + 3);
+
+    SampleSummaryBatch decoded = SampleSummaryBatch_init_zero;
+    pb_istream_t in = pb_istream_from_buffer(buffer, out.bytes_written);
+    CHECK(pb_decode(&in, SampleSummaryBatch_fields, &decoded));
+    CHECK_EQ(decoded.summaries_count, 1);
+
+    const SampleSummary* summary = &decoded.summaries[0];
+    CHECK_EQ(summary->count, WINDOW_MS / INTERVAL_MS);
+    CHECK_EQ(summary->pressure_mean, 300);
+    CHECK_EQ(summary->channels_count, 3);
+    CHECK_EQ(summary->channels[0].min, 300);
+    CHECK_EQ(summary->channels[0].max, 300);
+    CHECK_EQ(summary->channels[1].min, 98);
+    CHECK_EQ(summary->channels[1].max, 102);
+    CHECK_EQ(summary->channels[1].mean, 100);
+    CHECK_EQ(summary->channels[2].mean, 250);
+    CHECK_EQ(summary->channels[2].last, 250);
+}
+
+int main(void) {
+    RUN(test_flat);
+    RUN(test_edge_of_deadband);
+    RUN(test_excursion);
+    RUN(test_channels);
+    return TEST_RESULT();
+}
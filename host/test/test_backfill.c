@@ -0,0 +1,247 @@
+/* Deep sleep flow backfill: a square wave flow signal is sampled by the C model of pulse_count.S at the
+ * ULP period, the RTC slow clock running off nominal, and the counters are read back through
+ * backfill_buckets like app_sleep_backfill does. Every bucket is compared with the pulses the signal
+ * really had in the wall clock window it was placed in. */
+#include <math.h>
+#include <stdlib.h>
+
+#include "backfill.h"
+#include "fake_ulp.h"
+#include "test.h"
+
+#define BUCKET_MS 60000
+#define ENTERED_MS 1700000000000ull
+#define MINUTES_MAX (UINT16_MAX + 256)
+
+/* Pulse frequency of each wall clock minute, and the signal phase in pulses at its start */
+static double minute_hz[MINUTES_MAX];
+static double minute_phase[MINUTES_MAX + 1];
+
+typedef struct {
+    uint32_t period_us;         // nominal ULP period
+    double clock_error;         // real period over nominal
+    double buckets;             // sleep duration in nominal buckets
+} sleep_t;
+
+static fake_ulp_t ulp;
+
+static void profile_done(void) {
+    minute_phase[0] = 0;
+    for (size_t m = 0; m < MINUTES_MAX; ++m) {
+        minute_phase[m + 1] = minute_phase[m] + minute_hz[m] * 60;
+    }
+}
+
+static double phase_at(double t_ms) {
+    size_t m = (size_t)(t_ms / 60000);
+    return minute_phase[m] + minute_hz[m] * (t_ms - m * 60000.0) / 1000;
+}
+
+/* The line idles high, a pulse pulls it low for the second half of its period */
+static int level_at(double t_ms) {
+    double phase = phase_at(t_ms);
+    return phase - floor(phase) < 0.5 ? 1 : 0;
+}
+
+/* Falling edges of the signal in (from_ms, to_ms] */
+static long pulses_between(double from_ms, double to_ms) {
+    return (long)floor(phase_at(to_ms) + 0.5) - (long)floor(phase_at(from_ms) + 0.5);
+}
+
+/* Runs the ULP over the sleep, returns the wall clock time of the read back relative to entering */
+static double run_sleep(const sleep_t* sleep) {
+    uint32_t ticks_per_bucket = BUCKET_MS * 1000 / sleep->period_us;
+    uint64_t runs = (uint64_t)(sleep->buckets * ticks_per_bucket);
+    double real_period_ms = sleep->period_us / 1000.0 * sleep->clock_error;
+
+    fake_ulp_arm(&ulp, ticks_per_bucket, UINT16_MAX);
+    for (uint64_t k = 1; k <= runs; ++k) {
+        fake_ulp_run(&ulp, level_at(k * real_period_ms));
+    }
+    return runs * real_period_ms;
+}
+
+static size_t read_back(const sleep_t* sleep, double elapsed_ms, backfill_bucket_t* buckets, size_t max) {
+    backfill_ulp_t counters = {
+        .edges = ulp.bucket_edges,
+        .total = ulp.bucket_total,
+        .ticks = ulp.tick_count,
+        .ticks_per_bucket = ulp.ticks_per_bucket,
+        .period_us = sleep->period_us,
+    };
+    return backfill_buckets(&counters, ENTERED_MS, ENTERED_MS + (uint64_t)elapsed_ms, buckets, max);
+}
+
+/* Buckets are contiguous, real bucket length, end at the read back, and hold the pulses of their window.
+ * first_bucket is the index since entering of the oldest one returned. */
+static void check_buckets(const sleep_t* sleep, double elapsed_ms, const backfill_bucket_t* buckets, size_t n,
+                          uint64_t first_bucket) {
+    double bucket_ms = BUCKET_MS * sleep->clock_error;
+    long pulses = 0;
+
+    CHECK(n > 0);
+    CHECK_NEAR(buckets[0].start_ms - ENTERED_MS, first_bucket * bucket_ms, 2);
+    CHECK_EQ(buckets[n - 1].end_ms, ENTERED_MS + (uint64_t)elapsed_ms);
+    for (size_t i = 0; i < n; ++i) {
+        const backfill_bucket_t* b = &buckets[i];
+        double from = (double)(b->start_ms - ENTERED_MS), to = (double)(b->end_ms - ENTERED_MS);
+
+        if (i + 1 < n) {
+            CHECK_EQ(b->end_ms, buckets[i + 1].start_ms);
+            CHECK_NEAR(to - from, bucket_ms, 2);
+        }
+        /* A pulse straddling a boundary lands on either side */
+        CHECK_NEAR(b->pulses, pulses_between(from, to), 1);
+        pulses += b->pulses;
+    }
+    CHECK_NEAR(pulses, pulses_between((double)(buckets[0].start_ms - ENTERED_MS), elapsed_ms), 2);
+}
+
+static void profile_reset(void) {
+    for (size_t m = 0; m < MINUTES_MAX; ++m) {
+        minute_hz[m] = 0;
+    }
+}
+
+/* Instruction level behaviour of the model */
+static void test_ulp_model(void) {
+    fake_ulp_init(&ulp);
+    fake_ulp_arm(&ulp, 4, 6);
+
+    /* Idle high is no edge, then every level change is one */
+    const int levels[] = { 1, 1, 0, 0, 1, 0, 1, 1, 0 };
+    bool woke = false;
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); ++i) {
+        woke |= fake_ulp_run(&ulp, levels[i]);
+    }
+    CHECK_EQ(ulp.edge_count & UINT16_MAX, 5);
+    CHECK(!woke);
+    /* Runs 1-3 are bucket 0, 4-7 bucket 1, 8-9 bucket 2 */
+    CHECK_EQ(ulp.bucket_total & UINT16_MAX, 2);
+    CHECK_EQ(ulp.tick_count & UINT16_MAX, 1);
+    CHECK_EQ(ulp.bucket_edges[0] & UINT16_MAX, 1);
+    CHECK_EQ(ulp.bucket_edges[1] & UINT16_MAX, 3);
+    CHECK_EQ(ulp.bucket_edges[2] & UINT16_MAX, 1);
+    /* The upper halves are not counts */
+    CHECK(ulp.bucket_edges[1] > UINT16_MAX);
+
+    CHECK(fake_ulp_run(&ulp, 1));
+    CHECK(ulp.woke);
+}
+
+/* Ten and a half minutes at the default 20 ms period, the slow clock 3% slow */
+static void test_short_sleep(void) {
+    const sleep_t sleep = { .period_us = 20000, .clock_error = 1.03, .buckets = 10.5 };
+    backfill_bucket_t buckets[ULP_BUCKET_COUNT];
+
+    profile_reset();
+    for (size_t m = 3; m < 6; ++m) {
+        minute_hz[m] = 2;
+    }
+    minute_hz[6] = 10;
+    minute_hz[7] = minute_hz[8] = minute_hz[9] = minute_hz[10] = 0.35;
+    profile_done();
+
+    fake_ulp_init(&ulp);
+    double elapsed = run_sleep(&sleep);
+    size_t n = read_back(&sleep, elapsed, buckets, ULP_BUCKET_COUNT);
+
+    CHECK_EQ(n, 11);
+    check_buckets(&sleep, elapsed, buckets, n, 0);
+    CHECK_EQ(buckets[0].pulses, 0);
+}
+
+/* More buckets than the ring holds, the oldest are gone and the rest keep their place in time */
+static void test_bucket_cap(void) {
+    const sleep_t sleep = { .period_us = 20000, .clock_error = 0.97, .buckets = 100.3 };
+    backfill_bucket_t buckets[ULP_BUCKET_COUNT];
+
+    profile_reset();
+    for (size_t m = 0; m < 110; ++m) {
+        minute_hz[m] = (m % 7) * 0.8;
+    }
+    profile_done();
+
+    fake_ulp_init(&ulp);
+    double elapsed = run_sleep(&sleep);
+    size_t n = read_back(&sleep, elapsed, buckets, ULP_BUCKET_COUNT);
+    uint64_t total = ulp.bucket_total & UINT16_MAX;
+
+    CHECK_EQ(total, 100);
+    CHECK_EQ(n, ULP_BUCKET_COUNT);
+    check_buckets(&sleep, elapsed, buckets, n, total - ULP_BUCKET_COUNT + 1);
+
+    /* A smaller output keeps the newest */
+    n = read_back(&sleep, elapsed, buckets, 5);
+    CHECK_EQ(n, 5);
+    check_buckets(&sleep, elapsed, buckets, n, total - 4);
+}
+
+/* bucket_total wraps at 16 bits after 65536 buckets. At a 1 s period, with the slow clock 4% fast. */
+static void test_total_wrap(void) {
+    const double lengths[] = { 65536 + 70.5, 65536 + 10.2, 65536 - 1.5 };
+    backfill_bucket_t buckets[ULP_BUCKET_COUNT];
+
+    profile_reset();
+    for (size_t m = 65536 - 80; m < MINUTES_MAX; ++m) {
+        minute_hz[m] = 0.05 + (m % 5) * 0.05;
+    }
+    profile_done();
+
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        const sleep_t sleep = { .period_us = 1000000, .clock_error = 1 / 1.04, .buckets = lengths[i] };
+        uint64_t total = (uint64_t)lengths[i];
+
+        fake_ulp_init(&ulp);
+        double elapsed = run_sleep(&sleep);
+        size_t n = read_back(&sleep, elapsed, buckets, ULP_BUCKET_COUNT);
+
+        CHECK_EQ(n, ULP_BUCKET_COUNT);
+        check_buckets(&sleep, elapsed, buckets, n, total - ULP_BUCKET_COUNT + 1);
+    }
+}
+
+/* Odd edge counts are carried, a steady flow over many buckets is not rounded down in each */
+static void test_edge_carry(void) {
+    const sleep_t sleep = { .period_us = 20000, .clock_error = 1, .buckets = 30 };
+    backfill_bucket_t buckets[ULP_BUCKET_COUNT];
+
+    profile_reset();
+    for (size_t m = 0; m < 31; ++m) {
+        minute_hz[m] = 7.0 / 60 + 1.0 / 120;     // 7.5 pulses per minute
+    }
+    profile_done();
+
+    fake_ulp_init(&ulp);
+    double elapsed = run_sleep(&sleep);
+    size_t n = read_back(&sleep, elapsed, buckets, ULP_BUCKET_COUNT);
+
+    long pulses = 0;
+    for (size_t i = 0; i < n; ++i) {
+        pulses += buckets[i].pulses;
+    }
+    CHECK_NEAR(pulses, pulses_between(0, elapsed), 1);
+}
+
+static void test_no_sleep(void) {
+    backfill_bucket_t buckets[1];
+    const sleep_t sleep = { .period_us = 20000, .clock_error = 1, .buckets = 0 };
+
+    fake_ulp_init(&ulp);
+    fake_ulp_arm(&ulp, BUCKET_MS * 1000 / sleep.period_us, 10);
+    CHECK_EQ(read_back(&sleep, 0, buckets, 0), 0);
+    /* Woken right away, one empty bucket up to now */
+    CHECK_EQ(read_back(&sleep, 15, buckets, 1), 1);
+    CHECK_EQ(buckets[0].pulses, 0);
+    CHECK_EQ(buckets[0].end_ms, ENTERED_MS + 15);
+}
+
+int main(void) {
+    RUN(test_ulp_model);
+    RUN(test_short_sleep);
+    RUN(test_bucket_cap);
+    RUN(test_total_wrap);
+    RUN(test_edge_carry);
+    RUN(test_no_sleep);
+    return TEST_RESULT();
+}
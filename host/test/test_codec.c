@@ -0,0 +1,394 @@
+/* SampleBatchV2 round trip: batches built with codec_batch_add and finished are decoded the way the
+ * backend reads them, every field of every sample must come back within the 1/1000 quantization */
+#include <string.h>
+
+#include "pb_encode.h"
+#include "pb_decode.h"
+#include "codec.h"
+#include "test.h"
+
+#define BATCH_SAMPLES 30
+#define QUANT (0.5 / CODEC_QUANT_SCALE + 1e-6)
+
+typedef struct {
+    int64_t values[BATCH_SAMPLES * CODEC_CHANNELS_MAX];
+    size_t count;
+    bool zigzag;
+} column_t;
+
+typedef struct {
+    uint64_t base_timestamp;
+    uint32_t interval_ms;
+    column_t pressure, flow, jitter, pressure_min, pressure_max, pressure_stddev, channels, drip_flow;
+} decoded_t;
+
+static uint8_t arena[2048];
+static uint8_t buffer[2048];
+
+/* Called once per packed value */
+static bool decode_value(pb_istream_t* stream, const pb_field_t* field, void** arg) {
+    (void)field;
+    column_t* column = *arg;
+    if (column->count == sizeof(column->values) / sizeof(column->values[0])) {
+        return false;
+    }
+    if (column->zigzag) {
+        return pb_decode_svarint(stream, &column->values[column->count++]);
+    }
+    uint64_t value;
+    if (!pb_decode_varint(stream, &value)) {
+        return false;
+    }
+    column->values[column->count++] = (int64_t)value;
+    return true;
+}
+
+static void bind(pb_callback_t* callback, column_t* column, bool zigzag) {
+    column->zigzag = zigzag;
+    callback->funcs.decode = decode_value;
+    callback->arg = column;
+}
+
+static bool decode(const uint8_t* data, size_t len, decoded_t* out) {
+    SampleBatchV2 message = SampleBatchV2_init_zero;
+    memset(out, 0, sizeof(*out));
+    bind(&message.pressure, &out->pressure, true);
+    bind(&message.flow, &out->flow, true);
+    bind(&message.timestamp_jitter, &out->jitter, true);
+    bind(&message.pressure_min, &out->pressure_min, false);
+    bind(&message.pressure_max, &out->pressure_max, false);
+    bind(&message.pressure_stddev, &out->pressure_stddev, false);
+    bind(&message.channels, &out->channels, true);
+    bind(&message.drip_flow, &out->drip_flow, false);
+
+    pb_istream_t stream = pb_istream_from_buffer(data, len);
+    if (!pb_decode(&stream, SampleBatchV2_fields, &message)) {
+        return false;
+    }
+    out->base_timestamp = message.base_timestamp;
+    out->interval_ms = message.interval_ms;
+    return true;
+}
+
+/* Reconstructs sample i from the deltas, like the backend */
+static void sample_at(const decoded_t* d, size_t i, Sample* s) {
+    int64_t pressure = 0, flow = 0;
+    for (size_t j = 0; j <= i; ++j) {
+        pressure += d->pressure.values[j];
+        flow += d->flow.values[j];
+    }
+    memset(s, 0, sizeof(*s));
+    s->timestamp = d->base_timestamp + i * d->interval_ms + (d->jitter.count > 0 ? d->jitter.values[i] : 0);
+    s->pressure = (float)pressure / CODEC_QUANT_SCALE;
+    s->flow = (float)flow / CODEC_QUANT_SCALE;
+    if (d->drip_flow.count > 0 && d->drip_flow.values[i] > 0) {
+        s->flow = (float)d->drip_flow.values[i] / CODEC_DRIP_SCALE;
+    }
+    if (d->pressure_min.count > 0) {
+        s->pressure_min = s->pressure - (float)d->pressure_min.values[i] / CODEC_QUANT_SCALE;
+        s->pressure_max = s->pressure + (float)d->pressure_max.values[i] / CODEC_QUANT_SCALE;
+        s->pressure_stddev = (float)d->pressure_stddev.values[i] / CODEC_QUANT_SCALE;
+    }
+
+    size_t samples = d->pressure.count;
+    size_t channels = samples > 0 ? d->channels.count / samples : 0;
+    s->channels_count = channels;
+    for (size_t c = 0; c < channels; ++c) {
+        int64_t value = 0;
+        for (size_t j = 0; j <= i; ++j) {
+            value += d->channels.values[c * samples + j];
+        }
+        s->channels[c] = (float)value / CODEC_QUANT_SCALE;
+    }
+}
+
+static Sample make_sample(uint64_t timestamp, size_t i, size_t channels, bool stats) {
+    Sample s = Sample_init_zero;
+    s.timestamp = timestamp;
+    s.pressure = 0.3f + 0.05f * sinf(i * 0.7f);
+    s.flow = i % 7 == 0 ? 0.0f : 0.4f + 0.001f * i;
+    if (stats) {
+        s.has_pressure_min = s.has_pressure_max = s.has_pressure_stddev = true;
+        s.pressure_min = s.pressure - 0.004f - 0.001f * (i % 3);
+        s.pressure_max = s.pressure + 0.006f;
+        s.pressure_stddev = 0.002f;
+    }
+    s.channels_count = channels;
+    for (size_t c = 0; c < channels; ++c) {
+        s.channels[c] = 0.1f * c + 0.01f * i;
+    }
+    return s;
+}
+
+/* Builds a batch, finishes and decodes it and compares every sample */
+static void round_trip(const Sample* samples, size_t count, decoded_t* d) {
+    codec_batch_t batch;
+    codec_batch_init(&batch, arena, sizeof(arena));
+    for (size_t i = 0; i < count; ++i) {
+        CHECK(codec_batch_add(&batch, &samples[i]));
+    }
+
+    size_t len = codec_batch_finish(&batch, buffer, sizeof(buffer));
+    CHECK(len > 0);
+    CHECK(len <= sizeof(arena));
+    CHECK(decode(buffer, len, d));
+    CHECK_EQ(d->pressure.count, count);
+    CHECK_EQ(d->flow.count, count);
+
+    for (size_t i = 0; i < count && i < d->pressure.count; ++i) {
+        Sample s;
+        sample_at(d, i, &s);
+        CHECK_EQ(s.timestamp, samples[i].timestamp);
+        CHECK_NEAR(s.pressure, samples[i].pressure, QUANT);
+        CHECK_NEAR(s.flow, samples[i].flow, QUANT);
+        if (samples[i].has_pressure_min && d->pressure_min.count > 0) {
+            CHECK_NEAR(s.pressure_min, samples[i].pressure_min, 2 * QUANT);
+            CHECK_NEAR(s.pressure_max, samples[i].pressure_max, 2 * QUANT);
+            CHECK_NEAR(s.pressure_stddev, samples[i].pressure_stddev, QUANT);
+        }
+        if (d->channels.count > 0) {
+            CHECK_EQ(s.channels_count, samples[i].channels_count);
+            for (size_t c = 0; c < s.channels_count; ++c) {
+                CHECK_NEAR(s.channels[c], samples[i].channels[c], QUANT);
+            }
+        }
+    }
+}
+
+static void test_even_spacing(void) {
+    Sample samples[BATCH_SAMPLES];
+    for (size_t i = 0; i < BATCH_SAMPLES; ++i) {
+        samples[i] = make_sample(1700000000000ull + i * 1000, i, 0, false);
+    }
+
+    decoded_t d;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.base_timestamp, samples[0].timestamp);
+    CHECK_EQ(d.interval_ms, 1000);
+    /* Evenly spaced batches carry no jitter, samples without spread no spread columns */
+    CHECK_EQ(d.jitter.count, 0);
+    CHECK_EQ(d.pressure_min.count, 0);
+    CHECK_EQ(d.channels.count, 0);
+}
+
+static void test_jitter(void) {
+    static const int offsets[] = { 0, 3, -2, 40, 0, -7, 1, 0, 0, 250 };
+    Sample samples[10];
+    for (size_t i = 0; i < 10; ++i) {
+        samples[i] = make_sample(5000 + i * 2000 + offsets[i], i, 0, false);
+    }
+
+    decoded_t d;
+    round_trip(samples, 10, &d);
+    CHECK_EQ(d.jitter.count, 10);
+}
+
+static void test_single_sample(void) {
+    Sample sample = make_sample(42, 3, 0, false);
+    decoded_t d;
+    round_trip(&sample, 1, &d);
+    CHECK_EQ(d.interval_ms, 0);
+}
+
+static void test_pressure_spread(void) {
+    Sample samples[BATCH_SAMPLES];
+    for (size_t i = 0; i < BATCH_SAMPLES; ++i) {
+        samples[i] = make_sample(1000 + i * 500, i, 0, true);
+    }
+
+    decoded_t d;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.pressure_min.count, BATCH_SAMPLES);
+    CHECK_EQ(d.pressure_max.count, BATCH_SAMPLES);
+    CHECK_EQ(d.pressure_stddev.count, BATCH_SAMPLES);
+
+    /* One sample without the spread drops the columns of the whole batch */
+    samples[5].has_pressure_min = samples[5].has_pressure_max = samples[5].has_pressure_stddev = false;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.pressure_min.count, 0);
+}
+
+static void test_channels(void) {
+    Sample samples[BATCH_SAMPLES];
+    for (size_t i = 0; i < BATCH_SAMPLES; ++i) {
+        samples[i] = make_sample(1000 + i * 1000, i, 4, false);
+    }
+
+    decoded_t d;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.channels.count, 4 * BATCH_SAMPLES);
+
+    /* Channels are only carried if every sample has the same count */
+    samples[7].channels_count = 2;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.channels.count, 0);
+}
+
+static void test_drip_flow(void) {
+    Sample samples[BATCH_SAMPLES];
+    for (size_t i = 0; i < BATCH_SAMPLES; ++i) {
+        samples[i] = make_sample(1000 + i * 1000, i, 0, false);
+        samples[i].flow = 0;
+    }
+
+    decoded_t d;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.drip_flow.count, 0);
+
+    /* A drip below the flow resolution survives in its own column */
+    samples[3].flow = 0.00025f;
+    samples[4].flow = 0.0004f;
+    round_trip(samples, BATCH_SAMPLES, &d);
+    CHECK_EQ(d.drip_flow.count, BATCH_SAMPLES);
+    Sample s;
+    sample_at(&d, 3, &s);
+    CHECK_NEAR(s.flow, 0.00025f, 1e-6);
+    sample_at(&d, 4, &s);
+    CHECK_NEAR(s.flow, 0.0004f, 1e-6);
+    sample_at(&d, 5, &s);
+    CHECK_EQ(s.flow, 0);
+}
+
+static void test_capacity(void) {
+    static uint8_t small[128];
+    codec_batch_t batch;
+    codec_batch_init(&batch, small, sizeof(small));
+
+    size_t added = 0;
+    for (size_t i = 0; i < 1000; ++i) {
+        Sample s = make_sample(i * 1000, i, 2, true);
+        if (!codec_batch_add(&batch, &s)) {
+            break;
+        }
+        added++;
+    }
+    CHECK(added > 0);
+    CHECK(added < 1000);
+
+    /* The encoded batch fits a buffer of the arena's size */
+    CHECK(codec_batch_finish(&batch, buffer, sizeof(small)) > 0);
+}
+
+static void test_out_of_order(void) {
+    codec_batch_t batch;
+    codec_batch_init(&batch, arena, sizeof(arena));
+    Sample a = make_sample(2000, 0, 0, false);
+    Sample b = make_sample(1000, 1, 0, false);
+    CHECK(codec_batch_add(&batch, &a));
+    CHECK(!codec_batch_add(&batch, &b));
+    CHECK_EQ(batch.count, 1);
+}
+
+static void test_shift_and_rebase(void) {
+    Sample samples[5];
+    for (size_t i = 0; i < 5; ++i) {
+        samples[i] = make_sample(10000 + i * 1000, i, 0, false);
+    }
+
+    codec_batch_t batch;
+    codec_batch_init(&batch, arena, sizeof(arena));
+    for (size_t i = 0; i < 5; ++i) {
+        codec_batch_add(&batch, &samples[i]);
+    }
+    codec_batch_shift(&batch, 1700000000000ll);
+    size_t len = codec_batch_finish(&batch, buffer, sizeof(buffer));
+
+    decoded_t d;
+    CHECK(decode(buffer, len, &d));
+    CHECK_EQ(d.base_timestamp, 1700000010000ull);
+
+    static uint8_t rebased[2048];
+    size_t rebased_len = codec_batch_rebase(buffer, len, -1700000000000ll, rebased, sizeof(rebased));
+    CHECK(rebased_len > 0);
+    CHECK(decode(rebased, rebased_len, &d));
+    CHECK_EQ(d.base_timestamp, 10000);
+    CHECK_EQ(d.interval_ms, 1000);
+    CHECK_EQ(d.pressure.count, 5);
+
+    CHECK(!codec_is_summary_batch(buffer, len));
+    CHECK_EQ(codec_batch_rebase(buffer, 0, 0, rebased, sizeof(rebased)), 0);
+}
+
+static void test_summary_batch(void) {
+    SampleSummaryBatch summaries = SampleSummaryBatch_init_zero;
+    summaries.summaries_count = 1;
+    summaries.summaries[0].timestamp = 1700000000000ull;
+    summaries.summaries[0].count = 60;
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    CHECK(pb_encode(&stream, SampleSummaryBatch_fields, &summaries));
+    CHECK(codec_is_summary_batch(buffer, stream.bytes_written));
+}
+
+/* An event record is the events field of a SampleBatchBundle, told apart from stored batches and summaries */
+static void test_event_record(void) {
+    LeakEvent event = { .type = LeakEventType_NIGHT_FLOW, .timestamp = 1700000000000ull, .value = 0.02f, .baseline = 0.005f };
+    uint8_t record[CODEC_EVENT_RECORD_HEADER + LeakEvent_size];
+    size_t len = codec_event_record(&event, record, sizeof(record));
+    CHECK(len > CODEC_EVENT_RECORD_HEADER);
+    CHECK(codec_is_event_record(record, len));
+    CHECK(!codec_is_summary_batch(record, len));
+
+    pb_istream_t in = pb_istream_from_buffer(record, len);
+    pb_wire_type_t wire_type;
+    uint32_t tag;
+    bool eof;
+    CHECK(pb_decode_tag(&in, &wire_type, &tag, &eof));
+    CHECK_EQ(tag, SampleBatchBundle_events_tag);
+    CHECK_EQ(wire_type, PB_WT_STRING);
+
+    LeakEvent decoded = LeakEvent_init_zero;
+    pb_istream_t payload = pb_istream_from_buffer(record + CODEC_EVENT_RECORD_HEADER, len - CODEC_EVENT_RECORD_HEADER);
+    CHECK(pb_decode(&payload, LeakEvent_fields, &decoded));
+    CHECK_EQ(decoded.type, LeakEventType_NIGHT_FLOW);
+    CHECK_EQ(decoded.timestamp, event.timestamp);
+    CHECK_NEAR(decoded.value, event.value, 1e-6);
+
+    /* Neither a finished batch nor a truncated record passes for an event */
+    codec_batch_t batch;
+    codec_batch_init(&batch, arena, sizeof(arena));
+    Sample s = make_sample(1700000000000ull, 0, 0, false);
+    CHECK(codec_batch_add(&batch, &s));
+    size_t batch_len = codec_batch_finish(&batch, buffer, sizeof(buffer));
+    CHECK(!codec_is_event_record(buffer, batch_len));
+    CHECK(!codec_is_event_record(record, len - 1));
+    CHECK_EQ(codec_event_record(&event, record, CODEC_EVENT_RECORD_HEADER + 3), 0);
+}
+
+static void test_transient(void) {
+    float pressure[100];
+    for (size_t i = 0; i < 100; ++i) {
+        pressure[i] = 0.3f + (i > 50 ? 0.2f : 0.0f) + 0.0003f * (i % 5);
+    }
+
+    uint8_t blob[512];
+    size_t len = codec_transient_encode(pressure, 100, blob, sizeof(blob));
+    CHECK(len > 0);
+
+    pb_istream_t in = pb_istream_from_buffer(blob, len);
+    int64_t value = 0;
+    for (size_t i = 0; i < 100; ++i) {
+        int64_t delta;
+        CHECK(pb_decode_svarint(&in, &delta));
+        value += delta;
+        CHECK_NEAR((float)value / CODEC_TRANSIENT_SCALE, pressure[i], 0.5 / CODEC_TRANSIENT_SCALE + 1e-6);
+    }
+    CHECK_EQ(in.bytes_left, 0);
+    CHECK_EQ(codec_transient_encode(pressure, 100, blob, 4), 0);
+}
+
+int main(void) {
+    RUN(test_even_spacing);
+    RUN(test_jitter);
+    RUN(test_single_sample);
+    RUN(test_pressure_spread);
+    RUN(test_channels);
+    RUN(test_drip_flow);
+    RUN(test_capacity);
+    RUN(test_out_of_order);
+    RUN(test_shift_and_rebase);
+    RUN(test_summary_batch);
+    RUN(test_event_record);
+    RUN(test_transient);
+    return TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+/* Replays synthetic day traces of 1 s samples through detect.c with the default config, and checks which
+ * events come out and when. */
+#include <math.h>
+
+#include "detect.h"
+#include "test.h"
+
+/* 2024-06-01 00:00:00 UTC */
+#define DAY0_MS 1717200000000ull
+#define DAY_S 86400
+#define EVENTS_MAX 16
+
+#define LINE_PRESSURE 0.30f
+#define IRRIGATION_FLOW 0.4f
+
+typedef void (*trace_t)(uint32_t t_s, float* flow, float* pressure);
+
+static detect_event_t events[EVENTS_MAX];
+
+static uint32_t at(uint32_t hour, uint32_t minute, uint32_t second) {
+    return hour * 3600 + minute * 60 + second;
+}
+
+static uint64_t timestamp_of(uint32_t t_s) {
+    return DAY0_MS + (uint64_t)t_s * 1000;
+}
+
+/* A few thousandths of pressure noise, reproducible */
+static float pressure_noise(uint32_t t_s) {
+    return 0.002f * sinf(t_s * 0.7f) * cosf(t_s * 0.13f);
+}
+
+static size_t replay(trace_t trace, uint32_t seconds) {
+    detect_config_t config = DETECT_CONFIG_DEFAULT;
+    detect_t detect;
+    size_t count = 0;
+
+    detect_init(&detect, &config);
+    for (uint32_t t = 0; t < seconds; ++t) {
+        float flow, pressure;
+        trace(t, &flow, &pressure);
+        detect_event_t event;
+        if (detect_update(&detect, timestamp_of(t), flow, pressure, &event) && count < EVENTS_MAX) {
+            events[count++] = event;
+        }
+    }
+    return count;
+}
+
+/* Closed all night, one 30 minute irrigation run at 06:00 with the line pressure sagging while it runs, and
+ * the household draws of a day: a 6 L/min tap for 2 minutes three times, a 10 minute shower */
+static void irrigation_day(uint32_t t, float* flow, float* pressure) {
+    bool running = t >= at(6, 0, 0) && t < at(6, 30, 0);
+    bool tap = (t >= at(7, 15, 0) && t < at(7, 17, 0)) || (t >= at(12, 0, 0) && t < at(12, 2, 0)) ||
+               (t >= at(18, 40, 0) && t < at(18, 42, 0));
+    bool shower = t >= at(21, 0, 0) && t < at(21, 10, 0);
+    *flow = running ? IRRIGATION_FLOW : tap ? 0.2f : shower ? 0.3f : 0;
+    *pressure = (running || tap || shower ? LINE_PRESSURE - 0.05f : LINE_PRESSURE) + pressure_noise(t);
+}
+
+/* A 0.02 leak opens at 01:00 and keeps running */
+static void leak_night(uint32_t t, float* flow, float* pressure) {
+    *flow = t >= at(1, 0, 0) ? 0.02f : 0;
+    *pressure = LINE_PRESSURE + pressure_noise(t);
+}
+
+/* Nothing flows through the meter, the closed line loses 0.004 a minute from 00:30 */
+static void pressure_leak(uint32_t t, float* flow, float* pressure) {
+    *flow = 0;
+    *pressure = LINE_PRESSURE + pressure_noise(t);
+    if (t >= at(0, 30, 0)) {
+        *pressure -= 0.004f * (t - at(0, 30, 0)) / 60;
+    }
+}
+
+/* A normal day has no event: every draw ends before cusum_min_ms, and the line holds its pressure */
+static void test_irrigation_day(void) {
+    CHECK_EQ(replay(irrigation_day, DAY_S), 0);
+}
+
+/* The same irrigation run going on for longer than cusum_min_ms is reported once it did */
+static void long_run(uint32_t t, float* flow, float* pressure) {
+    *flow = t >= at(6, 0, 0) && t < at(9, 0, 0) ? IRRIGATION_FLOW : 0;
+    *pressure = LINE_PRESSURE - 0.05f + pressure_noise(t);
+}
+
+static void test_long_run(void) {
+    detect_config_t config = DETECT_CONFIG_DEFAULT;
+    size_t n = replay(long_run, at(12, 0, 0));
+
+    CHECK_EQ(n, 1);
+    CHECK_EQ(events[0].type, DETECT_EVENT_FLOW_CUSUM);
+    CHECK_EQ(events[0].timestamp, timestamp_of(at(6, 0, 0)) + config.cusum_min_ms);
+}
+
+/* The leak is flagged by the CUSUM cusum_min_ms after it opens, the baseline stays where it was before it
+ * meanwhile, and by the night minimum when the window ends */
+static void test_leak_night(void) {
+    detect_config_t config = DETECT_CONFIG_DEFAULT;
+    size_t n = replay(leak_night, at(6, 0, 0));
+
+    CHECK_EQ(n, 2);
+    CHECK_EQ(events[0].type, DETECT_EVENT_FLOW_CUSUM);
+    CHECK_EQ(events[0].timestamp, timestamp_of(at(1, 0, 0)) + config.cusum_min_ms);
+    CHECK(events[0].baseline < 0.001f);
+    CHECK_NEAR(events[0].value, (0.02 - config.cusum_slack) * config.cusum_min_ms / 1000, 1);
+
+    CHECK_EQ(events[1].type, DETECT_EVENT_NIGHT_FLOW);
+    CHECK_EQ(events[1].timestamp, timestamp_of(at(4, 0, 0)));
+    CHECK_NEAR(events[1].value, 0.02, 1e-6);
+}
+
+/* Decay windows of 10 minutes run back to back from the first closed sample, the first one that sees
+ * the drop reports it. The leak starts on a window boundary. */
+static void test_pressure_leak(void) {
+    size_t n = replay(pressure_leak, at(1, 0, 0));
+
+    CHECK(n > 0);
+    CHECK_EQ(events[0].type, DETECT_EVENT_PRESSURE_DECAY);
+    CHECK_EQ(events[0].timestamp, timestamp_of(at(0, 40, 0)));
+    CHECK_NEAR(events[0].value, 0.04, 0.005);
+    CHECK_NEAR(events[0].baseline, LINE_PRESSURE, 0.005);
+    /* Every following window reports again */
+    CHECK_EQ(n, 2);
+    CHECK_EQ(events[1].type, DETECT_EVENT_PRESSURE_DECAY);
+    CHECK_EQ(events[1].timestamp, timestamp_of(at(0, 50, 0)));
+}
+
+/* Below the pressurized minimum the decay detector stays quiet */
+static void drained_line(uint32_t t, float* flow, float* pressure) {
+    *flow = 0;
+    *pressure = 0.04f - 0.00001f * t;
+}
+
+static void test_drained_line(void) {
+    CHECK_EQ(replay(drained_line, at(1, 0, 0)), 0);
+}
+
+int main(void) {
+    RUN(test_irrigation_day);
+    RUN(test_long_run);
+    RUN(test_leak_night);
+    RUN(test_pressure_leak);
+    RUN(test_drained_line);
+    return TEST_RESULT();
+}
@@ -0,0 +1,220 @@
+/* filter.c kernels, and synthetic pressure traces through the reduction the filter task applies to every
+ * DMA frame: boxcar decimation by CONFIG_PRESSURE_SENSOR_DECIMATION, the median of the decimated values,
+ * and the interval stats over the frame medians. */
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "filter.h"
+#include "test.h"
+
+/* As in sensors.c, one analog channel gets the whole frame */
+#define FRAME_RESULTS 256
+#define DECIMATION CONFIG_PRESSURE_SENSOR_DECIMATION
+#define BLOCKS (FRAME_RESULTS / DECIMATION)
+#define FRAMES_PER_S (CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ / FRAME_RESULTS)
+#define ADC_MAX 4095
+
+static uint32_t noise_state;
+
+/* Uniform in [-amplitude, amplitude], reproducible */
+static int noise(int amplitude) {
+    noise_state = noise_state * 1664525u + 1013904223u;
+    return amplitude > 0 ? (int)(noise_state >> 8) % (2 * amplitude + 1) - amplitude : 0;
+}
+
+static uint16_t clamp_code(int code) {
+    return code < 0 ? 0 : code > ADC_MAX ? ADC_MAX : (uint16_t)code;
+}
+
+/* The filter task's reduction of one channel's frame */
+static float frame_reduce(const uint16_t* codes, size_t n) {
+    float decimated[BLOCKS];
+    size_t m = filter_boxcar_decimate(codes, n, DECIMATION, decimated);
+    return filter_median(decimated, m);
+}
+
+static void frame_fill(uint16_t* codes, int level, int noise_amplitude) {
+    for (size_t i = 0; i < FRAME_RESULTS; ++i) {
+        codes[i] = clamp_code(level + noise(noise_amplitude));
+    }
+}
+
+static void test_boxcar(void) {
+    const uint16_t in[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    float out[3];
+
+    CHECK_EQ(filter_boxcar_decimate(in, 8, 3, out), 2);
+    CHECK_NEAR(out[0], 2.0, 1e-6);
+    CHECK_NEAR(out[1], 5.0, 1e-6);
+
+    CHECK_EQ(filter_boxcar_decimate(in, 2, 3, out), 0);
+    CHECK_EQ(filter_boxcar_decimate(in, 8, 1, out), 8);
+
+    /* A full frame of full scale codes does not overflow the sum */
+    uint16_t codes[FRAME_RESULTS];
+    float decimated[1];
+    frame_fill(codes, ADC_MAX, 0);
+    CHECK_EQ(filter_boxcar_decimate(codes, FRAME_RESULTS, FRAME_RESULTS, decimated), 1);
+    CHECK_NEAR(decimated[0], ADC_MAX, 1e-3);
+}
+
+static void test_median(void) {
+    float odd[] = { 5, 1, 4, 2, 3 };
+    float even[] = { 8, 1, 7, 2 };
+    float one[] = { 42 };
+
+    CHECK_NEAR(filter_median(odd, 5), 3.0, 1e-6);
+    CHECK_NEAR(filter_median(even, 4), 4.5, 1e-6);
+    CHECK_NEAR(filter_median(one, 1), 42.0, 1e-6);
+    CHECK(isnan(filter_median(one, 0)));
+    /* Sorted in place */
+    CHECK(odd[0] == 1 && odd[4] == 5);
+}
+
+static void test_stats(void) {
+    const float values[] = { 2, 4, 4, 4, 5, 5, 7, 9 };
+    filter_stats_t stats;
+
+    filter_stats_reset(&stats);
+    CHECK_EQ(stats.count, 0);
+    CHECK_NEAR(filter_stats_stddev(&stats), 0.0, 0);
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+        filter_stats_add(&stats, values[i]);
+    }
+    CHECK_EQ(stats.count, 8);
+    CHECK_NEAR(stats.mean, 5.0, 1e-6);
+    CHECK_NEAR(filter_stats_stddev(&stats), sqrt(32.0 / 7), 1e-5);
+    CHECK_NEAR(stats.min, 2.0, 0);
+    CHECK_NEAR(stats.max, 9.0, 0);
+
+    filter_stats_reset(&stats);
+    filter_stats_add(&stats, 3);
+    CHECK_NEAR(filter_stats_stddev(&stats), 0.0, 0);
+    CHECK_NEAR(stats.min, 3.0, 0);
+    CHECK_NEAR(stats.max, 3.0, 0);
+}
+
+/* One measurement interval of a steady level with conversion noise: the frame medians average it out */
+static void test_trace_noise(void) {
+    const int level = 2000, amplitude = 40;
+    uint16_t codes[FRAME_RESULTS];
+    filter_stats_t stats;
+
+    noise_state = 1;
+    filter_stats_reset(&stats);
+    for (int f = 0; f < FRAMES_PER_S; ++f) {
+        frame_fill(codes, level, amplitude);
+        filter_stats_add(&stats, frame_reduce(codes, FRAME_RESULTS));
+    }
+
+    /* Uniform noise of +-40 codes has a stddev of 23 codes per conversion */
+    CHECK_EQ(stats.count, FRAMES_PER_S);
+    CHECK_NEAR(stats.mean, level, 1.0);
+    CHECK(filter_stats_stddev(&stats) < 4.0f);
+    CHECK(stats.min > level - 10 && stats.max < level + 10);
+}
+
+/* Single conversion spikes, to full scale or to zero, are rejected while they hit fewer than half of the
+ * boxcar blocks of a frame. A plain frame average would move by 8 codes per spike. */
+static void test_spike_rejection(void) {
+    const int level = 2000;
+    uint16_t codes[FRAME_RESULTS];
+
+    for (int spikes = 0; spikes < BLOCKS / 2; ++spikes) {
+        frame_fill(codes, level, 0);
+        for (int s = 0; s < spikes; ++s) {
+            codes[s * DECIMATION + s % DECIMATION] = s % 2 ? ADC_MAX : 0;
+        }
+        CHECK_NEAR(frame_reduce(codes, FRAME_RESULTS), level, 0);
+    }
+
+    /* All spikes upwards, one block short of half */
+    frame_fill(codes, level, 0);
+    for (int s = 0; s < BLOCKS / 2 - 1; ++s) {
+        codes[s * DECIMATION] = ADC_MAX;
+    }
+    CHECK_NEAR(frame_reduce(codes, FRAME_RESULTS), level, 0);
+
+    /* Half of the blocks hit, the median is the midpoint of a clean and a spiked block */
+    codes[(BLOCKS / 2 - 1) * DECIMATION] = ADC_MAX;
+    CHECK_NEAR(frame_reduce(codes, FRAME_RESULTS), level + (ADC_MAX - level) / (2.0 * DECIMATION), 1e-3);
+
+    /* Spikes on top of noise still leave the interval mean where it was */
+    filter_stats_t stats;
+    noise_state = 2;
+    filter_stats_reset(&stats);
+    for (int f = 0; f < FRAMES_PER_S; ++f) {
+        frame_fill(codes, level, 20);
+        for (int s = 0; s < 3; ++s) {
+            codes[(f * 5 + s * 71) % FRAME_RESULTS] = ADC_MAX;
+        }
+        filter_stats_add(&stats, frame_reduce(codes, FRAME_RESULTS));
+    }
+    CHECK_NEAR(stats.mean, level, 1.5);
+    CHECK(stats.max < level + 10);
+}
+
+/* A step from low to high at every conversion of a frame: the frames before report low, the frames after
+ * high, the frame holding the step switches once most of its blocks are past it. The output lags the
+ * input by at most one frame, 12.8 ms at 20 kHz. */
+static void test_step_response(void) {
+    const int low = 1000, high = 3000;
+    uint16_t codes[FRAME_RESULTS];
+    float previous = high;
+
+    for (int at = 0; at < FRAME_RESULTS; ++at) {
+        frame_fill(codes, low, 0);
+        CHECK_NEAR(frame_reduce(codes, FRAME_RESULTS), low, 0);
+
+        for (int i = 0; i < FRAME_RESULTS; ++i) {
+            codes[i] = i < at ? low : high;
+        }
+        float stepped = frame_reduce(codes, FRAME_RESULTS);
+        CHECK(stepped >= low && stepped <= high);
+        /* Later steps never read higher */
+        CHECK(stepped <= previous);
+        previous = stepped;
+        if (at <= (BLOCKS / 2 - 1) * DECIMATION) {
+            CHECK_NEAR(stepped, high, 0);
+        }
+        if (at >= (BLOCKS / 2 + 1) * DECIMATION) {
+            CHECK_NEAR(stepped, low, 0);
+        }
+
+        frame_fill(codes, high, 0);
+        CHECK_NEAR(frame_reduce(codes, FRAME_RESULTS), high, 0);
+    }
+
+    /* Over a measurement interval the mean follows the share of frames after the step */
+    filter_stats_t stats;
+    filter_stats_reset(&stats);
+    for (int f = 0; f < FRAMES_PER_S; ++f) {
+        frame_fill(codes, f < FRAMES_PER_S / 2 ? low : high, 0);
+        filter_stats_add(&stats, frame_reduce(codes, FRAME_RESULTS));
+    }
+    int after = FRAMES_PER_S - FRAMES_PER_S / 2;
+    CHECK_NEAR(stats.mean, low + (double)(high - low) * after / FRAMES_PER_S, 1e-2);
+    CHECK_NEAR(stats.min, low, 0);
+    CHECK_NEAR(stats.max, high, 0);
+}
+
+/* A linear ramp within a frame reads as its middle */
+static void test_ramp(void) {
+    uint16_t codes[FRAME_RESULTS];
+    for (int i = 0; i < FRAME_RESULTS; ++i) {
+        codes[i] = (uint16_t)(1000 + i * 2);
+    }
+    CHECK_NEAR(frame_reduce(codes, FRAME_RESULTS), 1000 + (FRAME_RESULTS - 1), 1e-3);
+}
+
+int main(void) {
+    RUN(test_boxcar);
+    RUN(test_median);
+    RUN(test_stats);
+    RUN(test_trace_noise);
+    RUN(test_spike_rejection);
+    RUN(test_step_response);
+    RUN(test_ramp);
+    return TEST_RESULT();
+}
@@ -0,0 +1,187 @@
+/* Simulated pulse trains of a flow meter through pulse_rate.c: constant flows from 0.01 to 30 L/min read in
+ * 1 s windows, edges timestamped with interrupt latency, the estimate against the true pulse rate. */
+#include <math.h>
+
+#include "pulse_rate.h"
+#include "sdkconfig.h"
+#include "test.h"
+
+#define WINDOW_US 1000000
+#define TIMEOUT_MS (CONFIG_FLOW_PULSE_TIMEOUT_S * 1000)
+/* Interrupt latency of the edge timestamps, up to this much late */
+#define LATENCY_US 50
+#define MAX_FLOW_LPM 30.0f
+
+typedef struct {
+    float worst_error;          // relative, over the windows after the second pulse
+    uint32_t windows;
+    uint32_t counted;           // windows measured by count
+} sweep_t;
+
+static uint32_t noise_state = 1;
+
+static int64_t latency(void) {
+    noise_state = noise_state * 1664525u + 1013904223u;
+    return (noise_state >> 8) % (LATENCY_US + 1);
+}
+
+/* Runs a constant flow for at least duration_us and a few pulses, checking every window once the
+ * estimate has two pulses to go by */
+static sweep_t simulate(float pulses_per_liter, float lpm, int64_t duration_us) {
+    pulse_rate_config_t config = {
+        .count_min = pulse_rate_count_min(pulses_per_liter, MAX_FLOW_LPM, WINDOW_US / 1000),
+        .timeout_ms = TIMEOUT_MS,
+    };
+    pulse_rate_t rate;
+    pulse_rate_init(&rate, &config);
+
+    double period_us = 60e6 / (pulses_per_liter * lpm);
+    double true_rate = 1e6 / period_us;
+    if (duration_us < 4 * period_us) {
+        duration_us = (int64_t)(4 * period_us);
+    }
+
+    /* The first pulse comes a third of a period into the run, not on a window boundary */
+    double next_pulse = period_us / 3;
+    uint32_t pulses = 0;
+    sweep_t sweep = { 0 };
+
+    for (int64_t end = WINDOW_US; end <= duration_us; end += WINDOW_US) {
+        pulse_edges_t edges = { 0 };
+        uint32_t count = 0;
+        while (next_pulse <= end) {
+            /* Late timestamps stay in order and in the window the counter saw them in */
+            int64_t at = (int64_t)next_pulse + latency();
+            at = at > end ? end : at;
+            at = edges.count > 0 && at < edges.last_us ? edges.last_us : at;
+            if (edges.count == 0) {
+                edges.first_us = at;
+            }
+            edges.last_us = at;
+            edges.count++;
+            count++;
+            pulses++;
+            next_pulse += period_us;
+        }
+
+        float estimate = pulse_rate_update(&rate, count, &edges, WINDOW_US, end);
+        if (pulses < 2) {
+            continue;
+        }
+        float error = fabsf(estimate - (float)true_rate) / (float)true_rate;
+        sweep.worst_error = error > sweep.worst_error ? error : sweep.worst_error;
+        sweep.windows++;
+        sweep.counted += config.count_min > 0 && count >= config.count_min;
+    }
+    return sweep;
+}
+
+/* Flows from the floor to full scale, 20 per decade */
+static void sweep(float pulses_per_liter, float floor_lpm, float max_error, uint32_t* counted) {
+    *counted = 0;
+    for (float lpm = floor_lpm; lpm <= MAX_FLOW_LPM * 1.0001f; lpm *= powf(10, 1 / 20.0f)) {
+        sweep_t s = simulate(pulses_per_liter, lpm, 60 * (int64_t)WINDOW_US);
+        CHECK(s.windows > 0);
+        if (s.worst_error > max_error) {
+            fprintf(stderr, "%.1f pulses/L at %.4f L/min: error %.4f\n", pulses_per_liter, lpm, s.worst_error);
+        }
+        CHECK(s.worst_error <= max_error);
+        *counted += s.counted;
+    }
+}
+
+/* The 1% count is out of reach of a slow meter in a 1 s window, a fast one gets there at high flow */
+static void test_count_min(void) {
+    CHECK_EQ(pulse_rate_count_min(6.6f, 30, 1000), 0);
+    CHECK_EQ(pulse_rate_count_min(6.6f, 30, 10000), 0);
+    CHECK_EQ(pulse_rate_count_min(450, 30, 1000), PULSE_RATE_COUNT_PULSES);
+    CHECK_EQ(pulse_rate_count_min(450, 30, 100), 0);
+}
+
+/* The default meter from one pulse per timeout up to 30 L/min, all by period. One pulse per timeout is
+ * 0.0101 L/min, 0.01 itself reads as no flow. */
+static void test_default_meter(void) {
+    const float ppl = 6.6f;
+    float floor_lpm = 60000.0f / TIMEOUT_MS / ppl * 1.01f;
+    uint32_t counted;
+    sweep(ppl, floor_lpm, 0.001f, &counted);
+    CHECK_EQ(counted, 0);
+
+    sweep_t below = simulate(ppl, 0.01f, 0);
+    CHECK(below.worst_error == 1.0f);
+}
+
+/* A 450 pulses per liter hall meter switches to the count at 100 pulses a second, 13.3 L/min, the count is
+ * within 1% from there on */
+static void test_fast_meter(void) {
+    uint32_t counted;
+    sweep(450, 0.01f, 0.01f, &counted);
+    CHECK(counted > 0);
+
+    sweep_t below = simulate(450, 13.0f, 60 * (int64_t)WINDOW_US);
+    CHECK_EQ(below.counted, 0);
+    CHECK(below.worst_error < 0.001f);
+    sweep_t above = simulate(450, 14.0f, 60 * (int64_t)WINDOW_US);
+    CHECK_EQ(above.counted, above.windows);
+}
+
+/* After the flow stops the estimate decays with the time since the last pulse and is 0 two periods after it */
+static void test_stop(void) {
+    pulse_rate_config_t config = { .count_min = 0, .timeout_ms = TIMEOUT_MS };
+    pulse_rate_t rate;
+    pulse_rate_init(&rate, &config);
+
+    /* 2 pulses a second for 10 s, the last one at 9.75 s, then nothing */
+    for (int64_t end = WINDOW_US; end <= 10 * WINDOW_US; end += WINDOW_US) {
+        pulse_edges_t edges = { 2, end - 750000, end - 250000 };
+        pulse_rate_update(&rate, 2, &edges, WINDOW_US, end);
+    }
+    pulse_edges_t none = { 0 };
+    CHECK_NEAR(pulse_rate_update(&rate, 0, &none, WINDOW_US / 2, 10 * WINDOW_US + 500000), 1 / 0.75, 1e-4);
+    CHECK_EQ(pulse_rate_update(&rate, 0, &none, WINDOW_US / 2, 11 * WINDOW_US), 0);
+    CHECK_EQ(pulse_rate_update(&rate, 0, &none, WINDOW_US, 20 * WINDOW_US), 0);
+
+    /* The flow comes back slower within the timeout, the first edge measures the period from the last one */
+    pulse_edges_t back = { 1, 30 * WINDOW_US - 250000, 30 * WINDOW_US - 250000 };
+    CHECK_NEAR(pulse_rate_update(&rate, 1, &back, WINDOW_US, 30 * WINDOW_US), 1 / 20.0, 1e-4);
+}
+
+/* A drip of one pulse a minute reads 0 from two minutes after the last pulse, not after the 15 minute
+ * timeout, and its flow until then */
+static void test_drip_stop(void) {
+    pulse_rate_config_t config = { .count_min = 0, .timeout_ms = TIMEOUT_MS };
+    pulse_rate_t rate;
+    pulse_rate_init(&rate, &config);
+
+    int64_t last = 0;
+    for (int64_t end = WINDOW_US; end <= 600 * WINDOW_US; end += WINDOW_US) {
+        pulse_edges_t edges = { 0 };
+        uint32_t count = 0;
+        if (end % (60 * WINDOW_US) == 0) {
+            edges = (pulse_edges_t) { 1, end, end };
+            count = 1;
+            last = end;
+        }
+        float estimate = pulse_rate_update(&rate, count, &edges, WINDOW_US, end);
+        if (end > 120 * WINDOW_US) {
+            CHECK_NEAR(estimate, 1 / 60.0, 1e-5);
+        }
+    }
+    CHECK_EQ(last, 600 * WINDOW_US);
+
+    uint32_t nonzero = 0;
+    for (int64_t end = last + WINDOW_US; end <= last + 600 * WINDOW_US; end += WINDOW_US) {
+        pulse_edges_t none = { 0 };
+        nonzero += pulse_rate_update(&rate, 0, &none, WINDOW_US, end) > 0;
+    }
+    CHECK_EQ(nonzero, 2 * 60);
+}
+
+int main(void) {
+    RUN(test_count_min);
+    RUN(test_default_meter);
+    RUN(test_fast_meter);
+    RUN(test_stop);
+    RUN(test_drip_stop);
+    return TEST_RESULT();
+}
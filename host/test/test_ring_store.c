@@ -0,0 +1,265 @@
+/* ring_store on a simulated NOR flash. The power-cut tests run an append (or consume) with the power cut
+ * at every step it takes, one per byte programmed and one per erase, then remount and check that every
+ * record committed before is still pending with its content, and that no torn record is returned. */
+#include <string.h>
+
+#include "ring_store.h"
+#include "fake_flash.h"
+#include "test.h"
+
+#define SECTOR_SIZE 256
+#define SECTORS 4
+#define RECORDS_MAX 256
+/* Enough records to wrap the ring a few times */
+#define PRELOAD_MAX 48
+
+typedef struct {
+    uint32_t ids[RECORDS_MAX];
+    size_t count;
+} list_t;
+
+static uint8_t data[SECTOR_SIZE * SECTORS];
+static fake_flash_t flash;
+
+/* Record id of 4 bytes followed by a pattern of it, 20..59 bytes */
+static size_t make_record(uint32_t id, uint8_t* buffer) {
+    size_t len = 20 + (id * 7) % 40;
+    memcpy(buffer, &id, sizeof(id));
+    for (size_t i = sizeof(id); i < len; ++i) {
+        buffer[i] = (uint8_t)(id * 31 + i);
+    }
+    return len;
+}
+
+static bool append(ring_store_t* store, uint32_t id) {
+    uint8_t buffer[64];
+    size_t len = make_record(id, buffer);
+    return ring_store_append(store, buffer, len);
+}
+
+/* Reads every pending record, returns false if one does not match the content of its id */
+static bool read_all(const ring_store_t* store, list_t* list) {
+    ring_store_pos_t pos = store->read;
+    uint8_t buffer[SECTOR_SIZE];
+    uint8_t expected[64];
+    size_t len;
+
+    list->count = 0;
+    while (ring_store_peek(store, &pos, buffer, sizeof(buffer), &len)) {
+        uint32_t id;
+        if (len < sizeof(id) || list->count == RECORDS_MAX) {
+            return false;
+        }
+        memcpy(&id, buffer, sizeof(id));
+        if (len != make_record(id, expected) || memcmp(buffer, expected, len) != 0) {
+            return false;
+        }
+        list->ids[list->count++] = id;
+    }
+    return true;
+}
+
+/* after == before[dropped:] + extra */
+static bool list_is(const list_t* after, const list_t* before, size_t dropped, const uint32_t* extra, size_t extra_count) {
+    if (dropped > before->count || after->count != before->count - dropped + extra_count) {
+        return false;
+    }
+    for (size_t i = 0; i < before->count - dropped; ++i) {
+        if (after->ids[i] != before->ids[dropped + i]) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < extra_count; ++i) {
+        if (after->ids[before->count - dropped + i] != extra[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Fresh flash with records 0..preload-1 appended, the oldest half of the pending ones consumed if asked */
+static void prepare(ring_store_t* store, uint32_t preload, bool consume_half) {
+    fake_flash_init(&flash, data, sizeof(data), SECTOR_SIZE);
+    ring_store_flash_t ops = fake_flash_ops(&flash);
+    CHECK(ring_store_mount(store, &ops));
+    for (uint32_t id = 0; id < preload; ++id) {
+        CHECK(append(store, id));
+    }
+    if (consume_half) {
+        CHECK(ring_store_consume(store, store->pending / 2));
+    }
+}
+
+static bool remount(ring_store_t* store) {
+    fake_flash_power_on(&flash);
+    ring_store_flash_t ops = fake_flash_ops(&flash);
+    return ring_store_mount(store, &ops);
+}
+
+static void test_append_read_consume(void) {
+    ring_store_t store;
+    list_t list;
+    prepare(&store, 3, false);
+    CHECK_EQ(store.pending, 3);
+    CHECK(read_all(&store, &list));
+    CHECK_EQ(list.count, 3);
+    CHECK_EQ(list.ids[0], 0);
+    CHECK_EQ(list.ids[2], 2);
+
+    CHECK(ring_store_consume(&store, 2));
+    CHECK_EQ(store.pending, 1);
+    CHECK(remount(&store));
+    CHECK_EQ(store.pending, 1);
+    CHECK(read_all(&store, &list));
+    CHECK_EQ(list.count, 1);
+    CHECK_EQ(list.ids[0], 2);
+
+    /* Consuming more than is pending consumes all and reports it */
+    CHECK(!ring_store_consume(&store, 5));
+    CHECK_EQ(store.pending, 0);
+}
+
+static void test_wrap_drops_oldest(void) {
+    ring_store_t store;
+    list_t list;
+    prepare(&store, 100, false);
+
+    CHECK(store.dropped > 0);
+    CHECK_EQ(store.pending + store.dropped, 100);
+    CHECK(read_all(&store, &list));
+    CHECK_EQ(list.count, store.pending);
+    /* The newest records survive, in order */
+    CHECK_EQ(list.ids[list.count - 1], 99);
+    for (size_t i = 1; i < list.count; ++i) {
+        CHECK_EQ(list.ids[i], list.ids[i - 1] + 1);
+    }
+
+    uint32_t pending = store.pending;
+    CHECK(remount(&store));
+    CHECK_EQ(store.pending, pending);
+    CHECK(store.max_erase_count > 1);
+}
+
+static void test_limits(void) {
+    ring_store_t store;
+    prepare(&store, 1, false);
+
+    uint8_t big[SECTOR_SIZE] = { 0 };
+    size_t max = ring_store_max_record(&store);
+    CHECK(!ring_store_append(&store, big, max + 1));
+    CHECK(ring_store_append(&store, big, max));
+
+    /* A record larger than the peek buffer is reported as empty, it still counts towards consume */
+    ring_store_pos_t pos = store.read;
+    uint8_t small[8];
+    size_t len = 99;
+    CHECK(ring_store_peek(&store, &pos, small, sizeof(small), &len));
+    CHECK_EQ(len, 0);
+
+    ring_store_flash_t ops = fake_flash_ops(&flash);
+    ops.size = SECTOR_SIZE;
+    CHECK(!ring_store_mount(&store, &ops));
+}
+
+/* Appends the record after preload with the power cut at every step, see the top of the file */
+static void cut_append(uint32_t preload, bool consume_half) {
+    ring_store_t store;
+    list_t before, after;
+    const uint32_t id = preload;
+    const uint32_t next = preload + 1;
+
+    /* Reference run without a cut, for the records a full ring drops to make room */
+    prepare(&store, preload, consume_half);
+    CHECK(read_all(&store, &before));
+    uint32_t dropped = store.dropped;
+    CHECK(append(&store, id));
+    size_t ring_drop = store.dropped - dropped;
+
+    for (uint64_t cut = 0;; ++cut) {
+        prepare(&store, preload, consume_half);
+        fake_flash_cut_after(&flash, cut);
+        bool appended = append(&store, id);
+        bool finished = !flash.off;
+
+        bool mounted = remount(&store);
+        CHECK(mounted);
+        bool intact = read_all(&store, &after);
+        CHECK(intact);
+        CHECK_EQ(store.pending, after.count);
+
+        /* Nothing committed is lost, except the sector a full ring drops anyway. The record being
+         * appended is either complete or absent. */
+        bool kept = false;
+        for (size_t drop = 0; drop <= ring_drop && !kept; drop += ring_drop > 0 ? ring_drop : 1) {
+            kept = list_is(&after, &before, drop, NULL, 0) ||
+                   list_is(&after, &before, drop, &id, 1);
+        }
+        if (!kept || !mounted || !intact) {
+            fprintf(stderr, "preload %u%s, cut at step %llu: %zu records before, %zu after\n",
+                preload, consume_half ? " half consumed" : "", (unsigned long long)cut, before.count, after.count);
+        }
+        CHECK(kept);
+        if (finished) {
+            CHECK(appended);
+            CHECK(after.count > 0 && after.ids[after.count - 1] == id);
+        }
+
+        /* The store keeps working after the recovery */
+        list_t recovered = after;
+        CHECK(append(&store, next));
+        CHECK(remount(&store));
+        CHECK(read_all(&store, &after));
+        CHECK(after.count > 0 && after.ids[after.count - 1] == next);
+        CHECK(after.count <= recovered.count + 1);
+
+        if (finished || test_failures > 0) {
+            break;
+        }
+    }
+}
+
+static void test_power_cut_append(void) {
+    for (uint32_t preload = 0; preload <= PRELOAD_MAX && test_failures == 0; ++preload) {
+        cut_append(preload, false);
+        cut_append(preload, true);
+    }
+}
+
+/* Consumes count records with the power cut at every step, the oldest ones are consumed or not, in order */
+static void test_power_cut_consume(void) {
+    ring_store_t store;
+    list_t before, after;
+    const uint32_t preload = 12, count = 5;
+
+    for (uint64_t cut = 0;; ++cut) {
+        prepare(&store, preload, false);
+        CHECK(read_all(&store, &before));
+        fake_flash_cut_after(&flash, cut);
+        ring_store_consume(&store, count);
+        bool finished = !flash.off;
+
+        CHECK(remount(&store));
+        CHECK(read_all(&store, &after));
+        bool prefix = false;
+        for (size_t consumed = 0; consumed <= count; ++consumed) {
+            prefix |= list_is(&after, &before, consumed, NULL, 0);
+        }
+        CHECK(prefix);
+        if (finished) {
+            CHECK(list_is(&after, &before, count, NULL, 0));
+            break;
+        }
+        if (test_failures > 0) {
+            break;
+        }
+    }
+}
+
+int main(void) {
+    RUN(test_append_read_consume);
+    RUN(test_wrap_drops_oldest);
+    RUN(test_limits);
+    RUN(test_power_cut_append);
+    RUN(test_power_cut_consume);
+    return TEST_RESULT();
+}
@@ -0,0 +1,204 @@
+/* Feeds synthetic pressure waveforms through transient.c and checks where it triggers and what the
+ * frozen window holds before and after the trigger sample. */
+#include <stdint.h>
+
+#include "transient.h"
+#include "test.h"
+
+#define PRE 20
+#define POST 80
+#define SPAN 4
+#define THRESHOLD 100.0f
+#define WAVE_MAX 4096
+#define BASE 1200
+
+static const transient_config_t config = {
+    .pre_samples = PRE,
+    .post_samples = POST,
+    .slope_span = SPAN,
+    .slope_threshold = THRESHOLD,
+};
+
+static uint16_t ring[PRE + POST];
+static uint16_t wave[WAVE_MAX];
+static transient_t transient;
+
+/* Feeds wave[from, to), returns the index of the sample that completed the capture or -1 */
+static long feed(size_t from, size_t to) {
+    long completed = -1;
+    for (size_t i = from; i < to; ++i) {
+        if (transient_add(&transient, wave[i]) && completed < 0) {
+            completed = (long)i;
+        }
+    }
+    return completed;
+}
+
+/* The capture of a trigger at wave[trigger] is pre samples before it and POST from it on */
+static void check_window(size_t trigger, uint32_t expected_pre) {
+    uint16_t out[PRE + POST];
+    uint32_t pre = UINT32_MAX;
+    size_t n = transient_read(&transient, out, PRE + POST, &pre);
+
+    CHECK_EQ(pre, expected_pre);
+    CHECK_EQ(n, expected_pre + POST);
+    if (n != expected_pre + POST) {
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        CHECK_EQ(out[i], wave[trigger - expected_pre + i]);
+    }
+}
+
+static void flat(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        wave[i] = BASE;
+    }
+}
+
+static void start(void) {
+    transient_init(&transient, &config, ring);
+}
+
+/* Triggers on the first sample of the step, the pre window is the old level and the post window the
+ * new one. Later samples leave the frozen capture alone. */
+static void test_step(void) {
+    const size_t at = 300;
+    flat(WAVE_MAX);
+    for (size_t i = at; i < WAVE_MAX; ++i) {
+        wave[i] = BASE + 500 + (i % 7);
+    }
+
+    start();
+    CHECK_EQ(feed(0, WAVE_MAX), at + POST - 1);
+    CHECK(transient_is_frozen(&transient));
+    check_window(at, PRE);
+
+    uint16_t out[PRE + POST];
+    uint32_t pre;
+    transient_read(&transient, out, PRE + POST, &pre);
+    for (size_t i = 0; i < PRE; ++i) {
+        CHECK_EQ(out[i], BASE);
+    }
+    for (size_t i = PRE; i < PRE + POST; ++i) {
+        CHECK(out[i] >= BASE + 500);
+    }
+}
+
+/* A pressure drop triggers the same way */
+static void test_falling_step(void) {
+    const size_t at = 100;
+    flat(WAVE_MAX);
+    for (size_t i = at; i < WAVE_MAX; ++i) {
+        wave[i] = BASE - 120;
+    }
+
+    start();
+    CHECK_EQ(feed(0, WAVE_MAX), at + POST - 1);
+    check_window(at, PRE);
+}
+
+/* rate per sample from wave[at] on */
+static void ramp(size_t at, uint16_t rate) {
+    flat(WAVE_MAX);
+    for (size_t i = at; i < WAVE_MAX; ++i) {
+        uint32_t value = BASE + rate * (uint32_t)(i - at + 1);
+        wave[i] = value > UINT16_MAX ? UINT16_MAX : (uint16_t)value;
+    }
+}
+
+/* A ramp that changes less than the threshold within the slope span never triggers, however far it goes */
+static void test_slow_ramp(void) {
+    const uint16_t rate = (uint16_t)(THRESHOLD / SPAN) - 1;
+    ramp(200, rate);
+
+    start();
+    CHECK_EQ(feed(0, WAVE_MAX), -1);
+    CHECK(!transient_is_frozen(&transient));
+
+    uint16_t out[PRE + POST];
+    uint32_t pre;
+    CHECK_EQ(transient_read(&transient, out, PRE + POST, &pre), 0);
+}
+
+/* One count per sample steeper triggers once the span has filled with the ramp */
+static void test_steep_ramp(void) {
+    const size_t at = 200;
+    const uint16_t rate = (uint16_t)(THRESHOLD / SPAN) + 1;
+    ramp(at, rate);
+
+    start();
+    size_t trigger = at + SPAN - 1;
+    CHECK_EQ(feed(0, WAVE_MAX), trigger + POST - 1);
+    check_window(trigger, PRE);
+}
+
+/* Noise of up to +/-45 counts stays below the threshold, a step on top of it is found on its first
+ * sample, with the noise captured as it was fed */
+static void test_noise(void) {
+    const size_t at = 3000;
+    uint32_t state = 1;
+    for (size_t i = 0; i < WAVE_MAX; ++i) {
+        state = state * 1664525u + 1013904223u;
+        wave[i] = BASE + (int)(state >> 8) % 91 - 45;
+        if (i >= at) {
+            wave[i] += 300;
+        }
+    }
+
+    start();
+    CHECK_EQ(feed(0, at), -1);
+    CHECK_EQ(feed(at, WAVE_MAX), at + POST - 1);
+    check_window(at, PRE);
+}
+
+/* A trigger right after init has fewer pre samples, a rearm starts a fresh capture that ignores what
+ * was fed while frozen */
+static void test_rearm(void) {
+    const size_t first = SPAN + 2;
+    const size_t second = first + POST + 50;
+    flat(WAVE_MAX);
+    for (size_t i = first; i < second; ++i) {
+        wave[i] = BASE + 400;
+    }
+
+    start();
+    CHECK_EQ(feed(0, second), first + POST - 1);
+    check_window(first, first);
+
+    /* Back to BASE at second, a fall of 400 */
+    transient_rearm(&transient);
+    CHECK(!transient_is_frozen(&transient));
+    CHECK_EQ(feed(first + POST, WAVE_MAX), second + POST - 1);
+    check_window(second, PRE);
+}
+
+/* With a shorter output the newest samples are kept and the pre count shrinks with it */
+static void test_read_truncated(void) {
+    const size_t at = 500;
+    flat(WAVE_MAX);
+    for (size_t i = at; i < WAVE_MAX; ++i) {
+        wave[i] = BASE + 200;
+    }
+
+    start();
+    feed(0, WAVE_MAX);
+
+    uint16_t out[PRE + POST];
+    uint32_t pre;
+    CHECK_EQ(transient_read(&transient, out, POST + 5, &pre), POST + 5);
+    CHECK_EQ(pre, 5);
+    CHECK_EQ(out[4], BASE);
+    CHECK_EQ(out[5], BASE + 200);
+}
+
+int main(void) {
+    RUN(test_step);
+    RUN(test_falling_step);
+    RUN(test_slow_ramp);
+    RUN(test_steep_ramp);
+    RUN(test_noise);
+    RUN(test_rearm);
+    RUN(test_read_truncated);
+    return TEST_RESULT();
+}
@@ -0,0 +1,120 @@
+#include <math.h>
+
+#include "aggregate.h"
+
+void aggregate_init(aggregate_t* aggregate, const aggregate_config_t* config) {
+    aggregate->config = *config;
+    aggregate->has_reference = false;
+    aggregate->window.count = 0;
+}
+
+static bool moved(const aggregate_t* aggregate, const Sample* sample) {
+    const aggregate_config_t* config = &aggregate->config;
+    const Sample* reference = &aggregate->reference;
+
+    if (fabsf(sample->flow - reference->flow) > config->flow_deadband ||
+        fabsf(sample->pressure - reference->pressure) > config->pressure_deadband ||
+        sample->channels_count != reference->channels_count) {
+        return true;
+    }
+
+    for (pb_size_t c = 0; c < sample->channels_count; ++c) {
+        if (fabsf(sample->channels[c] - reference->channels[c]) > config->pressure_deadband) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void stats_add(aggregate_stats_t* stats, float value, bool first) {
+    if (first) {
+        stats->min = value;
+        stats->max = value;
+        stats->sum = 0;
+    }
+    stats->min = fminf(stats->min, value);
+    stats->max = fmaxf(stats->max, value);
+    stats->sum += value;
+    stats->last = value;
+}
+
+aggregate_result_t aggregate_add(aggregate_t* aggregate, const Sample* sample, aggregate_window_t* closed, bool* has_closed) {
+    aggregate_window_t* window = &aggregate->window;
+    *has_closed = false;
+
+    if (!aggregate->has_reference || moved(aggregate, sample)) {
+        *has_closed = aggregate_close(aggregate, closed);
+        aggregate->reference = *sample;
+        aggregate->has_reference = true;
+        return AGGREGATE_RAW;
+    }
+
+    if (sample->timestamp - aggregate->reference.timestamp < aggregate->config.hold_ms) {
+        return AGGREGATE_RAW;
+    }
+
+    if (window->count > 0 && sample->timestamp - window->first_timestamp >= aggregate->config.window_ms) {
+        *has_closed = aggregate_close(aggregate, closed);
+    }
+
+    bool first = window->count == 0;
+    if (first) {
+        window->first_timestamp = sample->timestamp;
+    }
+    window->last_timestamp = sample->timestamp;
+    window->count++;
+    stats_add(&window->flow, sample->flow, first);
+    stats_add(&window->pressure, sample->pressure, first);
+    window->channels_count = sample->channels_count;
+    for (pb_size_t c = 0; c < sample->channels_count; ++c) {
+        stats_add(&window->channels[c], sample->channels[c], first);
+    }
+
+    return AGGREGATE_SUMMARIZED;
+}
+
+bool aggregate_close(aggregate_t* aggregate, aggregate_window_t* closed) {
+    if (aggregate->window.count == 0) {
+        return false;
+    }
+    *closed = aggregate->window;
+    aggregate->window.count = 0;
+    return true;
+}
+
+void aggregate_shift(aggregate_t* aggregate, int64_t delta_ms) {
+    aggregate->reference.timestamp += delta_ms;
+    if (aggregate->window.count > 0) {
+        aggregate->window.first_timestamp += delta_ms;
+        aggregate->window.last_timestamp += delta_ms;
+    }
+}
+
+static inline uint32_t quantize(float v) {
+    return v > 0 ? (uint32_t)lroundf(v * CODEC_QUANT_SCALE) : 0;
+}
+
+void aggregate_summary(const aggregate_window_t* window, SampleSummary* summary) {
+    summary->timestamp = window->first_timestamp;
+    summary->duration_ms = (uint32_t)(window->last_timestamp - window->first_timestamp);
+    summary->count = window->count;
+    summary->pressure_min = quantize(window->pressure.min);
+    summary->pressure_max = quantize(window->pressure.max);
+    summary->pressure_mean = quantize(window->pressure.sum / window->count);
+    summary->pressure_last = quantize(window->pressure.last);
+    summary->flow_min = quantize(window->flow.min);
+    summary->flow_max = quantize(window->flow.max);
+    summary->flow_mean = quantize(window->flow.sum / window->count);
+    summary->flow_last = quantize(window->flow.last);
+
+    summary->channels_count = window->channels_count;
+    for (pb_size_t c = 0; c < window->channels_count; ++c) {
+        const aggregate_stats_t* stats = &window->channels[c];
+        summary->channels[c] = (ChannelSummary) {
+            .min = quantize(stats->min),
+            .max = quantize(stats->max),
+            .mean = quantize(stats->sum / window->count),
+            .last = quantize(stats->last),
+        };
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef AGGREGATE_H_
+#define AGGREGATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Splits the sample stream into raw samples and summaries. A sample is raw if flow, pressure or an
+ * additional channel moved beyond the deadband of the last raw sample, or if it comes within hold_ms
+ * of that one, so a signal at the edge of the deadband does not flip between the two every sample.
+ * Every other sample is rolled into a window summarizing count, min, max, mean and last value.
+ * Constant work per sample.
+ * No platform dependencies, traces can be replayed off-device. */
+
+typedef struct {
+    float flow_deadband;        // changes up to this from the last raw sample are summarized
+    float pressure_deadband;    // also used for the additional channels
+    uint32_t window_ms;         // a window closes once it spans this long
+    uint32_t hold_ms;           // samples stay raw this long after one moved
+} aggregate_config_t;
+
+typedef struct {
+    float min;
+    float max;
+    float sum;
+    float last;
+} aggregate_stats_t;
+
+typedef struct {
+    uint32_t count;
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    aggregate_stats_t flow;
+    aggregate_stats_t pressure;
+    pb_size_t channels_count;   // the same for every sample of the window
+    aggregate_stats_t channels[CODEC_CHANNELS_MAX];
+} aggregate_window_t;
+
+typedef struct {
+    aggregate_config_t config;
+    bool has_reference;
+    Sample reference;           // last sample that moved
+    aggregate_window_t window;  // open window, empty while count is 0
+} aggregate_t;
+
+typedef enum {
+    AGGREGATE_RAW,              // send the sample itself
+    AGGREGATE_SUMMARIZED,       // rolled into the open window
+} aggregate_result_t;
+
+void aggregate_init(aggregate_t* aggregate, const aggregate_config_t* config);
+
+/* Feeds one sample. If it ends the open window, because it is raw or the window is due, the window
+ * is copied to closed and true is stored in has_closed. */
+aggregate_result_t aggregate_add(aggregate_t* aggregate, const Sample* sample, aggregate_window_t* closed, bool* has_closed);
+
+/* Closes the open window early, e.g. before deep sleep. Returns false if it is empty. */
+bool aggregate_close(aggregate_t* aggregate, aggregate_window_t* closed);
+
+/* Moves the open window after the wall clock was corrected */
+void aggregate_shift(aggregate_t* aggregate, int64_t delta_ms);
+
+/* Window as SampleSummary, in 1/CODEC_QUANT_SCALE units, the additional channels included */
+void aggregate_summary(const aggregate_window_t* window, SampleSummary* summary);
+
+#endif
@@ -0,0 +1,68 @@
+#include "batcher.h"
+
+void batcher_init(batcher_t* batcher, const batcher_config_t* config, uint8_t* arena, size_t capacity) {
+    batcher->config = *config;
+    codec_batch_init(&batcher->encoder, arena, capacity);
+    batcher_reset(batcher);
+}
+
+void batcher_reset(batcher_t* batcher) {
+    codec_batch_reset(&batcher->encoder);
+    batcher->interval_ms = 0;
+    batcher->active = false;
+}
+
+static bool spacing_changed(const batcher_t* batcher, const Sample* next) {
+    if (batcher_count(batcher) < 2) {
+        return false;
+    }
+
+    uint64_t interval = batcher->interval_ms;
+    uint64_t delta = next->timestamp - batcher->last.timestamp;
+    uint64_t diff = delta > interval ? delta - interval : interval - delta;
+    return diff > interval / 2;
+}
+
+bool batcher_add(batcher_t* batcher, const Sample* sample) {
+    if (spacing_changed(batcher, sample) || !codec_batch_add(&batcher->encoder, sample)) {
+        return false;
+    }
+
+    uint32_t count = batcher_count(batcher);
+    if (count == 1) {
+        batcher->first = *sample;
+    } else if (count == 2) {
+        batcher->interval_ms = (uint32_t)(sample->timestamp - batcher->first.timestamp);
+    }
+    batcher->last = *sample;
+    batcher->active |= sample->flow != 0 || sample->pressure > batcher->config.pressure_min;
+
+    return true;
+}
+
+bool batcher_is_complete(const batcher_t* batcher) {
+    uint32_t count = batcher_count(batcher);
+    if (count == 0) {
+        return false;
+    }
+
+    uint64_t age = batcher->last.timestamp - batcher->first.timestamp;
+    return count >= batcher->config.max_samples || age >= batcher->config.max_age_ms;
+}
+
+bool batcher_is_idle(const batcher_t* batcher) {
+    return !batcher->active;
+}
+
+void batcher_shift(batcher_t* batcher, int64_t delta_ms) {
+    if (batcher_count(batcher) == 0) {
+        return;
+    }
+    codec_batch_shift(&batcher->encoder, delta_ms);
+    batcher->first.timestamp += delta_ms;
+    batcher->last.timestamp += delta_ms;
+}
+
+size_t batcher_finish(const batcher_t* batcher, uint8_t* buffer, size_t size) {
+    return codec_batch_finish(&batcher->encoder, buffer, size);
+}
@@ -0,0 +1,52 @@
+#ifndef BATCHER_H_
+#define BATCHER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "codec.h"
+
+/* Rules for assembling live samples into variable size batches. No platform dependencies. */
+
+typedef struct {
+    uint32_t max_samples;       // complete at this many samples
+    uint32_t max_age_ms;        // complete once the newest sample is this much younger than the oldest
+    float pressure_min;         // samples without flow and with pressure at or below count as idle
+} batcher_config_t;
+
+typedef struct {
+    batcher_config_t config;
+    codec_batch_t encoder;
+    Sample first;
+    Sample last;
+    uint32_t interval_ms;       // spacing of the first two samples
+    bool active;                // some sample showed flow or pressure
+} batcher_t;
+
+/* Samples are encoded into arena as they are added, the encoded batch never exceeds its capacity */
+void batcher_init(batcher_t* batcher, const batcher_config_t* config, uint8_t* arena, size_t capacity);
+void batcher_reset(batcher_t* batcher);
+
+/* Adds a sample, returns false if it does not belong into the current batch: it would break the even
+ * spacing (e.g. after a change of sampling rate), go back in time or exceed the byte budget.
+ * The batch is unchanged then, finish it and add the sample to the next one. */
+bool batcher_add(batcher_t* batcher, const Sample* sample);
+
+static inline uint32_t batcher_count(const batcher_t* batcher) {
+    return batcher->encoder.count;
+}
+
+/* True once the batch reached max_samples or max_age_ms */
+bool batcher_is_complete(const batcher_t* batcher);
+
+/* True if no sample of the batch showed flow or pressure above pressure_min */
+bool batcher_is_idle(const batcher_t* batcher);
+
+/* Moves the batch by delta_ms after the wall clock was corrected */
+void batcher_shift(batcher_t* batcher, int64_t delta_ms);
+
+/* Encodes the batch as SampleBatchV2 into buffer, returns the number of bytes written or 0 on failure */
+size_t batcher_finish(const batcher_t* batcher, uint8_t* buffer, size_t size);
+
+#endif
@@ -0,0 +1,452 @@
+#include <math.h>
+#include <string.h>
+
+#include "pb_encode.h"
+#include "pb_decode.h"
+
+#include "codec.h"
+
+/* Every sample is kept in the arena as one row of varints:
+ *   header      (channel count << 2) | has drip << 1 | has pressure spread
+ *   offset      timestamp - first timestamp
+ *   pressure    zigzag delta from the previous sample, 1/1000
+ *   flow        zigzag delta from the previous sample, 1/1000
+ *   [drip]                             if has drip, flow in 1/1000000
+ *   [min, max, stddev offsets]         if has pressure spread
+ * The values are the same varints that go on the wire, finish only regroups them by field.
+ * The channels go out channel-major, one pass over the batch per channel. Re-reading the rows on each
+ * pass made finish quadratic in the channel count, so their values are stored as int16 in 1/1000 at
+ * the end of the arena instead, batch->channels per sample from the last byte down, and finish reads
+ * them by index. Only a batch whose samples all carry the same channel count sends them, the values
+ * of the others are not stored. */
+
+/* Largest possible row */
+#define ROW_MAX (2 + 10 + 5 + 5 + 5 + 3 * 5)
+
+/* A row contributes at least its header and offset bytes that are not sent, while a jitter entry
+ * takes at most 5 bytes and a row without drip sends a 0 in the drip column, so the encoded batch
+ * grows by at most this much per sample over the arena */
+#define ROW_WIRE_EXTRA 4
+
+typedef struct {
+    pb_size_t channels;
+    bool stats;
+    uint64_t drip;
+    uint64_t offset;
+    int64_t pressure;
+    int64_t flow;
+    uint64_t pressure_min;
+    uint64_t pressure_max;
+    uint64_t pressure_stddev;
+} row_t;
+
+typedef enum {
+    COLUMN_PRESSURE,
+    COLUMN_FLOW,
+    COLUMN_JITTER,
+    COLUMN_PRESSURE_MIN,
+    COLUMN_PRESSURE_MAX,
+    COLUMN_PRESSURE_STDDEV,
+    COLUMN_CHANNELS,
+    COLUMN_DRIP_FLOW,
+    COLUMN_COUNT,
+} column_id_t;
+
+typedef struct {
+    const codec_batch_t* batch;
+    uint32_t interval_ms;
+    bool jitter;
+} finish_t;
+
+typedef struct {
+    const finish_t* finish;
+    column_id_t id;
+} column_t;
+
+static inline int32_t quantize(float v) {
+    return (int32_t)lroundf(v * CODEC_QUANT_SCALE);
+}
+
+/* Flow that quantizes to 0 but is not, 0 otherwise */
+static inline uint32_t quantize_drip(float flow) {
+    return flow > 0 && quantize(flow) == 0 ? (uint32_t)lroundf(flow * CODEC_DRIP_SCALE) : 0;
+}
+
+static inline uint32_t quantize_offset(float from, float to) {
+    int32_t q = quantize(to) - quantize(from);
+    return q > 0 ? (uint32_t)q : 0;
+}
+
+/* Channel values are stored as int16, 32 times full scale is far out of any sensor's range */
+static inline int32_t quantize_channel(float v) {
+    int32_t q = quantize(v);
+    return q > INT16_MAX ? INT16_MAX : (q < INT16_MIN ? INT16_MIN : q);
+}
+
+static inline uint8_t* channel_slot(const codec_batch_t* batch, uint32_t sample, pb_size_t channel) {
+    return batch->arena + batch->capacity - ((size_t)sample * batch->channels + channel + 1) * sizeof(int16_t);
+}
+
+static int32_t channel_value(const codec_batch_t* batch, uint32_t sample, pb_size_t channel) {
+    int16_t value;
+    memcpy(&value, channel_slot(batch, sample, channel), sizeof(value));
+    return value;
+}
+
+static size_t svarint_size(int32_t value) {
+    pb_ostream_t sizing = PB_OSTREAM_SIZING;
+    pb_encode_svarint(&sizing, value);
+    return sizing.bytes_written;
+}
+
+static inline bool has_pressure_stats(const Sample* s) {
+    return s->has_pressure_min && s->has_pressure_max && s->has_pressure_stddev;
+}
+
+void codec_batch_init(codec_batch_t* batch, uint8_t* arena, size_t capacity) {
+    batch->arena = arena;
+    batch->capacity = capacity;
+    codec_batch_reset(batch);
+}
+
+void codec_batch_reset(codec_batch_t* batch) {
+    batch->used = 0;
+    batch->count = 0;
+    batch->first_timestamp = 0;
+    batch->last_timestamp = 0;
+    batch->prev_pressure = 0;
+    batch->prev_flow = 0;
+    memset(batch->prev_channels, 0, sizeof(batch->prev_channels));
+    batch->channel_bytes = 0;
+    batch->channels = 0;
+    batch->same_channels = true;
+    batch->stats = true;
+    batch->drip = false;
+}
+
+bool codec_batch_add(codec_batch_t* batch, const Sample* s) {
+    uint8_t row[ROW_MAX];
+
+    if (batch->count > 0 && s->timestamp < batch->last_timestamp) {
+        return false;
+    }
+
+    uint64_t first = batch->count > 0 ? batch->first_timestamp : s->timestamp;
+    pb_size_t channels = s->channels_count < CODEC_CHANNELS_MAX ? s->channels_count : CODEC_CHANNELS_MAX;
+    bool stats = has_pressure_stats(s);
+    int32_t pressure = quantize(s->pressure);
+    int32_t flow = quantize(s->flow);
+    uint32_t drip = quantize_drip(s->flow);
+
+    pb_ostream_t out = pb_ostream_from_buffer(row, sizeof(row));
+    pb_encode_varint(&out, ((uint64_t)channels << 2) | (drip > 0) << 1 | stats);
+    pb_encode_varint(&out, s->timestamp - first);
+    pb_encode_svarint(&out, pressure - batch->prev_pressure);
+    pb_encode_svarint(&out, flow - batch->prev_flow);
+    if (drip > 0) {
+        pb_encode_varint(&out, drip);
+    }
+    if (stats) {
+        pb_encode_varint(&out, quantize_offset(s->pressure_min, s->pressure));
+        pb_encode_varint(&out, quantize_offset(s->pressure, s->pressure_max));
+        pb_encode_varint(&out, quantize_offset(0, s->pressure_stddev));
+    }
+
+    /* The values are kept while every sample carries the first one's channel count */
+    bool same_channels = batch->count == 0 || (batch->same_channels && channels == batch->channels);
+    size_t channel_bytes = 0;
+    if (same_channels) {
+        for (pb_size_t c = 0; c < channels; ++c) {
+            channel_bytes += svarint_size(quantize_channel(s->channels[c]) - batch->prev_channels[c]);
+        }
+    }
+
+    size_t stored = same_channels ? (size_t)(batch->count + 1) * channels * sizeof(int16_t) : 0;
+    size_t encoded = batch->used + out.bytes_written + batch->channel_bytes + channel_bytes +
+                     ROW_WIRE_EXTRA * (batch->count + 1) + CODEC_BATCH_OVERHEAD;
+    if (encoded > batch->capacity || batch->used + out.bytes_written + stored > batch->capacity) {
+        return false;
+    }
+
+    memcpy(batch->arena + batch->used, row, out.bytes_written);
+    batch->used += out.bytes_written;
+
+    if (batch->count == 0) {
+        batch->first_timestamp = s->timestamp;
+        batch->channels = channels;
+    }
+    batch->same_channels = same_channels;
+    batch->stats &= stats;
+    batch->drip |= drip > 0;
+    batch->last_timestamp = s->timestamp;
+    batch->prev_pressure = pressure;
+    batch->prev_flow = flow;
+    if (same_channels) {
+        for (pb_size_t c = 0; c < channels; ++c) {
+            int16_t value = (int16_t)quantize_channel(s->channels[c]);
+            memcpy(channel_slot(batch, batch->count, c), &value, sizeof(value));
+            batch->prev_channels[c] = value;
+        }
+        batch->channel_bytes += channel_bytes;
+    }
+    batch->count++;
+
+    return true;
+}
+
+static bool read_row(pb_istream_t* in, row_t* row) {
+    uint64_t header;
+    if (!pb_decode_varint(in, &header) ||
+        !pb_decode_varint(in, &row->offset) ||
+        !pb_decode_svarint(in, &row->pressure) ||
+        !pb_decode_svarint(in, &row->flow)) {
+        return false;
+    }
+
+    row->stats = header & 1;
+    row->channels = (pb_size_t)(header >> 2);
+    if (row->channels > CODEC_CHANNELS_MAX) {
+        return false;
+    }
+
+    row->drip = 0;
+    if ((header & 2) && !pb_decode_varint(in, &row->drip)) {
+        return false;
+    }
+
+    if (row->stats &&
+        (!pb_decode_varint(in, &row->pressure_min) ||
+         !pb_decode_varint(in, &row->pressure_max) ||
+         !pb_decode_varint(in, &row->pressure_stddev))) {
+        return false;
+    }
+
+    return true;
+}
+
+static bool column_present(const column_t* column) {
+    const codec_batch_t* batch = column->finish->batch;
+
+    switch (column->id) {
+        case COLUMN_JITTER:
+            /* Evenly spaced batches (the common case) do not carry jitter at all */
+            return column->finish->jitter;
+        case COLUMN_PRESSURE_MIN:
+        case COLUMN_PRESSURE_MAX:
+        case COLUMN_PRESSURE_STDDEV:
+            /* Pressure spread is only sent if every sample carries it */
+            return batch->stats;
+        case COLUMN_CHANNELS:
+            return batch->same_channels && batch->channels > 0;
+        case COLUMN_DRIP_FLOW:
+            return batch->drip;
+        default:
+            return true;
+    }
+}
+
+/* Channel-major zigzag deltas of the stored channel values */
+static bool write_channels(pb_ostream_t* stream, const codec_batch_t* batch) {
+    for (pb_size_t c = 0; c < batch->channels; ++c) {
+        int32_t prev = 0;
+        for (uint32_t i = 0; i < batch->count; ++i) {
+            int32_t value = channel_value(batch, i, c);
+            if (!pb_encode_svarint(stream, value - prev)) {
+                return false;
+            }
+            prev = value;
+        }
+    }
+    return true;
+}
+
+/* Writes the values of one column */
+static bool write_values(pb_ostream_t* stream, const column_t* column) {
+    const codec_batch_t* batch = column->finish->batch;
+    if (column->id == COLUMN_CHANNELS) {
+        return write_channels(stream, batch);
+    }
+
+    pb_istream_t in = pb_istream_from_buffer(batch->arena, batch->used);
+    row_t row;
+
+    for (uint32_t i = 0; i < batch->count; ++i) {
+        if (!read_row(&in, &row)) {
+            return false;
+        }
+
+        bool ok;
+        switch (column->id) {
+            case COLUMN_PRESSURE:           ok = pb_encode_svarint(stream, row.pressure); break;
+            case COLUMN_FLOW:               ok = pb_encode_svarint(stream, row.flow); break;
+            case COLUMN_JITTER:
+                ok = pb_encode_svarint(stream, (int64_t)row.offset - (int64_t)i * column->finish->interval_ms);
+                break;
+            case COLUMN_PRESSURE_MIN:       ok = pb_encode_varint(stream, row.pressure_min); break;
+            case COLUMN_PRESSURE_MAX:       ok = pb_encode_varint(stream, row.pressure_max); break;
+            case COLUMN_PRESSURE_STDDEV:    ok = pb_encode_varint(stream, row.pressure_stddev); break;
+            case COLUMN_DRIP_FLOW:          ok = pb_encode_varint(stream, row.drip); break;
+            default:                        ok = false; break;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* nanopb callback for the packed repeated fields, sized first so the length prefix can be written */
+static bool encode_column(pb_ostream_t* stream, const pb_field_t* field, void* const* arg) {
+    const column_t* column = *arg;
+    if (!column_present(column)) {
+        return true;
+    }
+
+    pb_ostream_t sizing = PB_OSTREAM_SIZING;
+    if (!write_values(&sizing, column)) {
+        return false;
+    }
+
+    return pb_encode_tag(stream, PB_WT_STRING, field->tag) &&
+           pb_encode_varint(stream, sizing.bytes_written) &&
+           write_values(stream, column);
+}
+
+/* Best fitting interval, returns false if a residual does not fit into a sint32 jitter entry */
+static bool fit_interval(const codec_batch_t* batch, finish_t* finish) {
+    uint32_t n = batch->count;
+    uint64_t span = batch->last_timestamp - batch->first_timestamp;
+
+    finish->interval_ms = (n > 1) ? (uint32_t)((span + (n - 1) / 2) / (n - 1)) : 0;
+    finish->jitter = false;
+
+    pb_istream_t in = pb_istream_from_buffer(batch->arena, batch->used);
+    row_t row;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (!read_row(&in, &row)) {
+            return false;
+        }
+
+        int64_t deviation = (int64_t)row.offset - (int64_t)i * finish->interval_ms;
+        if (deviation > INT32_MAX || deviation < INT32_MIN) {
+            return false;
+        }
+        finish->jitter |= deviation != 0;
+    }
+    return true;
+}
+
+size_t codec_batch_finish(const codec_batch_t* batch, uint8_t* buffer, size_t size) {
+    if (batch->count == 0) {
+        return 0;
+    }
+
+    finish_t finish = { .batch = batch };
+    if (!fit_interval(batch, &finish)) {
+        return 0;
+    }
+
+    column_t columns[COLUMN_COUNT];
+    for (int i = 0; i < COLUMN_COUNT; ++i) {
+        columns[i] = (column_t){ .finish = &finish, .id = (column_id_t)i };
+    }
+
+    SampleBatchV2 message = SampleBatchV2_init_zero;
+    message.base_timestamp = batch->first_timestamp;
+    message.interval_ms = finish.interval_ms;
+
+    pb_callback_t* fields[COLUMN_COUNT] = {
+        [COLUMN_PRESSURE] = &message.pressure,
+        [COLUMN_FLOW] = &message.flow,
+        [COLUMN_JITTER] = &message.timestamp_jitter,
+        [COLUMN_PRESSURE_MIN] = &message.pressure_min,
+        [COLUMN_PRESSURE_MAX] = &message.pressure_max,
+        [COLUMN_PRESSURE_STDDEV] = &message.pressure_stddev,
+        [COLUMN_CHANNELS] = &message.channels,
+        [COLUMN_DRIP_FLOW] = &message.drip_flow,
+    };
+    for (int i = 0; i < COLUMN_COUNT; ++i) {
+        fields[i]->funcs.encode = encode_column;
+        fields[i]->arg = &columns[i];
+    }
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, size);
+    if (!pb_encode(&stream, SampleBatchV2_fields, &message)) {
+        return 0;
+    }
+
+    return stream.bytes_written;
+}
+
+void codec_batch_shift(codec_batch_t* batch, int64_t delta_ms) {
+    if (batch->count == 0) {
+        return;
+    }
+    batch->first_timestamp += delta_ms;
+    batch->last_timestamp += delta_ms;
+}
+
+size_t codec_batch_rebase(const uint8_t* data, size_t len, int64_t delta_ms, uint8_t* out, size_t size) {
+    /* finish writes base_timestamp first */
+    pb_istream_t in = pb_istream_from_buffer(data, len);
+    uint32_t tag;
+    pb_wire_type_t wire_type;
+    bool eof;
+    uint64_t base_timestamp;
+    if (!pb_decode_tag(&in, &wire_type, &tag, &eof) ||
+        tag != SampleBatchV2_base_timestamp_tag || wire_type != PB_WT_VARINT ||
+        !pb_decode_varint(&in, &base_timestamp)) {
+        return 0;
+    }
+
+    size_t rest = in.bytes_left;
+    pb_ostream_t stream = pb_ostream_from_buffer(out, size);
+    if (!pb_encode_tag(&stream, PB_WT_VARINT, SampleBatchV2_base_timestamp_tag) ||
+        !pb_encode_varint(&stream, base_timestamp + delta_ms) ||
+        !pb_write(&stream, data + len - rest, rest)) {
+        return 0;
+    }
+
+    return stream.bytes_written;
+}
+
+bool codec_is_summary_batch(const uint8_t* data, size_t len) {
+    return len > 0 && data[0] == ((SampleSummaryBatch_summaries_tag << 3) | PB_WT_STRING);
+}
+
+_Static_assert(LeakEvent_size < 128, "Event record length is one varint byte");
+
+size_t codec_event_record(const LeakEvent* event, uint8_t* out, size_t size) {
+    if (size <= CODEC_EVENT_RECORD_HEADER) {
+        return 0;
+    }
+
+    pb_ostream_t stream = pb_ostream_from_buffer(out + CODEC_EVENT_RECORD_HEADER, size - CODEC_EVENT_RECORD_HEADER);
+    if (!pb_encode(&stream, LeakEvent_fields, event)) {
+        return 0;
+    }
+
+    out[0] = (SampleBatchBundle_events_tag << 3) | PB_WT_STRING;
+    out[1] = (uint8_t)stream.bytes_written;
+    return CODEC_EVENT_RECORD_HEADER + stream.bytes_written;
+}
+
+bool codec_is_event_record(const uint8_t* data, size_t len) {
+    return len > CODEC_EVENT_RECORD_HEADER && data[0] == ((SampleBatchBundle_events_tag << 3) | PB_WT_STRING) &&
+           data[1] == len - CODEC_EVENT_RECORD_HEADER;
+}
+
+size_t codec_transient_encode(const float* pressure, size_t count, uint8_t* out, size_t size) {
+    pb_ostream_t stream = pb_ostream_from_buffer(out, size);
+    int32_t prev = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        int32_t value = (int32_t)lroundf(pressure[i] * CODEC_TRANSIENT_SCALE);
+        if (!pb_encode_svarint(&stream, value - prev)) {
+            return 0;
+        }
+        prev = value;
+    }
+
+    return stream.bytes_written;
+}
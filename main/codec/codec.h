@@ -0,0 +1,83 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sample_batch.pb.h"
+
+/* Pressure and flow are normalized to [0, 1] and rounded to 3 decimals by the sensors,
+ * so they are carried on the wire as integers in 1/1000 units */
+#define CODEC_QUANT_SCALE 1000
+
+/* Flow that quantizes to 0 goes out in the drip_flow column in 1/1000000 units, the pulse period resolves
+ * drips far below 1/1000 of full scale */
+#define CODEC_DRIP_SCALE 1000000
+
+/* Transient captures resolve the 12 bit ADC, so they are carried in 1/10000 units */
+#define CODEC_TRANSIENT_SCALE 10000
+
+/* Max number of additional channels per sample */
+#define CODEC_CHANNELS_MAX (sizeof(((Sample*)0)->channels) / sizeof(float))
+
+/* Fixed part of an encoded batch: base_timestamp, interval_ms and tag + length of every packed field */
+#define CODEC_BATCH_OVERHEAD 44
+
+/* Builds one SampleBatchV2 sample by sample. Each sample is varint coded into the arena as it
+ * arrives (a few bytes per sample), the columnar message is streamed out of it by nanopb callbacks
+ * on finish. The encoded batch never exceeds the arena capacity, so a buffer of the same size fits it.
+ * Channel values are kept apart at the end of the arena, so finish stays linear in the channel count. */
+typedef struct {
+    uint8_t* arena;
+    size_t capacity;
+    size_t used;
+    uint32_t count;
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    int32_t prev_pressure;
+    int32_t prev_flow;
+    int32_t prev_channels[CODEC_CHANNELS_MAX];
+    size_t channel_bytes;       // zigzag deltas of the channel values as they go on the wire
+    pb_size_t channels;         // channel count of the first sample
+    bool same_channels;         // every sample carries the same channel count
+    bool stats;                 // every sample carries the pressure spread
+    bool drip;                  // some sample has a drip flow
+} codec_batch_t;
+
+void codec_batch_init(codec_batch_t* batch, uint8_t* arena, size_t capacity);
+void codec_batch_reset(codec_batch_t* batch);
+
+/* Appends a sample, returns false and leaves the batch unchanged if the encoded batch would
+ * no longer fit the capacity or the sample is older than the previous one */
+bool codec_batch_add(codec_batch_t* batch, const Sample* sample);
+
+/* Encodes the batch as SampleBatchV2, returns the number of bytes written or 0 on failure */
+size_t codec_batch_finish(const codec_batch_t* batch, uint8_t* buffer, size_t size);
+
+/* Moves every sample of the batch by delta_ms, the arena only holds offsets to the first one */
+void codec_batch_shift(codec_batch_t* batch, int64_t delta_ms);
+
+/* Copies an encoded SampleBatchV2 to out with base_timestamp moved by delta_ms, the rest of the message is
+ * left as is. Returns the number of bytes written or 0 if the input is malformed or out is too small. */
+size_t codec_batch_rebase(const uint8_t* data, size_t len, int64_t delta_ms, uint8_t* out, size_t size);
+
+/* Tells the stored message types apart: a SampleBatchV2 starts with its required base_timestamp,
+ * a SampleSummaryBatch with its first summary, both field 1 but of different wire types */
+bool codec_is_summary_batch(const uint8_t* data, size_t len);
+
+/* A leaf keeps its leak events in the store along with the batches, each one as a SampleBatchBundle
+ * holding just that event: events tag, one byte length, the LeakEvent. Copied as is into a bundle, or
+ * without the header into any other message's events field. */
+#define CODEC_EVENT_RECORD_HEADER 2
+
+/* Encodes event as a stored record, returns the number of bytes written or 0 if out is too small */
+size_t codec_event_record(const LeakEvent* event, uint8_t* out, size_t size);
+
+bool codec_is_event_record(const uint8_t* data, size_t len);
+
+/* Encodes normalized pressures as zigzag varint deltas in 1/CODEC_TRANSIENT_SCALE units, the blob carried
+ * by PressureTransientChunk. Returns the number of bytes written or 0 if out is too small. */
+size_t codec_transient_encode(const float* pressure, size_t count, uint8_t* out, size_t size);
+
+#endif
@@ -10,10 +10,14 @@ static const char* TAG = "COMMON";
 
 static char device_id[32];
 
+void app_format_device_id(char* id, size_t size, const uint8_t mac[6]) {
+    snprintf(id, size, "ESP-%02X%02X%02X", mac[3], mac[4], mac[5]);
+}
+
 void app_device_id_init(void) {
     uint8_t mac[6];
     esp_read_mac(mac, ESP_MAC_WIFI_STA);
-    snprintf(device_id, sizeof(device_id), "ESP-%02X%02X%02X", mac[3], mac[4], mac[5]);
+    app_format_device_id(device_id, sizeof(device_id), mac);
 }
 
 const char* app_get_device_id(void) {
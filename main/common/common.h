@@ -12,5 +12,7 @@ extern EventGroupHandle_t app_event_group;
 
 const char* app_get_device_id();
 void app_device_id_init();
+/* Device id of the station MAC mac, also used for the leaves a relay gateway reports for */
+void app_format_device_id(char* id, size_t size, const uint8_t mac[6]);
 
 #endif
\ No newline at end of file
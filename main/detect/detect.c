@@ -0,0 +1,164 @@
+#include <string.h>
+
+#include "detect.h"
+
+#define MS_PER_HOUR 3600000ULL
+#define MS_PER_DAY (24 * MS_PER_HOUR)
+
+void detect_init(detect_t* detect, const detect_config_t* config) {
+    memset(detect, 0, sizeof(*detect));
+    detect->config = *config;
+}
+
+static bool in_night_window(const detect_config_t* config, uint64_t timestamp) {
+    int64_t local = (int64_t)timestamp + (int64_t)config->utc_offset_min * 60000;
+    uint32_t hour = (uint32_t)((uint64_t)(local % (int64_t)MS_PER_DAY + MS_PER_DAY) % MS_PER_DAY / MS_PER_HOUR);
+
+    if (config->night_start_hour <= config->night_end_hour) {
+        return hour >= config->night_start_hour && hour < config->night_end_hour;
+    }
+    /* Window wrapping midnight */
+    return hour >= config->night_start_hour || hour < config->night_end_hour;
+}
+
+/* Draws end with the valve closing, a leak does not. The CUSUM starts over whenever the flow stops and only
+ * alarms once the excess lasted cusum_min_ms, so taps and irrigation runs shorter than that stay quiet. */
+static bool update_cusum(detect_t* detect, uint64_t timestamp, float flow, uint32_t dt, detect_event_t* event) {
+    const detect_config_t* config = &detect->config;
+
+    if (flow < config->no_flow) {
+        detect->cusum = 0;
+    } else {
+        float deviation = flow - detect->flow_baseline - config->cusum_slack;
+        if (detect->cusum == 0 && deviation > 0) {
+            detect->excess_start = timestamp;
+        }
+        detect->cusum += deviation * dt / 1000.0f;
+        if (detect->cusum < 0) {
+            detect->cusum = 0;
+        }
+    }
+
+    if (detect->cusum >= config->cusum_threshold && timestamp - detect->excess_start >= config->cusum_min_ms) {
+        *event = (detect_event_t) {
+            .type = DETECT_EVENT_FLOW_CUSUM,
+            .timestamp = timestamp,
+            .value = detect->cusum,
+            .baseline = detect->flow_baseline,
+        };
+        /* Re-baseline so a new steady level is not reported over and over */
+        detect->flow_baseline = flow;
+        detect->cusum = 0;
+        return true;
+    }
+
+    /* The baseline follows slowly while nothing accumulates, alpha = dt / (tau + dt) */
+    if (detect->cusum == 0) {
+        float alpha = (float)dt / (config->baseline_tau_ms + dt);
+        detect->flow_baseline += alpha * (flow - detect->flow_baseline);
+    }
+    return false;
+}
+
+static bool update_night(detect_t* detect, uint64_t timestamp, float flow, detect_event_t* event) {
+    const detect_config_t* config = &detect->config;
+    bool night = in_night_window(config, timestamp);
+
+    if (night) {
+        if (!detect->in_night || flow < detect->night_min) {
+            detect->night_min = flow;
+        }
+        detect->in_night = true;
+        return false;
+    }
+
+    if (!detect->in_night) {
+        return false;
+    }
+
+    /* Night window just ended */
+    detect->in_night = false;
+    if (detect->night_min > config->night_min_flow) {
+        *event = (detect_event_t) {
+            .type = DETECT_EVENT_NIGHT_FLOW,
+            .timestamp = timestamp,
+            .value = detect->night_min,
+            .baseline = detect->flow_baseline,
+        };
+        return true;
+    }
+    return false;
+}
+
+static bool update_decay(detect_t* detect, uint64_t timestamp, float flow, float pressure, detect_event_t* event) {
+    const detect_config_t* config = &detect->config;
+
+    if (flow >= config->no_flow || pressure <= config->pressure_min) {
+        detect->decay_tracking = false;
+        return false;
+    }
+
+    if (!detect->decay_tracking) {
+        detect->decay_tracking = true;
+        detect->decay_start = timestamp;
+        detect->decay_reference = pressure;
+        return false;
+    }
+
+    if (timestamp - detect->decay_start < config->decay_window_ms) {
+        return false;
+    }
+
+    float drop = detect->decay_reference - pressure;
+    bool triggered = drop >= config->decay_threshold;
+    if (triggered) {
+        *event = (detect_event_t) {
+            .type = DETECT_EVENT_PRESSURE_DECAY,
+            .timestamp = timestamp,
+            .value = drop,
+            .baseline = detect->decay_reference,
+        };
+    }
+
+    /* Start the next window */
+    detect->decay_start = timestamp;
+    detect->decay_reference = pressure;
+    return triggered;
+}
+
+bool detect_update(detect_t* detect, uint64_t timestamp, float flow, float pressure, detect_event_t* event) {
+    if (!detect->initialized) {
+        detect->initialized = true;
+        detect->last_timestamp = timestamp;
+        detect->flow_baseline = flow;
+    }
+
+    uint32_t dt = timestamp > detect->last_timestamp ? (uint32_t)(timestamp - detect->last_timestamp) : 0;
+    detect->last_timestamp = timestamp;
+
+    /* Every detector sees every sample, the first one to fire is reported */
+    detect_event_t other;
+    bool triggered = update_cusum(detect, timestamp, flow, dt, event);
+
+    if (update_night(detect, timestamp, flow, triggered ? &other : event)) {
+        triggered = true;
+    }
+    if (update_decay(detect, timestamp, flow, pressure, triggered ? &other : event)) {
+        triggered = true;
+    }
+
+    return triggered;
+}
+
+void detect_shift(detect_t* detect, int64_t delta_ms) {
+    if (!detect->initialized) {
+        return;
+    }
+    detect->last_timestamp += delta_ms;
+    if (detect->cusum > 0) {
+        detect->excess_start += delta_ms;
+    }
+    if (detect->decay_tracking) {
+        detect->decay_start += delta_ms;
+    }
+}
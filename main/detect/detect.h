@@ -0,0 +1,85 @@
+#ifndef DETECT_H_
+#define DETECT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Streaming leak detection over normalized flow/pressure samples.
+ * O(1) state per signal and no platform dependencies, so recorded traces can be replayed through it off-device. */
+
+typedef enum {
+    DETECT_EVENT_FLOW_CUSUM,        // flow above the baseline that never stopped for cusum_min_ms
+    DETECT_EVENT_NIGHT_FLOW,        // minimum flow in the night window never reached zero
+    DETECT_EVENT_PRESSURE_DECAY,    // pressure dropping while nothing is flowing
+} detect_event_type_t;
+
+typedef struct {
+    detect_event_type_t type;
+    uint64_t timestamp;     // ms
+    float value;            // CUSUM statistic, night minimum flow or pressure drop
+    float baseline;         // flow baseline, or pressure at the start of the decay window
+} detect_event_t;
+
+typedef struct {
+    uint32_t baseline_tau_ms;       // EWMA time constant of the flow baseline
+    float cusum_slack;              // flow above baseline tolerated without accumulating
+    float cusum_threshold;          // alarm level of the CUSUM statistic (flow x seconds)
+    uint32_t cusum_min_ms;          // and the excess has to last this long without the flow stopping
+
+    int32_t utc_offset_min;         // local time offset for the night window
+    uint8_t night_start_hour;       // local hour the night window starts
+    uint8_t night_end_hour;         // local hour the night window ends
+    float night_min_flow;           // minimum night flow above this is reported
+
+    float no_flow;                  // flow below this counts as closed
+    float pressure_min;             // decay is only tracked while pressurized
+    uint32_t decay_window_ms;       // no-flow time over which the pressure drop is measured
+    float decay_threshold;          // pressure drop reported within one window
+} detect_config_t;
+
+typedef struct {
+    detect_config_t config;
+
+    uint64_t last_timestamp;
+    bool initialized;
+
+    /* EWMA flow baseline and CUSUM. The baseline only follows while the CUSUM is 0, a draw or a leak is not
+     * learned as the new normal while it is being measured. */
+    float flow_baseline;
+    float cusum;
+    uint64_t excess_start;          // first sample of the excess the CUSUM is accumulating
+
+    /* Night minimum flow */
+    bool in_night;
+    float night_min;
+
+    /* Pressure decay while closed */
+    bool decay_tracking;
+    uint64_t decay_start;
+    float decay_reference;
+} detect_t;
+
+#define DETECT_CONFIG_DEFAULT { \
+    .baseline_tau_ms = 3600000, \
+    .cusum_slack = 0.005f, \
+    .cusum_threshold = 15.0f, \
+    .cusum_min_ms = 3600000, \
+    .utc_offset_min = 0, \
+    .night_start_hour = 2, \
+    .night_end_hour = 4, \
+    .night_min_flow = 0.003f, \
+    .no_flow = 0.001f, \
+    .pressure_min = 0.044f, \
+    .decay_window_ms = 600000, \
+    .decay_threshold = 0.02f, \
+}
+
+void detect_init(detect_t* detect, const detect_config_t* config);
+
+/* Feeds one sample, returns true and fills event if it triggered one */
+bool detect_update(detect_t* detect, uint64_t timestamp, float flow, float pressure, detect_event_t* event);
+
+/* Moves the state by delta_ms after the wall clock was corrected, so the step is not taken for elapsed time */
+void detect_shift(detect_t* detect, int64_t delta_ms);
+
+#endif
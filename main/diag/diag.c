@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+
+#include "pb_encode.h"
+
+#include "diag.h"
+#include "timebase.h"
+
+static const char* TAG = "diag";
+
+#define DIAG_MAGIC 0x44494147
+
+static const char* phase_names[] = {
+    "boot", "nvs", "wifi_init", "wifi_start", "wifi_connected", "sntp_synced", "mqtt_connected", "first_puback", "sleep",
+};
+
+/* Profile of the running wake, kept until the next one publishes it */
+static RTC_DATA_ATTR uint32_t profile_magic;
+static RTC_DATA_ATTR BootProfile profile;
+
+static BootProfile previous;
+static bool previous_valid = false;
+
+void app_diag_init(void) {
+    /* RTC memory is not initialized after a power-on reset */
+    if (profile_magic == DIAG_MAGIC) {
+        previous = profile;
+        previous_valid = true;
+    }
+
+    profile = (BootProfile)BootProfile_init_zero;
+    profile.wake_cause = esp_sleep_get_wakeup_cause();
+    profile_magic = DIAG_MAGIC;
+
+    app_diag_mark(DIAG_PHASE_BOOT);
+}
+
+void app_diag_mark(diag_phase_t phase) {
+    bool* has;
+    uint32_t* ms;
+
+    switch (phase) {
+        case DIAG_PHASE_BOOT:           has = &profile.has_boot_ms;             ms = &profile.boot_ms; break;
+        case DIAG_PHASE_NVS:            has = &profile.has_nvs_ms;              ms = &profile.nvs_ms; break;
+        case DIAG_PHASE_WIFI_INIT:      has = &profile.has_wifi_init_ms;        ms = &profile.wifi_init_ms; break;
+        case DIAG_PHASE_WIFI_START:     has = &profile.has_wifi_start_ms;       ms = &profile.wifi_start_ms; break;
+        case DIAG_PHASE_WIFI_CONNECTED: has = &profile.has_wifi_connected_ms;   ms = &profile.wifi_connected_ms; break;
+        case DIAG_PHASE_SNTP_SYNCED:    has = &profile.has_sntp_synced_ms;      ms = &profile.sntp_synced_ms; break;
+        case DIAG_PHASE_MQTT_CONNECTED: has = &profile.has_mqtt_connected_ms;   ms = &profile.mqtt_connected_ms; break;
+        case DIAG_PHASE_FIRST_PUBACK:   has = &profile.has_first_puback_ms;     ms = &profile.first_puback_ms; break;
+        case DIAG_PHASE_SLEEP:          has = &profile.has_sleep_ms;            ms = &profile.sleep_ms; break;
+        default:
+            return;
+    }
+
+    if (*has) {
+        return;
+    }
+
+    *ms = (uint32_t)(timebase_now_us() / 1000);
+    *has = true;
+
+    /* Wall time is only right once SNTP synced, refresh it on every phase */
+    profile.timestamp = timebase_wall_ms(0);
+
+    ESP_LOGI(TAG, "Phase %s at %lu ms", phase_names[phase], *ms);
+}
+
+void app_diag_wifi_start(bool provisioning) {
+    app_diag_mark(DIAG_PHASE_WIFI_START);
+
+    profile.has_heap_free = true;
+    profile.heap_free = esp_get_free_heap_size();
+    profile.has_provisioning = true;
+    profile.provisioning = provisioning;
+
+    /* One JSON object per line so it can be scraped from the console */
+    ESP_LOGI(TAG, "boot {\"path\":\"%s\",\"wifi_start_ms\":%lu,\"heap_free\":%lu}",
+             provisioning ? "provisioning" : "provisioned", profile.wifi_start_ms, profile.heap_free);
+}
+
+void app_diag_sleep_flush(uint32_t flush_ms, uint32_t unsent, uint32_t lost) {
+    profile.has_sleep_flush_ms = true;
+    profile.sleep_flush_ms = flush_ms;
+    profile.has_sleep_batches_unsent = true;
+    profile.sleep_batches_unsent = unsent;
+    profile.has_sleep_batches_lost = true;
+    profile.sleep_batches_lost = lost;
+
+    ESP_LOGI(TAG, "Sleep flush took %lu ms, %lu batches unsent, %lu lost", flush_ms, unsent, lost);
+}
+
+size_t app_diag_take(uint8_t* buffer, size_t size) {
+    if (!previous_valid) {
+        return 0;
+    }
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, size);
+    if (!pb_encode(&stream, BootProfile_fields, &previous)) {
+        ESP_LOGE(TAG, "Failed to encode boot profile: %s", PB_GET_ERROR(&stream));
+        return 0;
+    }
+
+    previous_valid = false;
+    return stream.bytes_written;
+}
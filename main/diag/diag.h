@@ -0,0 +1,40 @@
+#ifndef DIAG_H_
+#define DIAG_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "boot_profile.pb.h"
+
+typedef enum {
+    DIAG_PHASE_BOOT,
+    DIAG_PHASE_NVS,
+    DIAG_PHASE_WIFI_INIT,
+    DIAG_PHASE_WIFI_START,
+    DIAG_PHASE_WIFI_CONNECTED,
+    DIAG_PHASE_SNTP_SYNCED,
+    DIAG_PHASE_MQTT_CONNECTED,
+    DIAG_PHASE_FIRST_PUBACK,
+    DIAG_PHASE_SLEEP,
+} diag_phase_t;
+
+/* Starts the profile of this wake, the one of the previous wake becomes available to app_diag_take */
+void app_diag_init(void);
+
+/* Records the time since startup at which a phase was first reached in this wake.
+ * The profile lives in RTC memory, so phases up to deep sleep entry survive it. */
+void app_diag_mark(diag_phase_t phase);
+
+/* Marks DIAG_PHASE_WIFI_START once the STA, the relay leaf or BLE provisioning was started, with the free heap
+ * at that point. provisioning tells the two boot paths apart. */
+void app_diag_wifi_start(bool provisioning);
+
+/* Records how the batches of this wake fared at deep sleep entry: time spent waiting for PUBACKs,
+ * batches left in flash for the next wake and unacknowledged batches lost because the store did not take them */
+void app_diag_sleep_flush(uint32_t flush_ms, uint32_t unsent, uint32_t lost);
+
+/* Encodes the profile of the previous wake once, returns the number of bytes written or 0 if there is none */
+size_t app_diag_take(uint8_t* buffer, size_t size);
+
+#endif
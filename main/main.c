@@ -10,9 +10,6 @@
 #include <esp_event.h>
 #include <nvs_flash.h>
 
-#include <wifi_provisioning/manager.h>
-#include <wifi_provisioning/scheme_ble.h>
-
 #include "sdkconfig.h"
 
 #include "common.h"
@@ -20,9 +17,16 @@
 #include "sntp.h"
 #include "mqtt.h"
 #include "sensors.h"
+#include "store.h"
+#include "sleep.h"
+#include "diag.h"
+#include "timebase.h"
+#include "settings.h"
+#include "ota.h"
+#include "power.h"
+#include "relay.h"
 
 #include "esp_mac.h"
-#include "esp_pm.h"
 
 #include "esp_sleep.h"
 
@@ -33,6 +37,7 @@
 #include "driver/rtc_io.h"
 #include "ulp.h"
 #include "ulp_main.h"
+#include "ulp_config.h"
 
 static const char *TAG = "app";
 
@@ -55,25 +60,35 @@ void nvs_init() {
 
 void app_main(void)
 {
+    timebase_init();
+    app_diag_init();
+
+    // Initialize Power Management
+    app_power_init();
+
+    // Initialize NVS
+    nvs_init();
+    app_diag_mark(DIAG_PHASE_NVS);
+
+    /* The saved config tunes the ULP and the sensors */
+    app_settings_init();
+
+    /* A new image has to reach the broker before it is kept */
+    app_ota_init();
+
+    /* Whether this wake reports through a relay gateway */
+    app_relay_init();
+
     esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
     if (cause != ESP_SLEEP_WAKEUP_ULP) {
         printf("Not ULP wakeup, initializing ULP\n");
         init_ulp_program();
     } else {
-        printf("ULP wakeup\n");
+        /* The ULP keeps running while awake, ADC1 belongs to the sensors again */
+        ulp_pressure_enabled = 0;
+        printf("ULP wakeup, pressure wake reason: %lu\n", ulp_pressure_wake_reason & UINT16_MAX);
     }
 
-    // Initialize Power Management
-    esp_pm_config_t pm_config = {
-        .max_freq_mhz = 160,
-        .min_freq_mhz = 80,
-        .light_sleep_enable = false,
-    };
-    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
-
-    // Initialize NVS
-    nvs_init();
-
     app_device_id_init();
     const char* device_id = app_get_device_id();
 
@@ -92,42 +107,57 @@ void app_main(void)
 
     app_sntp_init();
     app_sensors_init();
+    app_store_init();
     app_mqtt_init();
     app_wifi_init();
-    app_prov_init();
+    app_diag_mark(DIAG_PHASE_WIFI_INIT);
 
-    bool provisioned = false;
-    ESP_ERROR_CHECK(wifi_prov_mgr_is_provisioned(&provisioned));
+    /* The BT controller only comes up for provisioning, a provisioned wake gives its memory to the heap */
+    bool provisioned = app_prov_is_provisioned();
 
     if (!provisioned) {
+        app_prov_init();
         app_prov_start();
     } else {
-        ESP_LOGI(TAG, "Already provisioned, starting Wi-Fi STA");
-        // app_prov_stop();
-        ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &prov_event_handler, NULL));
-        ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
-        ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM)); // for low power
-        ESP_ERROR_CHECK(esp_wifi_start());
+        app_prov_release_bt();
+        app_prov_button_init();
+
+        if (app_relay_is_leaf()) {
+            ESP_LOGI(TAG, "Access point out of reach, reporting through a relay gateway");
+            app_relay_start_leaf();
+        } else {
+            ESP_LOGI(TAG, "Already provisioned, starting Wi-Fi STA");
+            ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &prov_event_handler, NULL));
+            app_wifi_start();
+        }
     }
+    app_diag_wifi_start(!provisioned);
 
-    /* Wait for Wi-Fi connection */
-    xEventGroupWaitBits(app_event_group, WIFI_CONNECTED_BIT, true, true, portMAX_DELAY);
+    /* A leaf samples and stores as usual, it never joins the access point */
+    if (!provisioned || !app_relay_is_leaf()) {
+        /* Wait for Wi-Fi connection */
+        xEventGroupWaitBits(app_event_group, WIFI_CONNECTED_BIT, true, true, portMAX_DELAY);
 
-    ESP_LOGI(TAG, "Connected to wifi");
+        ESP_LOGI(TAG, "Connected to wifi");
+        app_diag_mark(DIAG_PHASE_WIFI_CONNECTED);
 
-    app_sntp_start();
-    app_mqtt_start();
+        app_sntp_start();
+        app_mqtt_start();
+        app_relay_start_gateway();
+    }
 
     BaseType_t xReturned;
     TaskHandle_t xHandle = NULL;
 
-    xReturned = xTaskCreate(
+    /* Publishing runs on the PRO core, the sampler it starts is pinned to the APP core */
+    xReturned = xTaskCreatePinnedToCore(
         app_mqtt_task,
         "mqtt_task",
         8192,
         NULL,
         5,
-        &xHandle);
+        &xHandle,
+        PRO_CPU_NUM);
 
     if (xReturned != pdPASS) {
         ESP_LOGE(TAG, "Failed to create MQTT task");
@@ -137,6 +167,8 @@ void app_main(void)
 }
 
 void init_ulp_program(void) {
+    settings_t settings;
+    app_settings_get(&settings);
 
     ESP_ERROR_CHECK(ulp_load_binary(0, ulp_main_bin_start, (ulp_main_bin_end - ulp_main_bin_start) / sizeof(uint32_t)));
 
@@ -147,7 +179,10 @@ void init_ulp_program(void) {
     /* These variables exist in auto-generated ulp_main.h */
     ulp_next_edge = 0;
     ulp_io_number = rtcio_num;
-    ulp_edge_count_to_wake_up = 10;
+    ulp_edge_count_to_wake_up = settings.ulp_wake_edges;
+    ulp_ticks_per_bucket = SLEEP_BUCKET_MS * 1000 / settings.ulp_period_us;
+    /* Before the sensors are up, so without their calibration. Rewritten at every deep sleep. */
+    app_sleep_pressure_thresholds(&settings, PRESSURE_MIN_VALUE);
 
     /* Setup for the RTC pin */
     rtc_gpio_init(gpio_num);
@@ -158,10 +193,15 @@ void init_ulp_program(void) {
 
     esp_deep_sleep_disable_rom_logging(); // suppress boot messages
 
-    /* Set ULP wake up period to T = 20ms.
-     * Minimum pulse width has to be T * (ulp_debounce_counter + 1) = 80ms.
+    /* Set ULP wake up period to T, 20ms unless configured otherwise.
+     * Minimum pulse width has to be T * (ulp_debounce_counter + 1) = 80ms at 20ms.
      */
-    ulp_set_wakeup_period(0, 20000);
+    ulp_set_wakeup_period(0, settings.ulp_period_us);
 
     esp_sleep_enable_ulp_wakeup();
+
+#if CONFIG_POWER_LIGHT_SLEEP
+    /* Counts flow edges from now on, also in light sleep while the pulse counters are stopped */
+    ESP_ERROR_CHECK(ulp_run(&ulp_entry - RTC_SLOW_MEM));
+#endif
 }
\ No newline at end of file
@@ -28,18 +28,49 @@
 
 #include "pb_encode.h"
 #include "sample_batch.pb.h"
+#include "leak_event.pb.h"
+#include "pressure_transient.pb.h"
+#include "device_config.pb.h"
+#include "ota.pb.h"
+#include "codec.h"
+#include "batcher.h"
+#include "aggregate.h"
+#include "detect.h"
+#include "diag.h"
+#include "store.h"
+#include "sampler.h"
+#include "sleep.h"
 #include "sensors.h"
+#include "timebase.h"
+#include "settings.h"
+#include "ota.h"
+#include "relay.h"
 #include "common.h"
 #include "prov.h"
 #include "mqtt.h"
+#include "tls_transport.h"
 #include "esp_sleep.h"
-#include "driver/rtc_io.h"
-#include "ulp.h"
-#include "ulp_main.h"
-#include "esp_sleep.h"
+#include "esp_timer.h"
 
 static const char* TAG = "MQTT"; 
 
+/* Max size of a coalesced publish of stored batches */
+#define DRAIN_BUFFER_SIZE 4096
+/* Republish stored batches if no PUBACK arrived within this time */
+#define DRAIN_ACK_TIMEOUT_MS 30000
+/* Check for PUBACKs this often while flushing before deep sleep */
+#define SLEEP_FLUSH_POLL_MS 50
+/* Live batches whose PUBACK is tracked at the same time */
+#define LIVE_INFLIGHT_MAX 8
+/* PUBACKs kept for publish calls that have not returned their msg id yet */
+#define UNCLAIMED_ACKS_MAX 4
+/* Log the pipeline stats every this many live batches */
+#define PIPELINE_STATS_PERIOD 10
+/* Batches finished before the first SNTP sync are held here until their timestamps can be corrected */
+#define PRESYNC_BUFFER_SIZE 8192
+/* Leak events found before the first SNTP sync, held the same way */
+#define PRESYNC_EVENTS_MAX 8
+
 extern const uint8_t client_cert_pem_start[] asm("_binary_client_crt_start");
 extern const uint8_t client_cert_pem_end[] asm("_binary_client_crt_end");
 extern const uint8_t client_key_pem_start[] asm("_binary_client_key_start");
@@ -49,6 +80,271 @@ extern const uint8_t server_cert_pem_end[] asm("_binary_ca_crt_end");
 
 esp_mqtt_client_handle_t client;
 
+static char config_topic[64];
+static char config_ack_topic[64];
+static char ota_topic[64];
+static char ota_status_topic[64];
+
+/* PUBACKs are handled by the client task and can arrive before the publish call that sent the message
+ * returned its msg id. Everything in flight is tracked under this lock, and a PUBACK that matches nothing
+ * is kept as unclaimed until the publisher looks for its id. */
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct {
+    int msg_ids[UNCLAIMED_ACKS_MAX];
+    uint32_t next;
+} unclaimed = { .msg_ids = { [0 ... UNCLAIMED_ACKS_MAX - 1] = -1 } };
+
+/* drain.msg_id while nothing is in flight, and while the publish call has not returned */
+#define DRAIN_IDLE -1
+#define DRAIN_SENDING -2
+
+/* Stored batches published but not yet acknowledged */
+static struct {
+    volatile int msg_id;
+    uint32_t count;
+    uint32_t dropped;
+    int64_t sent_at;
+} drain = { .msg_id = DRAIN_IDLE };
+
+static uint8_t drain_buffer[DRAIN_BUFFER_SIZE];
+
+/* Live batch, samples are encoded into the arena as they arrive and finished into batch_buffer */
+static batcher_t batcher;
+static uint8_t batch_arena[CONFIG_BATCH_MAX_BYTES];
+static uint8_t batch_buffer[CONFIG_BATCH_MAX_BYTES];
+
+/* Cost of the sample -> encode -> publish path for live batches */
+static struct {
+    uint32_t batches;
+    uint32_t samples;
+    uint32_t bytes;
+    int64_t encode_us;
+    int64_t encode_us_max;
+    int64_t latency_ms;     // newest sample of a batch to its publish call
+    int64_t latency_ms_max;
+    uint32_t stack_free_min;
+} pipeline;
+
+/* live.msg_ids entries besides a msg id */
+#define LIVE_FREE -1
+#define LIVE_SENDING -2
+#define LIVE_STORING -3
+
+/* Live batches published directly and not acknowledged yet, with their encoded bytes.
+ * The client outbox does not survive deep sleep or an expiry, so a batch still unacknowledged then
+ * goes to flash from here. A batch is only published live while a slot is free, otherwise it goes
+ * to flash like offline. */
+static struct {
+    int msg_ids[LIVE_INFLIGHT_MAX];
+    uint16_t lens[LIVE_INFLIGHT_MAX];
+    uint8_t data[LIVE_INFLIGHT_MAX][CONFIG_BATCH_MAX_BYTES];
+    uint32_t full;              // batches stored because every slot was in flight
+    uint32_t lost;              // unacknowledged batches the store did not take, since the last sleep
+} live = { .msg_ids = { [0 ... LIVE_INFLIGHT_MAX - 1] = LIVE_FREE } };
+
+/* Consecutive batches without activity, the device sleeps after CONFIG_SLEEP_QUIET_BATCHES */
+static uint32_t quiet_batches = 0;
+/* Set while the last batch before deep sleep is published, it goes to flash first */
+static bool sleep_pending = false;
+
+/* Length prefixed batches, oldest first. Sampling goes on while the clock is unsynced, the oldest
+ * batches are dropped if the sync takes longer than the buffer lasts. */
+static struct {
+    uint8_t buffer[PRESYNC_BUFFER_SIZE];
+    size_t used;
+    uint32_t dropped;
+} presync;
+
+/* Decoded, oldest first, so the correction can move their timestamps like those of the held batches */
+static struct {
+    LeakEvent events[PRESYNC_EVENTS_MAX];
+    size_t count;
+    uint32_t dropped;
+} presync_events;
+
+/* Set once the wall clock offset of everything in the pipeline is right, i.e. the first SNTP sync
+ * since power-on was applied. Checked instead of timebase_valid so a sync between two corrections
+ * cannot let a batch with the old offset through. Cleared again by clock_valid once the error bound
+ * outgrew CONFIG_TIME_VALID_MAX_ERROR_S, set by the correction of the next sync. */
+static bool clock_synced = false;
+
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+/* Capture being uploaded, one chunk per loop so live batches are not held up by it */
+static struct {
+    PressureTransientChunk chunk;       // header of the capture, data is filled per chunk
+    uint8_t blob[SENSORS_CAPTURE_MAX_SAMPLES * 3]; // deltas fit 3 varint bytes at 1/10000
+    size_t len;
+    size_t sent;
+    bool active;
+} transient;
+#endif
+
+static detect_t detector;
+
+#if CONFIG_AGGREGATE_IDLE
+/* Most summaries per SampleSummaryBatch, bounded by its max_count and by the size of a stored record */
+#define SUMMARY_MAX_COUNT (sizeof(((SampleSummaryBatch*)0)->summaries) / sizeof(SampleSummary))
+/* Tag and a length of up to 2 bytes per summary */
+#define SUMMARY_FIT_COUNT (CONFIG_BATCH_MAX_BYTES / (SampleSummary_size + 3))
+#define SUMMARY_BATCH_MAX (SUMMARY_FIT_COUNT < SUMMARY_MAX_COUNT ? SUMMARY_FIT_COUNT : SUMMARY_MAX_COUNT)
+
+static aggregate_t aggregator;
+/* Closed windows not published yet, kept decoded so a clock correction can still move them */
+static SampleSummaryBatch summaries;
+static uint32_t summaries_dropped = 0;
+static uint8_t summary_buffer[CONFIG_BATCH_MAX_BYTES];
+#endif
+
+#if !CONFIG_RAW_UPLOAD_ALWAYS
+/* Raw batches are published up to this timestamp (ms), 0 while no event happened */
+static uint64_t raw_until = 0;
+
+/* Last unpublished batch, sent as context if the next one contains an event */
+static uint8_t held_buffer[CONFIG_BATCH_MAX_BYTES];
+static size_t held_len = 0;
+#endif
+
+/* Applies a DeviceConfig and acknowledges it on the reply topic, whatever the outcome */
+static void handle_config(const char* data, int len) {
+    DeviceConfigAck ack = DeviceConfigAck_init_zero;
+    app_settings_apply((const uint8_t*)data, len, &ack);
+
+    uint8_t buffer[DeviceConfigAck_size];
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&stream, DeviceConfigAck_fields, &ack)) {
+        ESP_LOGE(TAG, "Failed to encode config ack");
+        return;
+    }
+    esp_mqtt_client_enqueue(client, config_ack_topic, (const char*)buffer, stream.bytes_written, QOS1, NO_RETAIN, true);
+}
+
+/* Removes msg_id from the unclaimed PUBACKs, returns false if it was not acknowledged yet. Called under ack_lock. */
+static bool unclaimed_take(int msg_id) {
+    for (int i = 0; i < UNCLAIMED_ACKS_MAX; ++i) {
+        if (unclaimed.msg_ids[i] == msg_id) {
+            unclaimed.msg_ids[i] = -1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Takes a slot for a live batch before it is published and keeps a copy of it, returns -1 if every
+ * slot is in flight */
+static int live_reserve(const uint8_t* data, size_t len) {
+    int slot = -1;
+    taskENTER_CRITICAL(&ack_lock);
+    for (int i = 0; i < LIVE_INFLIGHT_MAX; ++i) {
+        if (live.msg_ids[i] == LIVE_FREE) {
+            live.msg_ids[i] = LIVE_SENDING;
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        live.full++;
+    }
+    taskEXIT_CRITICAL(&ack_lock);
+
+    if (slot >= 0) {
+        memcpy(live.data[slot], data, len);
+        live.lens[slot] = (uint16_t)len;
+    }
+    return slot;
+}
+
+/* Records the msg id the publish call returned, the slot is freed if the call failed or the PUBACK
+ * was handled while it was still sending */
+static void live_track(int slot, int msg_id) {
+    taskENTER_CRITICAL(&ack_lock);
+    live.msg_ids[slot] = (msg_id < 0 || unclaimed_take(msg_id)) ? LIVE_FREE : msg_id;
+    taskEXIT_CRITICAL(&ack_lock);
+}
+
+/* Returns false if msg_id is not a live batch in flight. Called under ack_lock. */
+static bool live_acked(int msg_id) {
+    bool found = false;
+    for (int i = 0; i < LIVE_INFLIGHT_MAX; ++i) {
+        if (live.msg_ids[i] == msg_id) {
+            live.msg_ids[i] = LIVE_FREE;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/* Writes the copy of the live batch msg_id to flash, it is sent from there if no PUBACK comes.
+ * The slot is held while the flash write runs so no new batch can take it. */
+static void live_store(int msg_id) {
+    int slot = -1;
+    taskENTER_CRITICAL(&ack_lock);
+    for (int i = 0; i < LIVE_INFLIGHT_MAX; ++i) {
+        if (live.msg_ids[i] == msg_id) {
+            live.msg_ids[i] = LIVE_STORING;
+            slot = i;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&ack_lock);
+    if (slot < 0) {
+        return;
+    }
+
+    bool stored = app_store_append(live.data[slot], live.lens[slot]);
+
+    taskENTER_CRITICAL(&ack_lock);
+    live.msg_ids[slot] = LIVE_FREE;
+    live.lost += !stored;
+    taskEXIT_CRITICAL(&ack_lock);
+
+    if (stored) {
+        ESP_LOGW(TAG, "Stored unacknowledged live batch %d, %lu pending", msg_id, app_store_pending());
+    }
+}
+
+/* Moves every live batch still waiting for its PUBACK to flash */
+static void live_store_unacked(void) {
+    for (int i = 0; i < LIVE_INFLIGHT_MAX; ++i) {
+        taskENTER_CRITICAL(&ack_lock);
+        int msg_id = live.msg_ids[i];
+        taskEXIT_CRITICAL(&ack_lock);
+        if (msg_id >= 0) {
+            live_store(msg_id);
+        }
+    }
+}
+
+/* count stored batches were acknowledged, dropped is the ring's drop count when they were sent */
+static void drain_delivered(uint32_t count, uint32_t dropped) {
+    /* Only advance if the ring did not overwrite what was sent in the meantime */
+    if (dropped == app_store_dropped()) {
+        app_store_consume(count);
+        ESP_LOGI(TAG, "Delivered %lu stored batches, %lu pending", count, app_store_pending());
+    }
+}
+
+static void acked(int msg_id) {
+    bool delivered = false;
+    uint32_t count = 0;
+    uint32_t dropped = 0;
+
+    taskENTER_CRITICAL(&ack_lock);
+    if (msg_id == drain.msg_id) {
+        drain.msg_id = DRAIN_IDLE;
+        delivered = true;
+        count = drain.count;
+        dropped = drain.dropped;
+    } else if (!live_acked(msg_id)) {
+        unclaimed.msg_ids[unclaimed.next] = msg_id;
+        unclaimed.next = (unclaimed.next + 1) % UNCLAIMED_ACKS_MAX;
+    }
+    taskEXIT_CRITICAL(&ack_lock);
+
+    if (delivered) {
+        drain_delivered(count, dropped);
+    }
+}
+
 static void log_error_if_nonzero(const char *message, int error_code)
 {
     if (error_code != 0) {
@@ -64,10 +360,45 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
             xEventGroupSetBits(app_event_group, MQTT_CONNECTED_BIT);
+            app_diag_mark(DIAG_PHASE_MQTT_CONNECTED);
+            app_tls_session_save();
+            esp_mqtt_client_subscribe(client, config_topic, QOS1);
+            esp_mqtt_client_subscribe(client, ota_topic, QOS1);
+            app_ota_confirm();
             break;
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
             xEventGroupClearBits(app_event_group, MQTT_CONNECTED_BIT);
+            taskENTER_CRITICAL(&ack_lock);
+            if (drain.msg_id >= 0) {
+                drain.msg_id = DRAIN_IDLE;
+            }
+            taskEXIT_CRITICAL(&ack_lock);
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            app_diag_mark(DIAG_PHASE_FIRST_PUBACK);
+            acked(event->msg_id);
+            break;
+        case MQTT_EVENT_DELETED:
+            /* Expired in the outbox, no PUBACK will come. A live batch goes to flash, a stored drain is
+             * sent again on timeout. */
+            live_store(event->msg_id);
+            break;
+        case MQTT_EVENT_DATA:
+            if (event->topic_len == strlen(config_topic) && strncmp(event->topic, config_topic, event->topic_len) == 0) {
+                /* A config is a few dozen bytes, it never spans more than one event */
+                if (event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+                    handle_config(event->data, event->data_len);
+                } else {
+                    ESP_LOGE(TAG, "Ignoring fragmented config of %d bytes", event->total_data_len);
+                }
+            } else if (event->topic_len == strlen(ota_topic) && strncmp(event->topic, ota_topic, event->topic_len) == 0) {
+                if (event->current_data_offset == 0 && event->data_len == event->total_data_len) {
+                    app_ota_request((const uint8_t*)event->data, event->data_len);
+                } else {
+                    ESP_LOGE(TAG, "Ignoring fragmented update request of %d bytes", event->total_data_len);
+                }
+            }
             break;
         case MQTT_EVENT_ERROR:
             ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -91,16 +422,17 @@ void app_mqtt_init(void) {
 
     const char* device_id = app_get_device_id();
 
+    snprintf(config_topic, sizeof(config_topic), MQTT_TOPIC_CONFIG, device_id);
+    snprintf(config_ack_topic, sizeof(config_ack_topic), MQTT_TOPIC_CONFIG_ACK, device_id);
+    snprintf(ota_topic, sizeof(ota_topic), MQTT_TOPIC_OTA, device_id);
+    snprintf(ota_status_topic, sizeof(ota_status_topic), MQTT_TOPIC_OTA_STATUS, device_id);
+
+    /* The certificates go to the transport, which resumes the TLS session of the previous wake */
     const esp_mqtt_client_config_t mqtt_config = {
         .broker.address.uri = CONFIG_MQTT_BROKER_URL,
-        .broker.verification.certificate = (const char *)server_cert_pem_start,
-        .credentials = {
-            .authentication = {
-                .certificate = (const char *)client_cert_pem_start,
-                .key = (const char *)client_key_pem_start,
-            },
-            .client_id = device_id
-        }
+        .credentials.client_id = device_id,
+        .network.transport = app_tls_transport_init((const char *)server_cert_pem_start,
+            (const char *)client_cert_pem_start, (const char *)client_key_pem_start),
     };
 
     client = esp_mqtt_client_init(&mqtt_config);
@@ -111,56 +443,706 @@ void app_mqtt_start(void) {
     esp_mqtt_client_start(client);
 }
 
-bool should_stay_awake(SampleBatch* batch) {
-    for (int i = 0; i < SAMPLE_BATCH_SIZE; ++i)
-    {
-        if (batch->samples[i].flow != 0)
-            return true;
+static bool encode_stored_batches(pb_ostream_t *stream, const pb_field_t *field, void * const *arg) {
+    uint32_t* count = *arg;
+    static uint8_t record[CONFIG_BATCH_MAX_BYTES];
+    size_t len;
 
-        if (batch->samples[i].pressure > PRESSURE_MIN_VALUE)
-            return true;
+    ring_store_pos_t pos = app_store_begin();
+
+    while (*count < STORE_COALESCE_MAX && app_store_peek(&pos, record, sizeof(record), &len)) {
+        /* tag + length prefix + record */
+        if (stream->bytes_written + len + 3 > stream->max_size) {
+            break;
+        }
+
+        (*count)++;
+        if (len == 0) {
+            continue; // unreadable record, consumed together with the rest
+        }
+
+        /* An event record already is the events field of a bundle */
+        if (codec_is_event_record(record, len)) {
+            if (!pb_write(stream, record, len)) {
+                return false;
+            }
+            continue;
+        }
+
+        /* Summaries are stored along with the batches, they go into their own field of the bundle */
+        pb_size_t tag = codec_is_summary_batch(record, len) ? SampleBatchBundle_summaries_tag : SampleBatchBundle_batches_tag;
+        if (!pb_encode_tag(stream, PB_WT_STRING, tag) || !pb_encode_string(stream, record, len)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Publishes the oldest stored batches as one SampleBatchBundle, they are consumed on PUBACK */
+static void drain_store(void) {
+    if (drain.msg_id >= 0) {
+        if (esp_timer_get_time() - drain.sent_at < DRAIN_ACK_TIMEOUT_MS * 1000LL) {
+            return;
+        }
+        ESP_LOGW(TAG, "No PUBACK for stored batches, republishing");
+        taskENTER_CRITICAL(&ack_lock);
+        drain.msg_id = DRAIN_IDLE;
+        taskEXIT_CRITICAL(&ack_lock);
+    }
+
+    if (app_store_pending() == 0) {
+        return;
+    }
+
+    uint32_t count = 0;
+    SampleBatchBundle bundle = SampleBatchBundle_init_zero;
+    bundle.batches.funcs.encode = encode_stored_batches;
+    bundle.batches.arg = &count;
+
+    pb_ostream_t stream = pb_ostream_from_buffer(drain_buffer, sizeof(drain_buffer));
+    if (!pb_encode(&stream, SampleBatchBundle_fields, &bundle) || count == 0) {
+        ESP_LOGE(TAG, "Failed to encode stored batches");
+        return;
+    }
+
+    uint32_t dropped = app_store_dropped();
+    taskENTER_CRITICAL(&ack_lock);
+    drain.count = count;
+    drain.dropped = dropped;
+    drain.sent_at = esp_timer_get_time();
+    drain.msg_id = DRAIN_SENDING;
+    taskEXIT_CRITICAL(&ack_lock);
+
+    int msg_id = esp_mqtt_client_publish(client, MQTT_TOPIC_DATA_V2_BUNDLE, (const char*)drain_buffer, stream.bytes_written, QOS1, NO_RETAIN);
+
+    /* The PUBACK may have been handled while the call was still sending */
+    bool delivered = false;
+    taskENTER_CRITICAL(&ack_lock);
+    if (msg_id < 0) {
+        drain.msg_id = DRAIN_IDLE;
+    } else if (unclaimed_take(msg_id)) {
+        drain.msg_id = DRAIN_IDLE;
+        delivered = true;
+    } else {
+        drain.msg_id = msg_id;
+    }
+    taskEXIT_CRITICAL(&ack_lock);
+
+    if (msg_id < 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Sending %lu stored batches in %d bytes", count, stream.bytes_written);
+    if (delivered) {
+        drain_delivered(count, dropped);
+    }
+}
+
+/* Without a sync for long, e.g. WiFi gone for hours, the error bound grows past the limit and everything
+ * finished from then on is held again until the next sync corrects it */
+static bool clock_valid(void) {
+    if (clock_synced && !timebase_valid()) {
+        clock_synced = false;
+        xEventGroupClearBits(app_event_group, TIME_SYNCED_BIT);
+        ESP_LOGW(TAG, "Clock error %lu ms beyond the limit, holding batches until the next sync", timebase_error_ms());
+    }
+    return clock_synced;
+}
+
+/* Appends a batch to the presync buffer, dropping the oldest ones if it is full */
+static void presync_hold(const uint8_t* data, size_t len) {
+    size_t needed = len + sizeof(uint16_t);
+    if (needed > sizeof(presync.buffer)) {
+        return;
+    }
+
+    size_t dropped = 0;
+    while (presync.used - dropped + needed > sizeof(presync.buffer)) {
+        uint16_t record;
+        memcpy(&record, presync.buffer + dropped, sizeof(record));
+        dropped += sizeof(record) + record;
+        presync.dropped++;
+    }
+    if (dropped > 0) {
+        memmove(presync.buffer, presync.buffer + dropped, presync.used - dropped);
+        presync.used -= dropped;
+        ESP_LOGW(TAG, "Clock still unsynced, dropped %lu batches so far", presync.dropped);
+    }
+
+    uint16_t record = (uint16_t)len;
+    memcpy(presync.buffer + presync.used, &record, sizeof(record));
+    memcpy(presync.buffer + presync.used + sizeof(record), data, len);
+    presync.used += needed;
+}
+
+/* Publishes directly while connected and nothing is backlogged, otherwise keeps the batch in flash.
+ * Until the clock synced, batches stay in RAM so their timestamps can still be corrected.
+ * The last batch before deep sleep always goes to flash and is sent from there. */
+static void publish_or_store(const uint8_t* data, size_t len) {
+    if (!clock_valid()) {
+        presync_hold(data, len);
+        return;
+    }
+
+    EventBits_t bits = xEventGroupGetBits(app_event_group);
+
+    if ((bits & MQTT_CONNECTED_BIT) && app_store_pending() == 0 && !sleep_pending) {
+        int slot = live_reserve(data, len);
+        if (slot >= 0) {
+            const char* topic = codec_is_summary_batch(data, len) ? MQTT_TOPIC_DATA_V2_SUMMARY : MQTT_TOPIC_DATA_V2;
+            int msg_id = esp_mqtt_client_publish(client, topic, (const char*)data, len, QOS1, NO_RETAIN);
+            live_track(slot, msg_id);
+            if (msg_id >= 0) {
+                return;
+            }
+        } else {
+            ESP_LOGW(TAG, "%d live batches without PUBACK, storing", LIVE_INFLIGHT_MAX);
+        }
+    }
+
+    if (app_store_append(data, len)) {
+        ESP_LOGI(TAG, "Stored batch, %lu pending", app_store_pending());
+    }
+}
+
+static void send_event(const LeakEvent* message) {
+    if (app_relay_is_leaf()) {
+        /* A leaf has no broker and its RAM is gone at deep sleep, the event goes through the store and the gateway */
+        uint8_t record[CODEC_EVENT_RECORD_HEADER + LeakEvent_size];
+        size_t len = codec_event_record(message, record, sizeof(record));
+        if (len == 0 || !app_store_append(record, len)) {
+            ESP_LOGE(TAG, "Failed to store leak event");
+        }
+        return;
+    }
+
+    uint8_t buffer[LeakEvent_size];
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&stream, LeakEvent_fields, message)) {
+        ESP_LOGE(TAG, "Failed to encode leak event");
+        return;
+    }
+
+    /* Queued in the client outbox if the broker is not reachable right now */
+    esp_mqtt_client_enqueue(client, MQTT_TOPIC_EVENTS, (const char*)buffer, stream.bytes_written, QOS1, NO_RETAIN, true);
+}
+
+/* Until the clock synced, events stay in RAM with the batches around them, the oldest one goes if
+ * the sync takes longer than PRESYNC_EVENTS_MAX events */
+static void presync_hold_event(const LeakEvent* message) {
+    if (presync_events.count == PRESYNC_EVENTS_MAX) {
+        memmove(&presync_events.events[0], &presync_events.events[1], (PRESYNC_EVENTS_MAX - 1) * sizeof(LeakEvent));
+        presync_events.count--;
+        presync_events.dropped++;
+        ESP_LOGW(TAG, "Clock still unsynced, dropped %lu leak events so far", presync_events.dropped);
+    }
+    presync_events.events[presync_events.count++] = *message;
+}
+
+static void publish_event(const detect_event_t* event) {
+    LeakEvent message = {
+        .type = (LeakEventType)event->type,
+        .timestamp = event->timestamp,
+        .value = event->value,
+        .baseline = event->baseline,
+    };
+    ESP_LOGW(TAG, "Leak event %d, value %.4f, baseline %.4f", event->type, event->value, event->baseline);
+
+    if (clock_valid()) {
+        send_event(&message);
+    } else {
+        presync_hold_event(&message);
+    }
+
+#if !CONFIG_RAW_UPLOAD_ALWAYS
+    raw_until = event->timestamp + CONFIG_RAW_UPLOAD_HOLD_S * 1000ULL;
+#endif
+}
+
+static void detect_sample(const Sample* sample) {
+    detect_event_t event;
+    if (detect_update(&detector, sample->timestamp, sample->flow, sample->pressure, &event)) {
+        publish_event(&event);
+    }
+}
+
+/* Raw batches go out always, or only around leak events */
+static void publish_raw(const batcher_t* batch, const uint8_t* data, size_t len) {
+#if CONFIG_RAW_UPLOAD_ALWAYS
+    publish_or_store(data, len);
+#else
+    if (raw_until != 0 && batch->first.timestamp <= raw_until) {
+        if (held_len > 0) {
+            publish_or_store(held_buffer, held_len);
+            held_len = 0;
+        }
+        publish_or_store(data, len);
+    } else {
+        memcpy(held_buffer, data, len);
+        held_len = len;
+    }
+#endif
+}
+
+static void pipeline_log_stats(void) {
+    if (pipeline.batches == 0 || pipeline.samples == 0) {
+        return;
     }
 
+    /* One JSON object per line so it can be scraped from the console */
+    ESP_LOGI(TAG, "pipeline {\"batches\":%lu,\"samples\":%lu,\"bytes_per_sample\":%.2f,"
+        "\"encode_us_avg\":%lld,\"encode_us_max\":%lld,\"latency_ms_avg\":%lld,\"latency_ms_max\":%lld,"
+        "\"heap_free_min\":%lu,\"stack_free_min\":%lu,\"live_full\":%lu}",
+        pipeline.batches, pipeline.samples, (float)pipeline.bytes / pipeline.samples,
+        pipeline.encode_us / pipeline.batches, pipeline.encode_us_max,
+        pipeline.latency_ms / pipeline.batches, pipeline.latency_ms_max,
+        esp_get_minimum_free_heap_size(), pipeline.stack_free_min, live.full);
+}
+
+static void pipeline_record(const batcher_t* batch, size_t len, int64_t encode_us) {
+    int64_t now_ms = (int64_t)timebase_wall_ms(timebase_now_us());
+    int64_t latency_ms = now_ms - (int64_t)batch->last.timestamp;
+
+    pipeline.batches++;
+    pipeline.samples += batcher_count(batch);
+    pipeline.bytes += len;
+    pipeline.encode_us += encode_us;
+    pipeline.latency_ms += latency_ms;
+    if (encode_us > pipeline.encode_us_max) {
+        pipeline.encode_us_max = encode_us;
+    }
+    if (latency_ms > pipeline.latency_ms_max) {
+        pipeline.latency_ms_max = latency_ms;
+    }
+    /* Bytes of this task's stack never used so far */
+    pipeline.stack_free_min = uxTaskGetStackHighWaterMark(NULL);
+
+    if (pipeline.batches % PIPELINE_STATS_PERIOD == 0) {
+        pipeline_log_stats();
+    }
+}
+
+/* The previous wake's profile goes out along with the first batch of this one */
+static void publish_boot_profile(void) {
+    uint8_t buffer[BootProfile_size];
+    size_t len = app_diag_take(buffer, sizeof(buffer));
+    if (len > 0) {
+        esp_mqtt_client_enqueue(client, MQTT_TOPIC_DIAG_BOOT, (const char*)buffer, len, QOS1, NO_RETAIN, true);
+    }
+}
+
+static void publish_ota_status(void) {
+    uint8_t buffer[OtaStatus_size];
+    size_t len = app_ota_take_status(buffer, sizeof(buffer));
+    if (len > 0) {
+        esp_mqtt_client_enqueue(client, ota_status_topic, (const char*)buffer, len, QOS1, NO_RETAIN, true);
+    }
+}
+
+/* Counts consecutive quiet batches or summary windows, true once the device may sleep */
+static bool count_quiet(bool idle) {
+    quiet_batches = idle ? quiet_batches + 1 : 0;
+
+#if CONFIG_RELAY_GATEWAY
+    /* Leaves may send at any time */
     return false;
+#endif
+
+    /* Batches held for a sync live in RAM, stay awake until they went out, and during an update */
+    return quiet_batches >= CONFIG_SLEEP_QUIET_BATCHES && clock_valid() && !app_ota_in_progress();
+}
+
+#if CONFIG_AGGREGATE_IDLE
+/* Publishes the pending summaries as one SampleSummaryBatch, they wait in RAM until the clock synced */
+static void flush_summaries(void) {
+    if (summaries.summaries_count == 0 || !clock_valid()) {
+        return;
+    }
+
+    pb_ostream_t stream = pb_ostream_from_buffer(summary_buffer, sizeof(summary_buffer));
+    if (pb_encode(&stream, SampleSummaryBatch_fields, &summaries)) {
+        publish_or_store(summary_buffer, stream.bytes_written);
+    } else {
+        ESP_LOGE(TAG, "Failed to encode summaries: %s", PB_GET_ERROR(&stream));
+    }
+    summaries.summaries_count = 0;
+}
+
+static void summary_append(const aggregate_window_t* window) {
+    if (summaries.summaries_count == SUMMARY_BATCH_MAX) {
+        flush_summaries();
+    }
+
+    /* Still full while unsynced, the oldest window goes */
+    if (summaries.summaries_count == SUMMARY_BATCH_MAX) {
+        memmove(&summaries.summaries[0], &summaries.summaries[1], (SUMMARY_BATCH_MAX - 1) * sizeof(SampleSummary));
+        summaries.summaries_count--;
+        summaries_dropped++;
+        ESP_LOGW(TAG, "Clock still unsynced, dropped %lu summaries so far", summaries_dropped);
+    }
+
+    aggregate_summary(window, &summaries.summaries[summaries.summaries_count++]);
+}
+#endif
+
+/* Publishes what is in flash and waits for the outbox to empty, bounded by CONFIG_SLEEP_ACK_TIMEOUT_MS,
+ * then disconnects and sleeps. Unacknowledged stored batches stay in flash for the next wake, unacknowledged
+ * live batches are written there. */
+static void sleep_transition(const Sample* last) {
+#if CONFIG_AGGREGATE_IDLE
+    /* The open window and the pending summaries go to flash with the last batch */
+    aggregate_window_t window;
+    if (aggregate_close(&aggregator, &window)) {
+        summary_append(&window);
+    }
+    flush_summaries();
+#endif
+
+    int64_t started = esp_timer_get_time();
+    int64_t deadline = started + CONFIG_SLEEP_ACK_TIMEOUT_MS * 1000LL;
+
+    while (esp_timer_get_time() < deadline && (xEventGroupGetBits(app_event_group) & MQTT_CONNECTED_BIT)) {
+        drain_store();
+        if (app_store_pending() == 0 && esp_mqtt_client_get_outbox_size(client) == 0) {
+            break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(SLEEP_FLUSH_POLL_MS));
+    }
+
+    /* A leaf never connects, its store goes to the gateway */
+    if (app_relay_is_leaf()) {
+        app_relay_flush(CONFIG_SLEEP_ACK_TIMEOUT_MS);
+    }
+
+    live_store_unacked();
+    taskENTER_CRITICAL(&ack_lock);
+    uint32_t lost = live.lost;
+    live.lost = 0;
+    taskEXIT_CRITICAL(&ack_lock);
+    app_diag_sleep_flush((uint32_t)((esp_timer_get_time() - started) / 1000), app_store_pending(), lost);
+
+    /* A clean DISCONNECT, the broker does not wait for the keepalive to drop the session */
+    if (!app_relay_is_leaf()) {
+        esp_mqtt_client_disconnect(client);
+        esp_mqtt_client_stop(client);
+    }
+
+    app_sleep_enter(last);
+}
+
+static void flush_batch(void) {
+    if (batcher_count(&batcher) == 0) {
+        return;
+    }
+
+    int64_t started = esp_timer_get_time();
+    size_t len = batcher_finish(&batcher, batch_buffer, sizeof(batch_buffer));
+    int64_t encode_us = esp_timer_get_time() - started;
+
+    ESP_LOGI(TAG, "Sending %d bytes", len);
+    ESP_LOGI(TAG, "Sending %lu samples", batcher_count(&batcher));
+
+    sleep_pending = count_quiet(batcher_is_idle(&batcher));
+    Sample last = batcher.last;
+
+    if (len > 0) {
+        pipeline_record(&batcher, len, encode_us);
+        publish_boot_profile();
+        publish_raw(&batcher, batch_buffer, len);
+    } else {
+        ESP_LOGE(TAG, "Failed to encode batch");
+    }
+    batcher_reset(&batcher);
+
+    if (sleep_pending) {
+        ESP_LOGI(TAG, "Deep sleep after %lu quiet batches", quiet_batches);
+        sleep_transition(&last);
+    }
+}
+
+/* Samples that do not belong into the current batch start the next one */
+static void batch_sample(const Sample* sample) {
+    if (!batcher_add(&batcher, sample)) {
+        flush_batch();
+        if (!batcher_add(&batcher, sample)) {
+            ESP_LOGE(TAG, "Sample does not fit an empty batch");
+        }
+    }
+
+    if (batcher_is_complete(&batcher)) {
+        flush_batch();
+    }
+}
+
+#if CONFIG_AGGREGATE_IDLE
+/* Samples that moved beyond the deadband are batched as before, the others are summarized */
+static void aggregate_sample(const Sample* sample) {
+    aggregate_window_t window;
+    bool closed;
+
+    aggregate_result_t result = aggregate_add(&aggregator, sample, &window, &closed);
+    if (closed) {
+        summary_append(&window);
+    }
+
+    if (result == AGGREGATE_RAW) {
+        batch_sample(sample);
+        return;
+    }
+
+    /* Raw samples wait for the next run as long as a batch would, up to the window before sleep */
+    if (batcher_count(&batcher) > 0 && (closed || sample->timestamp - batcher.first.timestamp >= batcher.config.max_age_ms)) {
+        flush_batch();
+        if (sleep_pending) {
+            return;
+        }
+    }
+
+    if (!closed) {
+        return;
+    }
+
+    /* A window without flow and at rest pressure counts like an idle batch */
+    bool idle = window.flow.max == 0 && window.pressure.max <= batcher.config.pressure_min;
+    if (count_quiet(idle)) {
+        ESP_LOGI(TAG, "Deep sleep after %lu quiet windows", quiet_batches);
+        sleep_pending = true;
+        sleep_transition(sample);
+    }
+}
+#endif
+
+/* Flow recorded by the ULP during deep sleep goes out ahead of the live samples,
+ * as few batches as the byte budget allows */
+static void backfill_samples(void) {
+    static Sample backfill[SLEEP_BACKFILL_MAX];
+    size_t backfilled = app_sleep_backfill(backfill, SLEEP_BACKFILL_MAX);
+
+    for (size_t i = 0; i <= backfilled; ++i) {
+        if (i < backfilled && batcher_add(&batcher, &backfill[i])) {
+            continue;
+        }
+
+        size_t len = batcher_finish(&batcher, batch_buffer, sizeof(batch_buffer));
+        if (len > 0) {
+            publish_or_store(batch_buffer, len);
+        }
+        batcher_reset(&batcher);
+
+        if (i < backfilled) {
+            batcher_add(&batcher, &backfill[i]);
+        }
+    }
+}
+
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+/* Takes a frozen capture once the previous one went out, the trigger stays blocked until then */
+static bool transient_begin(void) {
+    static float pressure[SENSORS_CAPTURE_MAX_SAMPLES];
+    pressure_capture_t capture;
+
+    if (!app_sensors_capture_take(&capture, pressure, SENSORS_CAPTURE_MAX_SAMPLES)) {
+        return false;
+    }
+
+    transient.len = codec_transient_encode(pressure, capture.count, transient.blob, sizeof(transient.blob));
+    if (transient.len == 0) {
+        ESP_LOGE(TAG, "Failed to encode pressure transient");
+        return false;
+    }
+
+    const size_t chunk_size = sizeof(transient.chunk.data.bytes);
+    transient.chunk.capture_id++;
+    transient.chunk.chunk = 0;
+    transient.chunk.chunks = (transient.len + chunk_size - 1) / chunk_size;
+    transient.chunk.trigger_timestamp = timebase_wall_ms(capture.trigger_us);
+    transient.chunk.sample_rate_hz = capture.sample_rate_hz;
+    transient.chunk.pre_samples = capture.pre_samples;
+    transient.chunk.samples = capture.count;
+    transient.sent = 0;
+    transient.active = true;
+
+    ESP_LOGW(TAG, "Pressure transient captured, %d samples in %d bytes", capture.count, transient.len);
+    return true;
+}
+
+static void transient_upload(void) {
+    /* The trigger timestamp is only right once the clock synced */
+    if (!clock_valid() || !(xEventGroupGetBits(app_event_group) & MQTT_CONNECTED_BIT)) {
+        return;
+    }
+    if (!transient.active && !transient_begin()) {
+        return;
+    }
+
+    size_t n = transient.len - transient.sent;
+    if (n > sizeof(transient.chunk.data.bytes)) {
+        n = sizeof(transient.chunk.data.bytes);
+    }
+    memcpy(transient.chunk.data.bytes, transient.blob + transient.sent, n);
+    transient.chunk.data.size = n;
+
+    static uint8_t buffer[PressureTransientChunk_size];
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&stream, PressureTransientChunk_fields, &transient.chunk)) {
+        ESP_LOGE(TAG, "Failed to encode transient chunk");
+        transient.active = false;
+        return;
+    }
+
+    /* Handed to the client outbox, retried on the next loop if it is full */
+    if (esp_mqtt_client_enqueue(client, MQTT_TOPIC_TRANSIENT, (const char*)buffer, stream.bytes_written, QOS1, NO_RETAIN, true) < 0) {
+        return;
+    }
+
+    transient.sent += n;
+    transient.chunk.chunk++;
+    transient.active = transient.sent < transient.len;
+}
+#endif
+
+#if CONFIG_RELAY_GATEWAY
+/* Records of leaf nodes, left with the gateway while the broker is not reachable so leaves hold
+ * them in their own flash meanwhile */
+static void publish_relayed(void) {
+    static uint8_t buffer[RELAY_BUNDLE_SIZE];
+
+    size_t len = app_relay_take_bundle(buffer, sizeof(buffer));
+    if (len > 0) {
+        esp_mqtt_client_enqueue(client, MQTT_TOPIC_DATA_V2_RELAY, (const char*)buffer, len, QOS1, NO_RETAIN, true);
+    }
+}
+#endif
+
+/* Moves everything stamped with the previous wall clock offset: the open batch, the held context batch,
+ * the detector state and the batches and leak events finished before the first sync, which are released
+ * afterwards */
+static void apply_time_correction(int64_t delta_ms) {
+    batcher_shift(&batcher, delta_ms);
+    detect_shift(&detector, delta_ms);
+
+#if CONFIG_AGGREGATE_IDLE
+    aggregate_shift(&aggregator, delta_ms);
+    for (pb_size_t i = 0; i < summaries.summaries_count; ++i) {
+        summaries.summaries[i].timestamp += delta_ms;
+    }
+#endif
+
+#if !CONFIG_RAW_UPLOAD_ALWAYS
+    if (raw_until != 0) {
+        raw_until += delta_ms;
+    }
+    if (held_len > 0) {
+        held_len = codec_batch_rebase(held_buffer, held_len, delta_ms, batch_buffer, sizeof(batch_buffer));
+        memcpy(held_buffer, batch_buffer, held_len);
+    }
+#endif
+
+    clock_synced = true;
+
+    size_t pos = 0;
+    while (pos < presync.used) {
+        uint16_t record;
+        memcpy(&record, presync.buffer + pos, sizeof(record));
+        pos += sizeof(record);
+
+        size_t len = codec_batch_rebase(presync.buffer + pos, record, delta_ms, batch_buffer, sizeof(batch_buffer));
+        if (len > 0) {
+            publish_or_store(batch_buffer, len);
+        } else {
+            ESP_LOGE(TAG, "Failed to correct a held batch");
+        }
+        pos += record;
+    }
+    presync.used = 0;
+
+    for (size_t i = 0; i < presync_events.count; ++i) {
+        presync_events.events[i].timestamp += delta_ms;
+        send_event(&presync_events.events[i]);
+    }
+    presync_events.count = 0;
+}
+
+/* Batching and detection limits from the settings, the open batch and the detector state are kept */
+static void apply_settings(void) {
+    settings_t settings;
+    app_settings_get(&settings);
+
+    batcher.config.max_samples = settings.batch_max_samples;
+    batcher.config.max_age_ms = settings.batch_max_age_ms;
+    batcher.config.pressure_min = settings.pressure_min;
+    detector.config.pressure_min = settings.pressure_min;
 }
 
-// TODO: test if deep sleep works
 void app_mqtt_task(void *pvParameters) {
-    SampleBatch batch = SampleBatch_init_zero;
-    uint8_t buffer[SampleBatch_size];
+    settings_t settings;
+    uint32_t settings_generation = app_settings_generation();
+    app_settings_get(&settings);
 
-    while (1) {
+    batcher_config_t batcher_config = {
+        .max_samples = settings.batch_max_samples,
+        .max_age_ms = settings.batch_max_age_ms,
+        .pressure_min = settings.pressure_min,
+    };
+    batcher_init(&batcher, &batcher_config, batch_arena, sizeof(batch_arena));
 
+    /* The offset kept across deep sleep is valid right away while its error bound is small enough.
+     * After power-on, or once the bound grew too large, batches wait for the next sync. */
+    clock_synced = xEventGroupGetBits(app_event_group) & TIME_SYNCED_BIT;
+    backfill_samples();
 
-        app_sensors_read(&batch.samples[batch.samples_count]);
-        batch.samples_count++;
-        
-        if (batch.samples_count == SAMPLE_BATCH_SIZE) {
+    detect_config_t detect_config = DETECT_CONFIG_DEFAULT;
+    detect_config.pressure_min = settings.pressure_min;
+    detect_init(&detector, &detect_config);
 
-            // TODO: find better way to do this
-            xEventGroupWaitBits(app_event_group, MQTT_CONNECTED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+#if CONFIG_AGGREGATE_IDLE
+    aggregate_config_t aggregate_config = {
+        .flow_deadband = CONFIG_AGGREGATE_FLOW_DEADBAND / 1000.0f,
+        .pressure_deadband = CONFIG_AGGREGATE_PRESSURE_DEADBAND / 1000.0f,
+        .window_ms = CONFIG_AGGREGATE_WINDOW_S * 1000,
+        .hold_ms = CONFIG_BATCH_MAX_AGE_MS,
+    };
+    aggregate_init(&aggregator, &aggregate_config);
+#endif
 
-            pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
-            pb_encode(&stream, SampleBatch_fields, &batch);
+    app_sampler_start(xTaskGetCurrentTaskHandle());
 
-            ESP_LOGI(TAG, "Sending %d bytes", stream.bytes_written);
-            ESP_LOGI(TAG, "Sending %d samples", batch.samples_count);
+    while (1) {
+        /* Woken by the sampler after every sample, the timeout keeps the store draining if sampling stalls */
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MEASUREMENT_INTERVAL_MS));
 
-            if (!should_stay_awake(&batch)) {
-                ESP_LOGI(TAG, "Deep sleep due to inactivity");
+        if (settings_generation != app_settings_generation()) {
+            settings_generation = app_settings_generation();
+            apply_settings();
+        }
 
-            #if CONFIG_IDF_TARGET_ESP32
-                rtc_gpio_isolate(FLOW_SENSOR_PIN);
-            #endif
+        int64_t correction_ms;
+        if (timebase_take_correction(&correction_ms)) {
+            apply_time_correction(correction_ms);
+        }
 
-                ESP_ERROR_CHECK(ulp_run(&ulp_entry - RTC_SLOW_MEM));
-                esp_deep_sleep_start();
-            }
+        Sample sample;
+        while (app_sampler_pop(&sample)) {
+            sample.timestamp = timebase_wall_ms((int64_t)sample.timestamp * 1000);
+            detect_sample(&sample);
+#if CONFIG_AGGREGATE_IDLE
+            aggregate_sample(&sample);
+#else
+            batch_sample(&sample);
+#endif
+        }
 
-            esp_mqtt_client_publish(client, "data", (const char*)buffer, stream.bytes_written, QOS1, NO_RETAIN);
-            batch.samples_count = 0;
+        if (xEventGroupGetBits(app_event_group) & MQTT_CONNECTED_BIT) {
+            drain_store();
+#if CONFIG_RELAY_GATEWAY
+            publish_relayed();
+#endif
         }
 
-        vTaskDelay(pdMS_TO_TICKS(MEASUREMENT_INTERVAL_MS));
+        publish_ota_status();
+
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+        transient_upload();
+#endif
     }
-}
\ No newline at end of file
+}
@@ -8,6 +8,19 @@
 #define NO_RETAIN 0
 #define RETAIN 1
 
+#define MQTT_TOPIC_DATA_V2 "data/v2"
+#define MQTT_TOPIC_DATA_V2_BUNDLE "data/v2/bundle"
+#define MQTT_TOPIC_DATA_V2_SUMMARY "data/v2/summary"
+#define MQTT_TOPIC_DATA_V2_RELAY "data/v2/relay"
+#define MQTT_TOPIC_EVENTS "events"
+#define MQTT_TOPIC_DIAG_BOOT "diag/boot"
+#define MQTT_TOPIC_TRANSIENT "transient"
+/* Per device, formatted with the device id */
+#define MQTT_TOPIC_CONFIG "config/%s"
+#define MQTT_TOPIC_CONFIG_ACK "config/%s/ack"
+#define MQTT_TOPIC_OTA "ota/%s"
+#define MQTT_TOPIC_OTA_STATUS "ota/%s/status"
+
 void app_mqtt_init(void);
 void app_mqtt_start(void);
 void app_mqtt_task(void *pvParameters);
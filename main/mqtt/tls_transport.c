@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_tls.h"
+#include "mbedtls/ssl.h"
+#include "sdkconfig.h"
+
+#include "tls_transport.h"
+
+static const char* TAG = "tls";
+
+#if !CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS || !CONFIG_MBEDTLS_CLIENT_SSL_SESSION_TICKETS
+#error "Session resumption needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS and CONFIG_MBEDTLS_CLIENT_SSL_SESSION_TICKETS"
+#endif
+
+#define TLS_DEFAULT_PORT 8883
+#define TLS_SESSION_MAGIC 0x544c5353
+
+/* A serialized session holds the broker certificate and the ticket, about 1 KB with an RSA-2048
+ * broker certificate */
+#define TLS_SESSION_MAX 1280
+
+/* Session of the last accepted connection, kept across deep sleep so a wake presents its ticket
+ * instead of running a full handshake */
+static RTC_DATA_ATTR struct {
+    uint32_t magic;
+    uint32_t len;
+    uint8_t data[TLS_SESSION_MAX];
+} saved;
+
+static esp_tls_cfg_t config;
+static esp_tls_t* tls = NULL;
+
+/* NULL if no session was kept or it does not load */
+static esp_tls_client_session_t* session_load(void) {
+    if (saved.magic != TLS_SESSION_MAGIC || saved.len > sizeof(saved.data)) {
+        return NULL;
+    }
+
+    esp_tls_client_session_t* session = calloc(1, sizeof(*session));
+    if (session == NULL) {
+        return NULL;
+    }
+    mbedtls_ssl_session_init(&session->saved_session);
+    int ret = mbedtls_ssl_session_load(&session->saved_session, saved.data, saved.len);
+    if (ret != 0) {
+        ESP_LOGW(TAG, "Kept session unreadable: -0x%04x", -ret);
+        esp_tls_free_client_session(session);
+        saved.magic = 0;
+        return NULL;
+    }
+    return session;
+}
+
+static int tls_open(const char* host, int port, int timeout_ms, esp_tls_client_session_t* session) {
+    tls = esp_tls_init();
+    if (tls == NULL) {
+        return -1;
+    }
+
+    esp_tls_cfg_t cfg = config;
+    cfg.timeout_ms = timeout_ms;
+    cfg.client_session = session;
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, tls) <= 0) {
+        esp_tls_conn_destroy(tls);
+        tls = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static int tls_connect(esp_transport_handle_t t, const char* host, int port, int timeout_ms) {
+    esp_tls_client_session_t* session = session_load();
+    int ret = tls_open(host, port, timeout_ms, session);
+    if (ret < 0 && session != NULL) {
+        /* A broker that no longer knows the ticket answers with a full handshake by itself,
+         * this is for a kept session the handshake fails on */
+        ESP_LOGW(TAG, "Resumed handshake failed, retrying with a full handshake");
+        saved.magic = 0;
+        ret = tls_open(host, port, timeout_ms, NULL);
+    }
+    if (session != NULL) {
+        esp_tls_free_client_session(session);
+    }
+    return ret;
+}
+
+/* 1 if the socket is ready, 0 on timeout, -1 on error, as the esp_transport poll functions */
+static int tls_poll(int timeout_ms, bool write) {
+    int fd = -1;
+    if (tls == NULL || esp_tls_get_conn_sockfd(tls, &fd) != ESP_OK || fd < 0) {
+        return -1;
+    }
+
+    fd_set ready, errors;
+    FD_ZERO(&ready);
+    FD_ZERO(&errors);
+    FD_SET(fd, &ready);
+    FD_SET(fd, &errors);
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    int ret = select(fd + 1, write ? NULL : &ready, write ? &ready : NULL, &errors, timeout_ms < 0 ? NULL : &timeout);
+    if (ret > 0 && FD_ISSET(fd, &errors)) {
+        return -1;
+    }
+    return ret;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms) {
+    /* Decrypted bytes already buffered by mbedTLS do not show on the socket */
+    if (tls != NULL && esp_tls_get_bytes_avail(tls) > 0) {
+        return 1;
+    }
+    return tls_poll(timeout_ms, false);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms) {
+    return tls_poll(timeout_ms, true);
+}
+
+static int tls_read(esp_transport_handle_t t, char* buffer, int len, int timeout_ms) {
+    int poll = tls_poll_read(t, timeout_ms);
+    if (poll < 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    if (poll == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+
+    int ret = esp_tls_conn_read(tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Read failed: -0x%04x", -ret);
+        return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    }
+    /* Readable but nothing to read, the broker closed the connection */
+    return ret == 0 ? ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN : ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char* buffer, int len, int timeout_ms) {
+    int poll = tls_poll_write(t, timeout_ms);
+    if (poll <= 0) {
+        return poll;
+    }
+
+    int ret = esp_tls_conn_write(tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Write failed: -0x%04x", -ret);
+    }
+    return ret;
+}
+
+static int tls_close(esp_transport_handle_t t) {
+    if (tls != NULL) {
+        esp_tls_conn_destroy(tls);
+        tls = NULL;
+    }
+    return 0;
+}
+
+esp_transport_handle_t app_tls_transport_init(const char* ca_pem, const char* cert_pem, const char* key_pem) {
+    config = (esp_tls_cfg_t){
+        .cacert_buf = (const unsigned char*)ca_pem,
+        .cacert_bytes = strlen(ca_pem) + 1,
+        .clientcert_buf = (const unsigned char*)cert_pem,
+        .clientcert_bytes = strlen(cert_pem) + 1,
+        .clientkey_buf = (const unsigned char*)key_pem,
+        .clientkey_bytes = strlen(key_pem) + 1,
+    };
+
+    esp_transport_handle_t t = esp_transport_init();
+    if (t == NULL) {
+        ESP_LOGE(TAG, "Failed to create transport");
+        return NULL;
+    }
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write, tls_close);
+    esp_transport_set_default_port(t, TLS_DEFAULT_PORT);
+    return t;
+}
+
+void app_tls_session_save(void) {
+    if (tls == NULL) {
+        return;
+    }
+    esp_tls_client_session_t* session = esp_tls_get_client_session(tls);
+    if (session == NULL) {
+        return;
+    }
+
+    size_t len = 0;
+    int ret = mbedtls_ssl_session_save(&session->saved_session, saved.data, sizeof(saved.data), &len);
+    esp_tls_free_client_session(session);
+    if (ret != 0) {
+        ESP_LOGW(TAG, "Session not kept: -0x%04x", -ret);
+        saved.magic = 0;
+        return;
+    }
+
+    saved.len = len;
+    saved.magic = TLS_SESSION_MAGIC;
+    ESP_LOGI(TAG, "Kept %u byte session for the next wake", (unsigned)len);
+}
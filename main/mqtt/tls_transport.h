@@ -0,0 +1,13 @@
+#ifndef TLS_TRANSPORT_H_
+#define TLS_TRANSPORT_H_
+
+#include "esp_transport.h"
+
+/* MQTT over TLS through esp-tls, resuming the session of the previous wake with its session ticket.
+ * The PEM buffers are NUL terminated and have to outlive the transport. */
+esp_transport_handle_t app_tls_transport_init(const char* ca_pem, const char* cert_pem, const char* key_pem);
+
+/* Keeps the session of the current connection across deep sleep, called once the broker accepted it */
+void app_tls_session_save(void);
+
+#endif
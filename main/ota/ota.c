@@ -0,0 +1,313 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_delta_ota.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "pb_encode.h"
+#include "pb_decode.h"
+
+#include "ota.h"
+#include "power.h"
+
+static const char* TAG = "ota";
+
+#define OTA_TASK_STACK_SIZE 8192
+#define OTA_TASK_PRIORITY 4
+#define OTA_BUFFER_SIZE 4096
+
+/* Patch header written by esp_delta_ota_patch_gen.py: magic and the SHA-256 of the image it applies to */
+#define OTA_PATCH_MAGIC 0xfccdde10
+#define OTA_PATCH_HEADER_SIZE 64
+#define OTA_DIGEST_SIZE 32
+
+/* Time given to the DONE status to leave the outbox before rebooting */
+#define OTA_REBOOT_DELAY_MS 5000
+
+extern const uint8_t server_cert_pem_start[] asm("_binary_ca_crt_start");
+
+static OtaRequest request;
+static volatile bool running = false;
+static esp_timer_handle_t verify_timer = NULL;
+
+/* Newest status for the publisher, written by the update task */
+static portMUX_TYPE status_lock = portMUX_INITIALIZER_UNLOCKED;
+static OtaStatus status;
+static bool status_pending = false;
+
+typedef struct {
+    esp_ota_handle_t handle;
+    const esp_partition_t* running;
+    uint32_t downloaded;
+    uint32_t written;
+    int64_t started;
+} update_t;
+
+static void report(const update_t* update, OtaState state, esp_err_t err) {
+    taskENTER_CRITICAL(&status_lock);
+    status = (OtaStatus)OtaStatus_init_zero;
+    status.id = request.id;
+    status.state = state;
+    if (update != NULL) {
+        status.bytes_downloaded = update->downloaded;
+        status.image_bytes = update->written;
+        status.elapsed_ms = (uint32_t)((esp_timer_get_time() - update->started) / 1000);
+    }
+    status.has_error = err != ESP_OK;
+    status.error = err;
+    status_pending = true;
+    taskEXIT_CRITICAL(&status_lock);
+}
+
+static void verify_timeout_cb(void* arg) {
+    ESP_LOGE(TAG, "New image did not reach the broker in %d s, rolling back", OTA_VERIFY_TIMEOUT_S);
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+}
+
+void app_ota_init(void) {
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) != ESP_OK ||
+        state != ESP_OTA_IMG_PENDING_VERIFY) {
+        return;
+    }
+
+    /* A reset before confirming, a deep sleep wake included, makes the bootloader roll back as well */
+    ESP_LOGW(TAG, "First boot of a new image, rollback in %d s unless confirmed", OTA_VERIFY_TIMEOUT_S);
+    const esp_timer_create_args_t timer_args = {
+        .callback = verify_timeout_cb,
+        .name = "ota_verify",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &verify_timer));
+    ESP_ERROR_CHECK(esp_timer_start_once(verify_timer, OTA_VERIFY_TIMEOUT_S * 1000000ULL));
+}
+
+void app_ota_confirm(void) {
+    if (verify_timer == NULL) {
+        return;
+    }
+
+    esp_timer_stop(verify_timer);
+    esp_timer_delete(verify_timer);
+    verify_timer = NULL;
+
+    if (esp_ota_mark_app_valid_cancel_rollback() == ESP_OK) {
+        ESP_LOGI(TAG, "New image confirmed");
+        report(NULL, OtaState_OTA_CONFIRMED, ESP_OK);
+    }
+}
+
+static esp_err_t read_running(uint8_t* buf, size_t size, int offset, void* user_data) {
+    update_t* update = user_data;
+    return esp_partition_read(update->running, offset, buf, size);
+}
+
+static esp_err_t write_slot(const uint8_t* buf, size_t size, void* user_data) {
+    update_t* update = user_data;
+    esp_err_t err = esp_ota_write(update->handle, buf, size);
+    if (err == ESP_OK) {
+        update->written += size;
+    }
+    return err;
+}
+
+/* A patch only applies to the exact image it was generated against */
+static bool patch_matches_running(const uint8_t* header, const esp_partition_t* running) {
+    uint32_t magic;
+    memcpy(&magic, header, sizeof(magic));
+    if (magic != OTA_PATCH_MAGIC) {
+        ESP_LOGE(TAG, "Not a delta patch");
+        return false;
+    }
+
+    uint8_t digest[OTA_DIGEST_SIZE];
+    if (esp_partition_get_sha256(running, digest) != ESP_OK ||
+        memcmp(digest, header + sizeof(magic), OTA_DIGEST_SIZE) != 0) {
+        ESP_LOGE(TAG, "Patch was made for a different image");
+        return false;
+    }
+    return true;
+}
+
+/* Streams the download into the inactive slot, patches are merged with the running image on the way */
+static esp_err_t download(esp_http_client_handle_t http, update_t* update) {
+    static uint8_t buffer[OTA_BUFFER_SIZE];
+    bool delta = request.type == OtaImageType_OTA_DELTA;
+    esp_delta_ota_handle_t patcher = NULL;
+    size_t header = 0;
+    esp_err_t err = ESP_OK;
+
+    if (delta) {
+        esp_delta_ota_cfg_t cfg = {
+            .user_data = update,
+            .read_cb_with_user_ctx = read_running,
+            .write_cb_with_user_ctx = write_slot,
+        };
+        patcher = esp_delta_ota_init(&cfg);
+        if (patcher == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    while (err == ESP_OK) {
+        int len = esp_http_client_read(http, (char*)buffer, sizeof(buffer));
+        if (len < 0) {
+            err = ESP_FAIL;
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        update->downloaded += len;
+
+        if (!delta) {
+            err = write_slot(buffer, len, update);
+            continue;
+        }
+
+        /* The header may be split over reads, keep it in front of the buffer until it is complete */
+        int offset = 0;
+        if (header < OTA_PATCH_HEADER_SIZE) {
+            static uint8_t header_bytes[OTA_PATCH_HEADER_SIZE];
+            size_t n = OTA_PATCH_HEADER_SIZE - header < (size_t)len ? OTA_PATCH_HEADER_SIZE - header : (size_t)len;
+            memcpy(header_bytes + header, buffer, n);
+            header += n;
+            offset = n;
+            if (header == OTA_PATCH_HEADER_SIZE && !patch_matches_running(header_bytes, update->running)) {
+                err = ESP_ERR_INVALID_VERSION;
+                break;
+            }
+        }
+        if (offset < len) {
+            err = esp_delta_ota_feed_patch(patcher, buffer + offset, len - offset);
+        }
+    }
+
+    if (delta) {
+        if (err == ESP_OK) {
+            err = esp_delta_ota_finalize(patcher);
+        }
+        esp_delta_ota_deinit(patcher);
+    }
+
+    if (err == ESP_OK && !esp_http_client_is_complete_data_received(http)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    return err;
+}
+
+static esp_err_t update_run(update_t* update) {
+    const esp_partition_t* slot = esp_ota_get_next_update_partition(NULL);
+    if (slot == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_http_client_config_t config = {
+        .url = request.url,
+        .cert_pem = (const char*)server_cert_pem_start,
+        .buffer_size = OTA_BUFFER_SIZE,
+        .keep_alive_enable = true,
+    };
+    esp_http_client_handle_t http = esp_http_client_init(&config);
+    if (http == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t err = esp_http_client_open(http, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(http);
+        err = esp_ota_begin(slot, OTA_SIZE_UNKNOWN, &update->handle);
+    }
+    if (err == ESP_OK) {
+        err = download(http, update);
+        esp_err_t end = esp_ota_end(update->handle);
+        err = err != ESP_OK ? err : end;
+    }
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(slot);
+    }
+
+    esp_http_client_cleanup(http);
+    return err;
+}
+
+static void ota_task(void* pvParameters) {
+    update_t update = {
+        .running = esp_ota_get_running_partition(),
+        .started = esp_timer_get_time(),
+    };
+
+    ESP_LOGI(TAG, "Update %lu: %s image from %s", request.id,
+        request.type == OtaImageType_OTA_DELTA ? "delta" : "full", request.url);
+    report(&update, OtaState_OTA_STARTED, ESP_OK);
+
+    /* Light sleep would stretch the download */
+    app_power_hold(POWER_HOLD_OTA, true);
+    esp_err_t err = update_run(&update);
+    app_power_hold(POWER_HOLD_OTA, false);
+    ESP_LOGI(TAG, "Update %lu: %lu bytes downloaded, %lu bytes written in %lld ms: %s", request.id,
+        update.downloaded, update.written, (esp_timer_get_time() - update.started) / 1000, esp_err_to_name(err));
+
+    if (err != ESP_OK) {
+        report(&update, OtaState_OTA_FAILED, err);
+        running = false;
+        vTaskDelete(NULL);
+        return;
+    }
+
+    report(&update, OtaState_OTA_DONE, ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(OTA_REBOOT_DELAY_MS));
+    esp_restart();
+}
+
+void app_ota_request(const uint8_t* data, size_t len) {
+    if (running) {
+        ESP_LOGW(TAG, "Update %lu still running, ignoring request", request.id);
+        return;
+    }
+
+    OtaRequest next = OtaRequest_init_zero;
+    pb_istream_t stream = pb_istream_from_buffer(data, len);
+    if (!pb_decode(&stream, OtaRequest_fields, &next)) {
+        ESP_LOGE(TAG, "Failed to decode update request: %s", PB_GET_ERROR(&stream));
+        return;
+    }
+
+    request = next;
+    running = true;
+    if (xTaskCreate(ota_task, "ota_task", OTA_TASK_STACK_SIZE, NULL, OTA_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create update task");
+        running = false;
+    }
+}
+
+bool app_ota_in_progress(void) {
+    return running || verify_timer != NULL;
+}
+
+size_t app_ota_take_status(uint8_t* buffer, size_t size) {
+    OtaStatus next;
+
+    taskENTER_CRITICAL(&status_lock);
+    bool pending = status_pending;
+    next = status;
+    status_pending = false;
+    taskEXIT_CRITICAL(&status_lock);
+
+    if (!pending) {
+        return 0;
+    }
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, size);
+    if (!pb_encode(&stream, OtaStatus_fields, &next)) {
+        ESP_LOGE(TAG, "Failed to encode update status: %s", PB_GET_ERROR(&stream));
+        return 0;
+    }
+    return stream.bytes_written;
+}
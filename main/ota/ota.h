@@ -0,0 +1,28 @@
+#ifndef OTA_H_
+#define OTA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ota.pb.h"
+
+/* An image that booted for the first time after an update has this long to reach the broker */
+#define OTA_VERIFY_TIMEOUT_S 300
+
+/* Arms the rollback timer if this is the first boot of a new image */
+void app_ota_init(void);
+
+/* Keeps the running image, called once the broker is reached */
+void app_ota_confirm(void);
+
+/* Starts the update described by an encoded OtaRequest in the background, ignored while one is running */
+void app_ota_request(const uint8_t* data, size_t len);
+
+/* True while an update is downloading or the new image is not confirmed yet, the device must not sleep */
+bool app_ota_in_progress(void);
+
+/* Encodes the newest status not yet taken, returns the number of bytes written or 0 if there is none */
+size_t app_ota_take_status(uint8_t* buffer, size_t size);
+
+#endif
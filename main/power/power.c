@@ -0,0 +1,136 @@
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "sdkconfig.h"
+#include "power.h"
+
+static const char* TAG = "power";
+
+static esp_pm_lock_handle_t full_power_lock;
+static portMUX_TYPE hold_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t holds = 0;
+static power_wake_cb_t ulp_wake_cb = NULL;
+
+/* Time split of the current report period. Full power is the time a hold was taken, light sleep
+ * is measured by the PM callbacks. The rest is awake without a hold: DFS may run the CPU at the
+ * minimum frequency and Wi-Fi may be in modem sleep, neither is measured, so it is reported as
+ * awake rather than as modem sleep. */
+static struct {
+    int64_t period_start;
+    int64_t full_since;         // start of the current hold, 0 while none is held
+    int64_t full_us;
+    int64_t light_sleep_us;
+    uint32_t light_sleeps;
+} stats;
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+/* Runs in the idle task with interrupts disabled, the other core is stalled meanwhile */
+static esp_err_t IRAM_ATTR light_sleep_exit_cb(int64_t sleep_time_us, void* arg) {
+    stats.light_sleep_us += sleep_time_us;
+    stats.light_sleeps++;
+    if (ulp_wake_cb != NULL && esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_ULP) {
+        ulp_wake_cb();
+    }
+    return ESP_OK;
+}
+#endif
+
+static void stats_timer_cb(void* arg) {
+    app_power_log_stats();
+}
+
+void app_power_init(void) {
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = 160,
+        .min_freq_mhz = 80,
+#if CONFIG_POWER_LIGHT_SLEEP
+        .light_sleep_enable = true,
+#else
+        .light_sleep_enable = false,
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "full_power", &full_power_lock));
+
+#if CONFIG_PM_LIGHT_SLEEP_CALLBACKS
+    esp_pm_sleep_cbs_register_config_t cbs_config = {
+        .exit_cb = light_sleep_exit_cb,
+    };
+    ESP_ERROR_CHECK(esp_pm_light_sleep_register_cbs(&cbs_config));
+#endif
+
+    stats.period_start = esp_timer_get_time();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = stats_timer_cb,
+        .name = "power_stats",
+        .skip_unhandled_events = true,
+    };
+    esp_timer_handle_t timer;
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, POWER_STATS_PERIOD_S * 1000000ULL));
+}
+
+void app_power_set_ulp_wake_cb(power_wake_cb_t cb) {
+    ulp_wake_cb = cb;
+}
+
+void app_power_hold(power_hold_t reason, bool hold) {
+    uint32_t bit = 1u << reason;
+
+    taskENTER_CRITICAL(&hold_lock);
+    uint32_t before = holds;
+    holds = hold ? holds | bit : holds & ~bit;
+
+    /* The PM lock calls are ISR safe, taking them under the spinlock keeps the lock in step with the holds */
+    if (before == 0 && holds != 0) {
+        esp_pm_lock_acquire(full_power_lock);
+        stats.full_since = esp_timer_get_time();
+    } else if (before != 0 && holds == 0) {
+        esp_pm_lock_release(full_power_lock);
+        stats.full_us += esp_timer_get_time() - stats.full_since;
+        stats.full_since = 0;
+    }
+    taskEXIT_CRITICAL(&hold_lock);
+}
+
+void app_power_log_stats(void) {
+    int64_t now = esp_timer_get_time();
+
+    taskENTER_CRITICAL(&hold_lock);
+    int64_t elapsed = now - stats.period_start;
+    int64_t full_us = stats.full_us;
+    if (stats.full_since != 0) {
+        full_us += now - stats.full_since;
+        stats.full_since = now;
+    }
+    /* No light sleep can start while this core runs */
+    int64_t light_us = stats.light_sleep_us;
+    uint32_t light_sleeps = stats.light_sleeps;
+
+    stats.period_start = now;
+    stats.full_us = 0;
+    stats.light_sleep_us = 0;
+    stats.light_sleeps = 0;
+    taskEXIT_CRITICAL(&hold_lock);
+
+    if (elapsed <= 0) {
+        return;
+    }
+
+    int64_t awake_us = elapsed - full_us - light_us;
+    if (awake_us < 0) {
+        awake_us = 0;
+    }
+
+    /* One JSON object per line so it can be scraped from the console */
+    ESP_LOGI(TAG, "duty {\"period_s\":%lld,\"full_power_ms\":%lld,\"light_sleep_ms\":%lld,\"awake_ms\":%lld,"
+        "\"light_sleeps\":%lu,\"full_power_pct\":%.1f,\"light_sleep_pct\":%.1f,\"awake_pct\":%.1f}",
+        elapsed / 1000000, full_us / 1000, light_us / 1000, awake_us / 1000, light_sleeps,
+        100.0 * full_us / elapsed, 100.0 * light_us / elapsed, 100.0 * awake_us / elapsed);
+}
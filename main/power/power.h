@@ -0,0 +1,31 @@
+#ifndef POWER_H_
+#define POWER_H_
+
+#include <stdbool.h>
+
+/* Reasons to stay at full power, light sleep is allowed while none is held */
+typedef enum {
+    POWER_HOLD_SAMPLING,        // sampling faster than normal or flow counted by the PCNT
+    POWER_HOLD_OTA,             // firmware download
+    POWER_HOLD_COUNT,
+} power_hold_t;
+
+/* Log the duty cycle this often */
+#define POWER_STATS_PERIOD_S 3600
+
+/* Configures DFS and, if enabled, automatic light sleep, and starts the duty cycle report */
+void app_power_init(void);
+
+/* Holds or releases full power for one reason, safe from any task */
+void app_power_hold(power_hold_t reason, bool hold);
+
+/* Called in the light sleep exit callback if the ULP woke the chip, with interrupts disabled: must be in
+ * IRAM and may only use FreeRTOS FromISR calls */
+typedef void (*power_wake_cb_t)(void);
+void app_power_set_ulp_wake_cb(power_wake_cb_t cb);
+
+/* Logs the time split since the last report: full power, light sleep, and awake without a full power
+ * hold, which is not necessarily modem sleep */
+void app_power_log_stats(void);
+
+#endif
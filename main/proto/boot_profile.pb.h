@@ -0,0 +1,108 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.9.1 */
+
+#ifndef PB_BOOT_PROFILE_PB_H_INCLUDED
+#define PB_BOOT_PROFILE_PB_H_INCLUDED
+#include <pb.h>
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Struct definitions */
+/* Where the time of one wake went. Phases are ms since startup, absent if the wake never reached them. */
+typedef struct _BootProfile {
+    uint64_t timestamp; /* wall time of the wake (ms) */
+    uint32_t wake_cause; /* esp_sleep_wakeup_cause_t */
+    bool has_boot_ms;
+    uint32_t boot_ms; /* app_main entered */
+    bool has_nvs_ms;
+    uint32_t nvs_ms; /* NVS initialized */
+    bool has_wifi_init_ms;
+    uint32_t wifi_init_ms; /* Wi-Fi driver initialized */
+    bool has_wifi_connected_ms;
+    uint32_t wifi_connected_ms; /* got an IP */
+    bool has_sntp_synced_ms;
+    uint32_t sntp_synced_ms;
+    bool has_mqtt_connected_ms;
+    uint32_t mqtt_connected_ms;
+    bool has_first_puback_ms;
+    uint32_t first_puback_ms;
+    bool has_sleep_ms;
+    uint32_t sleep_ms; /* deep sleep entered */
+    bool has_sleep_flush_ms;
+    uint32_t sleep_flush_ms; /* waiting for PUBACKs before deep sleep */
+    bool has_sleep_batches_unsent;
+    uint32_t sleep_batches_unsent; /* left in flash for the next wake */
+    bool has_sleep_batches_lost;
+    uint32_t sleep_batches_lost; /* unacknowledged and not taken by the store */
+    bool has_wifi_start_ms;
+    uint32_t wifi_start_ms; /* STA or provisioning started */
+    bool has_heap_free;
+    uint32_t heap_free; /* free heap at wifi_start (bytes) */
+    bool has_provisioning;
+    bool provisioning; /* BLE provisioning was brought up */
+} BootProfile;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializer values for message structs */
+#define BootProfile_init_default                 {0, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0}
+#define BootProfile_init_zero                    {0, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define BootProfile_timestamp_tag                1
+#define BootProfile_wake_cause_tag               2
+#define BootProfile_boot_ms_tag                  3
+#define BootProfile_nvs_ms_tag                   4
+#define BootProfile_wifi_init_ms_tag             5
+#define BootProfile_wifi_connected_ms_tag        6
+#define BootProfile_sntp_synced_ms_tag           7
+#define BootProfile_mqtt_connected_ms_tag        8
+#define BootProfile_first_puback_ms_tag          9
+#define BootProfile_sleep_ms_tag                 10
+#define BootProfile_sleep_flush_ms_tag           11
+#define BootProfile_sleep_batches_unsent_tag     12
+#define BootProfile_sleep_batches_lost_tag       13
+#define BootProfile_wifi_start_ms_tag            14
+#define BootProfile_heap_free_tag                15
+#define BootProfile_provisioning_tag             16
+
+/* Struct field encoding specification for nanopb */
+#define BootProfile_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT64,   timestamp,         1) \
+X(a, STATIC,   REQUIRED, UINT32,   wake_cause,        2) \
+X(a, STATIC,   OPTIONAL, UINT32,   boot_ms,           3) \
+X(a, STATIC,   OPTIONAL, UINT32,   nvs_ms,            4) \
+X(a, STATIC,   OPTIONAL, UINT32,   wifi_init_ms,      5) \
+X(a, STATIC,   OPTIONAL, UINT32,   wifi_connected_ms,   6) \
+X(a, STATIC,   OPTIONAL, UINT32,   sntp_synced_ms,    7) \
+X(a, STATIC,   OPTIONAL, UINT32,   mqtt_connected_ms,   8) \
+X(a, STATIC,   OPTIONAL, UINT32,   first_puback_ms,   9) \
+X(a, STATIC,   OPTIONAL, UINT32,   sleep_ms,         10) \
+X(a, STATIC,   OPTIONAL, UINT32,   sleep_flush_ms,   11) \
+X(a, STATIC,   OPTIONAL, UINT32,   sleep_batches_unsent,  12) \
+X(a, STATIC,   OPTIONAL, UINT32,   sleep_batches_lost,  13) \
+X(a, STATIC,   OPTIONAL, UINT32,   wifi_start_ms,    14) \
+X(a, STATIC,   OPTIONAL, UINT32,   heap_free,        15) \
+X(a, STATIC,   OPTIONAL, BOOL,     provisioning,     16)
+#define BootProfile_CALLBACK NULL
+#define BootProfile_DEFAULT NULL
+
+extern const pb_msgdesc_t BootProfile_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define BootProfile_fields &BootProfile_msg
+
+/* Maximum encoded size of messages (where known) */
+#define BOOT_PROFILE_PB_H_MAX_SIZE               BootProfile_size
+#define BootProfile_size                         98
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
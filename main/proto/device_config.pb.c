@@ -0,0 +1,16 @@
+/* Automatically generated nanopb constant definitions */
+/* Generated by nanopb-0.4.9.1 */
+
+#include "device_config.pb.h"
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+PB_BIND(DeviceConfig, DeviceConfig, AUTO)
+
+
+PB_BIND(DeviceConfigAck, DeviceConfigAck, AUTO)
+
+
+
+
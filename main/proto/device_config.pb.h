@@ -0,0 +1,133 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.9.1 */
+
+#ifndef PB_DEVICE_CONFIG_PB_H_INCLUDED
+#define PB_DEVICE_CONFIG_PB_H_INCLUDED
+#include <pb.h>
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Enum definitions */
+typedef enum _DeviceConfigStatus {
+    DeviceConfigStatus_CONFIG_APPLIED = 0, /* saved and in effect */
+    DeviceConfigStatus_CONFIG_CURRENT = 1, /* this version is already active */
+    DeviceConfigStatus_CONFIG_STALE = 2, /* older than the active version */
+    DeviceConfigStatus_CONFIG_INVALID = 3, /* undecodable or a value out of range, nothing changed */
+    DeviceConfigStatus_CONFIG_FAILED = 4 /* could not be saved, nothing changed */
+} DeviceConfigStatus;
+
+/* Struct definitions */
+/* Tuning knobs pushed to a device. Absent fields keep their current value, a config is only taken
+ if its version is newer than the active one. */
+typedef struct _DeviceConfig {
+    uint32_t version;
+    bool has_measurement_interval_ms;
+    uint32_t measurement_interval_ms; /* sampling interval while signals are changing */
+    bool has_batch_max_samples;
+    uint32_t batch_max_samples;
+    bool has_batch_max_age_ms;
+    uint32_t batch_max_age_ms;
+    bool has_pressure_min;
+    float pressure_min; /* normalized pressure at or below counts as idle */
+    bool has_ulp_wake_edges;
+    uint32_t ulp_wake_edges; /* flow edges during deep sleep that wake the device */
+    bool has_ulp_period_us;
+    uint32_t ulp_period_us; /* ULP program period, applied on the next deep sleep */
+    bool has_pcnt_glitch_ns;
+    uint32_t pcnt_glitch_ns; /* pulse counter glitch filter, applied on the next boot */
+    bool has_reprovision;
+    bool reprovision; /* restart into BLE provisioning, not saved */
+    bool has_sleep_pressure_low;
+    float sleep_pressure_low; /* normalized pressure below which the ULP wakes the device, < 0 disables */
+    bool has_sleep_pressure_high;
+    float sleep_pressure_high; /* normalized pressure above which the ULP wakes the device, < 0 disables */
+    bool has_sleep_pressure_rate;
+    float sleep_pressure_rate; /* pressure change within 10 s that wakes the device, < 0 disables */
+} DeviceConfig;
+
+typedef struct _DeviceConfigAck {
+    uint32_t version; /* version of the config acknowledged */
+    DeviceConfigStatus status;
+    uint32_t active_version;
+} DeviceConfigAck;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Helper constants for enums */
+#define _DeviceConfigStatus_MIN DeviceConfigStatus_CONFIG_APPLIED
+#define _DeviceConfigStatus_MAX DeviceConfigStatus_CONFIG_FAILED
+#define _DeviceConfigStatus_ARRAYSIZE ((DeviceConfigStatus)(DeviceConfigStatus_CONFIG_FAILED+1))
+
+
+#define DeviceConfigAck_status_ENUMTYPE DeviceConfigStatus
+
+
+/* Initializer values for message structs */
+#define DeviceConfig_init_default                {0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0}
+#define DeviceConfigAck_init_default             {0, _DeviceConfigStatus_MIN, 0}
+#define DeviceConfig_init_zero                   {0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0, false, 0}
+#define DeviceConfigAck_init_zero                {0, _DeviceConfigStatus_MIN, 0}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define DeviceConfig_version_tag                 1
+#define DeviceConfig_measurement_interval_ms_tag 2
+#define DeviceConfig_batch_max_samples_tag       3
+#define DeviceConfig_batch_max_age_ms_tag        4
+#define DeviceConfig_pressure_min_tag            5
+#define DeviceConfig_ulp_wake_edges_tag          6
+#define DeviceConfig_ulp_period_us_tag           7
+#define DeviceConfig_pcnt_glitch_ns_tag          8
+#define DeviceConfig_reprovision_tag             9
+#define DeviceConfig_sleep_pressure_low_tag      10
+#define DeviceConfig_sleep_pressure_high_tag     11
+#define DeviceConfig_sleep_pressure_rate_tag     12
+#define DeviceConfigAck_version_tag              1
+#define DeviceConfigAck_status_tag               2
+#define DeviceConfigAck_active_version_tag       3
+
+/* Struct field encoding specification for nanopb */
+#define DeviceConfig_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   version,           1) \
+X(a, STATIC,   OPTIONAL, UINT32,   measurement_interval_ms,   2) \
+X(a, STATIC,   OPTIONAL, UINT32,   batch_max_samples,   3) \
+X(a, STATIC,   OPTIONAL, UINT32,   batch_max_age_ms,   4) \
+X(a, STATIC,   OPTIONAL, FLOAT,    pressure_min,      5) \
+X(a, STATIC,   OPTIONAL, UINT32,   ulp_wake_edges,    6) \
+X(a, STATIC,   OPTIONAL, UINT32,   ulp_period_us,     7) \
+X(a, STATIC,   OPTIONAL, UINT32,   pcnt_glitch_ns,    8) \
+X(a, STATIC,   OPTIONAL, BOOL,     reprovision,       9) \
+X(a, STATIC,   OPTIONAL, FLOAT,    sleep_pressure_low,  10) \
+X(a, STATIC,   OPTIONAL, FLOAT,    sleep_pressure_high,  11) \
+X(a, STATIC,   OPTIONAL, FLOAT,    sleep_pressure_rate,  12)
+#define DeviceConfig_CALLBACK NULL
+#define DeviceConfig_DEFAULT NULL
+
+#define DeviceConfigAck_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   version,           1) \
+X(a, STATIC,   REQUIRED, UENUM,    status,            2) \
+X(a, STATIC,   REQUIRED, UINT32,   active_version,    3)
+#define DeviceConfigAck_CALLBACK NULL
+#define DeviceConfigAck_DEFAULT NULL
+
+extern const pb_msgdesc_t DeviceConfig_msg;
+extern const pb_msgdesc_t DeviceConfigAck_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define DeviceConfig_fields &DeviceConfig_msg
+#define DeviceConfigAck_fields &DeviceConfigAck_msg
+
+/* Maximum encoded size of messages (where known) */
+#define DEVICE_CONFIG_PB_H_MAX_SIZE              DeviceConfig_size
+#define DeviceConfigAck_size                     14
+#define DeviceConfig_size                        64
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
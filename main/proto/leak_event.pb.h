@@ -0,0 +1,72 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.9.1 */
+
+#ifndef PB_LEAK_EVENT_PB_H_INCLUDED
+#define PB_LEAK_EVENT_PB_H_INCLUDED
+#include <pb.h>
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Enum definitions */
+typedef enum _LeakEventType {
+    LeakEventType_FLOW_CUSUM = 0, /* sustained flow above the baseline */
+    LeakEventType_NIGHT_FLOW = 1, /* minimum flow in the night window never reached zero */
+    LeakEventType_PRESSURE_DECAY = 2 /* pressure dropping while nothing is flowing */
+} LeakEventType;
+
+/* Struct definitions */
+typedef struct _LeakEvent {
+    LeakEventType type;
+    uint64_t timestamp;
+    float value; /* CUSUM statistic, night minimum flow or pressure drop */
+    float baseline; /* flow baseline, or pressure at the start of the decay window */
+} LeakEvent;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Helper constants for enums */
+#define _LeakEventType_MIN LeakEventType_FLOW_CUSUM
+#define _LeakEventType_MAX LeakEventType_PRESSURE_DECAY
+#define _LeakEventType_ARRAYSIZE ((LeakEventType)(LeakEventType_PRESSURE_DECAY+1))
+
+#define LeakEvent_type_ENUMTYPE LeakEventType
+
+
+/* Initializer values for message structs */
+#define LeakEvent_init_default                   {_LeakEventType_MIN, 0, 0, 0}
+#define LeakEvent_init_zero                      {_LeakEventType_MIN, 0, 0, 0}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define LeakEvent_type_tag                       1
+#define LeakEvent_timestamp_tag                  2
+#define LeakEvent_value_tag                      3
+#define LeakEvent_baseline_tag                   4
+
+/* Struct field encoding specification for nanopb */
+#define LeakEvent_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UENUM,    type,              1) \
+X(a, STATIC,   REQUIRED, UINT64,   timestamp,         2) \
+X(a, STATIC,   REQUIRED, FLOAT,    value,             3) \
+X(a, STATIC,   REQUIRED, FLOAT,    baseline,          4)
+#define LeakEvent_CALLBACK NULL
+#define LeakEvent_DEFAULT NULL
+
+extern const pb_msgdesc_t LeakEvent_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define LeakEvent_fields &LeakEvent_msg
+
+/* Maximum encoded size of messages (where known) */
+#define LEAK_EVENT_PB_H_MAX_SIZE                 LeakEvent_size
+#define LeakEvent_size                           23
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.9.1 */
+
+#ifndef PB_OTA_PB_H_INCLUDED
+#define PB_OTA_PB_H_INCLUDED
+#include <pb.h>
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Enum definitions */
+typedef enum _OtaImageType {
+    OtaImageType_OTA_FULL = 0, /* application image as built */
+    OtaImageType_OTA_DELTA = 1 /* esp_delta_ota patch against the running image */
+} OtaImageType;
+
+typedef enum _OtaState {
+    OtaState_OTA_STARTED = 0,
+    OtaState_OTA_DONE = 1, /* written to the inactive slot, rebooting into it */
+    OtaState_OTA_FAILED = 2,
+    OtaState_OTA_CONFIRMED = 3 /* the new image reached the broker and is kept */
+} OtaState;
+
+/* Struct definitions */
+/* Update pushed to a device, the image is fetched over HTTPS */
+typedef struct _OtaRequest {
+    uint32_t id; /* echoed in every OtaStatus of this update */
+    char url[256];
+    OtaImageType type;
+} OtaRequest;
+
+typedef struct _OtaStatus {
+    uint32_t id;
+    OtaState state;
+    uint32_t bytes_downloaded;
+    uint32_t image_bytes; /* bytes written to the slot, the size of the full image */
+    uint32_t elapsed_ms;
+    bool has_error;
+    int32_t error; /* esp_err_t */
+} OtaStatus;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Helper constants for enums */
+#define _OtaImageType_MIN OtaImageType_OTA_FULL
+#define _OtaImageType_MAX OtaImageType_OTA_DELTA
+#define _OtaImageType_ARRAYSIZE ((OtaImageType)(OtaImageType_OTA_DELTA+1))
+
+#define _OtaState_MIN OtaState_OTA_STARTED
+#define _OtaState_MAX OtaState_OTA_CONFIRMED
+#define _OtaState_ARRAYSIZE ((OtaState)(OtaState_OTA_CONFIRMED+1))
+
+#define OtaRequest_type_ENUMTYPE OtaImageType
+
+#define OtaStatus_state_ENUMTYPE OtaState
+
+
+/* Initializer values for message structs */
+#define OtaRequest_init_default                  {0, "", _OtaImageType_MIN}
+#define OtaStatus_init_default                   {0, _OtaState_MIN, 0, 0, 0, false, 0}
+#define OtaRequest_init_zero                     {0, "", _OtaImageType_MIN}
+#define OtaStatus_init_zero                      {0, _OtaState_MIN, 0, 0, 0, false, 0}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define OtaRequest_id_tag                        1
+#define OtaRequest_url_tag                       2
+#define OtaRequest_type_tag                      3
+#define OtaStatus_id_tag                         1
+#define OtaStatus_state_tag                      2
+#define OtaStatus_bytes_downloaded_tag           3
+#define OtaStatus_image_bytes_tag                4
+#define OtaStatus_elapsed_ms_tag                 5
+#define OtaStatus_error_tag                      6
+
+/* Struct field encoding specification for nanopb */
+#define OtaRequest_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   id,                1) \
+X(a, STATIC,   REQUIRED, STRING,   url,               2) \
+X(a, STATIC,   REQUIRED, UENUM,    type,              3)
+#define OtaRequest_CALLBACK NULL
+#define OtaRequest_DEFAULT NULL
+
+#define OtaStatus_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   id,                1) \
+X(a, STATIC,   REQUIRED, UENUM,    state,             2) \
+X(a, STATIC,   REQUIRED, UINT32,   bytes_downloaded,   3) \
+X(a, STATIC,   REQUIRED, UINT32,   image_bytes,       4) \
+X(a, STATIC,   REQUIRED, UINT32,   elapsed_ms,        5) \
+X(a, STATIC,   OPTIONAL, INT32,    error,             6)
+#define OtaStatus_CALLBACK NULL
+#define OtaStatus_DEFAULT NULL
+
+extern const pb_msgdesc_t OtaRequest_msg;
+extern const pb_msgdesc_t OtaStatus_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define OtaRequest_fields &OtaRequest_msg
+#define OtaStatus_fields &OtaStatus_msg
+
+/* Maximum encoded size of messages (where known) */
+#define OTA_PB_H_MAX_SIZE                        OtaRequest_size
+#define OtaRequest_size                          266
+#define OtaStatus_size                           37
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.9.1 */
+
+#ifndef PB_PRESSURE_TRANSIENT_PB_H_INCLUDED
+#define PB_PRESSURE_TRANSIENT_PB_H_INCLUDED
+#include <pb.h>
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Struct definitions */
+typedef PB_BYTES_ARRAY_T(1024) PressureTransientChunk_data_t;
+/* One slice of a high rate pressure capture around a transient. Every chunk of a capture repeats its header,
+ the data of chunks 0 .. chunks - 1 concatenated are zigzag varint deltas of pressure in 1/10000 units. */
+typedef struct _PressureTransientChunk {
+    uint32_t capture_id; /* counts captures since boot */
+    uint32_t chunk;
+    uint32_t chunks;
+    uint64_t trigger_timestamp; /* wall time of the trigger sample (ms) */
+    uint32_t sample_rate_hz;
+    uint32_t pre_samples; /* samples before the trigger sample */
+    uint32_t samples;
+    PressureTransientChunk_data_t data;
+} PressureTransientChunk;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializer values for message structs */
+#define PressureTransientChunk_init_default      {0, 0, 0, 0, 0, 0, 0, {0, {0}}}
+#define PressureTransientChunk_init_zero         {0, 0, 0, 0, 0, 0, 0, {0, {0}}}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define PressureTransientChunk_capture_id_tag    1
+#define PressureTransientChunk_chunk_tag         2
+#define PressureTransientChunk_chunks_tag        3
+#define PressureTransientChunk_trigger_timestamp_tag 4
+#define PressureTransientChunk_sample_rate_hz_tag 5
+#define PressureTransientChunk_pre_samples_tag   6
+#define PressureTransientChunk_samples_tag       7
+#define PressureTransientChunk_data_tag          8
+
+/* Struct field encoding specification for nanopb */
+#define PressureTransientChunk_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   capture_id,        1) \
+X(a, STATIC,   REQUIRED, UINT32,   chunk,             2) \
+X(a, STATIC,   REQUIRED, UINT32,   chunks,            3) \
+X(a, STATIC,   REQUIRED, UINT64,   trigger_timestamp,   4) \
+X(a, STATIC,   REQUIRED, UINT32,   sample_rate_hz,    5) \
+X(a, STATIC,   REQUIRED, UINT32,   pre_samples,       6) \
+X(a, STATIC,   REQUIRED, UINT32,   samples,           7) \
+X(a, STATIC,   REQUIRED, BYTES,    data,              8)
+#define PressureTransientChunk_CALLBACK NULL
+#define PressureTransientChunk_DEFAULT NULL
+
+extern const pb_msgdesc_t PressureTransientChunk_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define PressureTransientChunk_fields &PressureTransientChunk_msg
+
+/* Maximum encoded size of messages (where known) */
+#define PRESSURE_TRANSIENT_PB_H_MAX_SIZE         PressureTransientChunk_size
+#define PressureTransientChunk_size              1074
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -0,0 +1,15 @@
+/* Automatically generated nanopb constant definitions */
+/* Generated by nanopb-0.4.9.1 */
+
+#include "relay.pb.h"
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+PB_BIND(RelayedRecords, RelayedRecords, AUTO)
+
+
+PB_BIND(RelayBundle, RelayBundle, AUTO)
+
+
+
@@ -0,0 +1,82 @@
+/* Automatically generated nanopb header */
+/* Generated by nanopb-0.4.9.1 */
+
+#ifndef PB_RELAY_PB_H_INCLUDED
+#define PB_RELAY_PB_H_INCLUDED
+#include <pb.h>
+#include "leak_event.pb.h"
+#include "sample_batch.pb.h"
+
+#if PB_PROTO_HEADER_VERSION != 40
+#error Regenerate this file with the current version of nanopb generator.
+#endif
+
+/* Struct definitions */
+/* Records of one leaf node without Wi-Fi coverage, forwarded by a gateway node */
+typedef struct _RelayedRecords {
+    char device_id[16]; /* the leaf's, as it would use as MQTT client id */
+    int32_t rssi; /* of the last frame received from the leaf, dBm */
+    pb_callback_t batches;
+    pb_callback_t summaries;
+    pb_callback_t events;
+} RelayedRecords;
+
+/* Published by a gateway node on data/v2/relay */
+typedef struct _RelayBundle {
+    pb_callback_t leaves;
+} RelayBundle;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Initializer values for message structs */
+#define RelayedRecords_init_default              {"", 0, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}}
+#define RelayBundle_init_default                 {{{NULL}, NULL}}
+#define RelayedRecords_init_zero                 {"", 0, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}}
+#define RelayBundle_init_zero                    {{{NULL}, NULL}}
+
+/* Field tags (for use in manual encoding/decoding) */
+#define RelayedRecords_device_id_tag             1
+#define RelayedRecords_rssi_tag                  2
+#define RelayedRecords_batches_tag               3
+#define RelayedRecords_summaries_tag             4
+#define RelayedRecords_events_tag                5
+#define RelayBundle_leaves_tag                   1
+
+/* Struct field encoding specification for nanopb */
+#define RelayedRecords_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, STRING,   device_id,         1) \
+X(a, STATIC,   REQUIRED, SINT32,   rssi,              2) \
+X(a, CALLBACK, REPEATED, MESSAGE,  batches,           3) \
+X(a, CALLBACK, REPEATED, MESSAGE,  summaries,         4) \
+X(a, CALLBACK, REPEATED, MESSAGE,  events,            5)
+#define RelayedRecords_CALLBACK pb_default_field_callback
+#define RelayedRecords_DEFAULT NULL
+#define RelayedRecords_batches_MSGTYPE SampleBatchV2
+#define RelayedRecords_summaries_MSGTYPE SampleSummaryBatch
+#define RelayedRecords_events_MSGTYPE LeakEvent
+
+#define RelayBundle_FIELDLIST(X, a) \
+X(a, CALLBACK, REPEATED, MESSAGE,  leaves,            1)
+#define RelayBundle_CALLBACK pb_default_field_callback
+#define RelayBundle_DEFAULT NULL
+#define RelayBundle_leaves_MSGTYPE RelayedRecords
+
+extern const pb_msgdesc_t RelayedRecords_msg;
+extern const pb_msgdesc_t RelayBundle_msg;
+
+/* Defines for backwards compatibility with code written before nanopb-0.4.0 */
+#define RelayedRecords_fields &RelayedRecords_msg
+#define RelayBundle_fields &RelayBundle_msg
+
+/* Maximum encoded size of messages (where known) */
+/* RelayedRecords_size depends on runtime parameters */
+/* RelayBundle_size depends on runtime parameters */
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -12,4 +12,19 @@ PB_BIND(Sample, Sample, AUTO)
 PB_BIND(SampleBatch, SampleBatch, 2)
 
 
+PB_BIND(SampleBatchV2, SampleBatchV2, AUTO)
+
+
+PB_BIND(ChannelSummary, ChannelSummary, AUTO)
+
+
+PB_BIND(SampleSummary, SampleSummary, AUTO)
+
+
+PB_BIND(SampleSummaryBatch, SampleSummaryBatch, 2)
+
+
+PB_BIND(SampleBatchBundle, SampleBatchBundle, AUTO)
+
+
 
@@ -4,6 +4,7 @@
 #ifndef PB_SAMPLE_BATCH_PB_H_INCLUDED
 #define PB_SAMPLE_BATCH_PB_H_INCLUDED
 #include <pb.h>
+#include "leak_event.pb.h"
 #include "sys/types.h"
 
 #if PB_PROTO_HEADER_VERSION != 40
@@ -17,6 +18,16 @@ typedef struct _Sample {
     uint64_t timestamp;
     float flow;
     float pressure;
+    /* Spread of the pressure over the measurement interval, continuous ADC mode only */
+    bool has_pressure_min;
+    float pressure_min;
+    bool has_pressure_max;
+    float pressure_max;
+    bool has_pressure_stddev;
+    float pressure_stddev;
+    /* Sensor registry channels past the primary pressure/flow pair, in registry order */
+    pb_size_t channels_count;
+    float channels[6];
 } Sample;
 
 typedef struct _SampleBatch {
@@ -24,28 +35,136 @@ typedef struct _SampleBatch {
     Sample samples[SAMPLE_BATCH_SIZE];
 } SampleBatch;
 
+/* Compact encoding of a SampleBatch.
+ Timestamps are reconstructed as base_timestamp + i * interval_ms (+ timestamp_jitter[i] if present),
+ pressure and flow are quantized to 1/1000 and sent as zigzag deltas from the previous sample. */
+typedef struct _SampleBatchV2 {
+    uint64_t base_timestamp;
+    uint32_t interval_ms;
+    pb_callback_t pressure;
+    pb_callback_t flow;
+    pb_callback_t timestamp_jitter;
+    /* pressure - pressure_min, pressure_max - pressure and pressure_stddev in 1/1000, empty when not measured */
+    pb_callback_t pressure_min;
+    pb_callback_t pressure_max;
+    pb_callback_t pressure_stddev;
+    /* Additional channels quantized and delta coded like pressure and flow, one run of samples per channel.
+ The channel count is len(channels) / len(pressure), empty unless every sample has the same count. */
+    pb_callback_t channels;
+    /* Flow below 1/1000 of full scale, which the flow column carries as 0, in 1/1000000. 0 for the other
+ samples, empty unless a sample of the batch had such a drip. */
+    pb_callback_t drip_flow;
+} SampleBatchV2;
+
+/* One additional channel over a summary window, quantized like pressure and flow */
+typedef struct _ChannelSummary {
+    uint32_t min;
+    uint32_t max;
+    uint32_t mean;
+    uint32_t last;
+} ChannelSummary;
+
+/* A window of samples that all stayed within the deadband of the last raw sample, see aggregate.h.
+ Values are quantized to 1/1000 like SampleBatchV2, the mean is rounded. */
+typedef struct _SampleSummary {
+    uint64_t timestamp; /* first sample of the window (ms) */
+    uint32_t duration_ms; /* first to last sample */
+    uint32_t count;
+    uint32_t pressure_min;
+    uint32_t pressure_max;
+    uint32_t pressure_mean;
+    uint32_t pressure_last;
+    uint32_t flow_min;
+    uint32_t flow_max;
+    uint32_t flow_mean;
+    uint32_t flow_last;
+    pb_size_t channels_count;
+    ChannelSummary channels[6]; /* Sample.channels in order, every sample of a window has the same count */
+} SampleSummary;
+
+/* Consecutive summaries, oldest first */
+typedef struct _SampleSummaryBatch {
+    pb_size_t summaries_count;
+    SampleSummary summaries[16];
+} SampleSummaryBatch;
+
+/* Several stored SampleBatchV2 and SampleSummaryBatch coalesced into one publish */
+typedef struct _SampleBatchBundle {
+    pb_callback_t batches;
+    pb_callback_t summaries;
+    pb_callback_t events; /* stored by a leaf node, or by one that was a leaf before */
+} SampleBatchBundle;
+
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 /* Initializer values for message structs */
-#define Sample_init_default                      {0, 0, 0}
+#define Sample_init_default                      {0, 0, 0, false, 0, false, 0, false, 0, 0, {0, 0, 0, 0, 0, 0}}
 #define SampleBatch_init_default                 {0, {Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default, Sample_init_default}}
-#define Sample_init_zero                         {0, 0, 0}
+#define SampleBatchV2_init_default               {0, 0, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}}
+#define ChannelSummary_init_default              {0, 0, 0, 0}
+#define SampleSummary_init_default               {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, {ChannelSummary_init_default, ChannelSummary_init_default, ChannelSummary_init_default, ChannelSummary_init_default, ChannelSummary_init_default, ChannelSummary_init_default}}
+#define SampleSummaryBatch_init_default          {0, {SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default, SampleSummary_init_default}}
+#define SampleBatchBundle_init_default           {{{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}}
+#define Sample_init_zero                         {0, 0, 0, false, 0, false, 0, false, 0, 0, {0, 0, 0, 0, 0, 0}}
 #define SampleBatch_init_zero                    {0, {Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero, Sample_init_zero}}
+#define SampleBatchV2_init_zero                  {0, 0, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}}
+#define ChannelSummary_init_zero                 {0, 0, 0, 0}
+#define SampleSummary_init_zero                  {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, {ChannelSummary_init_zero, ChannelSummary_init_zero, ChannelSummary_init_zero, ChannelSummary_init_zero, ChannelSummary_init_zero, ChannelSummary_init_zero}}
+#define SampleSummaryBatch_init_zero             {0, {SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero, SampleSummary_init_zero}}
+#define SampleBatchBundle_init_zero              {{{NULL}, NULL}, {{NULL}, NULL}, {{NULL}, NULL}}
 
 /* Field tags (for use in manual encoding/decoding) */
 #define Sample_timestamp_tag                     1
 #define Sample_flow_tag                          2
 #define Sample_pressure_tag                      3
+#define Sample_pressure_min_tag                  4
+#define Sample_pressure_max_tag                  5
+#define Sample_pressure_stddev_tag               6
+#define Sample_channels_tag                      7
 #define SampleBatch_samples_tag                  1
+#define SampleBatchV2_base_timestamp_tag         1
+#define SampleBatchV2_interval_ms_tag            2
+#define SampleBatchV2_pressure_tag               3
+#define SampleBatchV2_flow_tag                   4
+#define SampleBatchV2_timestamp_jitter_tag       5
+#define SampleBatchV2_pressure_min_tag           6
+#define SampleBatchV2_pressure_max_tag           7
+#define SampleBatchV2_pressure_stddev_tag        8
+#define SampleBatchV2_channels_tag               9
+#define SampleBatchV2_drip_flow_tag              10
+#define ChannelSummary_min_tag                   1
+#define ChannelSummary_max_tag                   2
+#define ChannelSummary_mean_tag                  3
+#define ChannelSummary_last_tag                  4
+#define SampleSummary_timestamp_tag              1
+#define SampleSummary_duration_ms_tag            2
+#define SampleSummary_count_tag                  3
+#define SampleSummary_pressure_min_tag           4
+#define SampleSummary_pressure_max_tag           5
+#define SampleSummary_pressure_mean_tag          6
+#define SampleSummary_pressure_last_tag          7
+#define SampleSummary_flow_min_tag               8
+#define SampleSummary_flow_max_tag               9
+#define SampleSummary_flow_mean_tag              10
+#define SampleSummary_flow_last_tag              11
+#define SampleSummary_channels_tag               12
+#define SampleSummaryBatch_summaries_tag         1
+#define SampleBatchBundle_batches_tag            1
+#define SampleBatchBundle_summaries_tag          2
+#define SampleBatchBundle_events_tag             3
 
 /* Struct field encoding specification for nanopb */
 #define Sample_FIELDLIST(X, a) \
 X(a, STATIC,   REQUIRED, UINT64,   timestamp,         1) \
 X(a, STATIC,   REQUIRED, FLOAT,    flow,              2) \
-X(a, STATIC,   REQUIRED, FLOAT,    pressure,          3)
+X(a, STATIC,   REQUIRED, FLOAT,    pressure,          3) \
+X(a, STATIC,   OPTIONAL, FLOAT,    pressure_min,      4) \
+X(a, STATIC,   OPTIONAL, FLOAT,    pressure_max,      5) \
+X(a, STATIC,   OPTIONAL, FLOAT,    pressure_stddev,   6) \
+X(a, STATIC,   REPEATED, FLOAT,    channels,          7)
 #define Sample_CALLBACK NULL
 #define Sample_DEFAULT NULL
 
@@ -55,17 +174,87 @@ X(a, STATIC,   REPEATED, MESSAGE,  samples,           1)
 #define SampleBatch_DEFAULT NULL
 #define SampleBatch_samples_MSGTYPE Sample
 
+#define SampleBatchV2_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT64,   base_timestamp,    1) \
+X(a, STATIC,   REQUIRED, UINT32,   interval_ms,       2) \
+X(a, CALLBACK, REPEATED, SINT32,   pressure,          3) \
+X(a, CALLBACK, REPEATED, SINT32,   flow,              4) \
+X(a, CALLBACK, REPEATED, SINT32,   timestamp_jitter,   5) \
+X(a, CALLBACK, REPEATED, UINT32,   pressure_min,      6) \
+X(a, CALLBACK, REPEATED, UINT32,   pressure_max,      7) \
+X(a, CALLBACK, REPEATED, UINT32,   pressure_stddev,   8) \
+X(a, CALLBACK, REPEATED, SINT32,   channels,          9) \
+X(a, CALLBACK, REPEATED, UINT32,   drip_flow,        10)
+#define SampleBatchV2_CALLBACK pb_default_field_callback
+#define SampleBatchV2_DEFAULT NULL
+
+#define ChannelSummary_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT32,   min,               1) \
+X(a, STATIC,   REQUIRED, UINT32,   max,               2) \
+X(a, STATIC,   REQUIRED, UINT32,   mean,              3) \
+X(a, STATIC,   REQUIRED, UINT32,   last,              4)
+#define ChannelSummary_CALLBACK NULL
+#define ChannelSummary_DEFAULT NULL
+
+#define SampleSummary_FIELDLIST(X, a) \
+X(a, STATIC,   REQUIRED, UINT64,   timestamp,         1) \
+X(a, STATIC,   REQUIRED, UINT32,   duration_ms,       2) \
+X(a, STATIC,   REQUIRED, UINT32,   count,             3) \
+X(a, STATIC,   REQUIRED, UINT32,   pressure_min,      4) \
+X(a, STATIC,   REQUIRED, UINT32,   pressure_max,      5) \
+X(a, STATIC,   REQUIRED, UINT32,   pressure_mean,     6) \
+X(a, STATIC,   REQUIRED, UINT32,   pressure_last,     7) \
+X(a, STATIC,   REQUIRED, UINT32,   flow_min,          8) \
+X(a, STATIC,   REQUIRED, UINT32,   flow_max,          9) \
+X(a, STATIC,   REQUIRED, UINT32,   flow_mean,        10) \
+X(a, STATIC,   REQUIRED, UINT32,   flow_last,        11) \
+X(a, STATIC,   REPEATED, MESSAGE,  channels,         12)
+#define SampleSummary_CALLBACK NULL
+#define SampleSummary_DEFAULT NULL
+#define SampleSummary_channels_MSGTYPE ChannelSummary
+
+#define SampleSummaryBatch_FIELDLIST(X, a) \
+X(a, STATIC,   REPEATED, MESSAGE,  summaries,         1)
+#define SampleSummaryBatch_CALLBACK NULL
+#define SampleSummaryBatch_DEFAULT NULL
+#define SampleSummaryBatch_summaries_MSGTYPE SampleSummary
+
+#define SampleBatchBundle_FIELDLIST(X, a) \
+X(a, CALLBACK, REPEATED, MESSAGE,  batches,           1) \
+X(a, CALLBACK, REPEATED, MESSAGE,  summaries,         2) \
+X(a, CALLBACK, REPEATED, MESSAGE,  events,            3)
+#define SampleBatchBundle_CALLBACK pb_default_field_callback
+#define SampleBatchBundle_DEFAULT NULL
+#define SampleBatchBundle_batches_MSGTYPE SampleBatchV2
+#define SampleBatchBundle_summaries_MSGTYPE SampleSummaryBatch
+#define SampleBatchBundle_events_MSGTYPE LeakEvent
+
 extern const pb_msgdesc_t Sample_msg;
 extern const pb_msgdesc_t SampleBatch_msg;
+extern const pb_msgdesc_t SampleBatchV2_msg;
+extern const pb_msgdesc_t ChannelSummary_msg;
+extern const pb_msgdesc_t SampleSummary_msg;
+extern const pb_msgdesc_t SampleSummaryBatch_msg;
+extern const pb_msgdesc_t SampleBatchBundle_msg;
 
 /* Defines for backwards compatibility with code written before nanopb-0.4.0 */
 #define Sample_fields &Sample_msg
 #define SampleBatch_fields &SampleBatch_msg
+#define SampleBatchV2_fields &SampleBatchV2_msg
+#define ChannelSummary_fields &ChannelSummary_msg
+#define SampleSummary_fields &SampleSummary_msg
+#define SampleSummaryBatch_fields &SampleSummaryBatch_msg
+#define SampleBatchBundle_fields &SampleBatchBundle_msg
 
 /* Maximum encoded size of messages (where known) */
-#define SAMPLE_BATCH_PB_H_MAX_SIZE               SampleBatch_size
-#define SampleBatch_size                         690
-#define Sample_size                              21
+/* SampleBatchV2_size depends on runtime parameters */
+/* SampleBatchBundle_size depends on runtime parameters */
+#define SAMPLE_BATCH_PB_H_MAX_SIZE               SampleSummaryBatch_size
+#define SampleBatch_size                         2040
+#define ChannelSummary_size                      24
+#define SampleSummaryBatch_size                  3680
+#define SampleSummary_size                       227
+#define Sample_size                              66
 
 #ifdef __cplusplus
 } /* extern "C" */
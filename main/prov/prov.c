@@ -4,21 +4,31 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
+#include <freertos/timers.h>
 
 #include <esp_log.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
 #include <nvs_flash.h>
+#include <esp_bt.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
 
 #include <wifi_provisioning/manager.h>
 #include <wifi_provisioning/scheme_ble.h>
 
 #include "common.h"
 #include "mqtt.h"
+#include "relay.h"
 #include <protocomm_security.h>
 #include <protocomm_security1.h>
 
 #include "esp_chip_info.h"
+#include "esp_attr.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+
+#include <time.h>
 
 static const char* TAG = "prov";
 
@@ -28,6 +38,35 @@ static const char* TAG = "prov";
 #define MAX_RETRIES 3
 static int connection_retries = 0;
 
+/* A cached DHCP lease older than this is not reused, a full DHCP exchange runs instead */
+#define WIFI_CACHE_MAX_AGE_S 3600
+#define WIFI_CACHE_MAGIC 0x57494649
+
+/* Last association and lease, kept across deep sleep so a wake can skip the scan and DHCP */
+typedef struct {
+    uint32_t magic;
+    uint8_t bssid[6];
+    uint8_t channel;
+    bool lease_valid;
+    time_t lease_acquired;
+    esp_netif_ip_info_t ip_info;
+    esp_netif_dns_info_t dns;
+} wifi_cache_t;
+
+static RTC_DATA_ATTR wifi_cache_t wifi_cache;
+
+static esp_netif_t* sta_netif = NULL;
+static bool fast_connect = false;
+/* Hands the address back to DHCP once a reused lease reaches WIFI_CACHE_MAX_AGE_S, a wake kept going by
+ * flow or line pressure must not hold the static configuration past it */
+static esp_timer_handle_t lease_timer = NULL;
+
+/* Set until new credentials are received, so an interrupted provisioning starts again on the next boot */
+#define PROV_NVS_NAMESPACE "prov"
+#define PROV_NVS_KEY_REQUESTED "requested"
+
+static esp_timer_handle_t request_timer = NULL;
+
 
 static void get_device_service_name(char *service_name, size_t max)
 {
@@ -41,9 +80,243 @@ static void get_device_service_name(char *service_name, size_t max)
 
 void app_wifi_init() {
     /* Initialize Wi-Fi including netif with default config */
-    esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+
+    /* Needed on the provisioning and the STA path alike */
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &prov_event_handler, NULL));
+}
+
+static bool request_pending() {
+    nvs_handle_t handle;
+    uint8_t requested = 0;
+    if (nvs_open(PROV_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    nvs_get_u8(handle, PROV_NVS_KEY_REQUESTED, &requested);
+    nvs_close(handle);
+    return requested != 0;
+}
+
+static void request_write(bool requested) {
+    nvs_handle_t handle;
+    if (nvs_open(PROV_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open provisioning state");
+        return;
+    }
+    esp_err_t err = requested ? nvs_set_u8(handle, PROV_NVS_KEY_REQUESTED, 1) :
+                                nvs_erase_key(handle, PROV_NVS_KEY_REQUESTED);
+    if (err == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+bool app_prov_is_provisioned() {
+    /* The same check as wifi_prov_mgr_is_provisioned, without initializing the manager */
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK || wifi_config.sta.ssid[0] == '\0') {
+        return false;
+    }
+    if (request_pending()) {
+        ESP_LOGI(TAG, "Provisioning requested");
+        return false;
+    }
+    return true;
+}
+
+static void request_restart(void* arg) {
+    request_write(true);
+    ESP_LOGI(TAG, "Restarting provisioning");
+    esp_restart();
+}
+
+void app_prov_request(uint32_t delay_ms) {
+    if (delay_ms == 0) {
+        request_restart(NULL);
+        return;
+    }
+
+    if (request_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = request_restart,
+            .name = "prov_request",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &request_timer));
+    }
+    /* A second request while the first is pending changes nothing */
+    if (!esp_timer_is_active(request_timer)) {
+        ESP_ERROR_CHECK(esp_timer_start_once(request_timer, delay_ms * 1000ULL));
+    }
+}
+
+void app_prov_release_bt() {
+    /* Possible only while the controller was never initialized, the memory is gone until the next restart */
+    esp_err_t err = esp_bt_mem_release(ESP_BT_MODE_BTDM);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to release BT memory: %s", esp_err_to_name(err));
+    }
+}
+
+#if CONFIG_PROV_BUTTON_GPIO >= 0
+static TimerHandle_t button_timer = NULL;
+
+static void IRAM_ATTR button_isr(void* arg) {
+    BaseType_t woken = pdFALSE;
+    xTimerResetFromISR(button_timer, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+/* Runs once the button was pressed CONFIG_PROV_BUTTON_HOLD_MS ago, a short press is released by then */
+static void button_timer_cb(TimerHandle_t timer) {
+    if (gpio_get_level(CONFIG_PROV_BUTTON_GPIO) == 0) {
+        ESP_LOGW(TAG, "Provisioning button held");
+        /* The timer task stack is too small for NVS, the request runs from esp_timer */
+        app_prov_request(1);
+    }
+}
+
+void app_prov_button_init() {
+    button_timer = xTimerCreate("prov_button", pdMS_TO_TICKS(CONFIG_PROV_BUTTON_HOLD_MS), pdFALSE, NULL, button_timer_cb);
+
+    gpio_config_t io_config = {
+        .pin_bit_mask = 1ULL << CONFIG_PROV_BUTTON_GPIO,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .intr_type = GPIO_INTR_NEGEDGE,
+    };
+    ESP_ERROR_CHECK(gpio_config(&io_config));
+
+    /* Shared with the flow channels, may already be installed */
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_isr_handler_add(CONFIG_PROV_BUTTON_GPIO, button_isr, NULL));
+
+    /* Held since before the wake */
+    if (gpio_get_level(CONFIG_PROV_BUTTON_GPIO) == 0) {
+        xTimerStart(button_timer, 0);
+    }
+}
+#else
+void app_prov_button_init() {
+}
+#endif
+
+static bool wifi_cache_usable() {
+    if (wifi_cache.magic != WIFI_CACHE_MAGIC || wifi_cache.channel == 0) {
+        return false;
+    }
+
+    /* The RTC keeps counting through deep sleep, so the age holds even before SNTP */
+    time_t age = time(NULL) - wifi_cache.lease_acquired;
+    if (!wifi_cache.lease_valid || age < 0 || age > WIFI_CACHE_MAX_AGE_S) {
+        wifi_cache.lease_valid = false;
+    }
+    return true;
+}
+
+static void wifi_fast_connect_setup() {
+    wifi_config_t wifi_config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+
+    /* Join the last AP directly, only its channel is probed */
+    memcpy(wifi_config.sta.bssid, wifi_cache.bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.bssid_set = true;
+    wifi_config.sta.channel = wifi_cache.channel;
+    wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    if (wifi_cache.lease_valid) {
+        esp_err_t err = esp_netif_dhcpc_stop(sta_netif);
+        if (err == ESP_OK || err == ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+            ESP_ERROR_CHECK(esp_netif_set_ip_info(sta_netif, &wifi_cache.ip_info));
+            ESP_ERROR_CHECK(esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &wifi_cache.dns));
+        }
+    }
+
+    ESP_LOGI(TAG, "Fast connect to " MACSTR " on channel %d%s",
+             MAC2STR(wifi_cache.bssid), wifi_cache.channel,
+             wifi_cache.lease_valid ? " with cached lease" : "");
+    fast_connect = true;
+}
+
+static void dhcp_restart() {
+    esp_err_t err = esp_netif_dhcpc_start(sta_netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STARTED) {
+        ESP_LOGE(TAG, "Failed to restart DHCP client: %s", esp_err_to_name(err));
+    }
+}
+
+static void lease_timer_cb(void* arg) {
+    ESP_LOGI(TAG, "Cached lease reached %d s, renewing it by DHCP", WIFI_CACHE_MAX_AGE_S);
+    wifi_cache.lease_valid = false;
+    dhcp_restart();
+}
+
+/* The static configuration of a reused lease lasts until the lease would have expired */
+static void lease_timer_start() {
+    if (lease_timer == NULL) {
+        const esp_timer_create_args_t timer_args = {
+            .callback = lease_timer_cb,
+            .name = "dhcp_lease",
+        };
+        ESP_ERROR_CHECK(esp_timer_create(&timer_args, &lease_timer));
+    }
+
+    time_t remaining = wifi_cache.lease_acquired + WIFI_CACHE_MAX_AGE_S - time(NULL);
+    if (remaining < 1) {
+        remaining = 1;
+    }
+    esp_timer_stop(lease_timer);
+    ESP_ERROR_CHECK(esp_timer_start_once(lease_timer, remaining * 1000000ULL));
+}
+
+static void wifi_fast_connect_fallback() {
+    ESP_LOGW(TAG, "Fast connect failed, falling back to scan and DHCP");
+    fast_connect = false;
+    memset(&wifi_cache, 0, sizeof(wifi_cache));
+
+    wifi_config_t wifi_config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+    wifi_config.sta.bssid_set = false;
+    wifi_config.sta.channel = 0;
+    wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    if (lease_timer != NULL) {
+        esp_timer_stop(lease_timer);
+    }
+    dhcp_restart();
+}
+
+void app_wifi_start() {
+    /* Credentials are already in NVS, don't rewrite them on every wake */
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    if (wifi_cache_usable()) {
+        wifi_fast_connect_setup();
+    }
+
+#if CONFIG_POWER_LIGHT_SLEEP
+    /* Wake for every listen interval-th beacon only, the chip light sleeps in between */
+    wifi_config_t wifi_config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+    wifi_config.sta.listen_interval = CONFIG_WIFI_LISTEN_INTERVAL;
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MAX_MODEM));
+#elif CONFIG_RELAY_GATEWAY
+    /* Leaves send at any time, frames are missed in modem sleep */
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+#else
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM)); // for low power
+#endif
+    ESP_ERROR_CHECK(esp_wifi_start());
 }
 
 /* Event handler for catching system events */
@@ -75,6 +348,7 @@ void prov_event_handler(void* arg, esp_event_base_t event_base,
             }
             case WIFI_PROV_CRED_SUCCESS:
                 ESP_LOGI(TAG, "Provisioning successful");
+                request_write(false);
                 break;
             case WIFI_PROV_END: {
                 wifi_prov_mgr_deinit();
@@ -88,14 +362,35 @@ void prov_event_handler(void* arg, esp_event_base_t event_base,
             case WIFI_EVENT_STA_START:
                 esp_wifi_connect();
                 break;
+            case WIFI_EVENT_STA_CONNECTED: {
+                wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+                memcpy(wifi_cache.bssid, event->bssid, sizeof(wifi_cache.bssid));
+                wifi_cache.channel = event->channel;
+                wifi_cache.magic = WIFI_CACHE_MAGIC;
+                break;
+            }
             case WIFI_EVENT_STA_DISCONNECTED:
-                ESP_LOGI(TAG, "Wi-Fi disconnected, retrying connection...");
                 xEventGroupClearBits(app_event_group, WIFI_CONNECTED_BIT);
 
+                /* The cached AP or lease is stale, it doesn't count as a retry */
+                if (fast_connect) {
+                    wifi_fast_connect_fallback();
+                    esp_wifi_connect();
+                    break;
+                }
+
+                ESP_LOGI(TAG, "Wi-Fi disconnected, retrying connection...");
+
                 if (++connection_retries >= MAX_RETRIES) {
-                    ESP_LOGI(TAG, "Max retries reached. Restarting provisioning");
-                    esp_wifi_restore();
+#if CONFIG_RELAY_LEAF
+                    /* Out of reach rather than misconfigured as a rule, keep the credentials */
+                    ESP_LOGI(TAG, "Max retries reached. Restarting as relay leaf");
+                    app_relay_become_leaf();
                     esp_restart();
+#else
+                    ESP_LOGI(TAG, "Max retries reached. Restarting provisioning");
+                    app_prov_request(0);
+#endif
                 } else {
                     ESP_LOGI(TAG, "Reconnecting to WiFi...");
                     esp_wifi_connect();
@@ -108,6 +403,17 @@ void prov_event_handler(void* arg, esp_event_base_t event_base,
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "Connected with IP Address:" IPSTR, IP2STR(&event->ip_info.ip));
+
+        /* A reused lease keeps its original age */
+        if (fast_connect && wifi_cache.lease_valid) {
+            lease_timer_start();
+        } else {
+            wifi_cache.ip_info = event->ip_info;
+            esp_netif_get_dns_info(event->esp_netif, ESP_NETIF_DNS_MAIN, &wifi_cache.dns);
+            wifi_cache.lease_acquired = time(NULL);
+            wifi_cache.lease_valid = true;
+        }
+        fast_connect = false;
         xEventGroupSetBits(app_event_group, WIFI_CONNECTED_BIT);
     }
 }
@@ -137,11 +443,10 @@ void app_prov_init() {
     ESP_ERROR_CHECK(wifi_prov_mgr_init(config));
     wifi_prov_mgr_disable_auto_stop(5000);
 
-    /* Register our event handler for Wi-Fi, IP and Provisioning related events */
+    /* Register our event handler for Provisioning related events */
     ESP_ERROR_CHECK(esp_event_handler_register(WIFI_PROV_EVENT, ESP_EVENT_ANY_ID, &prov_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(PROTOCOMM_TRANSPORT_BLE_EVENT, ESP_EVENT_ANY_ID, &prov_event_handler, NULL));
     ESP_ERROR_CHECK(esp_event_handler_register(PROTOCOMM_SECURITY_SESSION_EVENT, ESP_EVENT_ANY_ID, &prov_event_handler, NULL));
-    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &prov_event_handler, NULL));
 }
 
 void print_uuid(const uint8_t uuid[16]) {
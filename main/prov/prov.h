@@ -1,9 +1,32 @@
 #ifndef PROV_H_
 #define PROV_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_event.h>
+
+/* Restart delay after a provisioning request from a config message, lets the ack leave first */
+#define PROV_REQUEST_DELAY_MS 3000
+
 void prov_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 
 void app_wifi_init();
+/* Start the STA of a provisioned device, reusing the AP and lease of the last wake when possible */
+void app_wifi_start();
+
+/* True if Wi-Fi credentials are stored and provisioning was not requested. Needs app_wifi_init. */
+bool app_prov_is_provisioned();
+
+/* Makes the next boot bring up BLE provisioning and restarts after delay_ms. The stored credentials
+ * are kept until new ones are received. */
+void app_prov_request(uint32_t delay_ms);
+
+/* Returns the memory of the BT controller and host to the heap, BLE provisioning needs a restart afterwards */
+void app_prov_release_bt();
+
+/* Requests provisioning once the button is held for CONFIG_PROV_BUTTON_HOLD_MS */
+void app_prov_button_init();
 
 void app_prov_init();
 void app_prov_start();
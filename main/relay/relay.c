@@ -0,0 +1,565 @@
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_wifi.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_mac.h"
+#include "nvs.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "pb_encode.h"
+#include "relay.pb.h"
+
+#include "codec.h"
+#include "common.h"
+#include "store.h"
+#include "timebase.h"
+#include "sntp.h"
+#include "prov.h"
+#include "relay_link.h"
+#include "relay.h"
+
+static const char* TAG = "relay";
+
+#define RELAY_NVS_NAMESPACE "relay"
+/* Present while the device is a leaf, wall time in s at which Wi-Fi is tried again, 0 until known */
+#define RELAY_NVS_KEY_LEAF_UNTIL "leaf_until"
+
+#define RELAY_TASK_STACK_SIZE 4096
+#define RELAY_TASK_PRIORITY 4
+#define RELAY_QUEUE_LENGTH 16
+
+/* Wait for a gateway's reply per channel */
+#define RELAY_HELLO_TIMEOUT_MS 30
+#define RELAY_CHANNEL_MAX 13
+/* Pause before sending again after the gateway was busy or did not answer */
+#define RELAY_BACKOFF_MS 2000
+/* Check the store this often while it is empty */
+#define RELAY_IDLE_POLL_MS 500
+/* Check the store this often while flushing before deep sleep */
+#define RELAY_FLUSH_POLL_MS 50
+
+/* Bytes of RelayBundle and RelayedRecords framing around one record at most */
+#define RELAY_RECORD_OVERHEAD 32
+/* Log the gateway stats every this many bundles */
+#define RELAY_STATS_PERIOD 10
+
+#define RELAY_CACHE_MAGIC 0x52454c59
+
+/* A frame as it came off the radio, handed from the Wi-Fi task to the relay task */
+typedef struct {
+    uint8_t addr[RELAY_ADDR_LEN];
+    int8_t rssi;
+    uint8_t len;
+    uint8_t data[RELAY_FRAME_MAX];
+} relay_frame_t;
+
+/* Gateway and channel of the last wake and the message sequence, kept across deep sleep */
+typedef struct {
+    uint32_t magic;
+    uint8_t addr[RELAY_ADDR_LEN];
+    uint8_t channel;
+    uint16_t seq;
+} leaf_cache_t;
+
+static bool leaf = false;
+
+#if CONFIG_RELAY_LEAF || CONFIG_RELAY_GATEWAY
+static QueueHandle_t frames = NULL;
+#endif
+
+#if CONFIG_RELAY_LEAF
+static RTC_DATA_ATTR leaf_cache_t leaf_cache;
+static const uint8_t broadcast_addr[RELAY_ADDR_LEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+static bool leaf_until_known = false;
+static relay_sender_t sender;
+static uint32_t leaf_delivered = 0;
+#endif
+
+#if CONFIG_RELAY_GATEWAY
+static relay_receiver_t receiver;
+static relay_peer_t peers[CONFIG_RELAY_GATEWAY_PEERS];
+static uint8_t peer_arena[CONFIG_RELAY_GATEWAY_PEERS * CONFIG_BATCH_MAX_BYTES];
+static int8_t frame_rssi;
+
+/* Records taken from leaves for the next RelayBundle, each as address, rssi, length and the record */
+#define RECORD_HEADER (RELAY_ADDR_LEN + 1 + sizeof(uint16_t))
+
+static SemaphoreHandle_t bundle_lock = NULL;
+static struct {
+    uint8_t buffer[RELAY_BUNDLE_SIZE];
+    size_t used;
+    size_t encoded;         // worst case size of the RelayBundle
+    uint32_t records;
+    int64_t first_at;
+
+    uint32_t bundles;
+    uint32_t bundle_bytes;
+} bundle;
+#endif
+
+#if CONFIG_RELAY_LEAF
+static void leaf_until_write(uint64_t until_s) {
+    nvs_handle_t handle;
+    if (nvs_open(RELAY_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_u64(handle, RELAY_NVS_KEY_LEAF_UNTIL, until_s) == ESP_OK) {
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+static void leaf_clear(void) {
+    nvs_handle_t handle;
+    if (nvs_open(RELAY_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK) {
+        return;
+    }
+    nvs_erase_key(handle, RELAY_NVS_KEY_LEAF_UNTIL);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+void app_relay_init(void) {
+    nvs_handle_t handle;
+    uint64_t until_s;
+    if (nvs_open(RELAY_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    esp_err_t err = nvs_get_u64(handle, RELAY_NVS_KEY_LEAF_UNTIL, &until_s);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        return;
+    }
+
+    leaf_until_known = until_s != 0;
+    if (leaf_until_known && timebase_valid() && (uint64_t)time(NULL) >= until_s) {
+        ESP_LOGI(TAG, "Leaf period over, trying Wi-Fi again");
+        leaf_clear();
+        return;
+    }
+    leaf = true;
+}
+
+void app_relay_become_leaf(void) {
+    uint64_t until_s = timebase_valid() ? (uint64_t)time(NULL) + CONFIG_RELAY_WIFI_RETRY_H * 3600ULL : 0;
+    leaf_until_write(until_s);
+    memset(&leaf_cache, 0, sizeof(leaf_cache));
+}
+#else
+void app_relay_init(void) {
+}
+
+void app_relay_become_leaf(void) {
+}
+#endif
+
+bool app_relay_is_leaf(void) {
+    return leaf;
+}
+
+#if CONFIG_RELAY_LEAF || CONFIG_RELAY_GATEWAY
+static inline uint64_t now_ms(void) {
+    return (uint64_t)(esp_timer_get_time() / 1000);
+}
+
+/* Frames of unknown senders need a peer entry before they can be answered */
+static bool espnow_send(void* ctx, const uint8_t addr[RELAY_ADDR_LEN], const uint8_t* frame, size_t len) {
+    if (!esp_now_is_peer_exist(addr)) {
+        esp_now_peer_info_t peer = {
+            .channel = 0,       // the current one
+            .ifidx = WIFI_IF_STA,
+            .encrypt = false,
+        };
+        memcpy(peer.peer_addr, addr, RELAY_ADDR_LEN);
+
+        esp_err_t err = esp_now_add_peer(&peer);
+        if (err == ESP_ERR_ESPNOW_FULL) {
+            /* The peer list only holds a few entries, the gateway hears from more leaves */
+            esp_now_peer_info_t oldest;
+            if (esp_now_fetch_peer(true, &oldest) == ESP_OK) {
+                esp_now_del_peer(oldest.peer_addr);
+            }
+            err = esp_now_add_peer(&peer);
+        }
+        if (err != ESP_OK) {
+            return false;
+        }
+    }
+    return esp_now_send(addr, frame, len) == ESP_OK;
+}
+
+static const relay_transport_t transport = {
+    .send = espnow_send,
+    .ctx = NULL,
+};
+
+/* Runs in the Wi-Fi task, frames that do not fit the queue are repeated by their sender */
+static void espnow_recv(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+    if (len <= 0 || len > RELAY_FRAME_MAX) {
+        return;
+    }
+
+    relay_frame_t frame;
+    memcpy(frame.addr, info->src_addr, RELAY_ADDR_LEN);
+    frame.rssi = info->rx_ctrl->rssi;
+    frame.len = (uint8_t)len;
+    memcpy(frame.data, data, len);
+    xQueueSend(frames, &frame, 0);
+}
+
+static bool espnow_init(void) {
+    frames = xQueueCreate(RELAY_QUEUE_LENGTH, sizeof(relay_frame_t));
+    if (frames == NULL) {
+        ESP_LOGE(TAG, "Failed to create frame queue");
+        return false;
+    }
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_recv));
+    return true;
+}
+#endif
+
+#if CONFIG_RELAY_LEAF
+/* The gateway's clock stands in for SNTP, a leaf never reaches a time server */
+static void sync_clock(uint64_t wall_ms) {
+    struct timeval tv = {
+        .tv_sec = wall_ms / 1000,
+        .tv_usec = (wall_ms % 1000) * 1000,
+    };
+    app_sntp_set_time(&tv);
+
+    if (!leaf_until_known) {
+        leaf_until_write(tv.tv_sec + CONFIG_RELAY_WIFI_RETRY_H * 3600ULL);
+        leaf_until_known = true;
+    }
+}
+
+static bool discover_on(uint8_t channel) {
+    ESP_ERROR_CHECK(esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE));
+
+    uint8_t hello[RELAY_FRAME_MAX];
+    espnow_send(NULL, broadcast_addr, hello, relay_frame_hello(hello));
+
+    uint64_t deadline = now_ms() + RELAY_HELLO_TIMEOUT_MS;
+    relay_frame_t frame;
+    uint64_t wall_ms;
+    while (now_ms() < deadline) {
+        if (xQueueReceive(frames, &frame, pdMS_TO_TICKS(RELAY_HELLO_TIMEOUT_MS)) != pdTRUE ||
+            !relay_parse_hello_reply(frame.data, frame.len, &wall_ms)) {
+            continue;
+        }
+
+        memcpy(leaf_cache.addr, frame.addr, RELAY_ADDR_LEN);
+        leaf_cache.channel = channel;
+        leaf_cache.magic = RELAY_CACHE_MAGIC;
+        if (wall_ms != 0) {
+            sync_clock(wall_ms);
+        }
+        ESP_LOGI(TAG, "Gateway " MACSTR " on channel %d, rssi %d", MAC2STR(frame.addr), channel, frame.rssi);
+        return true;
+    }
+    return false;
+}
+
+/* The last channel first, then all of them */
+static bool discover(void) {
+    uint8_t last = leaf_cache.magic == RELAY_CACHE_MAGIC ? leaf_cache.channel : 0;
+    if (last != 0 && discover_on(last)) {
+        return true;
+    }
+    for (uint8_t channel = 1; channel <= RELAY_CHANNEL_MAX; ++channel) {
+        if (channel != last && discover_on(channel)) {
+            return true;
+        }
+    }
+    leaf_cache.magic = 0;
+    return false;
+}
+
+/* Sends the oldest stored record, it is consumed once the gateway took it */
+static relay_send_state_t send_oldest(const uint8_t* record, size_t len) {
+    if (!relay_sender_start(&sender, record, len, now_ms())) {
+        return RELAY_SEND_FAILED;
+    }
+
+    relay_send_state_t state;
+    while ((state = relay_sender_poll(&sender, now_ms())) == RELAY_SEND_PENDING) {
+        relay_frame_t frame;
+        if (xQueueReceive(frames, &frame, pdMS_TO_TICKS(CONFIG_RELAY_ACK_TIMEOUT_MS)) == pdTRUE &&
+            memcmp(frame.addr, sender.peer, RELAY_ADDR_LEN) == 0) {
+            relay_sender_receive(&sender, frame.data, frame.len);
+        }
+    }
+    leaf_cache.seq = sender.seq;
+    return state;
+}
+
+static void leaf_task(void* pvParameters) {
+    static uint8_t record[CONFIG_BATCH_MAX_BYTES];
+
+    while (1) {
+        size_t len;
+        ring_store_pos_t pos = app_store_begin();
+        if (!app_store_peek(&pos, record, sizeof(record), &len)) {
+            vTaskDelay(pdMS_TO_TICKS(RELAY_IDLE_POLL_MS));
+            continue;
+        }
+        if (len == 0) {
+            app_store_consume(1); // unreadable record
+            continue;
+        }
+
+        relay_send_state_t state = send_oldest(record, len);
+        if (state == RELAY_SEND_DELIVERED) {
+            app_store_consume(1);
+            leaf_delivered++;
+            continue;
+        }
+
+        if (sender.busy) {
+            ESP_LOGW(TAG, "Gateway busy, %lu records pending", app_store_pending());
+        } else {
+            /* The gateway may have moved with its access point */
+            ESP_LOGW(TAG, "No ack from gateway, searching again");
+            if (discover()) {
+                memcpy(sender.peer, leaf_cache.addr, RELAY_ADDR_LEN);
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(RELAY_BACKOFF_MS));
+    }
+}
+
+void app_relay_start_leaf(void) {
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+    ESP_ERROR_CHECK(esp_wifi_start());
+    /* Awake only for a short burst, acks must not be missed in modem sleep */
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+    if (!espnow_init()) {
+        return;
+    }
+
+    /* After deep sleep the gateway of the last wake is still known. Asking it again brings its clock,
+     * that is only needed once the error bound of ours went above the budget. */
+    bool cached = leaf_cache.magic == RELAY_CACHE_MAGIC;
+    if (cached && !app_sntp_due()) {
+        ESP_ERROR_CHECK(esp_wifi_set_channel(leaf_cache.channel, WIFI_SECOND_CHAN_NONE));
+    } else if (!discover()) {
+        ESP_LOGW(TAG, "No gateway in range. Restarting provisioning");
+        leaf_clear();
+        app_prov_request(0);
+    } else if (!cached) {
+        leaf_cache.seq = (uint16_t)esp_random();
+    }
+
+    relay_sender_config_t config = {
+        .ack_timeout_ms = CONFIG_RELAY_ACK_TIMEOUT_MS,
+        .retries = CONFIG_RELAY_RETRIES,
+    };
+    relay_sender_init(&sender, &config, &transport, leaf_cache.addr, leaf_cache.seq);
+
+    if (xTaskCreate(leaf_task, "relay_leaf", RELAY_TASK_STACK_SIZE, NULL, RELAY_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create leaf task");
+    }
+}
+
+void app_relay_flush(uint32_t timeout_ms) {
+    if (!leaf) {
+        return;
+    }
+
+    int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+    while (app_store_pending() > 0 && esp_timer_get_time() < deadline) {
+        vTaskDelay(pdMS_TO_TICKS(RELAY_FLUSH_POLL_MS));
+    }
+    app_relay_log_stats();
+}
+#else
+void app_relay_start_leaf(void) {
+}
+
+void app_relay_flush(uint32_t timeout_ms) {
+}
+#endif
+
+#if CONFIG_RELAY_GATEWAY
+/* Called by the receiver with a complete record, refused while the bundle has no room */
+static bool take_record(void* ctx, const uint8_t addr[RELAY_ADDR_LEN], const uint8_t* data, size_t len) {
+    xSemaphoreTake(bundle_lock, portMAX_DELAY);
+
+    bool room = bundle.used + RECORD_HEADER + len <= sizeof(bundle.buffer) &&
+                bundle.encoded + len + RELAY_RECORD_OVERHEAD <= RELAY_BUNDLE_SIZE;
+    if (room) {
+        uint8_t* entry = bundle.buffer + bundle.used;
+        uint16_t record = (uint16_t)len;
+        memcpy(entry, addr, RELAY_ADDR_LEN);
+        entry[RELAY_ADDR_LEN] = (uint8_t)frame_rssi;
+        memcpy(entry + RELAY_ADDR_LEN + 1, &record, sizeof(record));
+        memcpy(entry + RECORD_HEADER, data, len);
+
+        if (bundle.records == 0) {
+            bundle.first_at = esp_timer_get_time();
+        }
+        bundle.used += RECORD_HEADER + len;
+        bundle.encoded += len + RELAY_RECORD_OVERHEAD;
+        bundle.records++;
+    }
+
+    xSemaphoreGive(bundle_lock);
+    return room;
+}
+
+static void gateway_task(void* pvParameters) {
+    relay_frame_t frame;
+
+    while (1) {
+        if (xQueueReceive(frames, &frame, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+
+        switch (relay_frame_type(frame.data, frame.len)) {
+            case RELAY_FRAME_HELLO: {
+                uint8_t reply[RELAY_HELLO_REPLY_LEN];
+                uint64_t wall_ms = timebase_valid() ? timebase_wall_ms(timebase_now_us()) : 0;
+                espnow_send(NULL, frame.addr, reply, relay_frame_hello_reply(reply, wall_ms));
+                break;
+            }
+            case RELAY_FRAME_DATA:
+                frame_rssi = frame.rssi;
+                relay_receiver_receive(&receiver, frame.addr, frame.data, frame.len, now_ms());
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void app_relay_start_gateway(void) {
+    bundle_lock = xSemaphoreCreateMutex();
+    if (bundle_lock == NULL || !espnow_init()) {
+        ESP_LOGE(TAG, "Failed to start gateway");
+        bundle_lock = NULL;
+        return;
+    }
+
+    relay_receiver_init(&receiver, &transport, peers, CONFIG_RELAY_GATEWAY_PEERS,
+                        peer_arena, CONFIG_BATCH_MAX_BYTES, take_record, NULL);
+
+    if (xTaskCreate(gateway_task, "relay_gateway", RELAY_TASK_STACK_SIZE, NULL, RELAY_TASK_PRIORITY, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create gateway task");
+    }
+}
+
+typedef struct {
+    const uint8_t* data;
+    size_t len;
+} relay_record_t;
+
+static bool encode_record(pb_ostream_t* stream, const pb_field_t* field, void* const* arg) {
+    const relay_record_t* record = *arg;
+    return pb_encode_tag_for_field(stream, field) && pb_encode_string(stream, record->data, record->len);
+}
+
+static bool encode_leaves(pb_ostream_t* stream, const pb_field_t* field, void* const* arg) {
+    size_t pos = 0;
+
+    while (pos < bundle.used) {
+        const uint8_t* entry = bundle.buffer + pos;
+        uint16_t len;
+        memcpy(&len, entry + RELAY_ADDR_LEN + 1, sizeof(len));
+
+        RelayedRecords leaves = RelayedRecords_init_zero;
+        app_format_device_id(leaves.device_id, sizeof(leaves.device_id), entry);
+        leaves.rssi = (int8_t)entry[RELAY_ADDR_LEN];
+
+        /* Stored the same way as on any other device, summaries and events go into their own fields */
+        relay_record_t record = { .data = entry + RECORD_HEADER, .len = len };
+        pb_callback_t* target = &leaves.batches;
+        if (codec_is_event_record(record.data, len)) {
+            record.data += CODEC_EVENT_RECORD_HEADER;
+            record.len -= CODEC_EVENT_RECORD_HEADER;
+            target = &leaves.events;
+        } else if (codec_is_summary_batch(record.data, len)) {
+            target = &leaves.summaries;
+        }
+        target->funcs.encode = encode_record;
+        target->arg = &record;
+
+        if (!pb_encode_tag_for_field(stream, field) || !pb_encode_submessage(stream, RelayedRecords_fields, &leaves)) {
+            return false;
+        }
+        pos += RECORD_HEADER + len;
+    }
+    return true;
+}
+
+size_t app_relay_take_bundle(uint8_t* buffer, size_t size) {
+    if (bundle_lock == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(bundle_lock, portMAX_DELAY);
+
+    bool due = bundle.records > 0 && (bundle.encoded >= RELAY_BUNDLE_SIZE / 2 ||
+               esp_timer_get_time() - bundle.first_at >= RELAY_BUNDLE_MAX_AGE_MS * 1000LL);
+    size_t len = 0;
+    if (due) {
+        RelayBundle message = RelayBundle_init_zero;
+        message.leaves.funcs.encode = encode_leaves;
+
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, size);
+        if (pb_encode(&stream, RelayBundle_fields, &message)) {
+            len = stream.bytes_written;
+            bundle.bundles++;
+            bundle.bundle_bytes += len;
+        } else {
+            ESP_LOGE(TAG, "Failed to encode relay bundle: %s", PB_GET_ERROR(&stream));
+        }
+        bundle.used = 0;
+        bundle.encoded = 0;
+        bundle.records = 0;
+    }
+
+    xSemaphoreGive(bundle_lock);
+
+    if (due && bundle.bundles % RELAY_STATS_PERIOD == 0) {
+        app_relay_log_stats();
+    }
+    return len;
+}
+#else
+void app_relay_start_gateway(void) {
+}
+
+size_t app_relay_take_bundle(uint8_t* buffer, size_t size) {
+    return 0;
+}
+#endif
+
+void app_relay_log_stats(void) {
+    /* One JSON object per line so it can be scraped from the console */
+#if CONFIG_RELAY_GATEWAY
+    uint32_t leaves = 0;
+    for (size_t i = 0; i < CONFIG_RELAY_GATEWAY_PEERS; ++i) {
+        leaves += peers[i].used;
+    }
+    ESP_LOGI(TAG, "relay {\"role\":\"gateway\",\"leaves\":%lu,\"frames\":%lu,\"duplicate\":%lu,\"delivered\":%lu,"
+        "\"busy\":%lu,\"evicted\":%lu,\"bundles\":%lu,\"bundle_bytes\":%lu}",
+        leaves, receiver.frames_received, receiver.frames_duplicate, receiver.messages_delivered,
+        receiver.messages_busy, receiver.peers_evicted, bundle.bundles, bundle.bundle_bytes);
+#elif CONFIG_RELAY_LEAF
+    ESP_LOGI(TAG, "relay {\"role\":\"leaf\",\"delivered\":%lu,\"failed\":%lu,\"frames\":%lu,\"repeated\":%lu,\"pending\":%lu}",
+        leaf_delivered, sender.messages_failed, sender.frames_sent, sender.frames_repeated, app_store_pending());
+#endif
+}
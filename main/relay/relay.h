@@ -0,0 +1,41 @@
+#ifndef RELAY_H_
+#define RELAY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Devices without Wi-Fi coverage report through a mains powered gateway node over ESP-NOW.
+ * A leaf samples and stores as usual, its stored records go to the gateway instead of the broker.
+ * The gateway publishes the records of many leaves together as one RelayBundle. */
+
+/* Records taken from leaves are published once they fill half the bundle or are this old */
+#define RELAY_BUNDLE_SIZE 4096
+#define RELAY_BUNDLE_MAX_AGE_MS 10000
+
+/* Reads the role kept in NVS, Wi-Fi is tried again once the leaf period is over */
+void app_relay_init(void);
+
+/* True if this wake runs as a leaf node */
+bool app_relay_is_leaf(void);
+
+/* Keeps the Wi-Fi credentials and makes the next boot a leaf, called once the access point is out of reach */
+void app_relay_become_leaf(void);
+
+/* Starts the radio without joining an access point, finds the gateway and starts sending stored records.
+ * Falls back to provisioning if no gateway answers. */
+void app_relay_start_leaf(void);
+
+/* Waits until the store is empty or timeout_ms passed, before deep sleep */
+void app_relay_flush(uint32_t timeout_ms);
+
+/* Starts receiving from leaves on the channel of the joined access point */
+void app_relay_start_gateway(void);
+
+/* Encodes the records taken from leaves as a RelayBundle once it is due, returns the number of
+ * bytes written or 0 if there is nothing to publish yet */
+size_t app_relay_take_bundle(uint8_t* buffer, size_t size);
+
+void app_relay_log_stats(void);
+
+#endif
@@ -0,0 +1,266 @@
+#include <string.h>
+
+#include "relay_link.h"
+
+static inline uint32_t fragments_mask(uint8_t count) {
+    return count >= 32 ? UINT32_MAX : (1u << count) - 1;
+}
+
+static inline void put_u16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t get_u16(const uint8_t* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline void put_u32(uint8_t* p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline uint32_t get_u32(const uint8_t* p) {
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+relay_frame_type_t relay_frame_type(const uint8_t* frame, size_t len) {
+    return len > 0 ? (relay_frame_type_t)frame[0] : 0;
+}
+
+size_t relay_frame_hello(uint8_t* frame) {
+    frame[0] = RELAY_FRAME_HELLO;
+    return 1;
+}
+
+size_t relay_frame_hello_reply(uint8_t* frame, uint64_t wall_ms) {
+    frame[0] = RELAY_FRAME_HELLO_REPLY;
+    put_u32(frame + 1, (uint32_t)wall_ms);
+    put_u32(frame + 5, (uint32_t)(wall_ms >> 32));
+    return RELAY_HELLO_REPLY_LEN;
+}
+
+bool relay_parse_hello_reply(const uint8_t* frame, size_t len, uint64_t* wall_ms) {
+    if (len < RELAY_HELLO_REPLY_LEN || frame[0] != RELAY_FRAME_HELLO_REPLY) {
+        return false;
+    }
+    *wall_ms = get_u32(frame + 1) | (uint64_t)get_u32(frame + 5) << 32;
+    return true;
+}
+
+void relay_sender_init(relay_sender_t* sender, const relay_sender_config_t* config, const relay_transport_t* transport,
+                       const uint8_t peer[RELAY_ADDR_LEN], uint16_t seq) {
+    memset(sender, 0, sizeof(*sender));
+    sender->config = *config;
+    sender->transport = transport;
+    memcpy(sender->peer, peer, RELAY_ADDR_LEN);
+    sender->seq = seq;
+    sender->state = RELAY_SEND_IDLE;
+}
+
+/* One burst of every fragment not acked yet, the last one asks for an ack */
+static void send_missing(relay_sender_t* sender, uint64_t now_ms) {
+    uint8_t frame[RELAY_FRAME_MAX];
+    uint32_t missing = fragments_mask(sender->count) & ~sender->acked;
+
+    for (uint8_t i = 0; i < sender->count; ++i) {
+        if (!(missing & (1u << i))) {
+            continue;
+        }
+        missing &= ~(1u << i);
+
+        size_t offset = (size_t)i * RELAY_FRAGMENT_MAX;
+        size_t len = sender->len - offset < RELAY_FRAGMENT_MAX ? sender->len - offset : RELAY_FRAGMENT_MAX;
+
+        frame[0] = RELAY_FRAME_DATA;
+        put_u16(frame + 1, sender->seq);
+        frame[3] = i;
+        frame[4] = sender->count;
+        frame[5] = missing == 0 ? RELAY_FLAG_ACK_REQUEST : 0;
+        memcpy(frame + RELAY_DATA_HEADER, sender->data + offset, len);
+
+        sender->transport->send(sender->transport->ctx, sender->peer, frame, RELAY_DATA_HEADER + len);
+        sender->frames_sent++;
+        if (sender->attempts > 0) {
+            sender->frames_repeated++;
+        }
+    }
+    sender->sent_at = now_ms;
+}
+
+bool relay_sender_start(relay_sender_t* sender, const uint8_t* data, size_t len, uint64_t now_ms) {
+    if (sender->state == RELAY_SEND_PENDING || len == 0 || len > RELAY_MESSAGE_MAX) {
+        return false;
+    }
+
+    sender->data = data;
+    sender->len = len;
+    sender->seq++;
+    sender->count = (uint8_t)((len + RELAY_FRAGMENT_MAX - 1) / RELAY_FRAGMENT_MAX);
+    sender->acked = 0;
+    sender->attempts = 0;
+    sender->busy = false;
+    sender->state = RELAY_SEND_PENDING;
+
+    send_missing(sender, now_ms);
+    return true;
+}
+
+void relay_sender_receive(relay_sender_t* sender, const uint8_t* frame, size_t len) {
+    if (len < RELAY_ACK_LEN || frame[0] != RELAY_FRAME_ACK ||
+        sender->state != RELAY_SEND_PENDING || get_u16(frame + 1) != sender->seq) {
+        return;
+    }
+
+    if (frame[3] == RELAY_ACK_BUSY) {
+        sender->busy = true;
+        sender->state = RELAY_SEND_FAILED;
+        return;
+    }
+
+    sender->acked |= get_u32(frame + 4);
+    if ((sender->acked & fragments_mask(sender->count)) == fragments_mask(sender->count)) {
+        sender->state = RELAY_SEND_DELIVERED;
+    }
+}
+
+relay_send_state_t relay_sender_poll(relay_sender_t* sender, uint64_t now_ms) {
+    relay_send_state_t state = sender->state;
+
+    if (state == RELAY_SEND_PENDING && now_ms - sender->sent_at >= sender->config.ack_timeout_ms) {
+        if (sender->attempts >= sender->config.retries) {
+            state = RELAY_SEND_FAILED;
+        } else {
+            sender->attempts++;
+            send_missing(sender, now_ms);
+        }
+    }
+
+    if (state == RELAY_SEND_DELIVERED || state == RELAY_SEND_FAILED) {
+        if (state == RELAY_SEND_FAILED) {
+            sender->messages_failed++;
+        }
+        sender->state = RELAY_SEND_IDLE;
+    }
+    return state;
+}
+
+void relay_receiver_init(relay_receiver_t* receiver, const relay_transport_t* transport, relay_peer_t* peers,
+                         size_t peer_count, uint8_t* arena, size_t slot_size, relay_deliver_t deliver, void* ctx) {
+    memset(receiver, 0, sizeof(*receiver));
+    receiver->transport = transport;
+    receiver->peers = peers;
+    receiver->peer_count = peer_count;
+    receiver->slot_size = slot_size;
+    receiver->deliver = deliver;
+    receiver->ctx = ctx;
+
+    memset(peers, 0, peer_count * sizeof(relay_peer_t));
+    for (size_t i = 0; i < peer_count; ++i) {
+        peers[i].buffer = arena + i * slot_size;
+    }
+}
+
+static relay_peer_t* find_peer(relay_receiver_t* receiver, const uint8_t addr[RELAY_ADDR_LEN]) {
+    relay_peer_t* oldest = &receiver->peers[0];
+
+    for (size_t i = 0; i < receiver->peer_count; ++i) {
+        relay_peer_t* peer = &receiver->peers[i];
+        if (peer->used && memcmp(peer->addr, addr, RELAY_ADDR_LEN) == 0) {
+            return peer;
+        }
+        if (!peer->used) {
+            oldest = peer;
+        } else if (oldest->used && peer->active_at < oldest->active_at) {
+            oldest = peer;
+        }
+    }
+
+    if (oldest->used) {
+        receiver->peers_evicted++;
+    }
+    uint8_t* buffer = oldest->buffer;
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->buffer = buffer;
+    memcpy(oldest->addr, addr, RELAY_ADDR_LEN);
+    oldest->used = true;
+    return oldest;
+}
+
+static void send_ack(relay_receiver_t* receiver, const uint8_t addr[RELAY_ADDR_LEN], uint16_t seq,
+                     relay_ack_status_t status, uint32_t received) {
+    uint8_t frame[RELAY_ACK_LEN];
+    frame[0] = RELAY_FRAME_ACK;
+    put_u16(frame + 1, seq);
+    frame[3] = status;
+    put_u32(frame + 4, received);
+    receiver->transport->send(receiver->transport->ctx, addr, frame, sizeof(frame));
+}
+
+void relay_receiver_receive(relay_receiver_t* receiver, const uint8_t addr[RELAY_ADDR_LEN],
+                            const uint8_t* frame, size_t len, uint64_t now_ms) {
+    if (len <= RELAY_DATA_HEADER || frame[0] != RELAY_FRAME_DATA) {
+        return;
+    }
+
+    uint16_t seq = get_u16(frame + 1);
+    uint8_t index = frame[3];
+    uint8_t count = frame[4];
+    bool ack_request = frame[5] & RELAY_FLAG_ACK_REQUEST;
+    size_t payload = len - RELAY_DATA_HEADER;
+    size_t offset = (size_t)index * RELAY_FRAGMENT_MAX;
+
+    /* Only the last fragment may be short */
+    if (count == 0 || count > RELAY_FRAGMENTS_MAX || index >= count ||
+        (index < count - 1 && payload != RELAY_FRAGMENT_MAX) || offset + payload > receiver->slot_size) {
+        return;
+    }
+
+    relay_peer_t* peer = find_peer(receiver, addr);
+    peer->active_at = now_ms;
+    receiver->frames_received++;
+
+    if (peer->has_done && seq == peer->done_seq) {
+        receiver->frames_duplicate++;
+        if (ack_request) {
+            send_ack(receiver, addr, seq, RELAY_ACK_OK, fragments_mask(count));
+        }
+        return;
+    }
+
+    if (seq != peer->seq || count != peer->count) {
+        peer->seq = seq;
+        peer->count = count;
+        peer->received = 0;
+        peer->len = 0;
+    }
+
+    if (peer->received & (1u << index)) {
+        receiver->frames_duplicate++;
+    } else {
+        memcpy(peer->buffer + offset, frame + RELAY_DATA_HEADER, payload);
+        peer->received |= 1u << index;
+        if (index == count - 1) {
+            peer->len = offset + payload;
+        }
+    }
+
+    if (peer->received != fragments_mask(count)) {
+        if (ack_request) {
+            send_ack(receiver, addr, seq, RELAY_ACK_OK, peer->received);
+        }
+        return;
+    }
+
+    if (receiver->deliver(receiver->ctx, addr, peer->buffer, peer->len)) {
+        receiver->messages_delivered++;
+        peer->has_done = true;
+        peer->done_seq = seq;
+        send_ack(receiver, addr, seq, RELAY_ACK_OK, peer->received);
+    } else {
+        /* Sent again as a whole once the sender backed off */
+        receiver->messages_busy++;
+        peer->received = 0;
+        send_ack(receiver, addr, seq, RELAY_ACK_BUSY, 0);
+    }
+}
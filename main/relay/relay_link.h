@@ -0,0 +1,143 @@
+#ifndef RELAY_LINK_H_
+#define RELAY_LINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Framing, fragmentation and ack/retry for relaying stored records from leaf nodes to a gateway node
+ * over a datagram medium. The medium is behind relay_transport_t, ESP-NOW on the device.
+ * No platform dependencies, callers pass the time in ms.
+ *
+ * Frames, little endian:
+ *   DATA         type, seq u16, index u8, count u8, flags u8, payload
+ *   ACK          type, seq u16, status u8, received bitmap u32
+ *   HELLO        type                          broadcast by a leaf looking for a gateway
+ *   HELLO_REPLY  type, wall time ms u64        0 if the gateway's clock is not synced
+ * A message is sent as up to RELAY_FRAGMENTS_MAX DATA frames. The receiver acks the frames flagged
+ * with RELAY_FLAG_ACK_REQUEST with the fragments it has, the sender repeats only the missing ones. */
+
+#define RELAY_ADDR_LEN 6
+/* ESP-NOW v1 payload limit */
+#define RELAY_FRAME_MAX 250
+#define RELAY_DATA_HEADER 6
+#define RELAY_ACK_LEN 8
+#define RELAY_HELLO_REPLY_LEN 9
+#define RELAY_FRAGMENT_MAX (RELAY_FRAME_MAX - RELAY_DATA_HEADER)
+#define RELAY_FRAGMENTS_MAX 32
+#define RELAY_MESSAGE_MAX (RELAY_FRAGMENT_MAX * RELAY_FRAGMENTS_MAX)
+
+typedef enum {
+    RELAY_FRAME_DATA = 1,
+    RELAY_FRAME_ACK = 2,
+    RELAY_FRAME_HELLO = 3,
+    RELAY_FRAME_HELLO_REPLY = 4,
+} relay_frame_type_t;
+
+#define RELAY_FLAG_ACK_REQUEST 0x01
+
+typedef enum {
+    RELAY_ACK_OK,               // fragments received, the message was taken once complete
+    RELAY_ACK_BUSY,             // complete but the gateway has no room, send it again later
+} relay_ack_status_t;
+
+typedef struct {
+    /* Hands one frame to the medium, false if it could not be queued */
+    bool (*send)(void* ctx, const uint8_t addr[RELAY_ADDR_LEN], const uint8_t* frame, size_t len);
+    void* ctx;
+} relay_transport_t;
+
+/* Frame type, 0 if the frame is too short to be one */
+relay_frame_type_t relay_frame_type(const uint8_t* frame, size_t len);
+
+size_t relay_frame_hello(uint8_t* frame);
+size_t relay_frame_hello_reply(uint8_t* frame, uint64_t wall_ms);
+bool relay_parse_hello_reply(const uint8_t* frame, size_t len, uint64_t* wall_ms);
+
+typedef enum {
+    RELAY_SEND_IDLE,
+    RELAY_SEND_PENDING,         // waiting for acks
+    RELAY_SEND_DELIVERED,
+    RELAY_SEND_FAILED,          // no complete ack after all retries, or the gateway was busy
+} relay_send_state_t;
+
+typedef struct {
+    uint32_t ack_timeout_ms;    // repeat the missing fragments if no ack came within this time
+    uint32_t retries;           // repeats before the message fails
+} relay_sender_config_t;
+
+typedef struct {
+    relay_sender_config_t config;
+    const relay_transport_t* transport;
+    uint8_t peer[RELAY_ADDR_LEN];
+    relay_send_state_t state;
+    const uint8_t* data;        // owned by the caller until the message left RELAY_SEND_PENDING
+    size_t len;
+    uint16_t seq;
+    uint8_t count;
+    uint32_t acked;             // bitmap of fragments the receiver has
+    uint32_t attempts;
+    uint64_t sent_at;
+    bool busy;
+
+    uint32_t frames_sent;
+    uint32_t frames_repeated;
+    uint32_t messages_failed;
+} relay_sender_t;
+
+/* seq continues from the previous wake, so the receiver does not take a new message for a repeat */
+void relay_sender_init(relay_sender_t* sender, const relay_sender_config_t* config, const relay_transport_t* transport,
+                       const uint8_t peer[RELAY_ADDR_LEN], uint16_t seq);
+
+/* Sends a message of up to RELAY_MESSAGE_MAX bytes, false if one is still pending or it is too long */
+bool relay_sender_start(relay_sender_t* sender, const uint8_t* data, size_t len, uint64_t now_ms);
+
+/* Feeds a frame received from the peer */
+void relay_sender_receive(relay_sender_t* sender, const uint8_t* frame, size_t len);
+
+/* Repeats missing fragments once the ack timed out. DELIVERED and FAILED are returned once, the
+ * sender is idle again afterwards. */
+relay_send_state_t relay_sender_poll(relay_sender_t* sender, uint64_t now_ms);
+
+/* Takes a complete message, returns false if there is no room for it right now */
+typedef bool (*relay_deliver_t)(void* ctx, const uint8_t addr[RELAY_ADDR_LEN], const uint8_t* data, size_t len);
+
+/* Reassembly state of one sender */
+typedef struct {
+    uint8_t addr[RELAY_ADDR_LEN];
+    bool used;
+    uint16_t seq;
+    uint8_t count;
+    uint32_t received;
+    size_t len;
+    bool has_done;
+    uint16_t done_seq;          // last message taken, repeats of it are acked but not delivered again
+    uint64_t active_at;
+    uint8_t* buffer;            // RELAY_MESSAGE_MAX bytes at most, slot_size of the arena
+} relay_peer_t;
+
+typedef struct {
+    const relay_transport_t* transport;
+    relay_peer_t* peers;
+    size_t peer_count;
+    size_t slot_size;
+    relay_deliver_t deliver;
+    void* ctx;
+
+    uint32_t frames_received;
+    uint32_t frames_duplicate;
+    uint32_t messages_delivered;
+    uint32_t messages_busy;
+    uint32_t peers_evicted;
+} relay_receiver_t;
+
+/* Each of the peer_count senders reassembles into its own slot_size part of arena. A new sender
+ * takes the slot of the one heard from least recently once all are in use. */
+void relay_receiver_init(relay_receiver_t* receiver, const relay_transport_t* transport, relay_peer_t* peers,
+                         size_t peer_count, uint8_t* arena, size_t slot_size, relay_deliver_t deliver, void* ctx);
+
+/* Feeds a DATA frame, acks it if requested and delivers the message once complete */
+void relay_receiver_receive(relay_receiver_t* receiver, const uint8_t addr[RELAY_ADDR_LEN],
+                            const uint8_t* frame, size_t len, uint64_t now_ms);
+
+#endif
@@ -0,0 +1,51 @@
+#include <math.h>
+#include <string.h>
+
+#include "adaptive_rate.h"
+
+static void mark_change(adaptive_rate_t* rate, uint64_t timestamp, float flow, float pressure) {
+    rate->last_change = timestamp;
+    rate->change_flow = flow;
+    rate->change_pressure = pressure;
+}
+
+void adaptive_rate_init(adaptive_rate_t* rate, const adaptive_rate_config_t* config) {
+    memset(rate, 0, sizeof(*rate));
+    rate->config = *config;
+    rate->interval_ms = config->normal_ms;
+}
+
+uint32_t adaptive_rate_update(adaptive_rate_t* rate, uint64_t timestamp, float flow, float pressure) {
+    const adaptive_rate_config_t* config = &rate->config;
+
+    if (!rate->initialized) {
+        rate->initialized = true;
+        rate->last_flow = flow;
+        rate->last_pressure = pressure;
+        mark_change(rate, timestamp, flow, pressure);
+        return rate->interval_ms;
+    }
+
+    float flow_delta = fabsf(flow - rate->last_flow);
+    float pressure_delta = fabsf(pressure - rate->last_pressure);
+    rate->last_flow = flow;
+    rate->last_pressure = pressure;
+
+    if (flow_delta >= config->flow_step || pressure_delta >= config->pressure_step) {
+        rate->last_transient = timestamp;
+        mark_change(rate, timestamp, flow, pressure);
+        rate->interval_ms = config->fast_ms;
+    } else if (rate->last_transient != 0 && timestamp - rate->last_transient < config->fast_hold_ms) {
+        rate->interval_ms = config->fast_ms;
+    } else {
+        /* Against the value at the last change rather than the previous sample, so a slow ramp that moves
+         * less than the deadband per sample still counts as moving */
+        if (fabsf(flow - rate->change_flow) > config->flow_deadband ||
+            fabsf(pressure - rate->change_pressure) > config->pressure_deadband) {
+            mark_change(rate, timestamp, flow, pressure);
+        }
+        rate->interval_ms = (timestamp - rate->last_change >= config->stable_ms) ? config->slow_ms : config->normal_ms;
+    }
+
+    return rate->interval_ms;
+}
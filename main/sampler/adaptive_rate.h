@@ -0,0 +1,54 @@
+#ifndef ADAPTIVE_RATE_H_
+#define ADAPTIVE_RATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Picks the sampling interval from signal activity: fast around flow onsets and pressure transients,
+ * normal while anything moves, slow once the signals have been flat for a while.
+ * No platform dependencies. */
+
+typedef struct {
+    uint32_t fast_ms;
+    uint32_t normal_ms;
+    uint32_t slow_ms;
+
+    float flow_step;            // flow change between samples treated as a transient
+    float pressure_step;        // pressure change between samples treated as a transient
+    uint32_t fast_hold_ms;      // stay fast this long after the last transient
+
+    float flow_deadband;        // signals within this of their value at the last change count as flat
+    float pressure_deadband;
+    uint32_t stable_ms;         // flat for this long before slowing down
+} adaptive_rate_config_t;
+
+typedef struct {
+    adaptive_rate_config_t config;
+    uint32_t interval_ms;
+    bool initialized;
+    float last_flow;
+    float last_pressure;
+    uint64_t last_transient;
+    uint64_t last_change;
+    float change_flow;          // values at last_change, the deadband is measured from them
+    float change_pressure;
+} adaptive_rate_t;
+
+#define ADAPTIVE_RATE_CONFIG_DEFAULT { \
+    .fast_ms = 100, \
+    .normal_ms = 1000, \
+    .slow_ms = 10000, \
+    .flow_step = 0.02f, \
+    .pressure_step = 0.01f, \
+    .fast_hold_ms = 5000, \
+    .flow_deadband = 0.001f, \
+    .pressure_deadband = 0.002f, \
+    .stable_ms = 60000, \
+}
+
+void adaptive_rate_init(adaptive_rate_t* rate, const adaptive_rate_config_t* config);
+
+/* Feeds one sample, returns the interval until the next one */
+uint32_t adaptive_rate_update(adaptive_rate_t* rate, uint64_t timestamp, float flow, float pressure);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SAMPLE_RING_H_
+#define SAMPLE_RING_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sample_batch.pb.h"
+
+/* Must be a power of two. The MQTT task pops after every sample, the ring only has to cover the time it is
+ * blocked in a publish or a flash write: 64 samples are 6.4 s at the fast 100 ms interval, 64 s at the
+ * normal 1 s. Batches do not have to fit, they are built from the popped samples and go to the store
+ * while the broker is unreachable. Samples pushed into a full ring are counted as overruns. */
+#define SAMPLE_RING_SIZE 64
+
+/* Lock-free single producer / single consumer ring.
+ * Only the producer writes head and only the consumer writes tail. */
+typedef struct {
+    atomic_uint_fast32_t head;
+    atomic_uint_fast32_t tail;
+    Sample samples[SAMPLE_RING_SIZE];
+} sample_ring_t;
+
+static inline void sample_ring_init(sample_ring_t* ring) {
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+/* Producer side, returns false if the ring is full */
+static inline bool sample_ring_push(sample_ring_t* ring, const Sample* sample) {
+    uint_fast32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint_fast32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail == SAMPLE_RING_SIZE) {
+        return false;
+    }
+
+    ring->samples[head & (SAMPLE_RING_SIZE - 1)] = *sample;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+/* Consumer side, returns false if the ring is empty */
+static inline bool sample_ring_pop(sample_ring_t* ring, Sample* sample) {
+    uint_fast32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint_fast32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return false;
+    }
+
+    *sample = ring->samples[tail & (SAMPLE_RING_SIZE - 1)];
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sampler.h"
+#include "sample_ring.h"
+#include "adaptive_rate.h"
+#include "sensors.h"
+#include "channels.h"
+#include "settings.h"
+#include "power.h"
+
+static const char* TAG = "sampler";
+
+/* Upper bounds (us) of the deviation buckets of the actual inter-sample interval from the period in effect */
+static const int64_t histogram_bounds[] = { 100, 500, 1000, 5000, 10000, 50000 };
+#define HISTOGRAM_BUCKETS (sizeof(histogram_bounds) / sizeof(histogram_bounds[0]) + 1)
+
+static struct {
+    uint32_t histogram[HISTOGRAM_BUCKETS];
+    uint32_t samples;
+    uint32_t overruns;      // samples dropped because the publisher fell behind
+    int64_t max_deviation;
+    int64_t read_us;        // time spent in app_sensors_read, all registry channels
+    int64_t read_us_max;
+    int64_t expected;       // sum of the periods in effect for each interval
+    int64_t first_at;
+    int64_t last_at;
+} stats;
+
+static adaptive_rate_t rate;
+static uint32_t period_ms = MEASUREMENT_INTERVAL_MS;
+static uint32_t settings_generation;
+
+static sample_ring_t ring;
+static esp_timer_handle_t timer = NULL;
+static TaskHandle_t sampler_task_handle = NULL;
+static TaskHandle_t consumer_task_handle = NULL;
+
+#if CONFIG_POWER_LIGHT_SLEEP
+/* Set while light sleep is allowed, flow is then counted by the ULP */
+static bool low_power = false;
+/* Set by the ULP wake, the next sample is taken right away */
+static volatile bool ulp_woke = false;
+#endif
+
+static void record_interval(int64_t now) {
+    if (stats.samples > 0) {
+        int64_t deviation = llabs((now - stats.last_at) - period_ms * 1000LL);
+        stats.expected += period_ms * 1000LL;
+
+        size_t bucket = 0;
+        while (bucket < HISTOGRAM_BUCKETS - 1 && deviation >= histogram_bounds[bucket]) {
+            bucket++;
+        }
+        stats.histogram[bucket]++;
+
+        if (deviation > stats.max_deviation) {
+            stats.max_deviation = deviation;
+        }
+    } else {
+        stats.first_at = now;
+    }
+
+    stats.last_at = now;
+    stats.samples++;
+}
+
+static void sampler_timer_cb(void* arg) {
+    xTaskNotifyGive(sampler_task_handle);
+}
+
+#if CONFIG_POWER_LIGHT_SLEEP
+/* The ULP counted flow edges during light sleep */
+static void IRAM_ATTR ulp_wake_cb(void) {
+    BaseType_t woken = pdFALSE;
+    ulp_woke = true;
+    vTaskNotifyGiveFromISR(sampler_task_handle, &woken);
+}
+
+/* Light sleep between samples only while there is no flow and sampling is not faster than normal.
+ * A ULP wake means flow, full power is back whatever the edges read as. */
+static void update_power(const Sample* sample, bool woke) {
+    bool quiet = !woke && period_ms >= rate.config.normal_ms && sample->flow == 0;
+    if (quiet == low_power) {
+        return;
+    }
+
+    if (quiet) {
+        if (!app_sensors_flow_low_power(true)) {
+            return;
+        }
+        app_power_hold(POWER_HOLD_SAMPLING, false);
+    } else {
+        app_power_hold(POWER_HOLD_SAMPLING, true);
+        app_sensors_flow_low_power(false);
+    }
+
+    ESP_LOGI(TAG, "Light sleep %s", quiet ? "allowed" : "held off");
+    low_power = quiet;
+}
+#endif
+
+static void sampler_task(void* pvParameters) {
+    Sample sample = Sample_init_zero;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#if CONFIG_POWER_LIGHT_SLEEP
+        bool woke = ulp_woke;
+        ulp_woke = false;
+#else
+        bool woke = false;
+#endif
+
+        int64_t started = esp_timer_get_time();
+        record_interval(started);
+        app_sensors_read(&sample);
+
+        int64_t read_us = esp_timer_get_time() - started;
+        stats.read_us += read_us;
+        if (read_us > stats.read_us_max) {
+            stats.read_us_max = read_us;
+        }
+
+        /* A configured interval is picked up by the next rate decision */
+        if (settings_generation != app_settings_generation()) {
+            settings_t settings;
+            settings_generation = app_settings_generation();
+            app_settings_get(&settings);
+            rate.config.normal_ms = settings.measurement_interval_ms;
+        }
+
+        /* A new period takes effect from the next tick */
+        uint32_t next_ms = adaptive_rate_update(&rate, sample.timestamp, sample.flow, sample.pressure);
+        if (next_ms != period_ms || woke) {
+            ESP_LOGI(TAG, "Sampling interval %lu -> %lu ms%s", period_ms, next_ms, woke ? " on ULP wake" : "");
+            period_ms = next_ms;
+            ESP_ERROR_CHECK(esp_timer_restart(timer, period_ms * 1000ULL));
+        }
+
+#if CONFIG_POWER_LIGHT_SLEEP
+        update_power(&sample, woke);
+#endif
+
+        if (!sample_ring_push(&ring, &sample)) {
+            stats.overruns++;
+        }
+        xTaskNotifyGive(consumer_task_handle);
+
+        if (stats.samples % SAMPLER_STATS_PERIOD == 0) {
+            app_sampler_log_stats();
+        }
+    }
+}
+
+void app_sampler_start(TaskHandle_t consumer) {
+    sample_ring_init(&ring);
+    consumer_task_handle = consumer;
+
+    settings_t settings;
+    settings_generation = app_settings_generation();
+    app_settings_get(&settings);
+
+    adaptive_rate_config_t rate_config = ADAPTIVE_RATE_CONFIG_DEFAULT;
+    rate_config.normal_ms = settings.measurement_interval_ms;
+    adaptive_rate_init(&rate, &rate_config);
+    period_ms = rate.interval_ms;
+
+    /* Full power until the first sample shows the line is quiet */
+    app_power_hold(POWER_HOLD_SAMPLING, true);
+
+    BaseType_t xReturned = xTaskCreatePinnedToCore(
+        sampler_task,
+        "sampler_task",
+        SAMPLER_TASK_STACK_SIZE,
+        NULL,
+        SAMPLER_TASK_PRIORITY,
+        &sampler_task_handle,
+        SAMPLER_TASK_CORE);
+
+    if (xReturned != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create sampler task");
+        return;
+    }
+
+#if CONFIG_POWER_LIGHT_SLEEP
+    app_power_set_ulp_wake_cb(ulp_wake_cb);
+#endif
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = sampler_timer_cb,
+        .name = "sampler",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, period_ms * 1000ULL));
+}
+
+bool app_sampler_pop(Sample* sample) {
+    return sample_ring_pop(&ring, sample);
+}
+
+void app_sampler_log_stats(void) {
+    if (stats.samples < 2) {
+        return;
+    }
+
+    /* Accumulated difference between the elapsed time and the nominal one */
+    int64_t drift = (stats.last_at - stats.first_at) - stats.expected;
+
+    ESP_LOGI(TAG, "%lu samples, drift %lld us, max deviation %lld us, %lu overruns",
+        stats.samples, drift, stats.max_deviation, stats.overruns);
+    /* The read has to fit the fastest interval the adaptive rate can pick, whatever the current one is */
+    int64_t read_us_avg = stats.read_us / stats.samples;
+    ESP_LOGI(TAG, "read {\"channels\":%u,\"read_us_avg\":%lld,\"read_us_max\":%lld,\"us_per_channel\":%lld,"
+        "\"budget_us\":%lu,\"budget_pct_max\":%.2f}",
+        sensor_channel_count, read_us_avg, stats.read_us_max, read_us_avg / (int64_t)sensor_channel_count,
+        rate.config.fast_ms * 1000, 100.0 * stats.read_us_max / (rate.config.fast_ms * 1000.0));
+    ESP_LOGI(TAG, "deviation <100us: %lu, <500us: %lu, <1ms: %lu, <5ms: %lu, <10ms: %lu, <50ms: %lu, >=50ms: %lu",
+        stats.histogram[0], stats.histogram[1], stats.histogram[2], stats.histogram[3],
+        stats.histogram[4], stats.histogram[5], stats.histogram[6]);
+}
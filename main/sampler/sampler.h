@@ -0,0 +1,28 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include <stdbool.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "sample_batch.pb.h"
+
+/* Sampling runs on the APP core, publishing on the PRO core */
+#define SAMPLER_TASK_CORE APP_CPU_NUM
+#define SAMPLER_TASK_PRIORITY 10
+#define SAMPLER_TASK_STACK_SIZE 4096
+
+/* Log the interval histogram every this many samples */
+#define SAMPLER_STATS_PERIOD 300
+
+/* Starts the sampling timer, consumer is notified after every new sample.
+ * The period follows signal activity, see adaptive_rate.h. */
+void app_sampler_start(TaskHandle_t consumer);
+
+/* Consumer side, returns false when no sample is queued. Timestamps are monotonic, see timebase.h */
+bool app_sampler_pop(Sample* sample);
+
+void app_sampler_log_stats(void);
+
+#endif
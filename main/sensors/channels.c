@@ -0,0 +1,29 @@
+#include "hal/adc_types.h"
+#include "driver/gpio.h"
+
+#include "channels.h"
+#include "sample_batch.pb.h"
+
+const sensor_channel_t sensor_channels[] = {
+    [SENSOR_PRIMARY_PRESSURE] = {
+        .type = SENSOR_PRESSURE,
+        .io = PRESSURE_SENSOR_CHANNEL,
+        .scale = PRESSURE_SENSOR_VOLTAGE_MAX,
+        .calibrate = true,
+    },
+    [SENSOR_PRIMARY_FLOW] = {
+        .type = SENSOR_FLOW,
+        .io = FLOW_SENSOR_PIN,
+        .scale = FLOW_SENSOR_PULSES_PER_LITER,
+        .max_flow_lpm = MAX_FLOW_LPM,
+    },
+    /* Additional zones, e.g.
+     * { .type = SENSOR_PRESSURE, .io = ADC_CHANNEL_5, .scale = 3.3, .calibrate = true },  // GPIO33
+     * { .type = SENSOR_FLOW, .io = GPIO_NUM_26, .scale = 6.6, .max_flow_lpm = 30 },
+     */
+};
+
+const size_t sensor_channel_count = sizeof(sensor_channels) / sizeof(sensor_channels[0]);
+
+_Static_assert(sizeof(sensor_channels) / sizeof(sensor_channels[0]) <= SENSOR_CHANNELS_MAX, "Too many sensor channels");
+_Static_assert(SENSOR_CHANNELS_MAX - 2 == sizeof(((Sample*)0)->channels) / sizeof(float), "Sample.channels max_count mismatch");
@@ -0,0 +1,34 @@
+#ifndef CHANNELS_H_
+#define CHANNELS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sensors.h"
+
+/* Max number of entries in the sensor registry, the ones past the primary pair go into Sample.channels */
+#define SENSOR_CHANNELS_MAX 8
+
+/* The primary pressure/flow pair feeds Sample.pressure and Sample.flow, leak detection,
+ * the adaptive rate and the ULP during deep sleep */
+#define SENSOR_PRIMARY_PRESSURE 0
+#define SENSOR_PRIMARY_FLOW 1
+
+typedef enum {
+    SENSOR_PRESSURE,        // analog transducer on an ADC1 channel
+    SENSOR_FLOW,            // pulse output meter counted by a PCNT unit
+} sensor_type_t;
+
+typedef struct {
+    sensor_type_t type;
+    int io;                 // ADC1 channel for pressure, GPIO for flow
+    float scale;            // full scale voltage for pressure, pulses per liter for flow
+    float max_flow_lpm;     // flow only, flow normalized to 1
+    bool calibrate;         // pressure only, convert through the eFuse calibration if available
+} sensor_channel_t;
+
+/* The sensor registry, entries 0 and 1 are the primary pressure and flow channels */
+extern const sensor_channel_t sensor_channels[];
+extern const size_t sensor_channel_count;
+
+#endif
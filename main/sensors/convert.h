@@ -0,0 +1,44 @@
+#ifndef CONVERT_H_
+#define CONVERT_H_
+
+#include <math.h>
+#include <stdint.h>
+
+#include "sensors.h"
+
+/* Conversions from sensor readings to the normalized [0, 1] values carried in samples.
+ * No platform dependencies. */
+
+static inline float round3(float v) {
+    return roundf(v * 1000.0f) / 1000.0f;
+}
+
+/* Pressure of a transducer with the given full scale voltage */
+static inline float convert_pressure(int millivolts, float full_scale) {
+    float voltage = millivolts / 1000.0f;
+    float pressure = voltage / full_scale;
+    return round3(pressure);
+}
+
+/* Flow of a meter with the given pulses per liter at a measured pulse rate, normalized to max_flow_lpm.
+ * Not rounded, a pulse period resolves far below 1/1000 of full scale. */
+static inline float convert_flow_rate(float pulses_per_second, float pulses_per_liter, float max_flow_lpm) {
+    float flow_rate = pulses_per_second / pulses_per_liter;
+    return flow_rate / max_flow_lpm;
+}
+
+/* Flow of a meter with the given pulses per liter, normalized to max_flow_lpm */
+static inline float convert_flow(uint32_t pulse_count, uint32_t period_ms, float pulses_per_liter, float max_flow_lpm) {
+    float pulses_per_second = (float)pulse_count * 1000.0f / period_ms;
+    return round3(convert_flow_rate(pulses_per_second, pulses_per_liter, max_flow_lpm));
+}
+
+static inline float normalize_pressure(int millivolts) {
+    return convert_pressure(millivolts, PRESSURE_SENSOR_VOLTAGE_MAX);
+}
+
+static inline float normalize_flow(uint32_t pulse_count, uint32_t period_ms) {
+    return convert_flow(pulse_count, period_ms, FLOW_SENSOR_PULSES_PER_LITER, MAX_FLOW_LPM);
+}
+
+#endif
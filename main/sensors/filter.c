@@ -0,0 +1,63 @@
+#include <math.h>
+
+#include "filter.h"
+
+size_t filter_boxcar_decimate(const uint16_t* in, size_t n, size_t factor, float* out) {
+    size_t blocks = n / factor;
+
+    for (size_t b = 0; b < blocks; ++b) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < factor; ++i) {
+            sum += in[b * factor + i];
+        }
+        out[b] = (float)sum / factor;
+    }
+
+    return blocks;
+}
+
+float filter_median(float* values, size_t n) {
+    if (n == 0) {
+        return NAN;
+    }
+
+    /* Insertion sort, n is a handful of decimated values per DMA frame */
+    for (size_t i = 1; i < n; ++i) {
+        float v = values[i];
+        size_t j = i;
+        while (j > 0 && values[j - 1] > v) {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = v;
+    }
+
+    return (n % 2) ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2.0f;
+}
+
+void filter_stats_reset(filter_stats_t* stats) {
+    stats->count = 0;
+    stats->mean = 0;
+    stats->m2 = 0;
+    stats->min = INFINITY;
+    stats->max = -INFINITY;
+}
+
+void filter_stats_add(filter_stats_t* stats, float value) {
+    stats->count++;
+
+    float delta = value - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (value - stats->mean);
+
+    if (value < stats->min) {
+        stats->min = value;
+    }
+    if (value > stats->max) {
+        stats->max = value;
+    }
+}
+
+float filter_stats_stddev(const filter_stats_t* stats) {
+    return stats->count > 1 ? sqrtf(stats->m2 / (stats->count - 1)) : 0.0f;
+}
@@ -0,0 +1,29 @@
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Plain C filter kernels for the continuous ADC path, no ESP-IDF dependencies */
+
+/* Running statistics (Welford) over one measurement interval */
+typedef struct {
+    uint32_t count;
+    float mean;
+    float m2;
+    float min;
+    float max;
+} filter_stats_t;
+
+/* Boxcar (first order CIC) decimation, every factor inputs are averaged into one output.
+ * Returns the number of outputs written, a trailing partial block is dropped. */
+size_t filter_boxcar_decimate(const uint16_t* in, size_t n, size_t factor, float* out);
+
+/* Median of n values, reorders values in place */
+float filter_median(float* values, size_t n);
+
+void filter_stats_reset(filter_stats_t* stats);
+void filter_stats_add(filter_stats_t* stats, float value);
+float filter_stats_stddev(const filter_stats_t* stats);
+
+#endif
@@ -0,0 +1,51 @@
+#include "pulse_rate.h"
+
+void pulse_rate_init(pulse_rate_t* rate, const pulse_rate_config_t* config) {
+    rate->config = *config;
+    rate->last_edge_us = 0;
+    rate->period_us = 0;
+    rate->has_edge = false;
+}
+
+uint32_t pulse_rate_count_min(float pulses_per_liter, float max_flow_lpm, uint32_t window_ms) {
+    float full_scale = pulses_per_liter * max_flow_lpm / 60.0f * window_ms / 1000.0f;
+    return full_scale >= PULSE_RATE_COUNT_PULSES ? PULSE_RATE_COUNT_PULSES : 0;
+}
+
+float pulse_rate_update(pulse_rate_t* rate, uint32_t count, const pulse_edges_t* edges, int64_t window_us, int64_t now_us) {
+    const pulse_rate_config_t* config = &rate->config;
+    int64_t timeout_us = (int64_t)config->timeout_ms * 1000;
+
+    if (edges->count > 0) {
+        /* The last edge of an earlier window closes the first interval, unless it is too old to belong to this flow */
+        bool previous = rate->has_edge && edges->first_us - rate->last_edge_us <= timeout_us;
+        uint32_t intervals = edges->count - 1 + previous;
+        int64_t span = edges->last_us - (previous ? rate->last_edge_us : edges->first_us);
+
+        if (intervals > 0 && span > 0) {
+            rate->period_us = span / intervals;
+        }
+        rate->last_edge_us = edges->last_us;
+        rate->has_edge = true;
+    }
+
+    if (config->count_min > 0 && count >= config->count_min && window_us > 0) {
+        return count * 1000000.0f / window_us;
+    }
+
+    if (!rate->has_edge || rate->period_us == 0) {
+        return 0;
+    }
+
+    int64_t gap = now_us - rate->last_edge_us;
+    if (gap > timeout_us) {
+        rate->period_us = 0;
+        return 0;
+    }
+    if (gap > PULSE_RATE_STOP_PERIODS * rate->period_us) {
+        return 0;
+    }
+
+    int64_t period = gap > rate->period_us ? gap : rate->period_us;
+    return 1000000.0f / period;
+}
@@ -0,0 +1,50 @@
+#ifndef PULSE_RATE_H_
+#define PULSE_RATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Pulse rate of a flow meter from the spacing of its edges. At drip-level flows a measurement window sees
+ * zero or one pulse, so counting only yields quantization noise, while the time between two pulses
+ * resolves the rate down to one pulse per timeout. Once enough pulses fall into a window their count is
+ * just as precise and is used instead. No platform dependencies, pulse trains can be simulated off-device. */
+
+/* A count of this many pulses has 1% quantization, as precise as the period at most flows */
+#define PULSE_RATE_COUNT_PULSES 100
+
+/* No pulse for this many of the last periods reads as stopped. The flow may have slowed down instead, the
+ * next edge then measures the new period, as long as it comes within the timeout. */
+#define PULSE_RATE_STOP_PERIODS 2
+
+typedef struct {
+    uint32_t count_min;         // at or above this many pulses per window the count is used, 0 never
+    uint32_t timeout_ms;        // an edge after this long starts over instead of closing a period
+} pulse_rate_config_t;
+
+/* Edges timestamped during one measurement window */
+typedef struct {
+    uint32_t count;
+    int64_t first_us;           // first and last edge, valid if count > 0
+    int64_t last_us;
+} pulse_edges_t;
+
+typedef struct {
+    pulse_rate_config_t config;
+    int64_t last_edge_us;       // newest edge so far
+    int64_t period_us;          // newest measured pulse period, 0 while unknown
+    bool has_edge;
+} pulse_rate_t;
+
+void pulse_rate_init(pulse_rate_t* rate, const pulse_rate_config_t* config);
+
+/* count_min for a meter read every window_ms: PULSE_RATE_COUNT_PULSES if the meter gets there within the
+ * window at max_flow_lpm, otherwise 0. A slow meter (6.6 pulses per liter gives 3.3 a second at 30 L/min)
+ * never does, its whole range is measured from the period. */
+uint32_t pulse_rate_count_min(float pulses_per_liter, float max_flow_lpm, uint32_t window_ms);
+
+/* Pulses per second for a window of window_us ending at now_us, in which a counter saw count pulses and
+ * the edges were timestamped. Without a pulse the estimate decays with the time since the last one, as
+ * the period is at least that long, and is 0 once that is PULSE_RATE_STOP_PERIODS periods. */
+float pulse_rate_update(pulse_rate_t* rate, uint32_t count, const pulse_edges_t* edges, int64_t window_us, int64_t now_us);
+
+#endif
@@ -1,9 +1,9 @@
 #include "esp_log.h"
 #include "esp_adc/adc_oneshot.h"
+#include "esp_adc/adc_continuous.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
 #include "driver/gpio.h"
-#include "sys/time.h"
 #include "esp_timer.h"
 
 #include <freertos/FreeRTOS.h>
@@ -11,66 +11,474 @@
 #include <freertos/event_groups.h>
 
 #include "sensors.h"
+#include "filter.h"
+#include "convert.h"
+#include "channels.h"
+#include "transient.h"
+#include "pulse_rate.h"
+#include "timebase.h"
+#include "settings.h"
 #include "sample_batch.pb.h"
 #include <math.h>
+#include <string.h>
 #include "driver/pulse_cnt.h"
+#include "esp_cpu.h"
+#include "esp_attr.h"
+#if CONFIG_POWER_LIGHT_SLEEP
+#include "ulp_main.h"
+#endif
 
 static const char* TAG = "sensors";
 
+#if CONFIG_PRESSURE_SENSOR_CONTINUOUS
+/* 256 conversions per DMA frame, ~78 frames/s at 20 kHz, shared by all analog channels of the scan */
+#define PRESSURE_FRAME_RESULTS 256
+#define PRESSURE_FRAME_SIZE (PRESSURE_FRAME_RESULTS * SOC_ADC_DIGI_RESULT_BYTES)
+#define PRESSURE_FILTER_TASK_STACK_SIZE 4096
+#define PRESSURE_FILTER_TASK_PRIORITY 8
+
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define PRESSURE_ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define PRESSURE_ADC_GET_CHANNEL(p) ((p)->type1.channel)
+#define PRESSURE_ADC_GET_DATA(p) ((p)->type1.data)
+#else
+#define PRESSURE_ADC_OUTPUT_TYPE ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define PRESSURE_ADC_GET_CHANNEL(p) ((p)->type2.channel)
+#define PRESSURE_ADC_GET_DATA(p) ((p)->type2.data)
+#endif
+
+static adc_continuous_handle_t adc1_cont_handle;
+static TaskHandle_t pressure_filter_task_handle = NULL;
+
+/* Frame medians of the current measurement interval, shared with the sampler */
+static portMUX_TYPE pressure_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t pressure_filter_cycles;
+static uint32_t pressure_filter_cycles_max;
+
+/* Filter cost over the reads since the last "filter" stats line */
+#define PRESSURE_FILTER_LOG_READS 60
+static struct {
+    uint32_t reads;
+    uint32_t frames;
+    uint64_t cycles;
+    uint32_t cycles_max;
+} filter_log;
+static uint32_t pressure_scan_channels;
+
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+/* The trigger measures the pressure change over this many ms of the decimated stream */
+#define TRANSIENT_SLOPE_SPAN_MS 4
+
+/* Fed and frozen by the filter task, read and re-armed by the consumer, both under pressure_stats_lock */
+static transient_t transient;
+static uint16_t transient_ring[SENSORS_CAPTURE_MAX_SAMPLES];
+static uint32_t transient_rate_hz;
+static int64_t transient_trigger_us;
+#endif
+#else
 static adc_oneshot_unit_handle_t adc1_handle;
+#endif
 
-static adc_cali_handle_t pressure_sensor_cali_handle;
-static pcnt_unit_handle_t pcnt_unit = NULL;
+/* Runtime state of a sensor registry entry */
+typedef struct {
+    adc_cali_handle_t cali;
+    pcnt_unit_handle_t pcnt;
+#if CONFIG_PRESSURE_SENSOR_CONTINUOUS
+    filter_stats_t stats;
+#endif
+#if CONFIG_FLOW_PULSE_PERIOD
+    pulse_edges_t edges;        // timestamped by the GPIO interrupt since the last read
+    pulse_rate_t rate;
+#endif
+} channel_state_t;
+
+static channel_state_t channel_state[SENSOR_CHANNELS_MAX];
+
+#if CONFIG_FLOW_PULSE_PERIOD
+static portMUX_TYPE flow_edges_lock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+#if CONFIG_POWER_LIGHT_SLEEP
+/* Set while the pulse counters are stopped, ULP edges up to ulp_edges_read have been turned into pulses */
+static bool flow_low_power = false;
+static uint32_t ulp_edges_read;
+static uint32_t flow_wake_edges;
+
+/* The ULP wakes the CPU when its edge count equals edge_count_to_wake_up. Counted on from the edges read
+ * so far, so every read arms the next wake. Half a lap ahead it is out of reach while the counters run. */
+static void ulp_arm_wake(bool armed) {
+    uint32_t ahead = armed ? flow_wake_edges : (UINT16_MAX + 1) / 2;
+    ulp_edge_count_to_wake_up = (ulp_edges_read + ahead) & UINT16_MAX;
+}
+#endif
 
 static bool adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle);
 
-static inline float round3(float v) {
-    return roundf(v * 1000.0f) / 1000.0f;
+static int pressure_raw_to_millivolts(size_t index, float raw) {
+    int millivolts;
+    int code = (int)lroundf(raw);
+
+    if (channel_state[index].cali == NULL ||
+        adc_cali_raw_to_voltage(channel_state[index].cali, code, &millivolts) != ESP_OK) {
+        millivolts = code * (int)(sensor_channels[index].scale * 1000) / ((1 << PRESSURE_SENSOR_ADC_WIDTH) - 1);
+    }
+    return millivolts;
+}
+
+#if CONFIG_PRESSURE_SENSOR_CONTINUOUS
+/* One JSON object per line so it can be scraped from the console. A frame of 256 conversions
+ * at the default 20 kHz leaves the filter task 12.8 ms, 1.0M cycles at the lowest power management clock. */
+static void filter_log_record(uint32_t frames, uint32_t cycles, uint32_t cycles_max) {
+    filter_log.reads++;
+    filter_log.frames += frames;
+    filter_log.cycles += cycles;
+    if (cycles_max > filter_log.cycles_max) {
+        filter_log.cycles_max = cycles_max;
+    }
+
+    if (filter_log.reads < PRESSURE_FILTER_LOG_READS) {
+        return;
+    }
+    if (filter_log.frames > 0) {
+        ESP_LOGI(TAG, "filter {\"frames\":%lu,\"channels\":%lu,\"cycles_per_frame_avg\":%llu,\"cycles_per_frame_max\":%lu}",
+            filter_log.frames, pressure_scan_channels, filter_log.cycles / filter_log.frames, filter_log.cycles_max);
+    }
+    memset(&filter_log, 0, sizeof(filter_log));
+}
+
+/* Interval means of all analog channels, the spread is reported for the primary one */
+static inline void pressure_sensor_read(Sample* sample, float* values) {
+    filter_stats_t stats[SENSOR_CHANNELS_MAX];
+    uint32_t cycles, cycles_max;
+
+    portENTER_CRITICAL(&pressure_stats_lock);
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        stats[i] = channel_state[i].stats;
+        filter_stats_reset(&channel_state[i].stats);
+    }
+    cycles = pressure_filter_cycles;
+    cycles_max = pressure_filter_cycles_max;
+    pressure_filter_cycles = 0;
+    pressure_filter_cycles_max = 0;
+    portEXIT_CRITICAL(&pressure_stats_lock);
+
+    filter_log_record(stats[SENSOR_PRIMARY_PRESSURE].count, cycles, cycles_max);
+
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_PRESSURE) {
+            continue;
+        }
+        values[i] = stats[i].count > 0 ?
+            convert_pressure(pressure_raw_to_millivolts(i, stats[i].mean), sensor_channels[i].scale) : 0;
+    }
+
+    const filter_stats_t* primary = &stats[SENSOR_PRIMARY_PRESSURE];
+    if (primary->count == 0) {
+        ESP_LOGW(TAG, "No pressure frames in this interval");
+        sample->has_pressure_min = sample->has_pressure_max = sample->has_pressure_stddev = false;
+        return;
+    }
+
+    float stddev = filter_stats_stddev(primary);
+    int mean_mv = pressure_raw_to_millivolts(SENSOR_PRIMARY_PRESSURE, primary->mean);
+
+    sample->pressure_min = normalize_pressure(pressure_raw_to_millivolts(SENSOR_PRIMARY_PRESSURE, primary->min));
+    sample->pressure_max = normalize_pressure(pressure_raw_to_millivolts(SENSOR_PRIMARY_PRESSURE, primary->max));
+    sample->pressure_stddev = normalize_pressure(pressure_raw_to_millivolts(SENSOR_PRIMARY_PRESSURE, primary->mean + stddev) - mean_mv);
+    sample->has_pressure_min = sample->has_pressure_max = sample->has_pressure_stddev = true;
+
+    ESP_LOGD(TAG, "Pressure: %lu frames, %lu cycles/frame", primary->count, cycles / primary->count);
 }
 
-static inline float normalize_pressure(int millivolts) {
-    float voltage = millivolts / 1000.0f;
-    float pressure = voltage / PRESSURE_SENSOR_VOLTAGE_MAX;
-    return round3(pressure);
+static bool IRAM_ATTR pressure_conv_done_cb(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data) {
+    BaseType_t must_yield = pdFALSE;
+    vTaskNotifyGiveFromISR(pressure_filter_task_handle, &must_yield);
+    return must_yield == pdTRUE;
 }
 
-static inline float normalize_flow(uint32_t pulse_count) {
-    float flow_rate = (float)pulse_count / FLOW_SENSOR_PULSES_PER_LITER;
-    float flow_rate_norm = flow_rate / MAX_FLOW_LPM;
-    return round3(flow_rate_norm);
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+/* Runs the decimated values of one frame through the pre-trigger ring */
+static void transient_feed(const float* values, size_t n) {
+    int64_t now = esp_timer_get_time();
+    int64_t period_us = 1000000 / transient_rate_hz;
+
+    portENTER_CRITICAL(&pressure_stats_lock);
+    for (size_t i = 0; i < n; ++i) {
+        if (transient_add(&transient, (uint16_t)lroundf(values[i]))) {
+            /* The frame was just read, its last value is the newest. The trigger sample is the first one
+             * of the post-trigger part. */
+            uint32_t back = (uint32_t)(n - 1 - i) + transient.config.post_samples - 1;
+            transient_trigger_us = now - back * period_us;
+        }
+    }
+    portEXIT_CRITICAL(&pressure_stats_lock);
+}
+
+static void transient_init_capture(uint32_t pressure_channels) {
+    transient_rate_hz = CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ / pressure_channels / CONFIG_PRESSURE_SENSOR_DECIMATION;
+
+    uint32_t span = TRANSIENT_SLOPE_SPAN_MS * transient_rate_hz / 1000;
+    if (span == 0) {
+        span = 1;
+    }
+    float span_ms = span * 1000.0f / transient_rate_hz;
+
+    transient_config_t config = {
+        .pre_samples = CONFIG_PRESSURE_TRANSIENT_PRE_MS * transient_rate_hz / 1000,
+        .post_samples = CONFIG_PRESSURE_TRANSIENT_POST_MS * transient_rate_hz / 1000,
+        .slope_span = span,
+        /* Full scale is taken as the code range, close enough for a trigger level */
+        .slope_threshold = CONFIG_PRESSURE_TRANSIENT_TRIGGER / 1000.0f * span_ms * ((1 << PRESSURE_SENSOR_ADC_WIDTH) - 1),
+    };
+    transient_init(&transient, &config, transient_ring);
+
+    ESP_LOGI(TAG, "Transient capture at %lu Hz, %lu + %lu samples, trigger %.0f codes over %lu samples",
+        transient_rate_hz, config.pre_samples, config.post_samples, config.slope_threshold, span);
+}
+
+bool app_sensors_capture_take(pressure_capture_t* capture, float* pressure, size_t max) {
+    static uint16_t codes[SENSORS_CAPTURE_MAX_SAMPLES];
+
+    /* The filter task leaves a frozen ring alone, so only the state is read under the lock */
+    portENTER_CRITICAL(&pressure_stats_lock);
+    bool frozen = transient_is_frozen(&transient);
+    capture->trigger_us = transient_trigger_us;
+    portEXIT_CRITICAL(&pressure_stats_lock);
+
+    if (!frozen) {
+        return false;
+    }
+
+    size_t count = transient_read(&transient, codes, max < SENSORS_CAPTURE_MAX_SAMPLES ? max : SENSORS_CAPTURE_MAX_SAMPLES,
+                                  &capture->pre_samples);
+
+    portENTER_CRITICAL(&pressure_stats_lock);
+    transient_rearm(&transient);
+    portEXIT_CRITICAL(&pressure_stats_lock);
+
+    const sensor_channel_t* channel = &sensor_channels[SENSOR_PRIMARY_PRESSURE];
+    for (size_t i = 0; i < count; ++i) {
+        pressure[i] = pressure_raw_to_millivolts(SENSOR_PRIMARY_PRESSURE, codes[i]) / 1000.0f / channel->scale;
+    }
+    capture->sample_rate_hz = transient_rate_hz;
+    capture->count = count;
+
+    return count > 0;
+}
+#endif
+
+/* Splits every DMA frame of the scan by channel, reduces each to one median of boxcar averages
+ * and accumulates it into that channel's interval stats */
+static void pressure_filter_task(void* pvParameters) {
+    static uint8_t frame[PRESSURE_FRAME_SIZE];
+    static uint16_t codes[SENSOR_CHANNELS_MAX][PRESSURE_FRAME_RESULTS];
+    static float decimated[PRESSURE_FRAME_RESULTS / CONFIG_PRESSURE_SENSOR_DECIMATION];
+    float medians[SENSOR_CHANNELS_MAX];
+    size_t counts[SENSOR_CHANNELS_MAX];
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t len = 0;
+        while (adc_continuous_read(adc1_cont_handle, frame, sizeof(frame), &len, 0) == ESP_OK) {
+            uint32_t start = esp_cpu_get_cycle_count();
+
+            memset(counts, 0, sizeof(counts));
+            for (uint32_t i = 0; i < len; i += SOC_ADC_DIGI_RESULT_BYTES) {
+                adc_digi_output_data_t* p = (adc_digi_output_data_t*)&frame[i];
+                for (size_t c = 0; c < sensor_channel_count; ++c) {
+                    if (sensor_channels[c].type == SENSOR_PRESSURE && PRESSURE_ADC_GET_CHANNEL(p) == sensor_channels[c].io) {
+                        codes[c][counts[c]++] = PRESSURE_ADC_GET_DATA(p);
+                        break;
+                    }
+                }
+            }
+
+            for (size_t c = 0; c < sensor_channel_count; ++c) {
+                size_t m = filter_boxcar_decimate(codes[c], counts[c], CONFIG_PRESSURE_SENSOR_DECIMATION, decimated);
+                counts[c] = m;
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+                /* Before the median reorders them */
+                if (c == SENSOR_PRIMARY_PRESSURE) {
+                    transient_feed(decimated, m);
+                }
+#endif
+                if (m > 0) {
+                    medians[c] = filter_median(decimated, m);
+                }
+            }
+
+            uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+            portENTER_CRITICAL(&pressure_stats_lock);
+            for (size_t c = 0; c < sensor_channel_count; ++c) {
+                if (counts[c] > 0) {
+                    filter_stats_add(&channel_state[c].stats, medians[c]);
+                }
+            }
+            pressure_filter_cycles += cycles;
+            if (cycles > pressure_filter_cycles_max) {
+                pressure_filter_cycles_max = cycles;
+            }
+            portEXIT_CRITICAL(&pressure_stats_lock);
+        }
+    }
+}
+#else
+/* Converts all analog channels back to back */
+static inline void pressure_sensor_read(Sample* sample, float* values) {
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_PRESSURE) {
+            continue;
+        }
+
+        int raw = 0;
+        adc_oneshot_read(adc1_handle, sensor_channels[i].io, &raw);
+        values[i] = convert_pressure(pressure_raw_to_millivolts(i, raw), sensor_channels[i].scale);
+    }
+}
+#endif
+
+#if CONFIG_FLOW_PULSE_PERIOD
+/* Falling edges, the same ones the pulse counter counts */
+static void IRAM_ATTR flow_edge_isr(void* arg) {
+    pulse_edges_t* edges = arg;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL_ISR(&flow_edges_lock);
+    if (edges->count == 0) {
+        edges->first_us = now;
+    }
+    edges->last_us = now;
+    edges->count++;
+    portEXIT_CRITICAL_ISR(&flow_edges_lock);
 }
+#endif
+
+/* Reads all pulse counters back to back so every zone covers the same window */
+static inline void flow_sensor_read(float* values) {
+    static int64_t last_read_us = 0;
+    int pulse_counts[SENSOR_CHANNELS_MAX];
+
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_FLOW) {
+            continue;
+        }
+#if CONFIG_POWER_LIGHT_SLEEP
+        if (flow_low_power) {
+            /* Two edges per pulse, an odd edge is left for the next read */
+            uint32_t ulp_edges = (ulp_edge_count - ulp_edges_read) & UINT16_MAX;
+            pulse_counts[i] = ulp_edges / 2;
+            ulp_edges_read = (ulp_edges_read + ulp_edges / 2 * 2) & UINT16_MAX;
+            ulp_arm_wake(true);
+            continue;
+        }
+#endif
+        pcnt_unit_get_count(channel_state[i].pcnt, &pulse_counts[i]);
+        pcnt_unit_clear_count(channel_state[i].pcnt);
+    }
+
+#if CONFIG_FLOW_PULSE_PERIOD
+    pulse_edges_t edges[SENSOR_CHANNELS_MAX];
 
-static inline float pressure_sensor_read() {
-    int pressure;
-    adc_oneshot_get_calibrated_result(adc1_handle, pressure_sensor_cali_handle, PRESSURE_SENSOR_CHANNEL, &pressure);
-    return normalize_pressure(pressure);
+    portENTER_CRITICAL(&flow_edges_lock);
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type == SENSOR_FLOW) {
+            edges[i] = channel_state[i].edges;
+            channel_state[i].edges.count = 0;
+        }
+    }
+    portEXIT_CRITICAL(&flow_edges_lock);
+#endif
+
+    /* The sampling interval varies, count over the time actually elapsed */
+    int64_t now = esp_timer_get_time();
+    uint32_t period_ms = last_read_us ? (uint32_t)((now - last_read_us) / 1000) : MEASUREMENT_INTERVAL_MS;
+    last_read_us = now;
+
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_FLOW) {
+            continue;
+        }
+#if CONFIG_POWER_LIGHT_SLEEP
+        /* Edges are not timestamped in light sleep, the count is all there is */
+        if (flow_low_power) {
+            values[i] = convert_flow(pulse_counts[i], period_ms > 0 ? period_ms : 1,
+                                     sensor_channels[i].scale, sensor_channels[i].max_flow_lpm);
+            continue;
+        }
+#endif
+#if CONFIG_FLOW_PULSE_PERIOD
+        float pulses_per_second = pulse_rate_update(&channel_state[i].rate, pulse_counts[i], &edges[i],
+                                                    (int64_t)period_ms * 1000, now);
+        values[i] = convert_flow_rate(pulses_per_second, sensor_channels[i].scale, sensor_channels[i].max_flow_lpm);
+#else
+        values[i] = convert_flow(pulse_counts[i], period_ms > 0 ? period_ms : 1,
+                                 sensor_channels[i].scale, sensor_channels[i].max_flow_lpm);
+#endif
+    }
 }
 
-static inline float flow_sensor_read() {
-    int pulse_count;
-    pcnt_unit_get_count(pcnt_unit, &pulse_count);
-    pcnt_unit_clear_count(pcnt_unit);
-    return normalize_flow(pulse_count);
+#if CONFIG_POWER_LIGHT_SLEEP
+bool app_sensors_flow_low_power(bool enable) {
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type == SENSOR_FLOW && sensor_channels[i].io != FLOW_SENSOR_PIN) {
+            return false;
+        }
+    }
+
+    if (enable == flow_low_power) {
+        return true;
+    }
+
+    /* A disabled unit releases the APB lock its glitch filter holds */
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_FLOW) {
+            continue;
+        }
+        if (enable) {
+            ESP_ERROR_CHECK(pcnt_unit_stop(channel_state[i].pcnt));
+            ESP_ERROR_CHECK(pcnt_unit_disable(channel_state[i].pcnt));
+        } else {
+            ESP_ERROR_CHECK(pcnt_unit_enable(channel_state[i].pcnt));
+            ESP_ERROR_CHECK(pcnt_unit_clear_count(channel_state[i].pcnt));
+            ESP_ERROR_CHECK(pcnt_unit_start(channel_state[i].pcnt));
+        }
+    }
+
+    settings_t settings;
+    app_settings_get(&settings);
+    flow_wake_edges = settings.ulp_wake_edges > 0 ? settings.ulp_wake_edges : 1;
+
+    ulp_edges_read = ulp_edge_count & UINT16_MAX;
+    ulp_arm_wake(enable);
+    flow_low_power = enable;
+    return true;
 }
+#endif
 
-void flow_sensor_init(void) {
-    ESP_LOGI(TAG, "install pcnt unit");
+static void flow_sensor_init(size_t index) {
+    ESP_LOGI(TAG, "install pcnt unit for GPIO %d", sensor_channels[index].io);
     pcnt_unit_config_t unit_config = {
         .high_limit = 500,
         .low_limit = -500,
     };
     
+    pcnt_unit_handle_t pcnt_unit = NULL;
     ESP_ERROR_CHECK(pcnt_new_unit(&unit_config, &pcnt_unit));
 
+    settings_t settings;
+    app_settings_get(&settings);
+
     ESP_LOGI(TAG, "set glitch filter");
     pcnt_glitch_filter_config_t filter_config = {
-        .max_glitch_ns = 1000,
+        .max_glitch_ns = settings.pcnt_glitch_ns,
     };
     ESP_ERROR_CHECK(pcnt_unit_set_glitch_filter(pcnt_unit, &filter_config));
 
     ESP_LOGI(TAG, "install pcnt channels");
     pcnt_chan_config_t chan_a_config = {
-        .edge_gpio_num = GPIO_NUM_25,
+        .edge_gpio_num = sensor_channels[index].io,
         .level_gpio_num = -1,
     };
     pcnt_channel_handle_t pcnt_chan_a = NULL;
@@ -84,9 +492,99 @@ void flow_sensor_init(void) {
     ESP_ERROR_CHECK(pcnt_unit_clear_count(pcnt_unit));
     ESP_LOGI(TAG, "start pcnt unit");
     ESP_ERROR_CHECK(pcnt_unit_start(pcnt_unit));
+
+    channel_state[index].pcnt = pcnt_unit;
+
+#if CONFIG_FLOW_PULSE_PERIOD
+    /* Windows of the normal interval that reach 1% quantization are measured by count */
+    pulse_rate_config_t rate_config = {
+        .count_min = pulse_rate_count_min(sensor_channels[index].scale, sensor_channels[index].max_flow_lpm,
+                                          MEASUREMENT_INTERVAL_MS),
+        .timeout_ms = CONFIG_FLOW_PULSE_TIMEOUT_S * 1000,
+    };
+    pulse_rate_init(&channel_state[index].rate, &rate_config);
+    ESP_LOGI(TAG, "flow channel %u measured by %s", index, rate_config.count_min > 0 ? "count at high flow" : "period only");
+
+    /* Shared by all flow channels, may already be installed */
+    esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
+    ESP_ERROR_CHECK(gpio_set_intr_type(sensor_channels[index].io, GPIO_INTR_NEGEDGE));
+    ESP_ERROR_CHECK(gpio_isr_handler_add(sensor_channels[index].io, flow_edge_isr, &channel_state[index].edges));
+    ESP_ERROR_CHECK(gpio_intr_enable(sensor_channels[index].io));
+#endif
 }
 
-void pressure_sensor_init(void) {
+static void pressure_calibration_init(size_t index) {
+    if (!sensor_channels[index].calibrate) {
+        return;
+    }
+    bool calibrated = adc_calibration_init(ADC_UNIT_1, sensor_channels[index].io, PRESSURE_SENSOR_ADC_ATTENUATION, &channel_state[index].cali);
+    ESP_LOGI(TAG, "Pressure channel %d calibrated: %d", sensor_channels[index].io, calibrated);
+}
+
+#if CONFIG_PRESSURE_SENSOR_CONTINUOUS
+/* One continuous scan over all analog channels, the sample rate is shared between them */
+static void pressure_sensor_init(void) {
+    adc_digi_pattern_config_t patterns[SENSOR_CHANNELS_MAX];
+    uint32_t pattern_num = 0;
+
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_PRESSURE) {
+            continue;
+        }
+        pressure_calibration_init(i);
+        filter_stats_reset(&channel_state[i].stats);
+
+        patterns[pattern_num++] = (adc_digi_pattern_config_t) {
+            .atten = PRESSURE_SENSOR_ADC_ATTENUATION,
+            .channel = sensor_channels[i].io,
+            .unit = ADC_UNIT_1,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+    }
+    pressure_scan_channels = pattern_num;
+
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+    transient_init_capture(pattern_num);
+#endif
+
+    BaseType_t xReturned = xTaskCreate(
+        pressure_filter_task,
+        "pressure_filter",
+        PRESSURE_FILTER_TASK_STACK_SIZE,
+        NULL,
+        PRESSURE_FILTER_TASK_PRIORITY,
+        &pressure_filter_task_handle);
+    if (xReturned != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create pressure filter task");
+        return;
+    }
+
+    adc_continuous_handle_cfg_t handle_config = {
+        .max_store_buf_size = 4 * PRESSURE_FRAME_SIZE,
+        .conv_frame_size = PRESSURE_FRAME_SIZE,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_config, &adc1_cont_handle));
+
+    adc_continuous_config_t config = {
+        .pattern_num = pattern_num,
+        .adc_pattern = patterns,
+        .sample_freq_hz = CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = PRESSURE_ADC_OUTPUT_TYPE,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc1_cont_handle, &config));
+
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = pressure_conv_done_cb,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc1_cont_handle, &callbacks, NULL));
+    ESP_ERROR_CHECK(adc_continuous_start(adc1_cont_handle));
+}
+#else
+static void pressure_sensor_init(void) {
     adc_oneshot_unit_init_cfg_t init_config_adc1 = {
         .unit_id = ADC_UNIT_1,
     };
@@ -96,24 +594,85 @@ void pressure_sensor_init(void) {
         .atten = PRESSURE_SENSOR_ADC_ATTENUATION,
         .bitwidth = PRESSURE_SENSOR_ADC_WIDTH,
     };
-    ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, PRESSURE_SENSOR_CHANNEL, &config_adc1));
-    bool do_pressure_sensor_calibration = adc_calibration_init(ADC_UNIT_1, PRESSURE_SENSOR_CHANNEL, PRESSURE_SENSOR_ADC_ATTENUATION, &pressure_sensor_cali_handle);
-    ESP_LOGI(TAG, "Pressure calibrated: %d", do_pressure_sensor_calibration);
+
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type != SENSOR_PRESSURE) {
+            continue;
+        }
+        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, sensor_channels[i].io, &config_adc1));
+        pressure_calibration_init(i);
+    }
+}
+#endif
+
+uint16_t app_sensors_pressure_to_raw(float pressure) {
+    const int max_code = (1 << PRESSURE_SENSOR_ADC_WIDTH) - 1;
+    int target = (int)lroundf(pressure * PRESSURE_SENSOR_VOLTAGE_MAX * 1000.0f);
+    adc_cali_handle_t cali = channel_state[SENSOR_PRIMARY_PRESSURE].cali;
+
+    if (cali == NULL) {
+        int code = target * max_code / (int)(PRESSURE_SENSOR_VOLTAGE_MAX * 1000);
+        return code < 0 ? 0 : (code > max_code ? max_code : code);
+    }
+
+    /* The calibration curve is monotonic, find the first code at or above the target voltage */
+    int lo = 0;
+    int hi = max_code;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int millivolts = 0;
+        adc_cali_raw_to_voltage(cali, mid, &millivolts);
+        if (millivolts < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void app_sensors_release_adc(void) {
+#if CONFIG_PRESSURE_SENSOR_CONTINUOUS
+    ESP_ERROR_CHECK(adc_continuous_stop(adc1_cont_handle));
+    ESP_ERROR_CHECK(adc_continuous_deinit(adc1_cont_handle));
+#else
+    ESP_ERROR_CHECK(adc_oneshot_del_unit(adc1_handle));
+#endif
+}
+
+float app_sensors_normalize_flow(uint32_t pulse_count, uint32_t period_ms) {
+    return normalize_flow(pulse_count, period_ms);
 }
 
 void app_sensors_init(void) {
+    assert(sensor_channels[SENSOR_PRIMARY_PRESSURE].type == SENSOR_PRESSURE &&
+           sensor_channels[SENSOR_PRIMARY_FLOW].type == SENSOR_FLOW && "Registry must start with the primary pair");
+
     pressure_sensor_init();
-    flow_sensor_init();
+
+    for (size_t i = 0; i < sensor_channel_count; ++i) {
+        if (sensor_channels[i].type == SENSOR_FLOW) {
+            flow_sensor_init(i);
+        }
+    }
 }
 
 void app_sensors_read(Sample* sample) {
+    float values[SENSOR_CHANNELS_MAX] = { 0 };
 
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
+    /* Monotonic ms since boot, the publisher maps it to wall time once it dequeues the sample */
+    sample->timestamp = (uint64_t)(timebase_now_us() / 1000);
+    pressure_sensor_read(sample, values);
+    flow_sensor_read(values);
 
-    sample->timestamp = ((uint64_t)tv.tv_sec * 1000);
-    sample->pressure = pressure_sensor_read();
-    sample->flow = flow_sensor_read();
+    sample->pressure = values[SENSOR_PRIMARY_PRESSURE];
+    sample->flow = values[SENSOR_PRIMARY_FLOW];
+
+    /* Registry order past the primary pair */
+    sample->channels_count = sensor_channel_count - 2;
+    for (size_t i = 2; i < sensor_channel_count; ++i) {
+        sample->channels[i - 2] = values[i];
+    }
 
     ESP_LOGI(TAG, "Timestamp: %llu, Pressure: %.4f, Flow: %.4f", sample->timestamp, sample->pressure, sample->flow);
 }
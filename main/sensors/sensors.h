@@ -1,8 +1,14 @@
 #ifndef SENSORS_H_
 #define SENSORS_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
 #include "sample_batch.pb.h"
 
+/* Sampling interval while signals are changing, the sampler goes faster on transients and slower when flat */
 #define MEASUREMENT_INTERVAL_MS 1000
 
 /* PRESSURE SENSOR */
@@ -19,6 +25,40 @@
 #define MAX_FLOW_LPM 30
 
 void app_sensors_init(void);
+/* Stamps the sample with monotonic time (ms since boot) rather than wall time */
 void app_sensors_read(Sample*);
 
+/* Normalized flow for pulse_count pulses counted over period_ms */
+float app_sensors_normalize_flow(uint32_t pulse_count, uint32_t period_ms);
+
+/* Raw ADC code of a normalized pressure, through the calibration curve if available */
+uint16_t app_sensors_pressure_to_raw(float pressure);
+
+#if CONFIG_PRESSURE_TRANSIENT_CAPTURE
+/* Capture window at the highest decimated rate, i.e. with a single pressure channel */
+#define SENSORS_CAPTURE_MAX_SAMPLES ((CONFIG_PRESSURE_TRANSIENT_PRE_MS + CONFIG_PRESSURE_TRANSIENT_POST_MS) * \
+    (CONFIG_PRESSURE_SENSOR_SAMPLE_FREQ_HZ / CONFIG_PRESSURE_SENSOR_DECIMATION) / 1000)
+
+typedef struct {
+    int64_t trigger_us;         // monotonic time of the trigger sample, within one DMA frame
+    uint32_t sample_rate_hz;
+    uint32_t pre_samples;       // samples before the trigger sample
+    size_t count;
+} pressure_capture_t;
+
+/* Copies a frozen transient capture of the primary pressure channel as normalized pressures,
+ * not rounded, and re-arms the trigger. Returns false if no capture is frozen. */
+bool app_sensors_capture_take(pressure_capture_t* capture, float* pressure, size_t max);
+#endif
+
+#if CONFIG_POWER_LIGHT_SLEEP
+/* Stops the pulse counters so light sleep can gate their clock, flow is then taken from the edges the ULP
+ * counts on FLOW_SENSOR_PIN. Returns false and keeps the counters running if a flow channel is on another pin.
+ * Meanwhile the ULP wakes the chip after ulp_wake_edges edges that no read has taken yet. */
+bool app_sensors_flow_low_power(bool enable);
+#endif
+
+/* Frees ADC1 so the ULP can sample the pressure channel during deep sleep */
+void app_sensors_release_adc(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "transient.h"
+
+void transient_init(transient_t* transient, const transient_config_t* config, uint16_t* ring) {
+    transient->config = *config;
+    transient->ring = ring;
+    transient->capacity = config->pre_samples + config->post_samples;
+    transient_rearm(transient);
+}
+
+void transient_rearm(transient_t* transient) {
+    transient->written = 0;
+    transient->remaining = 0;
+    transient->triggered = false;
+    transient->frozen = false;
+}
+
+static inline uint16_t ring_at(const transient_t* transient, uint64_t index) {
+    return transient->ring[index % transient->capacity];
+}
+
+bool transient_add(transient_t* transient, uint16_t value) {
+    const transient_config_t* config = &transient->config;
+
+    if (transient->frozen) {
+        return false;
+    }
+
+    transient->ring[transient->written % transient->capacity] = value;
+    transient->written++;
+
+    if (transient->triggered) {
+        if (--transient->remaining == 0) {
+            transient->frozen = true;
+            return true;
+        }
+        return false;
+    }
+
+    if (transient->written <= config->slope_span) {
+        return false;
+    }
+
+    float change = (float)value - (float)ring_at(transient, transient->written - 1 - config->slope_span);
+    if (change >= config->slope_threshold || -change >= config->slope_threshold) {
+        transient->triggered = true;
+        transient->remaining = config->post_samples - 1;
+        if (transient->remaining == 0) {
+            transient->frozen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t transient_read(const transient_t* transient, uint16_t* out, size_t max, uint32_t* pre) {
+    if (!transient->frozen) {
+        return 0;
+    }
+
+    uint64_t count = transient->written < transient->capacity ? transient->written : transient->capacity;
+    if (count > max) {
+        count = max;
+    }
+
+    uint64_t first = transient->written - count;
+    for (uint64_t i = 0; i < count; ++i) {
+        out[i] = ring_at(transient, first + i);
+    }
+
+    *pre = count > transient->config.post_samples ? (uint32_t)(count - transient->config.post_samples) : 0;
+    return (size_t)count;
+}
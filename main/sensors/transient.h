@@ -0,0 +1,47 @@
+#ifndef TRANSIENT_H_
+#define TRANSIENT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pre-trigger recorder for fast pressure transients (water hammer, valve slam). Samples run through
+ * a ring, a steep enough change arms the trigger and the window around it is frozen once the
+ * post-trigger part is recorded. No platform dependencies, synthetic waveforms can be fed off-device. */
+
+typedef struct {
+    uint32_t pre_samples;       // kept before the trigger sample
+    uint32_t post_samples;      // recorded from the trigger sample on
+    uint32_t slope_span;        // samples over which the change is measured, less than pre_samples
+    float slope_threshold;      // change within slope_span that triggers, either direction
+} transient_config_t;
+
+typedef struct {
+    transient_config_t config;
+    uint16_t* ring;             // pre_samples + post_samples values
+    size_t capacity;
+    uint64_t written;           // samples added since the last rearm
+    uint32_t remaining;         // samples left to record after the trigger
+    bool triggered;
+    bool frozen;
+} transient_t;
+
+void transient_init(transient_t* transient, const transient_config_t* config, uint16_t* ring);
+
+/* Adds a sample, returns true if it completed a capture. The capture stays frozen and later
+ * samples are ignored until transient_rearm. */
+bool transient_add(transient_t* transient, uint16_t value);
+
+static inline bool transient_is_frozen(const transient_t* transient) {
+    return transient->frozen;
+}
+
+/* Copies the frozen window oldest first, returns the number of samples or 0 if nothing is frozen.
+ * pre is set to the number of samples before the trigger sample, fewer than configured if the
+ * trigger came right after rearming. */
+size_t transient_read(const transient_t* transient, uint16_t* out, size_t max, uint32_t* pre);
+
+/* Drops the frozen capture and starts over with an empty ring */
+void transient_rearm(transient_t* transient);
+
+#endif
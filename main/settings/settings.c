@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+
+#include "pb_encode.h"
+#include "pb_decode.h"
+
+#include "settings.h"
+#include "sensors.h"
+#include "prov.h"
+#include "ulp_config.h"
+#include "sleep.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "settings";
+
+#define SETTINGS_NVS_NAMESPACE "settings"
+#define SETTINGS_NVS_KEY "device"
+
+/* Written by the MQTT event task, read by the sampling pipeline */
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static settings_t current = {
+    .version = 0,
+    .measurement_interval_ms = MEASUREMENT_INTERVAL_MS,
+    .batch_max_samples = CONFIG_BATCH_MAX_SAMPLES,
+    .batch_max_age_ms = CONFIG_BATCH_MAX_AGE_MS,
+    .pressure_min = PRESSURE_MIN_VALUE,
+    .ulp_wake_edges = 10,
+    .ulp_period_us = ULP_WAKEUP_PERIOD_US,
+    .pcnt_glitch_ns = 1000,
+    .sleep_pressure_low = SLEEP_PRESSURE_LOW,
+    .sleep_pressure_high = SLEEP_PRESSURE_HIGH,
+    .sleep_pressure_rate = SLEEP_PRESSURE_RATE,
+};
+static volatile uint32_t generation = 0;
+
+/* Overrides the fields present in config */
+static void merge(settings_t* settings, const DeviceConfig* config) {
+    settings->version = config->version;
+    if (config->has_measurement_interval_ms) {
+        settings->measurement_interval_ms = config->measurement_interval_ms;
+    }
+    if (config->has_batch_max_samples) {
+        settings->batch_max_samples = config->batch_max_samples;
+    }
+    if (config->has_batch_max_age_ms) {
+        settings->batch_max_age_ms = config->batch_max_age_ms;
+    }
+    if (config->has_pressure_min) {
+        settings->pressure_min = config->pressure_min;
+    }
+    if (config->has_ulp_wake_edges) {
+        settings->ulp_wake_edges = config->ulp_wake_edges;
+    }
+    if (config->has_ulp_period_us) {
+        settings->ulp_period_us = config->ulp_period_us;
+    }
+    if (config->has_pcnt_glitch_ns) {
+        settings->pcnt_glitch_ns = config->pcnt_glitch_ns;
+    }
+    if (config->has_sleep_pressure_low) {
+        settings->sleep_pressure_low = config->sleep_pressure_low;
+    }
+    if (config->has_sleep_pressure_high) {
+        settings->sleep_pressure_high = config->sleep_pressure_high;
+    }
+    if (config->has_sleep_pressure_rate) {
+        settings->sleep_pressure_rate = config->sleep_pressure_rate;
+    }
+}
+
+static bool validate(const settings_t* s) {
+    /* A pressure wake threshold is either disabled or inside the sensor range, a rate below the
+     * 1/1000 resolution would wake on noise */
+    bool low = s->sleep_pressure_low <= 1;
+    bool high = s->sleep_pressure_high <= 1;
+    bool rate = s->sleep_pressure_rate < 0 || (s->sleep_pressure_rate >= 0.001f && s->sleep_pressure_rate <= 1);
+    bool ordered = s->sleep_pressure_low < 0 || s->sleep_pressure_high < 0 ||
+                   s->sleep_pressure_low < s->sleep_pressure_high;
+
+    /* The sampler slows down to 10 s when signals are flat, the ULP counts its ticks per flow bucket
+     * in 16 bits, which bounds its period from below */
+    return low && high && rate && ordered && s->measurement_interval_ms >= 100 && s->measurement_interval_ms <= 10000 &&
+           s->batch_max_samples >= 1 && s->batch_max_samples <= 1000 &&
+           s->batch_max_age_ms >= 1000 && s->batch_max_age_ms <= 3600000 &&
+           s->pressure_min >= 0 && s->pressure_min <= 1 &&
+           s->ulp_wake_edges >= 1 && s->ulp_wake_edges <= UINT16_MAX &&
+           s->ulp_period_us >= 1000 && s->ulp_period_us <= 1000000 &&
+           s->pcnt_glitch_ns <= 12000;
+}
+
+/* Saved as the merged config with every field present, so it survives changes of the compile time defaults */
+static esp_err_t save(const settings_t* s) {
+    DeviceConfig config = {
+        .version = s->version,
+        .has_measurement_interval_ms = true, .measurement_interval_ms = s->measurement_interval_ms,
+        .has_batch_max_samples = true, .batch_max_samples = s->batch_max_samples,
+        .has_batch_max_age_ms = true, .batch_max_age_ms = s->batch_max_age_ms,
+        .has_pressure_min = true, .pressure_min = s->pressure_min,
+        .has_ulp_wake_edges = true, .ulp_wake_edges = s->ulp_wake_edges,
+        .has_ulp_period_us = true, .ulp_period_us = s->ulp_period_us,
+        .has_pcnt_glitch_ns = true, .pcnt_glitch_ns = s->pcnt_glitch_ns,
+        .has_sleep_pressure_low = true, .sleep_pressure_low = s->sleep_pressure_low,
+        .has_sleep_pressure_high = true, .sleep_pressure_high = s->sleep_pressure_high,
+        .has_sleep_pressure_rate = true, .sleep_pressure_rate = s->sleep_pressure_rate,
+    };
+    uint8_t buffer[DeviceConfig_size];
+
+    pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&stream, DeviceConfig_fields, &config)) {
+        return ESP_FAIL;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        return err;
+    }
+    err = nvs_set_blob(handle, SETTINGS_NVS_KEY, buffer, stream.bytes_written);
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    return err;
+}
+
+void app_settings_init(void) {
+    uint8_t buffer[DeviceConfig_size];
+    size_t len = sizeof(buffer);
+    nvs_handle_t handle;
+
+    if (nvs_open(SETTINGS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        ESP_LOGI(TAG, "No saved config, using defaults");
+        return;
+    }
+    esp_err_t err = nvs_get_blob(handle, SETTINGS_NVS_KEY, buffer, &len);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        ESP_LOGI(TAG, "No saved config, using defaults");
+        return;
+    }
+
+    DeviceConfig config = DeviceConfig_init_zero;
+    pb_istream_t stream = pb_istream_from_buffer(buffer, len);
+    settings_t loaded = current;
+    if (!pb_decode(&stream, DeviceConfig_fields, &config)) {
+        ESP_LOGE(TAG, "Saved config unreadable, using defaults");
+        return;
+    }
+    merge(&loaded, &config);
+    if (!validate(&loaded)) {
+        ESP_LOGE(TAG, "Saved config %lu out of range, using defaults", loaded.version);
+        return;
+    }
+
+    current = loaded;
+    ESP_LOGI(TAG, "Loaded config version %lu", current.version);
+}
+
+void app_settings_get(settings_t* settings) {
+    taskENTER_CRITICAL(&lock);
+    *settings = current;
+    taskEXIT_CRITICAL(&lock);
+}
+
+uint32_t app_settings_generation(void) {
+    return generation;
+}
+
+void app_settings_apply(const uint8_t* data, size_t len, DeviceConfigAck* ack) {
+    DeviceConfig config = DeviceConfig_init_zero;
+    settings_t next;
+    app_settings_get(&next);
+
+    ack->active_version = next.version;
+
+    pb_istream_t stream = pb_istream_from_buffer(data, len);
+    if (!pb_decode(&stream, DeviceConfig_fields, &config)) {
+        ESP_LOGE(TAG, "Failed to decode config: %s", PB_GET_ERROR(&stream));
+        ack->version = 0;
+        ack->status = DeviceConfigStatus_CONFIG_INVALID;
+        return;
+    }
+
+    ack->version = config.version;
+    if (config.version == next.version) {
+        /* Retained configs come in again on every connect */
+        ack->status = DeviceConfigStatus_CONFIG_CURRENT;
+        return;
+    }
+    if (config.version < next.version) {
+        ESP_LOGW(TAG, "Ignoring config %lu, version %lu is active", config.version, next.version);
+        ack->status = DeviceConfigStatus_CONFIG_STALE;
+        return;
+    }
+
+    merge(&next, &config);
+    if (!validate(&next)) {
+        ESP_LOGE(TAG, "Rejecting config %lu, value out of range", config.version);
+        ack->status = DeviceConfigStatus_CONFIG_INVALID;
+        return;
+    }
+
+    esp_err_t err = save(&next);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save config %lu: %s", config.version, esp_err_to_name(err));
+        ack->status = DeviceConfigStatus_CONFIG_FAILED;
+        return;
+    }
+
+    taskENTER_CRITICAL(&lock);
+    current = next;
+    taskEXIT_CRITICAL(&lock);
+    generation++;
+
+    ESP_LOGI(TAG, "Applied config version %lu", next.version);
+    ack->status = DeviceConfigStatus_CONFIG_APPLIED;
+    ack->active_version = next.version;
+
+    /* Not saved, a retained config of the same version does not ask again */
+    if (config.has_reprovision && config.reprovision) {
+        app_prov_request(PROV_REQUEST_DELAY_MS);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "device_config.pb.h"
+
+/* Runtime tuning knobs. Defaults are the compile time values, a DeviceConfig received over MQTT
+ * overrides them and is kept in NVS, so it is in effect from the start of the next boot. */
+typedef struct {
+    uint32_t version;                   // 0 until a config was received
+    uint32_t measurement_interval_ms;
+    uint32_t batch_max_samples;
+    uint32_t batch_max_age_ms;
+    float pressure_min;
+    uint32_t ulp_wake_edges;
+    uint32_t ulp_period_us;
+    uint32_t pcnt_glitch_ns;
+    float sleep_pressure_low;           // ULP pressure wake thresholds, below 0 disables
+    float sleep_pressure_high;
+    float sleep_pressure_rate;
+} settings_t;
+
+/* Loads the saved config, needs NVS and has to run before the ULP and the sensors are initialized */
+void app_settings_init(void);
+
+/* Copy of the settings in effect */
+void app_settings_get(settings_t* settings);
+
+/* Incremented whenever a new config is applied, consumers compare it to the one they last applied */
+uint32_t app_settings_generation(void);
+
+/* Validates, saves and applies an encoded DeviceConfig, ack is filled for the reply either way */
+void app_settings_apply(const uint8_t* data, size_t len, DeviceConfigAck* ack);
+
+#endif
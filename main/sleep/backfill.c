@@ -0,0 +1,55 @@
+#include "backfill.h"
+#include "ulp_config.h"
+
+#define ULP_WORD_LAP (UINT16_MAX + 1)
+
+/* bucket_total wraps after 65536 buckets, 45 days of 1 minute buckets. The sleep duration at the nominal
+ * period tells the laps, the slow clock is nowhere near half a lap off. */
+static uint64_t unwrap_total(const backfill_ulp_t* ulp, uint64_t elapsed_ms) {
+    uint32_t total = ulp->total & UINT16_MAX;
+    uint64_t bucket_us = (uint64_t)(ulp->ticks_per_bucket & UINT16_MAX) * ulp->period_us;
+    if (bucket_us == 0) {
+        return total;
+    }
+
+    int64_t estimate = (int64_t)(elapsed_ms * 1000 / bucket_us);
+    int64_t behind = estimate - total + ULP_WORD_LAP / 2;
+    return total + (behind > 0 ? (uint64_t)(behind / ULP_WORD_LAP) * ULP_WORD_LAP : 0);
+}
+
+size_t backfill_buckets(const backfill_ulp_t* ulp, uint64_t entered_ms, uint64_t now_ms,
+                        backfill_bucket_t* buckets, size_t max) {
+    if (max == 0 || now_ms < entered_ms) {
+        return 0;
+    }
+
+    uint64_t elapsed = now_ms - entered_ms;
+    uint64_t total = unwrap_total(ulp, elapsed);
+    uint32_t ticks = ulp->ticks & UINT16_MAX;
+    uint32_t ticks_per_bucket = ulp->ticks_per_bucket & UINT16_MAX;
+
+    /* The ULP timer runs off the RTC slow clock, derive the real tick period from the sleep duration */
+    uint64_t total_ticks = total * ticks_per_bucket + ticks;
+    double tick_ms = total_ticks > 0 ? (double)elapsed / total_ticks : ulp->period_us / 1000.0;
+    double bucket_ms = tick_ms * ticks_per_bucket;
+
+    /* Buckets older than one lap of the ring have been overwritten */
+    uint64_t first = total >= ULP_BUCKET_COUNT ? total - ULP_BUCKET_COUNT + 1 : 0;
+    if (total - first + 1 > max) {
+        first = total + 1 - max;
+    }
+
+    /* Two edges per pulse, an odd edge is carried into the next bucket */
+    uint32_t carry = 0;
+    size_t n = 0;
+    for (uint64_t b = first; b <= total; ++b) {
+        uint32_t edges = (ulp->edges[b & (ULP_BUCKET_COUNT - 1)] & UINT16_MAX) + carry;
+        backfill_bucket_t* bucket = &buckets[n++];
+
+        bucket->start_ms = entered_ms + (uint64_t)(b * bucket_ms);
+        bucket->end_ms = (b == total) ? now_ms : entered_ms + (uint64_t)((b + 1) * bucket_ms);
+        bucket->pulses = edges / 2;
+        carry = edges % 2;
+    }
+    return n;
+}
@@ -0,0 +1,30 @@
+#ifndef BACKFILL_H_
+#define BACKFILL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Places the flow buckets the ULP counted during deep sleep (pulse_count.S) in wall clock time.
+ * The ULP stores 16 bit values into 32 bit words of RTC memory, the upper halves are ignored here.
+ * No platform dependencies, callers pass the ULP variables and the wall clock times. */
+
+typedef struct {
+    const uint32_t* edges;          // bucket_edges, ULP_BUCKET_COUNT edge counts
+    uint32_t total;                 // bucket_total, bucket boundaries crossed
+    uint32_t ticks;                 // tick_count, program runs into the current bucket
+    uint32_t ticks_per_bucket;
+    uint32_t period_us;             // nominal program period, the RTC slow clock is off by a few percent
+} backfill_ulp_t;
+
+typedef struct {
+    uint64_t start_ms;
+    uint64_t end_ms;
+    uint32_t pulses;
+} backfill_bucket_t;
+
+/* Buckets from entered_ms (ULP counters reset) to now_ms, oldest first. Only the last ULP_BUCKET_COUNT
+ * survive in the ring, and at most max of those are returned. Returns the number written. */
+size_t backfill_buckets(const backfill_ulp_t* ulp, uint64_t entered_ms, uint64_t now_ms,
+                        backfill_bucket_t* buckets, size_t max);
+
+#endif
@@ -0,0 +1,135 @@
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "driver/rtc_io.h"
+#include "soc/rtc_periph.h"
+#include "hal/adc_types.h"
+#include "ulp.h"
+#include "ulp_adc.h"
+#include "ulp_main.h"
+
+#include "ulp_config.h"
+#include "sleep.h"
+#include "backfill.h"
+#include "sensors.h"
+#include "timebase.h"
+#include "settings.h"
+#include "diag.h"
+
+static const char* TAG = "sleep";
+
+_Static_assert(PRESSURE_SENSOR_CHANNEL == ULP_PRESSURE_ADC_CHANNEL, "ULP pressure channel mismatch");
+
+/* Kept across deep sleep to place the ULP buckets in time */
+static RTC_DATA_ATTR uint64_t sleep_entered_at_ms;
+static RTC_DATA_ATTR float sleep_last_pressure;
+static RTC_DATA_ATTR uint32_t sleep_ulp_period_us;
+
+static uint64_t now_ms(void) {
+    return timebase_wall_ms(timebase_now_us());
+}
+
+void app_sleep_pressure_thresholds(const settings_t* settings, float pressure) {
+    uint16_t raw = app_sensors_pressure_to_raw(pressure);
+    float low = settings->sleep_pressure_low;
+    float high = settings->sleep_pressure_high;
+
+    ulp_pressure_high = high < 0 || pressure >= high ? UINT16_MAX : app_sensors_pressure_to_raw(high);
+    ulp_pressure_low = low < 0 || pressure <= low ? 0 : app_sensors_pressure_to_raw(low);
+    ulp_pressure_rate_threshold = settings->sleep_pressure_rate < 0 ? UINT16_MAX :
+        app_sensors_pressure_to_raw(pressure + settings->sleep_pressure_rate) - raw;
+    ulp_pressure_rate_samples = SLEEP_PRESSURE_RATE_WINDOW_MS / SLEEP_PRESSURE_PERIOD_MS;
+}
+
+/* Primes the ULP pressure average with the current pressure and hands ADC1 over to the ULP */
+static void arm_pressure_monitor(const settings_t* settings, float pressure) {
+    uint16_t raw = app_sensors_pressure_to_raw(pressure);
+
+    ulp_pressure_ticks = SLEEP_PRESSURE_PERIOD_MS * 1000 / settings->ulp_period_us;
+    ulp_pressure_tick = 0;
+    ulp_pressure_acc = raw * 8;
+    app_sleep_pressure_thresholds(settings, pressure);
+    ulp_pressure_rate_count = 0;
+    ulp_pressure_rate_ref = raw;
+    ulp_pressure_wake_reason = ULP_PRESSURE_WAKE_NONE;
+
+    app_sensors_release_adc();
+
+    ulp_adc_cfg_t cfg = {
+        .adc_n = ADC_UNIT_1,
+        .channel = PRESSURE_SENSOR_CHANNEL,
+        .width = PRESSURE_SENSOR_ADC_WIDTH,
+        .atten = PRESSURE_SENSOR_ADC_ATTENUATION,
+        .ulp_mode = ADC_ULP_MODE_FSM,
+    };
+    ESP_ERROR_CHECK(ulp_adc_init(&cfg));
+
+    ulp_pressure_enabled = 1;
+}
+
+void app_sleep_enter(const Sample* last) {
+    ESP_LOGI(TAG, "Entering deep sleep");
+    app_diag_mark(DIAG_PHASE_SLEEP);
+
+    sleep_entered_at_ms = now_ms();
+    sleep_last_pressure = last != NULL ? last->pressure : 0;
+
+    /* A config received while awake takes effect for this sleep */
+    settings_t settings;
+    app_settings_get(&settings);
+    ulp_edge_count_to_wake_up = settings.ulp_wake_edges;
+    ulp_ticks_per_bucket = SLEEP_BUCKET_MS * 1000 / settings.ulp_period_us;
+    ulp_set_wakeup_period(0, settings.ulp_period_us);
+    sleep_ulp_period_us = settings.ulp_period_us;
+
+    /* The ULP keeps running while the CPU is awake, start counting from scratch */
+    ulp_edge_count = 0;
+    ulp_tick_count = 0;
+    ulp_bucket_index = 0;
+    ulp_bucket_total = 0;
+    memset(&ulp_bucket_edges, 0, ULP_BUCKET_COUNT * sizeof(uint32_t));
+
+    arm_pressure_monitor(&settings, sleep_last_pressure);
+
+#if CONFIG_IDF_TARGET_ESP32
+    rtc_gpio_isolate(FLOW_SENSOR_PIN);
+#endif
+
+    ESP_ERROR_CHECK(ulp_run(&ulp_entry - RTC_SLOW_MEM));
+    esp_deep_sleep_start();
+}
+
+size_t app_sleep_backfill(Sample* samples, size_t max) {
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_ULP || sleep_entered_at_ms == 0) {
+        return 0;
+    }
+
+    backfill_ulp_t ulp = {
+        .edges = &ulp_bucket_edges,
+        .total = ulp_bucket_total,
+        .ticks = ulp_tick_count,
+        .ticks_per_bucket = ulp_ticks_per_bucket,
+        .period_us = sleep_ulp_period_us,
+    };
+
+    static backfill_bucket_t buckets[SLEEP_BACKFILL_MAX];
+    size_t n = backfill_buckets(&ulp, sleep_entered_at_ms, now_ms(),
+                                buckets, max < SLEEP_BACKFILL_MAX ? max : SLEEP_BACKFILL_MAX);
+
+    for (size_t i = 0; i < n; ++i) {
+        const backfill_bucket_t* bucket = &buckets[i];
+        Sample* s = &samples[i];
+        *s = (Sample)Sample_init_zero;
+        s->timestamp = bucket->end_ms;
+        s->pressure = sleep_last_pressure;
+        s->flow = app_sensors_normalize_flow(bucket->pulses,
+                                             bucket->end_ms > bucket->start_ms ? bucket->end_ms - bucket->start_ms : 1);
+    }
+
+    ESP_LOGI(TAG, "Backfilled %d samples from ULP buckets, %lu boundaries crossed", n, ulp_bucket_total & UINT16_MAX);
+
+    sleep_entered_at_ms = 0;
+    return n;
+}
@@ -0,0 +1,38 @@
+#ifndef SLEEP_H_
+#define SLEEP_H_
+
+#include <stddef.h>
+
+#include "sample_batch.pb.h"
+#include "sensors.h"
+#include "settings.h"
+
+/* Length of one ULP flow bucket during deep sleep */
+#define SLEEP_BUCKET_MS 60000
+
+/* ULP pressure monitoring during deep sleep. Thresholds are normalized pressures, a threshold
+ * below 0 disables the check. These are the defaults of the settings, the device sleeps at rest
+ * pressure, so the high threshold wakes it when the line is pressurized and the low one when the
+ * sensor signal is lost, well below its zero offset. */
+#define SLEEP_PRESSURE_PERIOD_MS 1000
+#define SLEEP_PRESSURE_LOW 0.02f
+#define SLEEP_PRESSURE_HIGH PRESSURE_MIN_VALUE
+#define SLEEP_PRESSURE_RATE 0.02f
+#define SLEEP_PRESSURE_RATE_WINDOW_MS 10000
+
+/* Max number of samples app_sleep_backfill can produce */
+#define SLEEP_BACKFILL_MAX ULP_BUCKET_COUNT
+
+/* Writes the pressure wake thresholds of settings to the ULP, relative to the current pressure.
+ * A level threshold the pressure is already past is disabled, it would wake the device right away. */
+void app_sleep_pressure_thresholds(const settings_t* settings, float pressure);
+
+/* Resets the ULP flow buckets, starts the ULP and enters deep sleep.
+ * last is the most recent sample, its pressure is carried into the backfilled samples. */
+void app_sleep_enter(const Sample* last);
+
+/* After a ULP wake-up, converts the flow buckets recorded during sleep into samples, oldest first.
+ * Returns the number of samples written, 0 if the device did not wake from ULP. */
+size_t app_sleep_backfill(Sample* samples, size_t max);
+
+#endif
@@ -0,0 +1,66 @@
+#include <math.h>
+
+#include "drift.h"
+
+void drift_init(drift_t* drift, const drift_config_t* config) {
+    drift->config = *config;
+    drift->synced = false;
+    drift->synced_at_us = 0;
+    drift->rate_ppm = 0;
+    drift->uncertainty_ppm = config->initial_ppm;
+    drift->measurements = 0;
+}
+
+int64_t drift_correction_us(const drift_t* drift, int64_t rtc_us) {
+    if (!drift->synced) {
+        return 0;
+    }
+    return (int64_t)((rtc_us - drift->synced_at_us) * (double)drift->rate_ppm / 1e6);
+}
+
+void drift_sync(drift_t* drift, int64_t rtc_us, int64_t error_us) {
+    int64_t elapsed_us = rtc_us - drift->synced_at_us;
+
+    /* Over a short interval the error is mostly that of the two syncs, only the clock is reset */
+    if (drift->synced && elapsed_us >= (int64_t)drift->config.min_interval_s * 1000000) {
+        float residual_ppm = (float)(error_us * 1e6 / elapsed_us);
+        /* The first measurement replaces the assumed rate of 0 */
+        float weight = drift->measurements == 0 ? 1.0f : drift->config.weight;
+
+        drift->rate_ppm += weight * residual_ppm;
+        drift->uncertainty_ppm += weight * (fabsf(residual_ppm) - drift->uncertainty_ppm);
+        if (drift->uncertainty_ppm < drift->config.min_ppm) {
+            drift->uncertainty_ppm = drift->config.min_ppm;
+        }
+        drift->measurements++;
+    }
+
+    drift->synced = true;
+    drift->synced_at_us = rtc_us;
+}
+
+uint32_t drift_error_ms(const drift_t* drift, int64_t rtc_us) {
+    if (!drift->synced) {
+        return UINT32_MAX;
+    }
+
+    int64_t elapsed_us = rtc_us > drift->synced_at_us ? rtc_us - drift->synced_at_us : 0;
+    double error_ms = drift->config.sync_error_ms + elapsed_us / 1000.0 * drift->uncertainty_ppm / 1e6;
+    return error_ms < UINT32_MAX ? (uint32_t)error_ms : UINT32_MAX;
+}
+
+int64_t drift_until_error_us(const drift_t* drift, int64_t rtc_us, uint32_t error_ms) {
+    if (!drift->synced || error_ms <= drift->config.sync_error_ms) {
+        return 0;
+    }
+    if (drift->uncertainty_ppm <= 0) {
+        return INT64_MAX;
+    }
+
+    double span_us = (error_ms - drift->config.sync_error_ms) * 1000.0 * 1e6 / drift->uncertainty_ppm;
+    double until_us = drift->synced_at_us + span_us - rtc_us;
+    if (until_us <= 0) {
+        return 0;
+    }
+    return until_us < (double)INT64_MAX ? (int64_t)until_us : INT64_MAX;
+}
@@ -0,0 +1,44 @@
+#ifndef DRIFT_H_
+#define DRIFT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Rate error of the RTC timer against the time server, and a bound of the wall clock error it causes
+ * since the last sync. Each sync measures the residual error of the prediction, the rate estimate
+ * follows it and the uncertainty of the rate follows its magnitude.
+ * No platform dependencies, callers pass the RTC time in µs. */
+
+typedef struct {
+    float initial_ppm;          // rate uncertainty until a rate was measured
+    float min_ppm;              // the uncertainty never drops below this
+    float weight;               // share of a new measurement in the estimates, 0..1
+    uint32_t sync_error_ms;     // wall clock error right after a sync
+    uint32_t min_interval_s;    // shorter intervals are dominated by the sync error and not measured
+} drift_config_t;
+
+typedef struct {
+    drift_config_t config;
+    bool synced;
+    int64_t synced_at_us;       // RTC time of the last sync
+    float rate_ppm;             // RTC timer runs slow by this, added to the elapsed time
+    float uncertainty_ppm;
+    uint32_t measurements;
+} drift_t;
+
+void drift_init(drift_t* drift, const drift_config_t* config);
+
+/* Wall clock time to add to the RTC prediction at rtc_us, for the rate measured so far */
+int64_t drift_correction_us(const drift_t* drift, int64_t rtc_us);
+
+/* Records a sync at rtc_us. error_us is the server time minus the prediction with the correction
+ * applied, ignored on the first sync. */
+void drift_sync(drift_t* drift, int64_t rtc_us, int64_t error_us);
+
+/* Bound of the wall clock error at rtc_us, UINT32_MAX before the first sync */
+uint32_t drift_error_ms(const drift_t* drift, int64_t rtc_us);
+
+/* RTC time in µs until the error bound reaches error_ms, 0 if it already did, INT64_MAX if it never will */
+int64_t drift_until_error_us(const drift_t* drift, int64_t rtc_us, uint32_t error_ms);
+
+#endif
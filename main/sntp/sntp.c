@@ -8,6 +8,7 @@
 #include "esp_log.h"
 #include "esp_attr.h"
 #include "esp_sleep.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_netif_sntp.h"
 #include "lwip/ip_addr.h"
@@ -15,12 +16,75 @@
 #include "esp_sntp.h"
 
 #include "common.h"
+#include "diag.h"
+#include "timebase.h"
 
 static const char* TAG = "sntp";
 
+#define SNTP_STATS_MAGIC 0x534e5450
+
+/* Counters of the current day, kept across deep sleep */
+static RTC_DATA_ATTR struct {
+    uint32_t magic;
+    uint64_t period_start_s;
+    uint32_t requests;
+    uint32_t avoided;
+    uint32_t syncs;
+} stats;
+
+static esp_timer_handle_t resync_timer = NULL;
+static bool started = false;
+
+/* Logs and restarts the counters once a day has passed, the wall clock has to be valid */
+static void stats_roll(void) {
+    if (!timebase_valid()) {
+        return;
+    }
+
+    uint64_t now_s = timebase_wall_ms(timebase_now_us()) / 1000;
+    if (stats.period_start_s == 0 || now_s < stats.period_start_s) {
+        stats.period_start_s = now_s;
+    } else if (now_s - stats.period_start_s >= SNTP_STATS_PERIOD_S) {
+        app_sntp_log_stats();
+        stats.period_start_s = now_s;
+        stats.requests = 0;
+        stats.avoided = 0;
+        stats.syncs = 0;
+    }
+}
+
+static void synced(const struct timeval* tv) {
+    timebase_sync(tv);
+    stats.syncs++;
+    app_diag_mark(DIAG_PHASE_SNTP_SYNCED);
+    xEventGroupSetBits(app_event_group, TIME_SYNCED_BIT);
+
+    /* The next background sync of this wake when the error bound reaches the budget, at least once a day */
+    int64_t until_us = timebase_until_error_us(CONFIG_TIME_ERROR_BUDGET_MS);
+    esp_sntp_set_sync_interval(until_us / 1000 < SNTP_SYNC_INTERVAL_MAX_MS ? (uint32_t)(until_us / 1000) : SNTP_SYNC_INTERVAL_MAX_MS);
+    stats_roll();
+}
+
 void sntp_sync_notification_cb(struct timeval *tv) {
     ESP_LOGI(TAG, "System time synchronized.");
-    xEventGroupSetBits(app_event_group, TIME_SYNCED_BIT);
+    synced(tv);
+}
+
+static void request(void) {
+    if (started) {
+        return;
+    }
+    started = true;
+    stats.requests++;
+    esp_netif_sntp_start();
+}
+
+static void resync_timer_cb(void* arg) {
+    if (xEventGroupGetBits(app_event_group) & WIFI_CONNECTED_BIT) {
+        request();
+    } else {
+        esp_timer_start_once(resync_timer, SNTP_RETRY_MS * 1000ULL);
+    }
 }
 
 void app_sntp_init(void) {
@@ -35,8 +99,63 @@ void app_sntp_init(void) {
     config.ip_event_to_renew = IP_EVENT_STA_GOT_IP;
     config.sync_cb = sntp_sync_notification_cb; // only if we need the notification function
     esp_netif_sntp_init(&config);
+
+    /* RTC memory is not initialized after a power-on reset */
+    if (stats.magic != SNTP_STATS_MAGIC) {
+        memset(&stats, 0, sizeof(stats));
+        stats.magic = SNTP_STATS_MAGIC;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = resync_timer_cb,
+        .name = "sntp_resync",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &resync_timer));
+
+    /* Timestamps taken from here on are right, nothing has to wait for SNTP */
+    if (timebase_valid()) {
+        xEventGroupSetBits(app_event_group, TIME_SYNCED_BIT);
+    }
+}
+
+bool app_sntp_due(void) {
+    uint32_t error_ms = timebase_error_ms();
+    bool due = error_ms > CONFIG_TIME_ERROR_BUDGET_MS;
+
+    if (!due) {
+        stats.avoided++;
+        ESP_LOGI(TAG, "Clock error within %lu ms, no sync needed", error_ms);
+    }
+    stats_roll();
+    return due;
 }
 
 void app_sntp_start(void) {
-    esp_netif_sntp_start();
+    if (app_sntp_due()) {
+        request();
+        return;
+    }
+
+    /* A long wake, e.g. while water flows, syncs once the bound reaches the budget */
+    int64_t until_us = timebase_until_error_us(CONFIG_TIME_ERROR_BUDGET_MS);
+    if (until_us != INT64_MAX) {
+        esp_timer_start_once(resync_timer, until_us);
+    }
+}
+
+void app_sntp_set_time(const struct timeval* tv) {
+    settimeofday(tv, NULL);
+    synced(tv);
+}
+
+void app_sntp_log_stats(void) {
+    drift_t drift;
+    timebase_get_drift(&drift);
+    uint32_t error_ms = timebase_error_ms();
+
+    /* One JSON object per line so it can be scraped from the console */
+    ESP_LOGI(TAG, "time {\"requests\":%lu,\"avoided\":%lu,\"syncs\":%lu,\"drift_ppm\":%.1f,"
+        "\"uncertainty_ppm\":%.1f,\"measurements\":%lu,\"error_ms\":%ld}",
+        stats.requests, stats.avoided, stats.syncs, drift.rate_ppm, drift.uncertainty_ppm,
+        drift.measurements, error_ms == UINT32_MAX ? -1L : (long)error_ms);
 }
\ No newline at end of file
@@ -1,7 +1,30 @@
 #ifndef SNTP_H_
 #define SNTP_H_
 
+#include <stdbool.h>
+#include <sys/time.h>
+
+/* The RTC keeps the wall clock through deep sleep, SNTP only runs once the error bound of the clock
+ * goes above CONFIG_TIME_ERROR_BUDGET_MS. Requests, skipped requests and syncs are counted per day. */
+#define SNTP_STATS_PERIOD_S 86400
+/* Retry of a scheduled sync while Wi-Fi is down */
+#define SNTP_RETRY_MS 60000
+/* Longest background sync interval, well below the 2^31 ms lwIP sys_timeout accepts, and a daily sync keeps
+ * the drift estimate fresh */
+#define SNTP_SYNC_INTERVAL_MAX_MS (24 * 3600 * 1000UL)
+
 void app_sntp_init(void);
+
+/* True if the clock error bound is above the budget, counts a skipped request otherwise.
+ * Called once per wake by whatever syncs the clock. */
+bool app_sntp_due(void);
+
+/* Syncs now if due, otherwise once the error bound reaches the budget in this wake */
 void app_sntp_start(void);
 
-#endif
\ No newline at end of file
+/* Sets the wall clock from another source than SNTP, e.g. a relay gateway */
+void app_sntp_set_time(const struct timeval* tv);
+
+void app_sntp_log_stats(void);
+
+#endif
@@ -0,0 +1,129 @@
+#include "timebase.h"
+
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_rtc_time.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "timebase";
+
+#define TIMEBASE_MAGIC 0x54494d45
+
+/* Wall time minus RTC timer of the last sync, the RTC timer keeps counting through deep sleep */
+static RTC_DATA_ATTR uint32_t rtc_magic;
+static RTC_DATA_ATTR int64_t rtc_offset_us;
+static RTC_DATA_ATTR drift_t drift;
+
+/* Wall time minus esp_timer of this wake, written by the SNTP task and read by the sampling pipeline */
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t offset_us;
+static int64_t correction_us;
+static bool correction_pending = false;
+
+static int64_t timeval_us(const struct timeval* tv) {
+    return (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/* Wall time the RTC timer predicts, valid once synced */
+static int64_t rtc_wall_us(int64_t rtc_us) {
+    return rtc_us + rtc_offset_us + drift_correction_us(&drift, rtc_us);
+}
+
+void timebase_init(void) {
+    int64_t monotonic = esp_timer_get_time();
+
+    /* RTC memory is not initialized after a power-on reset */
+    if (rtc_magic == TIMEBASE_MAGIC) {
+        int64_t rtc_us = (int64_t)esp_rtc_get_time_us();
+        offset_us = rtc_wall_us(rtc_us) - monotonic;
+        ESP_LOGI(TAG, "Restored wall clock offset, error within %lu ms", drift_error_ms(&drift, rtc_us));
+    } else {
+        drift_config_t config = {
+            .initial_ppm = TIMEBASE_DRIFT_INITIAL_PPM,
+            .min_ppm = TIMEBASE_DRIFT_MIN_PPM,
+            .weight = TIMEBASE_DRIFT_WEIGHT,
+            .sync_error_ms = TIMEBASE_SYNC_ERROR_MS,
+            .min_interval_s = TIMEBASE_DRIFT_MIN_INTERVAL_S,
+        };
+        drift_init(&drift, &config);
+
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        offset_us = timeval_us(&tv) - monotonic;
+        ESP_LOGW(TAG, "Wall clock not synced, timestamps are corrected on the first sync");
+    }
+}
+
+int64_t timebase_now_us(void) {
+    return esp_timer_get_time();
+}
+
+uint64_t timebase_wall_ms(int64_t monotonic_us) {
+    taskENTER_CRITICAL(&lock);
+    int64_t offset = offset_us;
+    taskEXIT_CRITICAL(&lock);
+
+    return (uint64_t)((monotonic_us + offset) / 1000);
+}
+
+bool timebase_valid(void) {
+    return rtc_magic == TIMEBASE_MAGIC && timebase_error_ms() <= CONFIG_TIME_VALID_MAX_ERROR_S * 1000;
+}
+
+uint32_t timebase_error_ms(void) {
+    int64_t rtc_us = (int64_t)esp_rtc_get_time_us();
+
+    taskENTER_CRITICAL(&lock);
+    uint32_t error_ms = drift_error_ms(&drift, rtc_us);
+    taskEXIT_CRITICAL(&lock);
+    return error_ms;
+}
+
+int64_t timebase_until_error_us(uint32_t error_ms) {
+    int64_t rtc_us = (int64_t)esp_rtc_get_time_us();
+
+    taskENTER_CRITICAL(&lock);
+    int64_t until_us = drift_until_error_us(&drift, rtc_us, error_ms);
+    taskEXIT_CRITICAL(&lock);
+    return until_us;
+}
+
+void timebase_get_drift(drift_t* copy) {
+    taskENTER_CRITICAL(&lock);
+    *copy = drift;
+    taskEXIT_CRITICAL(&lock);
+}
+
+void timebase_sync(const struct timeval* tv) {
+    int64_t wall = timeval_us(tv);
+    int64_t offset = wall - esp_timer_get_time();
+    int64_t rtc_us = (int64_t)esp_rtc_get_time_us();
+
+    taskENTER_CRITICAL(&lock);
+    correction_us += offset - offset_us;
+    correction_pending = true;
+    offset_us = offset;
+
+    /* What the RTC timer was off by since the last sync, after the rate measured so far */
+    drift_sync(&drift, rtc_us, rtc_magic == TIMEBASE_MAGIC ? wall - rtc_wall_us(rtc_us) : 0);
+    rtc_offset_us = wall - rtc_us;
+    rtc_magic = TIMEBASE_MAGIC;
+    taskEXIT_CRITICAL(&lock);
+}
+
+bool timebase_take_correction(int64_t* delta_ms) {
+    taskENTER_CRITICAL(&lock);
+    bool pending = correction_pending;
+    /* Whole ms are handed out, the rest is carried into the next correction */
+    *delta_ms = correction_us / 1000;
+    correction_us -= *delta_ms * 1000;
+    correction_pending = false;
+    taskEXIT_CRITICAL(&lock);
+
+    if (pending) {
+        ESP_LOGI(TAG, "Wall clock corrected by %lld ms", *delta_ms);
+    }
+    return pending;
+}
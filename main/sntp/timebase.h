@@ -0,0 +1,52 @@
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "drift.h"
+
+/* Samples are stamped with the monotonic esp_timer clock and mapped to wall time through an offset.
+ * The offset is kept in RTC memory relative to the RTC timer, so it survives deep sleep. An SNTP sync
+ * replaces it, the difference to the previous offset is handed out as a correction for everything
+ * that was stamped but not yet published. Each sync also measures the rate error of the RTC timer,
+ * it corrects the offset restored after deep sleep and bounds the error of the wall clock. */
+
+/* The RTC timer runs from the internal RC oscillator, calibrated at boot but drifting with temperature */
+#define TIMEBASE_DRIFT_INITIAL_PPM 500
+#define TIMEBASE_DRIFT_MIN_PPM 20
+#define TIMEBASE_DRIFT_WEIGHT 0.3f
+#define TIMEBASE_DRIFT_MIN_INTERVAL_S 600
+/* SNTP over the internet, and a relay gateway's clock passed on over ESP-NOW */
+#define TIMEBASE_SYNC_ERROR_MS 50
+
+/* Restores the offset of the previous wake, or starts from the unsynced system time after power-on */
+void timebase_init(void);
+
+/* Monotonic time since boot in µs, never steps */
+int64_t timebase_now_us(void);
+
+/* Wall time in ms of a monotonic timestamp in µs, using the current offset */
+uint64_t timebase_wall_ms(int64_t monotonic_us);
+
+/* True once the clock synced since power-on and its error bound is within CONFIG_TIME_VALID_MAX_ERROR_S */
+bool timebase_valid(void);
+
+/* Bound of the current wall clock error, UINT32_MAX if it never synced since power-on */
+uint32_t timebase_error_ms(void);
+
+/* Time until the error bound reaches error_ms, 0 if it already did, INT64_MAX if it never will */
+int64_t timebase_until_error_us(uint32_t error_ms);
+
+/* Copy of the RTC drift estimate */
+void timebase_get_drift(drift_t* drift);
+
+/* Called on every SNTP sync with the new system time */
+void timebase_sync(const struct timeval* tv);
+
+/* Returns true and the accumulated offset change in ms if an SNTP sync moved the clock since the
+ * last call. Wall timestamps handed out before have to be shifted by it. */
+bool timebase_take_correction(int64_t* delta_ms);
+
+#endif
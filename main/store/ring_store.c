@@ -0,0 +1,332 @@
+#include <string.h>
+
+#include "ring_store.h"
+
+#define SECTOR_MAGIC 0x52535431 // "RST1"
+
+#define RECORD_EMPTY    0xFF
+#define RECORD_WRITING  0xFE
+#define RECORD_VALID    0xFC
+#define RECORD_CONSUMED 0xF8
+
+typedef struct {
+    uint32_t magic;         // written last, a sector without it is treated as erased
+    uint32_t seq;
+    uint32_t erase_count;
+    uint32_t reserved;
+} sector_header_t;
+
+typedef struct {
+    uint8_t state;
+    uint8_t reserved;
+    uint16_t len;
+    uint32_t crc;
+} record_header_t;
+
+#define ALIGN4(x) (((x) + 3) & ~3u)
+
+static uint32_t crc32(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; ++i) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static inline uint32_t sector_base(const ring_store_t* store, uint32_t sector) {
+    return sector * store->flash.sector_size;
+}
+
+static bool read_sector_header(const ring_store_t* store, uint32_t sector, sector_header_t* hdr) {
+    if (!store->flash.read(store->flash.ctx, sector_base(store, sector), hdr, sizeof(*hdr))) {
+        return false;
+    }
+    return hdr->magic == SECTOR_MAGIC;
+}
+
+static bool read_record_header(const ring_store_t* store, const ring_store_pos_t* pos, record_header_t* hdr) {
+    return store->flash.read(store->flash.ctx, sector_base(store, pos->sector) + pos->offset, hdr, sizeof(*hdr));
+}
+
+static inline bool is_erased(const record_header_t* hdr) {
+    return hdr->state == RECORD_EMPTY && hdr->reserved == 0xFF && hdr->len == 0xFFFF && hdr->crc == 0xFFFFFFFF;
+}
+
+static inline bool is_complete(const ring_store_t* store, const ring_store_pos_t* pos, const record_header_t* hdr) {
+    if (hdr->state != RECORD_VALID && hdr->state != RECORD_CONSUMED) {
+        return false;
+    }
+    return pos->offset + sizeof(*hdr) + hdr->len <= store->flash.sector_size;
+}
+
+static inline uint32_t record_size(const record_header_t* hdr) {
+    return sizeof(*hdr) + ALIGN4(hdr->len);
+}
+
+/* Moves pos to the next complete record (valid or consumed) at or after pos.
+ * An erased header or a torn write ends the sector. Returns false when the write position is reached. */
+static bool next_record(const ring_store_t* store, ring_store_pos_t* pos, record_header_t* hdr) {
+    for (uint32_t visited = 0; visited <= store->sector_count; ++visited) {
+        if (pos->sector == store->write.sector && pos->offset >= store->write.offset) {
+            return false;
+        }
+
+        sector_header_t sector;
+        if (read_sector_header(store, pos->sector, &sector) &&
+            pos->offset + sizeof(*hdr) <= store->flash.sector_size &&
+            read_record_header(store, pos, hdr) &&
+            is_complete(store, pos, hdr)) {
+            return true;
+        }
+
+        if (pos->sector == store->write.sector) {
+            return false;
+        }
+        pos->sector = (pos->sector + 1) % store->sector_count;
+        pos->offset = sizeof(sector_header_t);
+    }
+    return false;
+}
+
+/* Finds the oldest valid record starting from pos, counting all valid records on the way if count is set */
+static void find_pending(ring_store_t* store, ring_store_pos_t pos, uint32_t* count) {
+    record_header_t hdr;
+    bool found = false;
+
+    store->read = store->write;
+    while (next_record(store, &pos, &hdr)) {
+        if (hdr.state == RECORD_VALID) {
+            if (!found) {
+                store->read = pos;
+                found = true;
+            }
+            if (count == NULL) {
+                return;
+            }
+            (*count)++;
+        }
+        pos.offset += record_size(&hdr);
+    }
+}
+
+static bool open_sector(ring_store_t* store, uint32_t sector) {
+    sector_header_t hdr;
+    uint32_t erase_count = read_sector_header(store, sector, &hdr) ? hdr.erase_count : 0;
+
+    /* Invalidate first so that an interrupted erase is not mistaken for live data */
+    uint32_t invalid = 0;
+    store->flash.write(store->flash.ctx, sector_base(store, sector), &invalid, sizeof(invalid));
+
+    if (!store->flash.erase_sector(store->flash.ctx, sector_base(store, sector))) {
+        return false;
+    }
+
+    hdr = (sector_header_t) {
+        .magic = 0xFFFFFFFF,
+        .seq = store->next_seq++,
+        .erase_count = erase_count + 1,
+        .reserved = 0xFFFFFFFF,
+    };
+    uint32_t magic = SECTOR_MAGIC;
+    if (!store->flash.write(store->flash.ctx, sector_base(store, sector), &hdr, sizeof(hdr)) ||
+        !store->flash.write(store->flash.ctx, sector_base(store, sector), &magic, sizeof(magic))) {
+        return false;
+    }
+
+    if (hdr.erase_count > store->max_erase_count) {
+        store->max_erase_count = hdr.erase_count;
+    }
+
+    store->write.sector = sector;
+    store->write.offset = sizeof(sector_header_t);
+    return true;
+}
+
+/* Opens the next sector for writing, dropping whatever is still pending in it */
+static bool advance_sector(ring_store_t* store) {
+    uint32_t next = (store->write.sector + 1) % store->sector_count;
+
+    if (store->pending > 0 && store->read.sector == next) {
+        uint32_t lost = 0;
+        ring_store_pos_t pos = store->read;
+        record_header_t hdr;
+        while (pos.sector == next && next_record(store, &pos, &hdr) && pos.sector == next) {
+            if (hdr.state == RECORD_VALID) {
+                lost++;
+            }
+            pos.offset += record_size(&hdr);
+        }
+        store->pending -= lost;
+        store->dropped += lost;
+    }
+
+    if (!open_sector(store, next)) {
+        return false;
+    }
+
+    if (store->pending == 0) {
+        store->read = store->write;
+    } else {
+        ring_store_pos_t pos = { (next + 1) % store->sector_count, sizeof(sector_header_t) };
+        find_pending(store, pos, NULL);
+    }
+    return true;
+}
+
+size_t ring_store_max_record(const ring_store_t* store) {
+    size_t max = store->flash.sector_size - sizeof(sector_header_t) - sizeof(record_header_t);
+    return max > UINT16_MAX ? UINT16_MAX : max;
+}
+
+bool ring_store_mount(ring_store_t* store, const ring_store_flash_t* flash) {
+    memset(store, 0, sizeof(*store));
+    store->flash = *flash;
+
+    if (flash->sector_size <= sizeof(sector_header_t) + sizeof(record_header_t) ||
+        flash->size < 2 * flash->sector_size || flash->size % flash->sector_size != 0) {
+        return false;
+    }
+    store->sector_count = flash->size / flash->sector_size;
+
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t newest_seq = 0;
+
+    for (uint32_t i = 0; i < store->sector_count; ++i) {
+        sector_header_t hdr;
+        if (!read_sector_header(store, i, &hdr)) {
+            continue;
+        }
+        if (!found || hdr.seq > newest_seq) {
+            newest = i;
+            newest_seq = hdr.seq;
+            found = true;
+        }
+        if (hdr.erase_count > store->max_erase_count) {
+            store->max_erase_count = hdr.erase_count;
+        }
+    }
+
+    if (!found) {
+        return open_sector(store, 0);
+    }
+
+    store->next_seq = newest_seq + 1;
+
+    /* Find the end of the newest sector. A torn write closes the sector, the next append opens a fresh one. */
+    ring_store_pos_t pos = { newest, sizeof(sector_header_t) };
+    store->write.sector = newest;
+    store->write.offset = flash->sector_size;
+
+    while (pos.offset + sizeof(record_header_t) <= flash->sector_size) {
+        record_header_t hdr;
+        if (!read_record_header(store, &pos, &hdr)) {
+            return false;
+        }
+        if (is_erased(&hdr)) {
+            store->write.offset = pos.offset;
+            break;
+        }
+        if (!is_complete(store, &pos, &hdr)) {
+            break;
+        }
+        pos.offset += record_size(&hdr);
+    }
+
+    ring_store_pos_t oldest = { (newest + 1) % store->sector_count, sizeof(sector_header_t) };
+    find_pending(store, oldest, &store->pending);
+    return true;
+}
+
+bool ring_store_append(ring_store_t* store, const void* data, size_t len) {
+    if (len > ring_store_max_record(store)) {
+        return false;
+    }
+
+    record_header_t hdr = {
+        .state = RECORD_WRITING,
+        .reserved = 0xFF,
+        .len = (uint16_t)len,
+        .crc = crc32(data, len),
+    };
+
+    if (store->write.offset + record_size(&hdr) > store->flash.sector_size) {
+        if (!advance_sector(store)) {
+            return false;
+        }
+    }
+
+    ring_store_pos_t pos = store->write;
+    uint32_t addr = sector_base(store, pos.sector) + pos.offset;
+
+    /* Reserve the space before anything can fail, a torn record must never be overwritten */
+    store->write.offset += record_size(&hdr);
+
+    if (!store->flash.write(store->flash.ctx, addr, &hdr, sizeof(hdr)) ||
+        !store->flash.write(store->flash.ctx, addr + sizeof(hdr), data, len)) {
+        store->write.offset = store->flash.sector_size;
+        return false;
+    }
+
+    uint8_t state = RECORD_VALID;
+    if (!store->flash.write(store->flash.ctx, addr, &state, sizeof(state))) {
+        store->write.offset = store->flash.sector_size;
+        return false;
+    }
+
+    if (store->pending == 0) {
+        store->read = pos;
+    }
+    store->pending++;
+    return true;
+}
+
+bool ring_store_peek(const ring_store_t* store, ring_store_pos_t* pos, void* dst, size_t size, size_t* len) {
+    record_header_t hdr;
+
+    while (next_record(store, pos, &hdr)) {
+        ring_store_pos_t at = *pos;
+        pos->offset += record_size(&hdr);
+
+        if (hdr.state != RECORD_VALID) {
+            continue;
+        }
+
+        /* Records that fail to read back are reported as empty so they still count towards consume */
+        *len = 0;
+        if (hdr.len <= size &&
+            store->flash.read(store->flash.ctx, sector_base(store, at.sector) + at.offset + sizeof(hdr), dst, hdr.len) &&
+            crc32(dst, hdr.len) == hdr.crc) {
+            *len = hdr.len;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool ring_store_consume(ring_store_t* store, uint32_t count) {
+    record_header_t hdr;
+    ring_store_pos_t pos = store->read;
+
+    while (count > 0 && next_record(store, &pos, &hdr)) {
+        if (hdr.state == RECORD_VALID) {
+            uint8_t state = RECORD_CONSUMED;
+            if (!store->flash.write(store->flash.ctx, sector_base(store, pos.sector) + pos.offset, &state, sizeof(state))) {
+                return false;
+            }
+            store->pending--;
+            count--;
+        }
+        pos.offset += record_size(&hdr);
+    }
+
+    if (store->pending == 0) {
+        store->read = store->write;
+    } else {
+        find_pending(store, pos, NULL);
+    }
+    return count == 0;
+}
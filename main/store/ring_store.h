@@ -0,0 +1,60 @@
+#ifndef RING_STORE_H_
+#define RING_STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Append-only ring of variable sized records on NOR flash.
+ *
+ * The area is split into erase sectors which are filled in order and reused round robin,
+ * so every sector sees the same number of erases. Records never span sectors.
+ * Record state is only ever changed by clearing bits (EMPTY -> WRITING -> VALID -> CONSUMED),
+ * so a power loss at any point leaves either a complete record or one that is skipped on mount.
+ *
+ * The core has no platform dependencies, flash access goes through ring_store_flash_t. */
+
+typedef struct {
+    bool (*read)(void* ctx, uint32_t offset, void* dst, size_t len);
+    bool (*write)(void* ctx, uint32_t offset, const void* src, size_t len);
+    bool (*erase_sector)(void* ctx, uint32_t offset);
+    void* ctx;
+    uint32_t size;          // bytes, multiple of sector_size
+    uint32_t sector_size;
+} ring_store_flash_t;
+
+typedef struct {
+    uint32_t sector;
+    uint32_t offset;
+} ring_store_pos_t;
+
+typedef struct {
+    ring_store_flash_t flash;
+    uint32_t sector_count;
+
+    ring_store_pos_t read;      // oldest record not yet consumed
+    ring_store_pos_t write;     // next free byte
+    uint32_t next_seq;          // sequence number for the next sector opened by the writer
+
+    uint32_t pending;           // records written but not consumed
+    uint32_t dropped;           // records overwritten before being consumed
+    uint32_t max_erase_count;   // highest erase count seen, for wear monitoring
+} ring_store_t;
+
+/* Largest payload a single record can hold */
+size_t ring_store_max_record(const ring_store_t* store);
+
+/* Scans the flash and recovers read/write positions, formats the area if it holds no valid sectors */
+bool ring_store_mount(ring_store_t* store, const ring_store_flash_t* flash);
+
+/* Appends one record, overwriting the oldest sector if the ring is full */
+bool ring_store_append(ring_store_t* store, const void* data, size_t len);
+
+/* Iterates pending records without consuming them. Start with *pos = store->read,
+ * returns false when there are no more records. */
+bool ring_store_peek(const ring_store_t* store, ring_store_pos_t* pos, void* dst, size_t size, size_t* len);
+
+/* Marks the count oldest pending records as consumed */
+bool ring_store_consume(ring_store_t* store, uint32_t count);
+
+#endif
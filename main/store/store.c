@@ -0,0 +1,118 @@
+#include "esp_log.h"
+#include "esp_partition.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "store.h"
+
+static const char* TAG = "store";
+
+static const esp_partition_t* partition = NULL;
+static ring_store_t ring;
+static SemaphoreHandle_t lock = NULL;
+
+static bool partition_read(void* ctx, uint32_t offset, void* dst, size_t len) {
+    return esp_partition_read((const esp_partition_t*)ctx, offset, dst, len) == ESP_OK;
+}
+
+static bool partition_write(void* ctx, uint32_t offset, const void* src, size_t len) {
+    return esp_partition_write((const esp_partition_t*)ctx, offset, src, len) == ESP_OK;
+}
+
+static bool partition_erase_sector(void* ctx, uint32_t offset) {
+    const esp_partition_t* part = (const esp_partition_t*)ctx;
+    return esp_partition_erase_range(part, offset, part->erase_size) == ESP_OK;
+}
+
+void app_store_init(void) {
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, STORE_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "Partition '%s' not found", STORE_PARTITION_LABEL);
+        return;
+    }
+
+    lock = xSemaphoreCreateMutex();
+    if (lock == NULL) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+        partition = NULL;
+        return;
+    }
+
+    const ring_store_flash_t flash = {
+        .read = partition_read,
+        .write = partition_write,
+        .erase_sector = partition_erase_sector,
+        .ctx = (void*)partition,
+        .size = partition->size,
+        .sector_size = partition->erase_size,
+    };
+
+    if (!ring_store_mount(&ring, &flash)) {
+        ESP_LOGE(TAG, "Failed to mount store");
+        partition = NULL;
+        return;
+    }
+
+    ESP_LOGI(TAG, "Mounted %lu sectors, %lu batches pending, max erase count %lu",
+        ring.sector_count, ring.pending, ring.max_erase_count);
+}
+
+bool app_store_append(const uint8_t* data, size_t len) {
+    if (partition == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool ok = ring_store_append(&ring, data, len);
+    xSemaphoreGive(lock);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to store %d bytes", len);
+    }
+    return ok;
+}
+
+uint32_t app_store_pending(void) {
+    return partition != NULL ? ring.pending : 0;
+}
+
+uint32_t app_store_dropped(void) {
+    return ring.dropped;
+}
+
+ring_store_pos_t app_store_begin(void) {
+    if (partition == NULL) {
+        return (ring_store_pos_t) { 0 };
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    ring_store_pos_t pos = ring.read;
+    xSemaphoreGive(lock);
+    return pos;
+}
+
+bool app_store_peek(ring_store_pos_t* pos, uint8_t* buffer, size_t size, size_t* len) {
+    if (partition == NULL) {
+        return false;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool ok = ring_store_peek(&ring, pos, buffer, size, len);
+    xSemaphoreGive(lock);
+    return ok;
+}
+
+void app_store_consume(uint32_t count) {
+    if (partition == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool ok = ring_store_consume(&ring, count);
+    xSemaphoreGive(lock);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to consume %lu batches", count);
+    }
+}
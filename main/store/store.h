@@ -0,0 +1,31 @@
+#ifndef STORE_H_
+#define STORE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ring_store.h"
+
+/* Data partition holding encoded batches that could not be published */
+#define STORE_PARTITION_LABEL "store"
+
+/* Max number of stored batches coalesced into one publish */
+#define STORE_COALESCE_MAX 16
+
+void app_store_init(void);
+
+/* Appends an encoded batch, never waits for the network */
+bool app_store_append(const uint8_t* data, size_t len);
+
+uint32_t app_store_pending(void);
+uint32_t app_store_dropped(void);
+
+/* Iterates pending batches, start with app_store_begin() */
+ring_store_pos_t app_store_begin(void);
+bool app_store_peek(ring_store_pos_t* pos, uint8_t* buffer, size_t size, size_t* len);
+
+/* Marks the count oldest batches as delivered */
+void app_store_consume(uint32_t count);
+
+#endif
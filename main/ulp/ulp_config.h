@@ -0,0 +1,21 @@
+#ifndef ULP_CONFIG_H_
+#define ULP_CONFIG_H_
+
+/* Shared between the ULP program and the main application */
+
+/* ULP program period, also the flow input sampling period */
+#define ULP_WAKEUP_PERIOD_US 20000
+
+/* Flow edges are counted into a ring of time buckets during deep sleep, must be a power of two */
+#define ULP_BUCKET_COUNT 64
+
+/* ADC1 channel of the pressure sensor, must match PRESSURE_SENSOR_CHANNEL */
+#define ULP_PRESSURE_ADC_CHANNEL 4
+
+/* Values of pressure_wake_reason */
+#define ULP_PRESSURE_WAKE_NONE 0
+#define ULP_PRESSURE_WAKE_HIGH 1
+#define ULP_PRESSURE_WAKE_LOW 2
+#define ULP_PRESSURE_WAKE_RATE 3
+
+#endif